@@ -61,8 +61,14 @@ generate_cmake_content()
   echo "target_link_options($entity PRIVATE \${INSTRUMENTATION_FLAGS_LIST})" >> "$output_file"
   echo "" >> "$output_file"
 
-  # Add target_link_libraries for the entity
+  # Add target_link_libraries for the entity; "exports" is not a library but
+  # exports the executable's symbols to the handler libraries it dlopens
   for library in $libraries; do
+    if [[ $library == "exports" ]]; then
+      echo "set_target_properties($entity PROPERTIES ENABLE_EXPORTS ON)" >> "$output_file"
+      echo "" >> "$output_file"
+      continue
+    fi
     echo "find_library(LIB_$library NAMES $library)" >> "$output_file"
     echo "if(LIB_$library)" >> "$output_file"
     echo "    target_link_libraries($entity PRIVATE \${LIB_$library})" >> "$output_file"
@@ -208,6 +208,7 @@ process_flags()
 #        "-fshort-wchar"
 #        "-fcommon"
         "-fno-common"
+        "-fno-omit-frame-pointer"
 #        "-fno-ident"
 #        "-finhibit-size-directive"
 #        "-fverbose-asm"
@@ -0,0 +1,128 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include "httpResponse.h"
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define ACCESS_LOG_RING_RECORDS 512    // per worker, a power of two
+#define ACCESS_LOG_REQUEST_MAX 192
+#define ACCESS_LOG_HEADER_MAX 96
+#define ACCESS_LOG_ROTATE_MB 64
+#define ACCESS_LOG_KEEP 5    // rotated files kept: path.1 ... path.5
+
+/**
+ * @brief Line formats the logger can write.
+ */
+typedef enum
+{
+    ACCESS_LOG_COMMON = 0,    // NCSA Common Log Format
+    ACCESS_LOG_COMBINED,      // Common plus Referer and User-Agent
+    ACCESS_LOG_JSON           // one JSON object per line
+} AccessLogFormat;
+
+/**
+ * @brief One request as a worker hands it to the logger: fixed size, no
+ * pointers, formatted only in the logger process. Strings are truncated
+ * and NUL-terminated.
+ */
+typedef struct
+{
+    uint64_t timeNs;         // CLOCK_REALTIME when the request was parsed
+    uint64_t startNs;        // CLOCK_MONOTONIC at the same moment
+    uint64_t bytes;          // response bytes sent, head included
+    uint32_t durationUs;     // parsed to sent
+    uint32_t peerAddress;    // IPv4, network byte order
+    int32_t  pid;
+    uint16_t status;
+    char     request[ACCESS_LOG_REQUEST_MAX];    // the request line
+    char     referer[ACCESS_LOG_HEADER_MAX];
+    char     agent[ACCESS_LOG_HEADER_MAX];
+} AccessRecord;
+
+/**
+ * @brief Creates one record ring per worker in shared memory and forks the
+ * logger process that drains them into `path`. Master, before the workers.
+ * @param path Log file, appended to; NULL leaves access logging off.
+ * @param format Line format.
+ * @param rotate_mb Size at which the file is rotated; 0 never rotates on size.
+ * @param max_workers Number of rings.
+ * @return 0 on success, -1 on failure.
+ */
+int access_log_init(const char *path, AccessLogFormat format, size_t rotate_mb, int max_workers);
+
+/**
+ * @brief Looks up a format by name: "common", "combined" or "json".
+ * @param name The name.
+ * @return the format, or -1 if unknown.
+ */
+int access_log_parse_format(const char *name);
+
+/**
+ * @brief Worker: selects its ring.
+ * @param worker The worker index.
+ */
+void access_log_worker_start(int worker);
+
+/**
+ * @brief Whether this process logs requests; lets callers skip building records.
+ * @return true if a ring is selected.
+ */
+bool access_log_enabled(void);
+
+/**
+ * @brief Worker: starts a record for a request that was just parsed.
+ * @param record The record to fill.
+ * @param request_line The request line, or NULL for a request that could not be parsed.
+ * @param line_length Length of the request line.
+ * @param peer The client address.
+ */
+void access_log_begin(AccessRecord *record, const char *request_line, size_t line_length, const struct sockaddr_in *peer);
+
+/**
+ * @brief Copies a header value into a record field.
+ * @param field The field, e.g. record->agent.
+ * @param size Size of the field.
+ * @param value The value, or NULL to leave it empty.
+ * @param length Length of the value.
+ */
+void access_log_set(char *field, size_t size, const char *value, size_t length);
+
+/**
+ * @brief Worker: completes a record once its response is sent and queues it
+ * for the logger. Never blocks: when the ring is full the record is counted
+ * as dropped instead.
+ * @param record The record.
+ * @param response The response that was sent.
+ */
+void access_log_commit(AccessRecord *record, const HTTPResponse *response);
+
+/**
+ * @brief Master: has the logger reopen its file, e.g. after logrotate moved it.
+ */
+void access_log_reopen(void);
+
+/**
+ * @brief Master: claims a child waitpid returned if it was the logger, and
+ * starts a new logger in its place.
+ * @param pid The child that exited.
+ * @param status Its wait status.
+ * @return true if pid was the logger.
+ */
+bool access_log_reap(pid_t pid, int status);
+
+/**
+ * @brief Master: stops the logger once it has written everything queued.
+ */
+void access_log_stop(void);
+
+/**
+ * @brief Records dropped because a ring was full, over all workers.
+ * @return the count
+ */
+uint64_t access_log_dropped(void);
+
+#endif    // ACCESSLOG_H
@@ -0,0 +1,76 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_DIR "../data/capture"
+#define CAPTURE_MAGIC "appcaptr"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_PERCENT 100
+
+/**
+ * @brief Start of a capture file. CaptureRecords follow, each with its
+ * request bytes, in the order requests finished.
+ */
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t percent;            // of connections captured
+    uint64_t startNs;            // CLOCK_MONOTONIC when the capture began
+    uint64_t startRealtimeNs;    // CLOCK_REALTIME at the same moment
+} CaptureHeader;
+
+/**
+ * @brief One captured request, followed by `length` bytes: the request
+ * exactly as received, head and body.
+ */
+typedef struct
+{
+    uint64_t offsetNs;      // parsed, relative to CaptureHeader.startNs
+    uint64_t connection;    // pid << 32 | per-worker connection number
+    uint32_t length;
+    uint32_t latencyUs;     // parsed to response ready, on the server
+    uint16_t status;
+    uint16_t reserved;
+    uint32_t reserved2;
+} CaptureRecord;
+
+/**
+ * @brief Opens a new capture file, CAPTURE_DIR/capture-<time>.bin. Master,
+ * before forking; workers append to the inherited descriptor.
+ * @param percent Percentage of connections to capture (1-100); 0 leaves capture off.
+ * @return 0 on success, -1 on failure.
+ */
+int capture_init(unsigned int percent);
+
+/**
+ * @brief Worker: decides whether a newly accepted connection is captured.
+ * Connections are sampled whole so replay sees the same sessions.
+ */
+void capture_connection_start(void);
+
+/**
+ * @brief Whether the current connection is captured.
+ * @return true if its requests are recorded.
+ */
+bool capture_active(void);
+
+/**
+ * @brief Reads the capture clock.
+ * @return CLOCK_MONOTONIC in nanoseconds.
+ */
+uint64_t capture_clock(void);
+
+/**
+ * @brief Worker: appends a request of the current connection, if captured.
+ * @param raw The request bytes.
+ * @param length Their length.
+ * @param parsed capture_clock() when the request was parsed.
+ * @param status The response status.
+ */
+void capture_request(const char *raw, size_t length, uint64_t parsed, int status);
+
+#endif    // CAPTURE_H
@@ -5,9 +5,62 @@
 #ifndef MAIN_CLIENT_H
 #define MAIN_CLIENT_H
 
-// WE DONT NEED CLIENT IN THIS PROJECT
+#include <stdbool.h>
+#include <stddef.h>
 
-void client(void);
-int  connect_client(char *serverInformation[]);
+#define LOAD_DEFAULT_CONNECTIONS 64
+#define LOAD_DEFAULT_THREADS 2
+#define LOAD_DEFAULT_SECONDS 10
+#define LOAD_DEFAULT_PATH "/index.html"
+#define LOAD_DEFAULT_BODY_BYTES 64
+#define LOAD_MAX_THREADS 64
+
+/**
+ * @brief How the load generator drives the server.
+ */
+typedef struct
+{
+    unsigned int connections;
+    unsigned int threads;
+    unsigned int seconds;
+    double       rate;          // requests per second over all connections; 0 runs closed loop
+    bool         keepAlive;     // false opens a connection per request
+    unsigned int getWeight;     // request mix, relative weights
+    unsigned int headWeight;
+    unsigned int postWeight;
+    const char  *path;          // target of every request
+    size_t       bodyBytes;     // POST body size
+    const char  *jsonPath;      // also write the results there as JSON, or NULL
+} LoadOptions;
+
+/**
+ * @brief Fills in the defaults: closed loop, keep-alive, GET only.
+ * @param options The options to fill.
+ */
+void load_options_defaults(LoadOptions *options);
+
+/**
+ * @brief Parses a request mix such as "get:80,head:10,post:10".
+ * @param spec The mix; methods left out get weight 0.
+ * @param options Receives the weights.
+ * @return 0 on success, -1 if the mix is malformed or all weights are 0.
+ */
+int load_parse_mix(const char *spec, LoadOptions *options);
+
+/**
+ * @brief Runs the load generator against a server and prints throughput and
+ * the latency distribution.
+ *
+ * Each thread drives its share of the connections through one epoll set. In
+ * closed loop every connection sends its next request as soon as the last
+ * one is answered. With a rate, every connection sends on a fixed schedule
+ * and latency is measured from when a request should have been sent, so a
+ * stalled server is not hidden by the requests it kept from being sent
+ * (coordinated omission).
+ * @param serverInformation IP and port.
+ * @param options How to drive the server.
+ * @return 0 on success, 1 on failure.
+ */
+int connect_client(char *serverInformation[], const LoadOptions *options);
 
 #endif    // MAIN_CLIENT_H
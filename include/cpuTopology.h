@@ -0,0 +1,36 @@
+#ifndef CPUTOPOLOGY_H
+#define CPUTOPOLOGY_H
+
+#define PROC_SELF_CGROUP "/proc/self/cgroup"
+#define CGROUP_V2_ROOT "/sys/fs/cgroup"
+#define CGROUP_V1_CPU_QUOTA "/sys/fs/cgroup/cpu/cpu.cfs_quota_us"
+#define CGROUP_V1_CPU_PERIOD "/sys/fs/cgroup/cpu/cpu.cfs_period_us"
+#define NUMA_NODE_DIR "/sys/devices/system/node"
+
+/**
+ * @brief Reads which CPUs this process may run on and orders them for worker
+ * placement: one CPU from each NUMA node in turn, so consecutive workers land
+ * on different nodes and each node's memory serves the workers pinned there.
+ * Call once in the master before forking.
+ * @return the number of usable CPUs (at least 1).
+ */
+int cpu_topology_init(void);
+
+/**
+ * @brief How many workers the machine can keep busy: the usable CPUs, capped
+ * by a cgroup CPU quota: the tightest cpu.max from the process's own cgroup
+ * (found through /proc/self/cgroup) up to the root, or cfs_quota_us /
+ * cfs_period_us on cgroup v1.
+ * @return the CPU budget, at least 1.
+ */
+int cpu_topology_budget(void);
+
+/**
+ * @brief Pins the calling process to the CPU chosen for a worker slot.
+ * Slots beyond the CPU count wrap around.
+ * @param worker The worker index.
+ * @return 0 on success, -1 on failure.
+ */
+int cpu_topology_pin(int worker);
+
+#endif    // CPUTOPOLOGY_H
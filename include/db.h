@@ -1,6 +1,7 @@
 #ifndef DB_H
 #define DB_H
 #include <inttypes.h>
+#include <stdbool.h>
 #include <string.h>    // for strlen
 
 #ifdef __APPLE__
@@ -17,6 +18,15 @@ typedef int datum_size;
 
 #define TO_SIZE_T(x) ((size_t)(x))
 
+// Database holding POST entries, relative to the server's working directory
+#define POST_DB_PATH "../data/db/post_data.db"
+
+// Counter key holding the next entry id
+#define POST_PK_NAME "entry_id"
+
+// Key of the entry with a given id, e.g. "entry_0001"
+#define POST_ENTRY_KEY_FORMAT "entry_%04d"
+
 typedef struct
 {
     // cppcheck-suppress unusedStructMember
@@ -28,20 +38,59 @@ typedef struct
 #define MAKE_CONST_DATUM(str) ((const_datum){(str), (datum_size)strlen(str) + 1})
 #define MAKE_CONST_DATUM_BYTE(str, size) ((const_datum){(str), (datum_size)(size)})
 
+struct RecordFields;
+
 typedef struct DBO
 {
     char *name;    // cppcheck-suppress unusedStructMember
     DBM  *db;      // cppcheck-suppress unusedStructMember
 } DBO;
 
+/**
+ * @brief A stored POST entry loaded by id.
+ */
+typedef struct
+{
+    /** @brief The entry id (the NNNN in "entry_NNNN"). */
+    int id;
+
+    /** @brief The stored record, or NULL if the entry does not exist. */
+    void *data;
+
+    /** @brief The number of bytes in data. */
+    size_t size;
+} PostEntry;
+
+/* Creates the lock that serializes database access between workers.
+   Must be called by the master before forking. Returns 0 on success, -1 on failure. */
+int database_init_shared_lock(void);
+
+/* Takes the shared database lock, pausing every other reader and writer.
+   A no-op when the lock was never created. Returns 0 on success, -1 on failure. */
+int database_lock(void);
+
+/* Releases the lock taken by database_lock. */
+void database_unlock(void);
+
 /* Opens the database specified in dbo->name in read/write mode (creating it if needed).
    Returns 0 on success, -1 on failure. */
 ssize_t database_open(DBO *dbo);
 
+/* Opens the database specified in dbo->name read-only.
+   Returns 0 on success, -1 on failure (including when it does not exist yet). */
+ssize_t database_open_readonly(DBO *dbo);
+
 /* Stores the string value under the key into the given DBM.
    Returns 0 on success, -1 on failure. */
 int store_string(DBM *db, const char *key, const char *value);
 
+/* Stores the int value under the key into the given DBM.
+   Returns 0 on success, -1 on failure. */
+int store_int(DBM *db, const char *key, int value);
+
+/* Formats the database key of a POST entry, e.g. "entry_0001". */
+void format_entry_key(char *key, size_t size, int id);
+
 /**
  * @brief Stores a parsed POST key-value entry in the DB using a unique entry key.
  * The entry key will be generated like "entry_001", "entry_002", etc.
@@ -52,6 +101,83 @@ int store_string(DBM *db, const char *key, const char *value);
  */
 int store_post_entry(DBO *dbo, const char *body_string, const char *pk_name);
 
+/**
+ * @brief Returns the number of POST entries stored so far.
+ * Answered from the shared record cache when possible.
+ * @param dbo The database object.
+ * @param pk_name The primary key counter name (e.g., "entry_id").
+ * @return the count, or -1 on failure.
+ */
+int retrieve_post_count(DBO *dbo, const char *pk_name);
+
+/**
+ * @brief Loads a batch of POST entries by id.
+ * The caller fills in each entries[i].id; data and size are set on return.
+ * Cache misses are read from the database with a single open and cached.
+ * @param dbo The database object.
+ * @param entries The entries to load.
+ * @param count The number of entries.
+ * @return 0 on success, -1 on failure (nothing is left allocated).
+ */
+int retrieve_post_entries(DBO *dbo, PostEntry *entries, size_t count);
+
+/**
+ * @brief Loads the record dictionaries, trains the compression dictionary if
+ * enabled and due, and brings every declared secondary index up to date with
+ * the stored entries. Called once by the master at startup.
+ * @param dbo The database object.
+ * @param pk_name The primary key counter name (e.g., "entry_id").
+ * @return 0 on success, -1 on failure.
+ */
+int database_prepare(DBO *dbo, const char *pk_name);
+
+/**
+ * @brief Enables compression of newly stored records. Existing records are
+ * read either way. Must be called by the master before forking.
+ * @param enabled true to compress.
+ */
+void database_set_compression(bool enabled);
+
+/**
+ * @brief Finds entries by the value of an indexed form field.
+ * @param dbo The database object.
+ * @param field The indexed field name.
+ * @param value The decoded value to match.
+ * @param prefix true for a prefix match, false for equality.
+ * @param ids Destination for matching ids, in ascending order.
+ * @param max The capacity of ids.
+ * @return the number of ids found, or -1 if the field is not indexed or on failure.
+ */
+int search_post_entries(DBO *dbo, const char *field, const char *value, bool prefix, int *ids, size_t max);
+
+/**
+ * @brief Decodes a stored record into its form fields, using the database
+ * to resolve names or dictionaries this process has not seen yet.
+ * @param db The open database.
+ * @param data The stored bytes.
+ * @param size The number of bytes.
+ * @param fields Destination; free with record_fields_free.
+ * @return 0 on success, -1 on failure.
+ */
+int decode_record(DBM *db, const void *data, size_t size, struct RecordFields *fields);
+
+/**
+ * @brief Decodes an entry loaded by retrieve_post_entries, opening the
+ * database only if the record refers to names this process has not seen yet.
+ * @param dbo The database object.
+ * @param entry The loaded entry.
+ * @param fields Destination; free with record_fields_free.
+ * @return 0 on success, -1 on failure.
+ */
+int decode_post_entry(DBO *dbo, const PostEntry *entry, struct RecordFields *fields);
+
+/**
+ * @brief Frees the data loaded by retrieve_post_entries.
+ * @param entries The entries to free.
+ * @param count The number of entries.
+ */
+void free_post_entries(PostEntry *entries, size_t count);
+
 /* Retrieves an integer from the DBM.
    Returns 0 on success, -1 on failure. */
 int retrieve_int(DBM *db, const char *key, int *result);
@@ -0,0 +1,72 @@
+#ifndef DBINDEX_H
+#define DBINDEX_H
+
+#include "db.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fields indexed when none are declared on the command line
+#define DEFAULT_INDEXED_FIELDS "name,email"
+
+// Maximum number of declared indexes
+#define DB_INDEX_MAX_FIELDS 8
+
+// Maximum length of an indexed field name
+#define DB_INDEX_MAX_NAME 32
+
+/**
+ * @brief Declares a secondary index on a POST form field. Must be called in
+ * the master before forking so every worker maintains the same indexes.
+ * @param field The form field name (letters, digits, '_' and '-').
+ * @return 0 on success, -1 if the name is invalid or too many are declared.
+ */
+int db_index_declare(const char *field);
+
+/**
+ * @brief Declares one index per name in a comma-separated list.
+ * @param fields The list, e.g. "name,email". An empty list declares none.
+ * @return 0 on success, -1 on the first invalid name.
+ */
+int db_index_declare_list(const char *fields);
+
+/**
+ * @brief Returns true if an index was declared on the given field.
+ * @param field The form field name.
+ * @return true or false
+ */
+bool db_index_is_declared(const char *field);
+
+/**
+ * @brief Adds one stored entry to every declared index that covers all
+ * entries before it; an index that fell behind picks the entry up in its
+ * next catch-up. Called from the write path with the database already open
+ * for writing.
+ * @param db The open database.
+ * @param id The entry id.
+ * @param fields The entry's decoded form fields.
+ * @return 0 on success, -1 on failure.
+ */
+int db_index_add_entry(DBM *db, int id, const struct RecordFields *fields);
+
+/**
+ * @brief Indexes entries written before an index was declared, from the
+ * point each index last reached up to count.
+ * @param db The open database.
+ * @param count The number of stored entries.
+ * @return 0 on success, -1 on failure.
+ */
+int db_index_catch_up(DBM *db, int count);
+
+/**
+ * @brief Looks up the ids of entries whose field equals, or starts with, value.
+ * @param db The open database.
+ * @param field An indexed form field name.
+ * @param value The decoded value to match.
+ * @param prefix true for a prefix match, false for equality.
+ * @param ids Destination for matching ids, in ascending order.
+ * @param max The capacity of ids.
+ * @return the number of ids written, or -1 on failure.
+ */
+int db_index_find(DBM *db, const char *field, const char *value, bool prefix, int *ids, size_t max);
+
+#endif    // DBINDEX_H
@@ -0,0 +1,108 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// With precision p, values below 2^(p + 1) get a bucket each; above that
+// every power of two is split into 2^p buckets (error <= 1 / 2^p).
+#define HISTOGRAM_BUCKETS_FOR(subBits) ((1U << ((subBits) + 1U)) + (64U - ((subBits) + 1U)) * (1U << (subBits)))
+
+// Precision of the shared Histogram: <= 12.5% error, small enough for shared memory
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_BUCKETS HISTOGRAM_BUCKETS_FOR(HISTOGRAM_SUB_BITS)
+
+// Quantiles are given in millionths, so p99.99 can be asked for
+#define HISTOGRAM_PER_MILLION 1000000
+
+/**
+ * @brief Log-linear histogram of unsigned values (typically nanoseconds).
+ * Lock-free: any number of processes may record into one living in shared
+ * memory while another reads it.
+ */
+typedef struct
+{
+    _Atomic(uint64_t) count;
+    _Atomic(uint64_t) sum;
+    _Atomic(uint64_t) max;
+    _Atomic(uint64_t) buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+/**
+ * @brief Adds one value.
+ * @param histogram The histogram.
+ * @param value The value to record.
+ */
+void histogram_record(Histogram *histogram, uint64_t value);
+
+/**
+ * @brief Clears every counter.
+ * @param histogram The histogram.
+ */
+void histogram_reset(Histogram *histogram);
+
+/**
+ * @brief Returns the number of recorded values.
+ * @param histogram The histogram.
+ * @return the count.
+ */
+uint64_t histogram_count(const Histogram *histogram);
+
+/**
+ * @brief Returns the mean of the recorded values, or 0 if there are none.
+ * @param histogram The histogram.
+ * @return the mean.
+ */
+double histogram_mean(const Histogram *histogram);
+
+/**
+ * @brief Estimates a quantile from the buckets.
+ * @param histogram The histogram.
+ * @param perMillion The quantile in millionths, e.g. 990000 for p99.
+ * @return the upper bound of the bucket holding the quantile, capped at the
+ * largest recorded value; 0 if there are no values.
+ */
+uint64_t histogram_percentile(const Histogram *histogram, unsigned int perMillion);
+
+/**
+ * @brief Returns the bucket a value falls into.
+ * @param value The value.
+ * @return the bucket index.
+ */
+unsigned int histogram_bucket(uint64_t value);
+
+/**
+ * @brief Returns the largest value that falls into a bucket.
+ * @param bucket The bucket index.
+ * @return the bucket's upper bound.
+ */
+uint64_t histogram_bucket_upper(unsigned int bucket);
+
+/**
+ * @brief Returns the bucket a value falls into at a given precision, for
+ * plain bucket arrays of HISTOGRAM_BUCKETS_FOR(subBits) counters.
+ * @param value The value.
+ * @param subBits The precision.
+ * @return the bucket index.
+ */
+unsigned int histogram_bucket_at(uint64_t value, unsigned int subBits);
+
+/**
+ * @brief Returns the largest value that falls into a bucket at a given precision.
+ * @param bucket The bucket index.
+ * @param subBits The precision.
+ * @return the bucket's upper bound.
+ */
+uint64_t histogram_bucket_upper_at(unsigned int bucket, unsigned int subBits);
+
+/**
+ * @brief Estimates a quantile from a plain bucket array.
+ * @param buckets HISTOGRAM_BUCKETS_FOR(subBits) counters.
+ * @param subBits The precision.
+ * @param max The largest recorded value.
+ * @param perMillion The quantile in millionths, e.g. 990000 for p99.
+ * @return as histogram_percentile.
+ */
+uint64_t histogram_buckets_percentile(const uint64_t *buckets, unsigned int subBits, uint64_t max, unsigned int perMillion);
+
+#endif    // HISTOGRAM_H
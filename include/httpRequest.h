@@ -23,6 +23,9 @@ typedef struct
 
     /** @brief Optional request body (e.g., for POST). */
     char *body;
+
+    /** @brief Connection the request arrived on, for peer lookups; -1 if none. */
+    int clientFd;
 } HTTPRequest;
 
 /**
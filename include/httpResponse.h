@@ -0,0 +1,173 @@
+#ifndef HTTPRESPONSE_H
+#define HTTPRESPONSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Longest a blocked client may stall a send before the connection is dropped
+#define HTTP_RESPONSE_SEND_TIMEOUT_MS 5000
+
+/**
+ * @brief Status codes the server and bundled handlers send.
+ */
+enum HTTPStatus
+{
+    OK_STATUS                    = 200,
+    CREATED_STATUS               = 201,
+    BAD_REQUEST_STATUS           = 400,
+    FORBIDDEN_STATUS             = 403,
+    NOT_FOUND_STATUS             = 404,
+    METHOD_NOT_ALLOWED_STATUS    = 405,
+    REQUEST_TIMEOUT_STATUS       = 408,
+    CONTENT_TOO_LARGE_STATUS     = 413,
+    HEADERS_TOO_LARGE_STATUS     = 431,
+    INTERNAL_SERVER_ERROR_STATUS = 500,
+    SERVICE_UNAVAILABLE_STATUS   = 503,
+};
+
+/**
+ * @brief Growable byte buffer owned by an HTTPResponse.
+ */
+typedef struct
+{
+    char  *data;
+    size_t length;
+    size_t capacity;
+} ResponseBuffer;
+
+/**
+ * @brief A response built by a handler and serialized and sent by the server.
+ * Buffers are kept across http_response_reset so a keep-alive connection
+ * reuses them for every request.
+ */
+typedef struct
+{
+    /** @brief Status code, 200 unless the handler sets one. */
+    int status;
+
+    /** @brief Extra header lines, each ending in \r\n. */
+    ResponseBuffer headers;
+
+    /** @brief The response body. */
+    ResponseBuffer body;
+
+    /** @brief Serialized status line and headers, filled by the server. */
+    ResponseBuffer head;
+
+    /** @brief Content-Length to advertise when the body is omitted (HEAD). */
+    size_t contentLength;
+
+    /** @brief True to send only the head, advertising contentLength. */
+    bool headOnly;
+
+    /** @brief False once the connection must close after this response. */
+    bool keepAlive;
+
+    /** @brief Set when an append ran out of memory; the server answers 500. */
+    bool failed;
+} HTTPResponse;
+
+/**
+ * @brief Initializes an empty 200 response.
+ * @param response The response to initialize.
+ */
+void http_response_init(HTTPResponse *response);
+
+/**
+ * @brief Clears a response for the next request, keeping its buffers.
+ * @param response The response to reset.
+ */
+void http_response_reset(HTTPResponse *response);
+
+/**
+ * @brief Frees the buffers of a response.
+ * @param response The response to free.
+ */
+void http_response_free(HTTPResponse *response);
+
+/**
+ * @brief Sets the status code.
+ * @param response The response.
+ * @param status The HTTP status code, e.g. 404.
+ */
+void http_response_set_status(HTTPResponse *response, int status);
+
+/**
+ * @brief Adds a header line. Content-Length and Connection are written by the
+ * server and must not be added here.
+ * @param response The response.
+ * @param name The header name, e.g. Content-Type.
+ * @param value The header value.
+ * @return 0 on success, -1 on failure.
+ */
+int http_response_add_header(HTTPResponse *response, const char *name, const char *value);
+
+/**
+ * @brief Appends bytes to the body.
+ * @param response The response.
+ * @param data The bytes to append.
+ * @param length The number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+int http_response_append(HTTPResponse *response, const void *data, size_t length);
+
+/**
+ * @brief Appends a NUL-terminated string to the body.
+ * @param response The response.
+ * @param text The string to append.
+ * @return 0 on success, -1 on failure.
+ */
+int http_response_append_str(HTTPResponse *response, const char *text);
+
+/**
+ * @brief Makes room for length more body bytes and returns where they go, so
+ * callers can read straight into the body. Commit them with
+ * http_response_commit.
+ * @param response The response.
+ * @param length The number of bytes to reserve.
+ * @return pointer to the reserved space, or NULL on failure.
+ */
+char *http_response_reserve(HTTPResponse *response, size_t length);
+
+/**
+ * @brief Adds length bytes written into space from http_response_reserve.
+ * @param response The response.
+ * @param length The number of bytes written.
+ */
+void http_response_commit(HTTPResponse *response, size_t length);
+
+/**
+ * @brief Sends only the head, advertising a body of the given length (HEAD).
+ * @param response The response.
+ * @param content_length The length of the resource.
+ */
+void http_response_set_head_only(HTTPResponse *response, size_t content_length);
+
+/**
+ * @brief Sets status and a complete body in one call.
+ * @param response The response.
+ * @param status The HTTP status code.
+ * @param content_type The Content-Type, or NULL for none.
+ * @param body The body text.
+ * @return 0 on success, -1 on failure.
+ */
+int http_response_set_text(HTTPResponse *response, int status, const char *content_type, const char *body);
+
+/**
+ * @brief Returns the reason phrase for a status code, e.g. "Not Found".
+ * @param status The HTTP status code.
+ * @return the reason phrase.
+ */
+const char *http_status_reason(int status);
+
+/**
+ * @brief Serializes the responses and sends them with as few writev calls as
+ * possible, so pipelined responses leave in one batch.
+ * @param client_fd The (possibly non-blocking) client socket.
+ * @param responses The responses in request order.
+ * @param count The number of responses.
+ * @return 0 on success, -1 if the connection failed.
+ */
+int http_response_send(int client_fd, HTTPResponse *responses, size_t count);
+
+#endif    // HTTPRESPONSE_H
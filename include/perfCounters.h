@@ -0,0 +1,98 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include "httpResponse.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Events counted around each handler call. Hardware events are left
+ * out where the PMU is not available (most VMs and containers); the software
+ * ones work everywhere perf_event_open is allowed.
+ */
+typedef enum
+{
+    PERF_INSTRUCTIONS = 0,
+    PERF_CYCLES,
+    PERF_CACHE_MISSES,
+    PERF_TASK_CLOCK,          // nanoseconds on CPU
+    PERF_CONTEXT_SWITCHES,
+    PERF_PAGE_FAULTS,
+    PERF_EVENT_COUNT
+} PerfEvent;
+
+/**
+ * @brief Request methods counters are split by.
+ */
+typedef enum
+{
+    PERF_METHOD_GET = 0,
+    PERF_METHOD_HEAD,
+    PERF_METHOD_POST,
+    PERF_METHOD_OTHER,
+    PERF_METHOD_COUNT
+} PerfMethod;
+
+/**
+ * @brief Counter values at the start of a handler call.
+ */
+typedef struct
+{
+    bool     valid;
+    uint64_t values[PERF_EVENT_COUNT];
+} PerfSnapshot;
+
+/**
+ * @brief Creates the shared per-route, per-method totals. Master, before
+ * forking.
+ * @param enabled false leaves the counters off.
+ * @return 0 on success, -1 on failure.
+ */
+int perf_counters_init(bool enabled);
+
+/**
+ * @brief Worker: opens this process's counter group. Events that cannot be
+ * opened are skipped; if none can, the worker runs without counters.
+ */
+void perf_counters_worker_start(void);
+
+/**
+ * @brief Worker: reads the counters before a handler call.
+ * @param snapshot Filled in; left invalid when counters are off.
+ */
+void perf_counters_begin(PerfSnapshot *snapshot);
+
+/**
+ * @brief Worker: reads the counters after a handler call and adds the
+ * difference to the totals of the request's route and method.
+ * @param snapshot The snapshot taken by perf_counters_begin.
+ * @param route The route index, or -1 for an unrouted request.
+ * @param method The request method.
+ */
+void perf_counters_end(const PerfSnapshot *snapshot, int route, const char *method);
+
+/**
+ * @brief Whether the master created the totals; lets /metrics skip the family.
+ * @return true if counters were enabled.
+ */
+bool perf_counters_enabled(void);
+
+/**
+ * @brief Appends one route's app_perf_calls_total samples to a /metrics
+ * response, one per method that was measured.
+ * @param response The response to append to.
+ * @param route The route index.
+ * @param route_label The escaped route prefix for the route="" label.
+ */
+void perf_counters_calls_metrics(HTTPResponse *response, int route, const char *route_label);
+
+/**
+ * @brief Appends one route's app_perf_events_total samples to a /metrics
+ * response: event counts per method, for the events some worker could open.
+ * @param response The response to append to.
+ * @param route The route index.
+ * @param route_label The escaped route prefix for the route="" label.
+ */
+void perf_counters_events_metrics(HTTPResponse *response, int route, const char *route_label);
+
+#endif    // PERFCOUNTERS_H
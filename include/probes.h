@@ -0,0 +1,80 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT probes under the provider "app", for bpftrace and friends:
+ *
+ *     bpftrace -e 'usdt:./app:app:request_parsed { printf("%s %s\n", str(arg0), str(arg1)); }'
+ *
+ * Each probe compiles to a single nop plus an ELF note that tools patch into
+ * a breakpoint when they attach; the arguments are only located, not
+ * computed, while nothing is attached. <sys/sdt.h> (systemtap-sdt-dev) is
+ * used when installed; otherwise, on x86-64 and AArch64, the note is written
+ * by the macros below in the same format. `readelf -n app` lists the probes
+ * under .note.stapsdt. -DAPP_NO_PROBES compiles them to nothing.
+ *
+ * Probe                 Arguments
+ * connection_accept     fd, peer IPv4 address (network order)
+ * connection_close      fd, requests answered
+ * request_parsed        method, path
+ * handler_entry         module, method, path
+ * handler_exit          module, status
+ * handler_reload        library path, generation
+ * db_store_begin        database path
+ * db_store_end          database path, result (0 on success)
+ * worker_spawn          worker, pid
+ * worker_exit           worker, pid, wait status
+ *
+ * scripts/bpftrace has scripts that turn these into latency histograms.
+ */
+
+#if defined(__has_include) && !defined(APP_NO_PROBES)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define APP_PROBES 1
+    #endif
+#endif
+
+#if !defined(APP_PROBES) && !defined(APP_NO_PROBES) && (defined(__x86_64__) || defined(__aarch64__))
+    // A stapsdt note: the probe's address, the shared base tools use to
+    // relocate it, no semaphore, then provider, name and argument locations
+    #define APP_PROBE_NOTE(name, args)                                       \
+        "990: nop\n"                                                         \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                        \
+        ".balign 4\n"                                                        \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                   \
+        "991: .asciz \"stapsdt\"\n"                                          \
+        "992: .balign 4\n"                                                   \
+        "993: .8byte 990b\n"                                                 \
+        ".8byte _.stapsdt.base\n"                                            \
+        ".8byte 0\n"                                                         \
+        ".asciz \"app\"\n"                                                   \
+        ".asciz \"" #name "\"\n"                                             \
+        ".asciz \"" args "\"\n"                                              \
+        "994: .balign 4\n"                                                   \
+        ".popsection\n"                                                      \
+        ".ifndef _.stapsdt.base\n"                                           \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                             \
+        ".hidden _.stapsdt.base\n"                                           \
+        "_.stapsdt.base: .space 1\n"                                         \
+        ".size _.stapsdt.base, 1\n"                                          \
+        ".popsection\n"                                                      \
+        ".endif\n"
+
+    // Every argument is passed as a signed 64-bit value, pointers included
+    #define PROBE1(name, a) __asm__ __volatile__(APP_PROBE_NOTE(name, "-8@%0") : : "nor"((long)(a)))
+    #define PROBE2(name, a, b) __asm__ __volatile__(APP_PROBE_NOTE(name, "-8@%0 -8@%1") : : "nor"((long)(a)), "nor"((long)(b)))
+    #define PROBE3(name, a, b, c) __asm__ __volatile__(APP_PROBE_NOTE(name, "-8@%0 -8@%1 -8@%2") : : "nor"((long)(a)), "nor"((long)(b)), "nor"((long)(c)))
+#elif defined(APP_PROBES)
+    #define PROBE1(name, a) DTRACE_PROBE1(app, name, a)
+    #define PROBE2(name, a, b) DTRACE_PROBE2(app, name, a, b)
+    #define PROBE3(name, a, b, c) DTRACE_PROBE3(app, name, a, b, c)
+#else
+    // sizeof keeps the arguments "used" without evaluating them
+    #define PROBE1(name, a) ((void)sizeof(a))
+    #define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+    #define PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#endif
+
+#endif    // PROBES_H
@@ -0,0 +1,57 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "httpResponse.h"
+#include <stdint.h>
+
+#define PROFILER_MAX_SAMPLES 4096    // per worker and run; later samples are counted as dropped
+#define PROFILER_MAX_DEPTH 32
+#define PROFILER_DEFAULT_HZ 99       // off the 100 Hz beat of periodic work
+#define PROFILER_MAX_HZ 1000
+#define PROFILER_DEFAULT_SECONDS 10
+#define PROFILER_MAX_SECONDS 60
+
+/**
+ * @brief Creates the shared run control and one sample buffer per worker.
+ * Master, before forking.
+ * @param max_workers Number of worker buffers.
+ * @return 0 on success, -1 on failure.
+ */
+int profiler_init(int max_workers);
+
+/**
+ * @brief Worker: selects its buffer and installs the SIGPROF handler. A
+ * SIGPROF sent to an idle worker (kill -PROF <pid>) profiles that worker
+ * for PROFILER_DEFAULT_SECONDS.
+ * @param worker The worker index.
+ */
+void profiler_worker_start(int worker);
+
+/**
+ * @brief Starts a profiling run: the selected workers sample their stacks
+ * on CPU time for the given number of seconds. Idle workers are woken with
+ * SIGPROF so they pick the run up at once. Replaces any run in progress.
+ * @param seconds Run length (capped at PROFILER_MAX_SECONDS).
+ * @param hz Samples per second of CPU time (capped at PROFILER_MAX_HZ).
+ * @param workers Comma-separated worker indexes, or NULL for all.
+ * @return the run number, or -1 if the worker list is invalid.
+ */
+int profiler_arm(unsigned int seconds, unsigned int hz, const char *workers);
+
+/**
+ * @brief Worker: starts or stops this worker's sampler when a run begins or
+ * ends. Cheap enough to call once per loop iteration.
+ */
+void profiler_poll(void);
+
+/**
+ * @brief Writes the samples of the latest run as folded stacks
+ * ("worker 0;main;run_worker;... 42" per line), the input flamegraph.pl and
+ * speedscope take. Frames are named with dladdr; static functions show as
+ * their object plus an offset.
+ * @param response The response to fill.
+ * @return 0 on success, -1 on failure.
+ */
+int profiler_report(HTTPResponse *response);
+
+#endif    // PROFILER_H
@@ -0,0 +1,161 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "db.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// First byte of an encoded record; never the first byte of a URL-encoded body
+#define RECORD_MAGIC 0xB7
+
+// Record flag: the field section is deflate-compressed
+#define RECORD_FLAG_COMPRESSED 0x01
+
+// Maximum number of field names in the name dictionary
+#define RECORD_MAX_NAMES 255
+
+// Maximum size of the trained compression dictionary
+#define RECORD_ZDICT_MAX 8192
+
+// record_decode result when the record refers to a name or dictionary this process has not loaded
+#define RECORD_UNKNOWN_REF 1
+
+/**
+ * @brief One decoded form field.
+ */
+typedef struct
+{
+    /** @brief The decoded field name. */
+    char *name;
+
+    /** @brief The decoded value, NUL-terminated. */
+    char *value;
+
+    /** @brief The value length, excluding the terminator. */
+    size_t valueLength;
+} RecordField;
+
+/**
+ * @brief The decoded fields of a POST entry, in submission order.
+ */
+typedef struct RecordFields
+{
+    /** @brief The fields. */
+    RecordField *fields;
+
+    /** @brief The number of fields. */
+    size_t count;
+} RecordFields;
+
+/**
+ * @brief The field-name dictionary and compression dictionary shared by the
+ * records in one database. Both are persisted in the database itself.
+ */
+typedef struct
+{
+    /** @brief Field names; a name's id is its index plus one. */
+    char *names[RECORD_MAX_NAMES];
+
+    /** @brief The number of names. */
+    size_t numNames;
+
+    /** @brief The trained deflate dictionary, or NULL. */
+    unsigned char *zdict;
+
+    /** @brief The size of zdict. */
+    size_t zdictLength;
+
+    /** @brief The id records use to refer to zdict; 0 when there is none. */
+    unsigned int zdictId;
+} RecordDictionary;
+
+/**
+ * @brief Parses and decodes a URL-encoded "key=value&..." body.
+ * @param body The raw POST body.
+ * @param fields Destination; free with record_fields_free.
+ * @return 0 on success, -1 on failure.
+ */
+int record_parse_body(const char *body, RecordFields *fields);
+
+/**
+ * @brief Frees decoded fields.
+ * @param fields The fields to free.
+ */
+void record_fields_free(RecordFields *fields);
+
+/**
+ * @brief Returns the value of the first field with the given name.
+ * @param fields The decoded fields.
+ * @param name The field name.
+ * @return the value, or NULL if there is no such field.
+ */
+const char *record_field_value(const RecordFields *fields, const char *name);
+
+/**
+ * @brief Encodes fields as a binary record: length-prefixed names and values,
+ * with names found in the dictionary replaced by their id, optionally
+ * deflate-compressed with the trained dictionary when that makes it smaller.
+ * @param fields The fields to encode.
+ * @param dict The dictionary.
+ * @param compress true to try compression.
+ * @param size Set to the size of the encoded record.
+ * @return the record (must be freed), or NULL on failure.
+ */
+unsigned char *record_encode(const RecordFields *fields, const RecordDictionary *dict, bool compress, size_t *size);
+
+/**
+ * @brief Decodes a stored record, binary or legacy URL-encoded text.
+ * @param data The stored bytes.
+ * @param size The number of bytes.
+ * @param dict The dictionary.
+ * @param fields Destination; free with record_fields_free.
+ * @return 0 on success, -1 if corrupt, RECORD_UNKNOWN_REF if dict must be reloaded.
+ */
+int record_decode(const void *data, size_t size, const RecordDictionary *dict, RecordFields *fields);
+
+/**
+ * @brief Loads (or reloads) the dictionaries persisted in the database.
+ * @param db The open database.
+ * @param dict Destination; previous contents are freed.
+ * @return 0 on success, -1 on failure.
+ */
+int record_dictionary_load(DBM *db, RecordDictionary *dict);
+
+/**
+ * @brief Returns the id of a field name, adding it to the persisted
+ * dictionary if needed. The database must be open for writing.
+ * @param db The open database.
+ * @param dict The dictionary.
+ * @param name The field name.
+ * @return the id, or 0 if the dictionary is full (the name is then stored inline).
+ */
+unsigned int record_dictionary_intern(DBM *db, RecordDictionary *dict, const char *name);
+
+/**
+ * @brief Trains and persists a deflate dictionary from sample records.
+ * Does nothing if the database already has one.
+ * @param db The open database.
+ * @param dict The dictionary.
+ * @param samples Uncompressed sample records, oldest first.
+ * @param sizes The sample sizes.
+ * @param count The number of samples.
+ * @return 0 on success, -1 on failure.
+ */
+int record_dictionary_train(DBM *db, RecordDictionary *dict, const unsigned char *const *samples, const size_t *sizes, size_t count);
+
+/**
+ * @brief Frees a dictionary's contents.
+ * @param dict The dictionary.
+ */
+void record_dictionary_free(RecordDictionary *dict);
+
+/**
+ * @brief Returns true for database keys that hold dictionaries or indexes
+ * rather than entries.
+ * @param key The key bytes.
+ * @param size The key size.
+ * @return true or false
+ */
+bool record_is_internal_key(const char *key, size_t size);
+
+#endif    // RECORD_H
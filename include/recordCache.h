@@ -0,0 +1,73 @@
+#ifndef RECORDCACHE_H
+#define RECORDCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Number of records kept in the shared LRU cache
+#define RECORD_CACHE_CAPACITY 4096
+
+// Records larger than this are never cached
+#define RECORD_CACHE_MAX_VALUE 512
+
+/**
+ * @brief Hit/miss counters of the shared record cache.
+ */
+typedef struct
+{
+    /** @brief Lookups answered from the cache. */
+    uint64_t hits;
+
+    /** @brief Lookups that had to go to the database. */
+    uint64_t misses;
+
+    /** @brief Records currently cached. */
+    size_t size;
+} RecordCacheStats;
+
+/**
+ * @brief Creates the shared LRU cache. Must be called by the master before
+ * forking workers so every worker sees the same cache.
+ * @return 0 on success, -1 on failure.
+ */
+int record_cache_init(void);
+
+/**
+ * @brief Inserts or refreshes a record, evicting the least recently used one
+ * when the cache is full. Does nothing if the cache was never initialized.
+ * @param id The entry id.
+ * @param data The stored record bytes.
+ * @param length The number of bytes in data.
+ */
+void record_cache_put(int id, const void *data, size_t length);
+
+/**
+ * @brief Copies a cached record into out and marks it most recently used.
+ * @param id The entry id.
+ * @param out Destination buffer.
+ * @param out_size Size of out; should be at least RECORD_CACHE_MAX_VALUE.
+ * @return the record length, or -1 on a miss.
+ */
+ssize_t record_cache_get(int id, void *out, size_t out_size);
+
+/**
+ * @brief Records the number of entries known to exist (the next id to be
+ * assigned), so listings can be bounded without opening the database.
+ * @param count The entry count.
+ */
+void record_cache_set_count(int count);
+
+/**
+ * @brief Returns the entry count recorded with record_cache_set_count.
+ * @return the count, or -1 if unknown.
+ */
+int record_cache_get_count(void);
+
+/**
+ * @brief Copies the current cache counters.
+ * @param stats Destination.
+ */
+void record_cache_get_stats(RecordCacheStats *stats);
+
+#endif    // RECORDCACHE_H
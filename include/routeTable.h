@@ -0,0 +1,77 @@
+#ifndef ROUTETABLE_H
+#define ROUTETABLE_H
+
+#include <stddef.h>
+
+// Route file read at startup: one "METHOD PREFIX SO_PATH" per line
+#define ROUTES_PATH "../data/routes.conf"
+
+// Method column value matching every method
+#define ROUTE_ANY_METHOD "*"
+
+/**
+ * @brief Maps method and path prefix to a module index. Built as a byte trie
+ * so a lookup walks the path once, whatever the number of routes.
+ */
+typedef struct RouteTable RouteTable;
+
+/**
+ * @brief Creates an empty route table.
+ * @return the table, or NULL on failure.
+ */
+RouteTable *route_table_create(void);
+
+/**
+ * @brief Adds a route. A later route for the same method and prefix
+ * replaces the earlier one.
+ * @param table The table.
+ * @param method GET, HEAD, POST or ROUTE_ANY_METHOD.
+ * @param prefix Path prefix, e.g. /entries.
+ * @param module Module index returned for matching requests.
+ * @return 0 on success, -1 on failure.
+ */
+int route_table_add(RouteTable *table, const char *method, const char *prefix, int module);
+
+/**
+ * @brief Finds the route for a request: the longest prefix that ends at a
+ * segment boundary ('/', '?' or the end of the path) wins, and at equal
+ * length a route for the exact method beats ROUTE_ANY_METHOD.
+ * @param table The table.
+ * @param method The request method.
+ * @param path The request path.
+ * @return the route index (0 to route_table_size() - 1), or -1 if none matches.
+ */
+int route_table_match(const RouteTable *table, const char *method, const char *path);
+
+/**
+ * @brief Returns the module a route leads to.
+ * @param table The table.
+ * @param route A route index from route_table_match.
+ * @return the module index.
+ */
+int route_table_module(const RouteTable *table, int route);
+
+/**
+ * @brief Returns the method column of a route.
+ * @param table The table.
+ * @param route A route index.
+ * @return GET, HEAD, POST or ROUTE_ANY_METHOD.
+ */
+const char *route_table_method(const RouteTable *table, int route);
+
+/**
+ * @brief Returns the path prefix of a route.
+ * @param table The table.
+ * @param route A route index.
+ * @return the prefix.
+ */
+const char *route_table_prefix(const RouteTable *table, int route);
+
+/**
+ * @brief Returns the number of distinct routes.
+ * @param table The table.
+ * @return the route count.
+ */
+size_t route_table_size(const RouteTable *table);
+
+#endif    // ROUTETABLE_H
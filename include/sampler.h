@@ -0,0 +1,18 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+
+// Sampling rates are given in percent
+#define SAMPLER_MAX_PERCENT 100
+
+/**
+ * @brief Decides whether to sample one event, such as a request. Draws from
+ * a per-process xorshift64 stream seeded from the clock and pid on first
+ * use, so forked workers do not sample in lockstep.
+ * @param percent The sampling rate, 0 to SAMPLER_MAX_PERCENT.
+ * @return true for about percent in every hundred calls.
+ */
+bool sampler_pick(unsigned int percent);
+
+#endif    // SAMPLER_H
@@ -0,0 +1,170 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include "histogram.h"
+#include "httpResponse.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SCOREBOARD_MAX_WORKERS 256
+#define SCOREBOARD_MAX_ROUTES 64
+
+// Responses are counted per status class: [1] = 1xx ... [5] = 5xx, [0] = other
+#define SCOREBOARD_STATUS_CLASSES 6
+
+/**
+ * @brief What a worker is doing right now.
+ */
+typedef enum
+{
+    WORKER_STATE_EMPTY = 0,    // no process in this slot
+    WORKER_STATE_IDLE,         // waiting for a connection
+    WORKER_STATE_READING,      // holding a connection, waiting for or reading a request
+    WORKER_STATE_HANDLING,     // running a handler
+    WORKER_STATE_WRITING,      // sending responses
+    WORKER_STATE_COUNT
+} WorkerState;
+
+/**
+ * @brief One worker's row in the shared scoreboard. Written only by that
+ * worker (and reset by the master before it forks one), read by anyone with
+ * relaxed atomics: a reader may see counters a moment apart, never torn.
+ */
+typedef struct
+{
+    atomic_int   pid;
+    atomic_int   state;
+    atomic_ulong startedNs;
+    atomic_ulong busyNs;       // total time spent holding connections, not counting the current one
+    atomic_ulong busySince;    // CLOCK_MONOTONIC ns when the current connection was accepted
+    atomic_ulong requests;     // requests answered, updated as each response is sent
+    atomic_ulong connections;
+    atomic_ulong bytesIn;
+    atomic_ulong bytesOut;
+    atomic_ulong statuses[SCOREBOARD_STATUS_CLASSES];
+} WorkerScore;
+
+/**
+ * @brief Per-route totals, shared by all workers.
+ */
+typedef struct
+{
+    atomic_ulong requests;
+    atomic_ulong errors;    // 5xx responses
+    Histogram    latency;    // ns from request parsed to handler done
+} RouteScore;
+
+/**
+ * @brief Creates the scoreboard in shared memory. Master, before forking.
+ * @param max_workers Number of worker rows, at most SCOREBOARD_MAX_WORKERS.
+ * @return 0 on success, -1 on failure.
+ */
+int scoreboard_init(int max_workers);
+
+/**
+ * @brief Master: clears a row before a worker is forked into it.
+ * @param worker The worker index.
+ */
+void scoreboard_reset(int worker);
+
+/**
+ * @brief Worker: claims its row; later calls update it.
+ * @param worker The worker index.
+ */
+void scoreboard_worker_start(int worker);
+
+/**
+ * @brief Worker: a connection was accepted. The worker counts as busy, in
+ * WORKER_STATE_READING, until scoreboard_idle.
+ */
+void scoreboard_busy(void);
+
+/**
+ * @brief Worker: the connection is closed.
+ */
+void scoreboard_idle(void);
+
+/**
+ * @brief Worker: moves between READING, HANDLING and WRITING.
+ * @param state The new state.
+ */
+void scoreboard_set_state(WorkerState state);
+
+/**
+ * @brief Worker: counts bytes received on a connection.
+ * @param bytes Bytes read.
+ */
+void scoreboard_bytes_in(size_t bytes);
+
+/**
+ * @brief Worker: counts a response that was sent.
+ * @param response The response, after http_response_send.
+ */
+void scoreboard_response(const HTTPResponse *response);
+
+/**
+ * @brief Worker: records how long a route took to handle a request.
+ * @param route Route index from handler_route (ignored if out of range).
+ * @param status The response status.
+ * @param latency_ns Handling time.
+ */
+void scoreboard_route(int route, int status, uint64_t latency_ns);
+
+/**
+ * @brief Time a worker has spent busy so far, including a connection in progress.
+ * @param worker The worker index.
+ * @param now_ns The current CLOCK_MONOTONIC time in ns.
+ * @return busy nanoseconds
+ */
+uint64_t scoreboard_busy_ns(int worker, uint64_t now_ns);
+
+/**
+ * @brief Returns the number of worker rows.
+ * @return the count
+ */
+int scoreboard_size(void);
+
+/**
+ * @brief Returns a worker's row.
+ * @param worker The worker index.
+ * @return the row, or NULL if out of range.
+ */
+const WorkerScore *scoreboard_worker(int worker);
+
+/**
+ * @brief Returns a route's totals.
+ * @param route The route index.
+ * @return the totals, or NULL if out of range.
+ */
+const RouteScore *scoreboard_route_score(int route);
+
+/**
+ * @brief Returns the printable name of a worker state.
+ * @param state The state.
+ * @return the name
+ */
+const char *scoreboard_state_name(int state);
+
+/**
+ * @brief Renders the scoreboard as a plain-text status page: totals, one line
+ * per worker and per-route latency.
+ * @param response The response to fill.
+ * @return 0 on success, -1 if the response could not be built.
+ */
+int scoreboard_status_report(HTTPResponse *response);
+
+/**
+ * @brief Renders the same counters in the Prometheus text exposition format.
+ * @param response The response to fill.
+ * @return 0 on success, -1 if the response could not be built.
+ */
+int scoreboard_metrics_report(HTTPResponse *response);
+
+/**
+ * @brief CLOCK_MONOTONIC in nanoseconds.
+ * @return the time
+ */
+uint64_t scoreboard_now_ns(void);
+
+#endif    // SCOREBOARD_H
@@ -6,6 +6,7 @@
 #define MAIN_SERVER_H
 
 #include "httpRequest.h"    // Not shared_lib.h — only server-side logic
+#include "httpResponse.h"
 #include <signal.h>
 
 #define BUFFER_SIZE 1024
@@ -25,7 +26,7 @@ struct clientInformation
 };
 
 // Pre-fork entry point
-int start_prefork_server(const char *ip, const char *port, const char *so_path, int num_workers);
+int start_prefork_server(const char *ip, const char *port, const char *so_path, int min_workers, int max_workers);
 
 // Legacy file functions (still useful for GET/HEAD)
 int  server_setup(char *passedServerInfo[]);
@@ -36,8 +37,6 @@ int  server_close(struct serverInformation server);
 int  client_close(int client);
 
 // Static HTTP helpers (used by handler_v1.so)
-int send_response_resource(int client_socket, const char *content, size_t content_length);
-int send_response_head(int client_socket, size_t content_length);
-int handle_post_request(int client_socket, const HTTPRequest *request, const char *body);
+int handle_post_request(HTTPResponse *response, const HTTPRequest *request, const char *body);
 
 #endif    // MAIN_SERVER_H
@@ -0,0 +1,56 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "httpRequest.h"
+#include "httpResponse.h"
+#include "shared_lib.h"
+#include <stdbool.h>
+
+/**
+ * @brief Turns on shadow evaluation: modules load a candidate library next to
+ * the active one and a sample of GET/HEAD requests also runs through it.
+ * Must be called by the master before the handler modules are loaded.
+ * @param percent Percentage of eligible requests to shadow (1-100); 0 leaves
+ * shadowing off.
+ * @return 0 on success, -1 on failure.
+ */
+int shadow_init(unsigned int percent);
+
+/**
+ * @brief Runs a request through the active handler. Sampled requests are
+ * also kept for the module's candidate, which runs them in
+ * shadow_run_pending once the client has its response. The candidate's
+ * response is discarded; the latency and heap growth of both are recorded.
+ * @param module The module the request was routed to.
+ * @param slot The module's active slot.
+ * @param client_fd The connection the request arrived on.
+ * @param request The request.
+ * @param response The response the client gets.
+ * @return the result of handler_invoke for the active handler.
+ */
+int shadow_invoke(int module, HandlerSlot *slot, int client_fd, const HTTPRequest *request, HTTPResponse *response);
+
+/**
+ * @brief Runs the requests kept by shadow_invoke through their candidates
+ * and compares the results. Called after a batch of responses is sent, so
+ * the candidate never delays the client.
+ */
+void shadow_run_pending(void);
+
+/**
+ * @brief Writes the active-versus-candidate comparison of every module with
+ * a candidate as JSON.
+ * @param response The response to fill.
+ * @return 0 on success, -1 on failure.
+ */
+int shadow_report(HTTPResponse *response);
+
+/**
+ * @brief Promotes the candidates of the given module, or of every module
+ * with a candidate when module is negative.
+ * @param module Module index, or -1 for all.
+ * @return number of candidates promoted, or -1 on failure.
+ */
+int shadow_promote(int module);
+
+#endif    // SHADOW_H
@@ -0,0 +1,89 @@
+#ifndef SHAREDMEMORY_H
+#define SHAREDMEMORY_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SHARED_MEMORY_NAME_MAX 32
+
+/**
+ * @brief Maps a zeroed anonymous region shared by the master and every worker
+ * forked after this call.
+ * @param size The size of the region in bytes.
+ * @return pointer to the region, or NULL on failure.
+ */
+void *shared_memory_create(size_t size);
+
+/**
+ * @brief Unmaps a region returned by shared_memory_create.
+ * @param addr The region.
+ * @param size The size passed to shared_memory_create.
+ */
+void shared_memory_destroy(void *addr, size_t size);
+
+/**
+ * @brief Maps a named shared region backed by a memfd, so that state which
+ * must survive a binary upgrade (database lock, record cache) can be handed
+ * to the new master. If the old master handed over a region of this name and
+ * size, that one is mapped instead and *attached is set: the caller must then
+ * skip initializing it.
+ * @param name The region name.
+ * @param size The size of the region in bytes.
+ * @param attached Set to true if an existing region was mapped.
+ * @return pointer to the region, or NULL on failure.
+ */
+void *shared_memory_attach(const char *name, size_t size, bool *attached);
+
+/**
+ * @brief New master: registers a region received from the old master, for a
+ * later shared_memory_attach of the same name. Takes ownership of fd.
+ * @param name The region name.
+ * @param fd The memfd.
+ * @return 0 on success, -1 on failure.
+ */
+int shared_memory_adopt(const char *name, int fd);
+
+/**
+ * @brief Returns the number of regions created by shared_memory_attach.
+ * @return the count
+ */
+int shared_memory_region_count(void);
+
+/**
+ * @brief Returns the name of a region created by shared_memory_attach.
+ * @param region Index below shared_memory_region_count().
+ * @return the name
+ */
+const char *shared_memory_region_name(int region);
+
+/**
+ * @brief Returns the memfd behind a region created by shared_memory_attach.
+ * @param region Index below shared_memory_region_count().
+ * @return the descriptor
+ */
+int shared_memory_region_fd(int region);
+
+/**
+ * @brief Initializes a robust, process-shared mutex living in shared memory.
+ * @param mutex The mutex to initialize.
+ * @return 0 on success, -1 on failure.
+ */
+int shared_mutex_init(pthread_mutex_t *mutex);
+
+/**
+ * @brief Locks a mutex created by shared_mutex_init.
+ * If the previous owner died while holding it, the mutex is made consistent
+ * again and 1 is returned so the caller can repair the data it protects.
+ * @param mutex The mutex to lock.
+ * @return 0 on success, 1 if recovered from a dead owner, -1 on failure.
+ */
+int shared_mutex_lock(pthread_mutex_t *mutex);
+
+/**
+ * @brief Unlocks a mutex created by shared_mutex_init.
+ * @param mutex The mutex to unlock.
+ */
+void shared_mutex_unlock(pthread_mutex_t *mutex);
+
+#endif    // SHAREDMEMORY_H
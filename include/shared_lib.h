@@ -2,28 +2,218 @@
 #define SHARED_LIB_H
 
 #include "httpRequest.h"
-#include <time.h>
+#include "httpResponse.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 
-// Global state for reload checks (optional if single `.so`)
-extern time_t last_mod_time;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
-extern void  *current_handle;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+// Most handler libraries the route table may name
+#define HANDLER_MAX_MODULES 16
 
-// Signature of handler used by .so files
+// handler_v1.so is shadowed by handler_v1.candidate.so in the same directory
+#define HANDLER_CANDIDATE_SUFFIX ".candidate.so"
+
+// ABI a module declares by exporting `const int handler_abi_version`.
+// Modules without it are legacy modules exporting only handle_request.
+#define HANDLER_ABI_LEGACY 1
+#define HANDLER_ABI_VERSION 2
+
+// Signature of handler used by legacy .so files: writes the response itself
 typedef int (*RequestHandlerFunc)(int client_fd, const HTTPRequest *request);
 
+// ABI v2: fills a response the server sends, with the worker's context
+typedef int (*RequestHandlerV2Func)(void *context, const HTTPRequest *request, HTTPResponse *response);
+
+// ABI v2, optional: called once per worker after fork / before unload
+typedef int (*HandlerInitFunc)(void **context);
+typedef void (*HandlerFiniFunc)(void *context);
+
 /**
- * The entry point each .so handler must implement.
+ * One loaded version of the handler library. The active slot holds one
+ * reference; every in-flight request holds another. The library is only
+ * dlclose'd once the slot is retired and the last reference is released.
+ */
+typedef struct HandlerSlot
+{
+    void                *handle;
+    int                  abi_version;
+    RequestHandlerFunc   handle_request;
+    RequestHandlerV2Func handle_request_v2;
+    HandlerInitFunc      init;
+    HandlerFiniFunc      fini;
+    void                *context;        // returned by init in this worker
+    bool                 initialized;    // init has run in this process
+    unsigned long        generation;
+    atomic_uint          refs;
+    int                  image_fd;    // private copy of the .so the handle was loaded from
+} HandlerSlot;
+
+/**
+ * The entry point of a legacy .so handler.
  */
 int handle_request(int client_fd, const HTTPRequest *request);
 
 /**
- * Load the shared library and resolve the handler function.
+ * The entry points of an ABI v2 .so handler. Only handle_request_v2 is
+ * required; handler_init/handler_fini run once per worker.
+ */
+extern const int handler_abi_version;
+int              handle_request_v2(void *context, const HTTPRequest *request, HTTPResponse *response);
+int              handler_init(void **context);
+void             handler_fini(void *context);
+
+/**
+ * Load a handler library as a module, or return the existing module for the
+ * same path.
+ * @param so_path path to the shared library
+ * @return module index, or -1 if it could not be loaded
+ */
+int handler_module_add(const char *so_path);
+
+/**
+ * Load the route table and every module it names. Without a route file all
+ * requests go to `default_so_path`.
+ * @param routes_path route file, see routeTable.h
+ * @param default_so_path module used when the route file does not exist
+ * @return 0 on success, -1 on failure
+ */
+int handler_modules_load(const char *routes_path, const char *default_so_path);
+
+/**
+ * Route a request to a module.
+ * @param method request method
+ * @param path request path
+ * @param route set to the index of the matching route (-1 if none), for
+ *        per-route statistics; may be NULL
+ * @return module index, or -1 if no route matches
+ */
+int handler_route(const char *method, const char *path, int *route);
+
+/**
+ * @return number of routes in the route table
+ */
+int handler_route_count(void);
+
+/**
+ * Describe a route, e.g. for labelling its statistics.
+ * @param route route index below handler_route_count()
+ * @param method set to the route's method column
+ * @param prefix set to the route's path prefix
+ */
+void handler_route_describe(int route, const char **method, const char **prefix);
+
+/**
+ * Take a reference to a module's active handler for the duration of a
+ * request.
+ * @param module module index from handler_route
+ * @return the active slot, or NULL if there is no such module
+ */
+HandlerSlot *handler_acquire(int module);
+
+/**
+ * Take a reference to a module's shadow candidate, if one is loaded.
+ * @param module module index from handler_route
+ * @return the candidate slot, or NULL
+ */
+HandlerSlot *handler_acquire_candidate(int module);
+
+/**
+ * Watch for shadow candidates (see HANDLER_CANDIDATE_SUFFIX). Off by
+ * default, in which case candidate files are ignored.
+ * @param enabled true to load candidates
+ */
+void handler_set_candidates(bool enabled);
+
+/**
+ * Replace a module's library with its candidate by renaming the candidate
+ * file over it; the master then reloads the module as usual.
+ * @param module module index
+ * @return 0 on success, -1 on failure
+ */
+int handler_promote_candidate(int module);
+
+/**
+ * @return number of loaded modules
+ */
+size_t handler_module_count_get(void);
+
+/**
+ * @param module module index
+ * @return path of the module's library
+ */
+const char *handler_module_path(int module);
+
+/**
+ * @param module module index
+ * @return path the module's shadow candidate is loaded from
+ */
+const char *handler_candidate_path(int module);
+
+/**
+ * Worker: run every module's handler_init once after fork.
+ * @return 0 on success, -1 if the module refused to start
+ */
+int handler_worker_start(void);
+
+/**
+ * Worker: drop this worker's modules before it exits, running each
+ * module's handler_fini.
+ */
+void handler_worker_stop(void);
+
+/**
+ * Run one request through a slot.
+ * @param slot slot returned by handler_acquire
+ * @param client_fd connection the request arrived on
+ * @param request the parsed request
+ * @param response filled by v2 modules
+ * @return 1 if `response` must be sent, 0 if a legacy module already wrote to client_fd
+ */
+int handler_invoke(HandlerSlot *slot, int client_fd, const HTTPRequest *request, HTTPResponse *response);
+
+/**
+ * Drop a reference taken by handler_acquire; unloads retired slots.
+ * @param slot slot returned by handler_acquire (NULL is ignored)
+ */
+void handler_release(HandlerSlot *slot);
+
+/**
+ * Set up hot reload in the master, after the modules are loaded and before
+ * forking workers: creates the shared generation counters and an inotify
+ * watch on each module's directory.
+ * Returns the inotify fd for the master's event loop, or -1 if the
+ * libraries cannot be watched (reload then only happens on SIGHUP).
+ */
+int handler_reload_init(void);
+
+/**
+ * Master: drain the inotify fd and mark every module whose .so was rewritten
+ * or replaced for reload.
+ */
+void handler_reload_on_event(int inotify_fd);
+
+/**
+ * Master: validate each marked module (every module after a bare SIGHUP) in
+ * a throwaway child and, if it loads, make it active in the master and bump
+ * its shared generation so workers follow. Other modules are untouched.
+ * Returns 0 on success, -1 if any new library was rejected.
+ */
+int handler_publish_reload(void);
+
+/**
+ * Master: request a reload of every module, as on SIGHUP.
+ */
+void handler_request_reload(void);
+
+/**
+ * Master: returns true, once, if a reload was requested.
  */
-RequestHandlerFunc load_request_handler(const char *so_path);
+bool handler_reload_requested(void);
 
 /**
- * Reload the handler if the .so file is updated.
+ * Worker: load the modules the master published new generations of, from
+ * the copies the master validated rather than the files on disk.
+ * Costs a single memory load when nothing changed.
  */
-void check_for_handler_update(const char *so_path, RequestHandlerFunc *handler);
+void handler_refresh(void);
 
 #endif    // SHARED_LIB_H
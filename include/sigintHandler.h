@@ -17,6 +17,18 @@ extern int    registered_num_pids;      // NOLINT(cppcoreguidelines-avoid-non-co
  */
 void register_child_pids(pid_t *pids, int count);
 
+/**
+ * Store a handler in a sigaction without going through the sa_handler macro.
+ * The pointer is copied rather than cast to void *, which ISO C does not
+ * allow for function pointers.
+ */
+void set_sigaction_handler(struct sigaction *sa, void (*handler)(int));
+
+/**
+ * Store an SA_SIGINFO handler in a sigaction, the same way.
+ */
+void set_sigaction_action(struct sigaction *sa, void (*action)(int, siginfo_t *, void *));
+
 /**
  * Setup the SIGINT handler.
  */
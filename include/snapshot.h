@@ -0,0 +1,44 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Directory snapshots are written to, relative to the server's working directory
+#define SNAPSHOT_DIR "../data/db/snapshots"
+
+// Maximum length of a snapshot path
+#define SNAPSHOT_MAX_PATH 256
+
+/**
+ * @brief Outcome of one online snapshot.
+ */
+typedef struct
+{
+    /** @brief Snapshot database name (open it like POST_DB_PATH). */
+    char path[SNAPSHOT_MAX_PATH];
+
+    /** @brief Bytes copied across all database files. */
+    size_t bytes;
+
+    /** @brief How long writers were paused, in milliseconds. */
+    double pauseMs;
+
+    /** @brief Total time taken, in milliseconds. */
+    double totalMs;
+
+    /** @brief true if the files were cloned with a reflink instead of copied. */
+    bool reflinked;
+} SnapshotResult;
+
+/**
+ * @brief Takes a point-in-time copy of a database while workers keep running.
+ * Writers are paused only while the files are reflinked, or read into memory
+ * when the filesystem cannot reflink; the copy is written out after they resume.
+ * @param db_path The database name (e.g. POST_DB_PATH).
+ * @param result Filled in on success.
+ * @return 0 on success, -1 on failure.
+ */
+int database_snapshot(const char *db_path, SnapshotResult *result);
+
+#endif    // SNAPSHOT_H
@@ -107,4 +107,18 @@ StringArray parseKeyValueBody(const char *body);
  */
 char *extractValueFromPair(const char *pair);
 
+/**
+ * @brief Frees every string in a StringArray and the array itself.
+ * @param stringArray The array returned by tokenizeString.
+ */
+void freeStringArray(StringArray *stringArray);
+
+/**
+ * @brief Decodes a URL-encoded (application/x-www-form-urlencoded) string.
+ * "+" becomes a space and "%XX" becomes the byte XX.
+ * @param encoded The encoded string.
+ * @return char* with the decoded string (must be freed), or NULL on failure.
+ */
+char *urlDecode(const char *encoded);
+
 #endif    // STRINGTOOLS_H
@@ -0,0 +1,169 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// A worker that dies sooner than this after starting counts as crash-looping
+#define SUPERVISOR_STABLE_MS 10000
+
+// Restart delay after the second quick crash in a row; doubles per crash up to the max
+#define SUPERVISOR_BACKOFF_BASE_MS 100
+#define SUPERVISOR_BACKOFF_MAX_MS 30000
+
+// Autoscaling and recycling are checked every interval. The pool grows by one
+// worker when the workers spent at least SCALE_UP percent of it holding a
+// connection, and shrinks by one after SCALE_DOWN_TICKS samples in a row below
+// SCALE_DOWN
+#define SUPERVISOR_SAMPLE_INTERVAL_MS 1000
+#define SUPERVISOR_SCALE_UP_PERCENT 75
+#define SUPERVISOR_SCALE_DOWN_PERCENT 25
+#define SUPERVISOR_SCALE_DOWN_TICKS 10
+
+// Default pool: min is the CPU budget, max this many workers per CPU, since a
+// worker is tied up for as long as a keep-alive connection stays open
+#define SUPERVISOR_MAX_WORKERS_PER_CPU 4
+
+// Recycling limits are raised by up to this much per worker, so workers started
+// together do not all reach them together
+#define RECYCLE_JITTER_PERCENT 10
+
+// How long workers get to finish in-flight requests on shutdown before SIGKILL
+#define SUPERVISOR_DRAIN_TIMEOUT_MS 10000
+
+// Bits returned by supervisor_wait
+#define SUPERVISOR_EVENT_RELOAD 0x1      // SIGHUP
+#define SUPERVISOR_EVENT_SNAPSHOT 0x2    // SIGUSR1
+#define SUPERVISOR_EVENT_WATCHED 0x4     // a descriptor added with supervisor_watch is readable
+#define SUPERVISOR_EVENT_SHUTDOWN 0x8    // SIGINT or SIGTERM
+#define SUPERVISOR_EVENT_UPGRADE 0x10    // SIGUSR2
+
+/**
+ * Body of a worker process; never returns.
+ */
+typedef void (*WorkerMainFunc)(int worker, void *arg);
+
+/**
+ * @brief When a worker is replaced by a fresh one. 0 disables a limit.
+ */
+typedef struct
+{
+    /** @brief Requests served. */
+    unsigned long maxRequests;
+
+    /** @brief Resident memory, in MiB. */
+    unsigned long maxRssMb;
+
+    /** @brief Time since the worker started. */
+    unsigned int maxAgeSeconds;
+} RecyclePolicy;
+
+/**
+ * @brief What the supervisor knows about one worker slot.
+ */
+typedef struct
+{
+    /** @brief Current PID, or 0 while waiting to be respawned. */
+    pid_t pid;
+
+    /** @brief Times this slot was respawned. */
+    unsigned int restarts;
+
+    /** @brief Quick crashes in a row; drives the backoff. */
+    unsigned int failures;
+
+    /** @brief Raw wait status of the last exit. */
+    int lastStatus;
+
+    /** @brief When the current process started (CLOCK_MONOTONIC, ms). */
+    uint64_t startedMs;
+
+    /** @brief When a dead worker is due to be respawned (CLOCK_MONOTONIC, ms). */
+    uint64_t respawnAtMs;
+
+    /** @brief Scoreboard busy time at the last autoscale sample. */
+    uint64_t sampledBusyNs;
+
+    /** @brief This worker's jittered request limit (0 if none). */
+    unsigned long requestLimit;
+
+    /** @brief This worker's jittered age limit in ms (0 if none). */
+    uint64_t ageLimitMs;
+
+    /** @brief Asked to exit by recycling; respawned right away. */
+    bool recycling;
+} WorkerSlot;
+
+/**
+ * @brief Takes over SIGCHLD, SIGHUP, SIGUSR1, SIGUSR2, SIGINT and SIGTERM
+ * through a signalfd and forks the workers. Signals stay blocked in the master and are
+ * unblocked in each worker before worker_main runs; in a worker SIGTERM
+ * starts a drain (see supervisor_worker_draining) and SIGINT is ignored.
+ * Each worker is pinned to a CPU (see cpu_topology_pin) and reports to the
+ * scoreboard; with max_workers above min_workers the pool is resized from it.
+ * @param min_workers Workers started, and the floor when shrinking.
+ * @param max_workers Ceiling when growing.
+ * @param worker_main Body of each worker.
+ * @param arg Passed to worker_main.
+ * @return 0 on success, -1 on failure.
+ */
+int supervisor_init(int min_workers, int max_workers, WorkerMainFunc worker_main, void *arg);
+
+/**
+ * @brief Adds a descriptor (e.g. the handler inotify fd) to the supervisor's
+ * event loop.
+ * @param fd The descriptor.
+ * @return 0 on success, -1 on failure.
+ */
+int supervisor_watch(int fd);
+
+/**
+ * @brief Sleeps until something happens: reaps and respawns workers itself
+ * and returns the other events for the caller to act on.
+ * @return a mask of SUPERVISOR_EVENT_* bits (0 if only workers changed).
+ */
+int supervisor_wait(void);
+
+/**
+ * @brief Sets how long supervisor_drain waits before killing workers.
+ * @param timeout_ms Milliseconds; 0 uses SUPERVISOR_DRAIN_TIMEOUT_MS.
+ */
+void supervisor_set_drain_timeout(unsigned int timeout_ms);
+
+/**
+ * @brief Sets when workers are recycled: drained and replaced once they
+ * reach a request count, resident memory size or age. Call before
+ * supervisor_init.
+ * @param policy The limits.
+ */
+void supervisor_set_recycle(const RecyclePolicy *policy);
+
+/**
+ * @brief Stops respawning, sends SIGTERM to every worker and reaps them as
+ * they finish. Workers still running at the deadline are killed.
+ * @return the number of workers that had to be killed.
+ */
+int supervisor_drain(void);
+
+/**
+ * @brief Worker: true once SIGTERM asked this worker to drain.
+ * @return true or false
+ */
+bool supervisor_worker_draining(void);
+
+/**
+ * @brief Worker: a descriptor that becomes readable when the drain starts,
+ * to poll alongside sockets.
+ * @return the descriptor
+ */
+int supervisor_worker_drain_fd(void);
+
+/**
+ * @brief Returns a worker slot, e.g. for status reports.
+ * @param worker The worker index.
+ * @return the slot, or NULL if out of range.
+ */
+const WorkerSlot *supervisor_worker(int worker);
+
+#endif    // SUPERVISOR_H
@@ -0,0 +1,123 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_PATH "../data/trace.ring"
+#define TRACE_MAGIC "apptrace"
+#define TRACE_VERSION 1
+#define TRACE_RING_EVENTS 4096    // per worker, a power of two
+#define TRACE_PENDING_EVENTS 64    // events held while a request is in flight
+
+/**
+ * @brief Where a request spent its time. TRACE_REQUEST spans the whole
+ * request, from the first phase to the send.
+ */
+typedef enum
+{
+    TRACE_ACCEPT = 0,
+    TRACE_READ,
+    TRACE_PARSE,
+    TRACE_HANDLE,
+    TRACE_DB_WRITE,
+    TRACE_SEND,
+    TRACE_REQUEST,
+    TRACE_PHASE_COUNT
+} TracePhase;
+
+/**
+ * @brief One timed phase. Times are raw clock ticks; TraceHeader says how to
+ * turn them into nanoseconds.
+ */
+typedef struct
+{
+    _Atomic(uint64_t) sequence;    // ring position + 1 once the event is complete, 0 while it is written
+    uint64_t          start;
+    uint64_t          end;
+    int32_t           pid;
+    uint32_t          request;     // per-worker number of the traced request
+    uint16_t          phase;
+    uint16_t          status;      // response status, TRACE_REQUEST only
+    uint32_t          count;       // requests answered by the send, TRACE_REQUEST only
+} TraceEvent;
+
+/**
+ * @brief One worker's ring; only that worker writes it.
+ */
+typedef struct
+{
+    _Atomic(uint64_t) head;    // events ever written
+    TraceEvent        events[TRACE_RING_EVENTS];
+} TraceRing;
+
+/**
+ * @brief Start of the trace file, followed by `workers` rings.
+ */
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t workers;
+    uint32_t ringEvents;
+    uint32_t percent;
+    double   ticksPerNs;    // 1.0 when the clock is CLOCK_MONOTONIC
+    uint64_t baseTicks;     // clock value when the file was created
+    uint64_t baseNs;        // CLOCK_MONOTONIC at the same moment
+    char     clock[16];     // "tsc" or "monotonic"
+} TraceHeader;
+
+/**
+ * @brief Creates the trace file with one ring per worker and maps it shared.
+ * Master, before forking. Picks the TSC when it is invariant, otherwise
+ * CLOCK_MONOTONIC.
+ * @param percent Percentage of requests to keep (1-100); 0 leaves tracing off.
+ * @param max_workers Number of rings.
+ * @return 0 on success, -1 on failure.
+ */
+int trace_init(unsigned int percent, int max_workers);
+
+/**
+ * @brief Worker: selects its ring.
+ * @param worker The worker index.
+ */
+void trace_worker_start(int worker);
+
+/**
+ * @brief Reads the trace clock.
+ * @return clock ticks, or 0 when tracing is off.
+ */
+uint64_t trace_clock(void);
+
+/**
+ * @brief Worker: notes that a phase ran from start until now. Phases are
+ * held until trace_request_end decides whether the request is sampled.
+ * @param phase The phase.
+ * @param start trace_clock() when the phase began.
+ */
+void trace_phase(TracePhase phase, uint64_t start);
+
+/**
+ * @brief Worker: the responses for the held phases were sent. A sampled
+ * request's phases are copied into the ring; otherwise they are dropped.
+ * Pipelined requests sent together are traced as one request.
+ * @param status The status of the last response sent.
+ * @param count The number of responses sent.
+ */
+void trace_request_end(int status, uint32_t count);
+
+/**
+ * @brief Worker: drops held phases, e.g. when a connection closes without
+ * another request.
+ */
+void trace_discard(void);
+
+/**
+ * @brief Returns the printable name of a phase.
+ * @param phase The phase.
+ * @return the name
+ */
+const char *trace_phase_name(int phase);
+
+#endif    // TRACE_H
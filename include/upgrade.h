@@ -0,0 +1,39 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+// Set in the new master's environment: the Unix socket it receives the
+// listening socket and shared regions on, and reports readiness over
+#define UPGRADE_FD_ENV "APP_UPGRADE_FD"
+
+// systemd-style socket activation: LISTEN_FDS sockets starting at fd 3
+#define LISTEN_FDS_START 3
+
+// How long the old master waits for the new one to report ready
+#define UPGRADE_READY_TIMEOUT_MS 30000
+
+/**
+ * @brief New master: returns a listening socket handed over by the old master
+ * (APP_UPGRADE_FD) or by the service manager (LISTEN_FDS/LISTEN_PID). Shared
+ * regions that came with it are adopted for shared_memory_attach, so call
+ * this before creating shared state.
+ * @return the listening socket, or -1 if there is none and the caller must bind.
+ */
+int upgrade_inherited_listener(void);
+
+/**
+ * @brief New master: tells the old master that workers are running, so it
+ * can start draining. Does nothing when not started by an upgrade.
+ */
+void upgrade_notify_ready(void);
+
+/**
+ * @brief Old master: re-executes the binary at the path this process was
+ * started from (picking up a replaced file), hands it the listening socket
+ * and the shared regions, and waits for it to report ready.
+ * @param listen_fd The listening socket.
+ * @return 0 once the new master is ready (the caller should drain and exit),
+ *         -1 if it failed (the caller keeps serving).
+ */
+int upgrade_start(int listen_fd);
+
+#endif    // UPGRADE_H
@@ -2,10 +2,26 @@
 #define RESPONSE_H
 
 #include "../include/httpRequest.h"
+#include "../include/httpResponse.h"
+#include <stdbool.h>
 
-int head_req_response(int client_socket, const char *filePath);
-int get_req_response(int client_socket, const char *filePath);
+int head_req_response(HTTPResponse *response, const char *filePath);
+int get_req_response(HTTPResponse *response, const char *filePath);
 int checkIfRoot(const char *filePath, char *verified_path);
-int handle_post_request(int client_socket, const HTTPRequest *request, const char *body);
+int handle_post_request(HTTPResponse *response, const HTTPRequest *request, const char *body);
+
+// Read API for stored POST entries: /entries/<id> and /entries?since=&limit=
+bool is_entries_path(const char *path);
+int  get_entries_response(HTTPResponse *response, const char *path);
+
+// Admin endpoints, served to loopback clients only
+bool is_loopback_client(int client_socket);
+int  admin_snapshot_response(HTTPResponse *response, const HTTPRequest *request);
+int  admin_shadow_response(HTTPResponse *response, const HTTPRequest *request);
+int  admin_shadow_promote_response(HTTPResponse *response, const HTTPRequest *request);
+int  admin_profile_start_response(HTTPResponse *response, const HTTPRequest *request);
+int  admin_profile_response(HTTPResponse *response, const HTTPRequest *request);
+int  server_status_response(HTTPResponse *response, const HTTPRequest *request);
+int  metrics_response(HTTPResponse *response, const HTTPRequest *request);
 
 #endif
@@ -0,0 +1,261 @@
+#!/usr/bin/env bash
+
+# Scaling benchmark: starts app on loopback once per server mode and worker
+# count, drives it with the built-in load generator (-t client) through each
+# scenario, and records throughput, latency percentiles, server CPU and RSS.
+# The report shows, per mode and scenario, how throughput grows with workers
+# and where it stops growing.
+#
+# Run it from the build directory, like app itself:
+#
+#     ../scripts/scaling.sh -w "1 2 4 8" -s "get head post large" -m "log:-l /tmp/scaling.log"
+#
+# The client runs on the same machine and competes with the server for CPU;
+# give it threads (-t) but leave cores for the workers. The post scenario
+# adds entries to ../data/db/post_data.db.
+
+set -e
+
+app="./app"
+workers="1 2 4"
+scenarios="get head post large"
+modes=()
+seconds=10
+connections=64
+threads=2
+port=18080
+large_mb=1
+output=""
+
+usage()
+{
+    echo "Usage: $0 [-a app] [-w \"1 2 4\"] [-s \"get head post large\"] [-m name:flags]... [-d seconds] [-c connections] [-t threads] [-p port] [-L large_mb] [-o dir]"
+    echo "  -a app          Server binary (default ./app)"
+    echo "  -w workers      Worker counts to try"
+    echo "  -s scenarios    Any of get, head, post, large"
+    echo "  -m name:flags   A server mode: a name and extra server flags; repeat for more (default prefork:)"
+    echo "  -d seconds      Length of each run (default 10)"
+    echo "  -c connections  Client connections (default 64)"
+    echo "  -t threads      Client threads (default 2)"
+    echo "  -p port         Port the server listens on (default 18080)"
+    echo "  -L large_mb     Size of the file the large scenario fetches (default 1)"
+    echo "  -o dir          Where results go (default scaling-<time>)"
+    exit 1
+}
+
+while getopts ":a:w:s:m:d:c:t:p:L:o:" opt; do
+  case $opt in
+    a)
+      app="$OPTARG"
+      ;;
+    w)
+      workers="$OPTARG"
+      ;;
+    s)
+      scenarios="$OPTARG"
+      ;;
+    m)
+      modes+=("$OPTARG")
+      ;;
+    d)
+      seconds="$OPTARG"
+      ;;
+    c)
+      connections="$OPTARG"
+      ;;
+    t)
+      threads="$OPTARG"
+      ;;
+    p)
+      port="$OPTARG"
+      ;;
+    L)
+      large_mb="$OPTARG"
+      ;;
+    o)
+      output="$OPTARG"
+      ;;
+    \?)
+      echo "Invalid option: -$OPTARG" >&2
+      usage
+      ;;
+    :)
+      echo "Option -$OPTARG requires an argument." >&2
+      usage
+      ;;
+  esac
+done
+
+if [ ${#modes[@]} -eq 0 ]; then
+    modes=("prefork:")
+fi
+if [ -z "$output" ]; then
+    output="scaling-$(date +%Y%m%d-%H%M%S)"
+fi
+if [ ! -x "$app" ]; then
+    echo "No server binary at $app; run from the build directory or pass -a" >&2
+    exit 1
+fi
+
+mkdir -p "$output"
+large_file="../data/scaling-large.bin"
+server_pid=""
+
+cleanup()
+{
+    if [ -n "$server_pid" ]; then
+        kill -TERM "$server_pid" 2>/dev/null || true
+        wait "$server_pid" 2>/dev/null || true
+    fi
+    rm -f "$large_file"
+}
+trap cleanup EXIT
+
+# The large scenario fetches a file of its own next to index.html
+if [[ " $scenarios " == *" large "* ]]; then
+    head -c "$((large_mb * 1024 * 1024))" /dev/zero | tr '\0' 'x' > "$large_file"
+fi
+
+# Client flags of a scenario
+scenario_flags()
+{
+    case $1 in
+      get)
+        echo "-M get:1 -u /index.html"
+        ;;
+      head)
+        echo "-M head:1 -u /index.html"
+        ;;
+      post)
+        echo "-M post:1 -u /submit -b 64"
+        ;;
+      large)
+        echo "-M get:1 -u /scaling-large.bin"
+        ;;
+      *)
+        echo "Unknown scenario: $1" >&2
+        exit 1
+        ;;
+    esac
+}
+
+# A number from the client's JSON, e.g. json_field run.json throughput
+json_field()
+{
+    sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p" "$1"
+}
+
+# CPU ticks of the server so far: the master, the workers it has reaped and
+# the ones still running
+server_ticks()
+{
+    local total=0
+    local pid
+
+    read -r -a fields < "/proc/$server_pid/stat"
+    total=$((fields[13] + fields[14] + fields[15] + fields[16]))
+    for pid in $(pgrep -P "$server_pid"); do
+        if read -r -a fields < "/proc/$pid/stat" 2>/dev/null; then
+            total=$((total + fields[13] + fields[14]))
+        fi
+    done
+    echo "$total"
+}
+
+# Peak resident set of the master and its live workers, in MB
+server_rss_mb()
+{
+    local total=0
+    local pid
+    local kb
+
+    for pid in "$server_pid" $(pgrep -P "$server_pid"); do
+        kb=$(sed -n 's/^VmHWM:[[:space:]]*\([0-9]*\) kB/\1/p' "/proc/$pid/status" 2>/dev/null)
+        total=$((total + ${kb:-0}))
+    done
+    echo $((total / 1024))
+}
+
+wait_for_port()
+{
+    for _ in $(seq 1 50); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+ticks_per_second=$(getconf CLK_TCK)
+csv="$output/results.csv"
+echo "mode,workers,scenario,requests_per_sec,p50_us,p99_us,p99_9_us,errors,non_2xx,server_cpu_cores,server_rss_mb" > "$csv"
+
+for mode in "${modes[@]}"; do
+    name="${mode%%:*}"
+    flags="${mode#*:}"
+
+    for count in $workers; do
+        echo "== $name, $count workers"
+        # shellcheck disable=SC2086 # flags holds several server arguments
+        "$app" -t server -i 127.0.0.1 -p "$port" -w "$count" $flags > "$output/server-$name-$count.log" 2>&1 &
+        server_pid=$!
+        if ! wait_for_port; then
+            echo "Server did not start; see $output/server-$name-$count.log" >&2
+            exit 1
+        fi
+
+        for scenario in $scenarios; do
+            run="$output/$name-$count-$scenario"
+            before=$(server_ticks)
+
+            # shellcheck disable=SC2046 # the scenario's flags are separate arguments
+            "$app" -t client -i 127.0.0.1 -p "$port" -C "$connections" -T "$threads" -D "$seconds" $(scenario_flags "$scenario") -j "$run.json" > "$run.txt"
+
+            after=$(server_ticks)
+            rss=$(server_rss_mb)
+            elapsed=$(json_field "$run.json" seconds)
+            cores=$(awk -v t="$((after - before))" -v hz="$ticks_per_second" -v s="$elapsed" 'BEGIN { printf "%.2f", t / hz / s }')
+            errors=$(($(json_field "$run.json" connect) + $(json_field "$run.json" read) + $(json_field "$run.json" write)))
+            non_2xx=$(($(json_field "$run.json" 1xx) + $(json_field "$run.json" 3xx) + $(json_field "$run.json" 4xx) + $(json_field "$run.json" 5xx)))
+
+            echo "$name,$count,$scenario,$(json_field "$run.json" throughput),$(json_field "$run.json" p50),$(json_field "$run.json" p99),$(json_field "$run.json" p99.9),$errors,$non_2xx,$cores,$rss" >> "$csv"
+            printf "   %-6s %10s req/s  p99 %8s us  cpu %5s cores  rss %4s MB\n" "$scenario" "$(json_field "$run.json" throughput)" "$(json_field "$run.json" p99)" "$cores" "$rss"
+        done
+
+        kill -TERM "$server_pid"
+        wait "$server_pid" 2>/dev/null || true
+        server_pid=""
+        if grep -q "killed by signal" "$output/server-$name-$count.log"; then
+            echo "   warning: workers were killed during the runs; see $output/server-$name-$count.log" >&2
+        fi
+    done
+done
+
+# Scaling curve: speedup over the smallest worker count and efficiency
+# (speedup per added worker); the knee is the first step that adds < 10%
+{
+    echo "$(nproc) CPUs shared by server and client; $connections connections, $threads client threads, ${seconds}s per run"
+    echo
+    awk -F, '
+NR == 1 { next }
+{
+    key = $1 " / " $3
+    if(!(key in base)) { base[key] = $4; baseWorkers[key] = $2; order[++keys] = key }
+    rows[key] = rows[key] sprintf("  %7d workers  %12.1f req/s  x%5.2f  efficiency %3.0f%%  p99 %9.1f us  cpu %5.2f  rss %5d MB\n",
+                                  $2, $4, $4 / base[key], 100 * ($4 / base[key]) / ($2 / baseWorkers[key]), $6, $10, $11)
+    if((key in last) && !(key in knee) && $4 < last[key] * 1.1) { knee[key] = lastWorkers[key] }
+    last[key] = $4; lastWorkers[key] = $2
+}
+END {
+    for(i = 1; i <= keys; i++)
+    {
+        key = order[i]
+        printf "%s\n%s", key, rows[key]
+        if(key in knee) { printf "  stops scaling after %d workers\n\n", knee[key] }
+        else { printf "  still scaling at the largest worker count\n\n" }
+    }
+}' "$csv"
+} | tee "$output/report.txt"
+
+echo "Results in $output (results.csv, report.txt, per-run JSON)"
@@ -0,0 +1,525 @@
+#include "../include/accessLog.h"
+#include "../include/sharedMemory.h"
+#include "../include/sigintHandler.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MICROSECOND 1000
+#define BYTES_PER_MB (1024 * 1024)
+#define CACHE_LINE 64
+#define LOGGER_IDLE_NS 10000000L    // how long the logger sleeps when every ring is empty
+#define LOGGER_BUFFER_SIZE 65536
+#define LOG_LINE_MAX 1024
+#define ROTATED_PATH_MAX 4096
+
+/*
+ * Single producer (the worker), single consumer (the logger). head and tail
+ * only ever grow; they sit on their own cache lines so the two sides do not
+ * bounce one line between cores on every record.
+ */
+typedef struct
+{
+    _Alignas(CACHE_LINE) _Atomic(uint64_t) head;
+    _Alignas(CACHE_LINE) _Atomic(uint64_t) tail;
+    _Atomic(uint64_t) dropped;
+    AccessRecord      records[ACCESS_LOG_RING_RECORDS];
+} AccessRing;
+
+typedef struct
+{
+    char           *path;
+    AccessLogFormat format;
+    size_t          rotateBytes;
+    int             fd;
+    size_t          size;
+    char            buffer[LOGGER_BUFFER_SIZE];
+    size_t          used;
+} Logger;
+
+static AccessRing *access_rings     = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int         access_num_rings = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static pid_t       logger_pid       = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static AccessRing *own_ring         = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// What the master needs to start the logger again
+static char           *logger_path         = NULL;                 // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static AccessLogFormat logger_format       = ACCESS_LOG_COMMON;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static size_t          logger_rotate_bytes = 0;                    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Set by the logger's signal handlers
+static volatile sig_atomic_t logger_stopping  = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static volatile sig_atomic_t logger_reopening = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static const char *const format_names[] = {"common", "combined", "json"};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+int access_log_parse_format(const char *name)
+{
+    for(size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++)
+    {
+        if(strcmp(name, format_names[i]) == 0)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void access_log_worker_start(int worker)
+{
+    if(access_rings && worker >= 0 && worker < access_num_rings)
+    {
+        own_ring = &access_rings[worker];
+    }
+}
+
+bool access_log_enabled(void)
+{
+    return own_ring != NULL;
+}
+
+void access_log_set(char *field, size_t size, const char *value, size_t length)
+{
+    if(!value)
+    {
+        field[0] = '\0';
+        return;
+    }
+    if(length >= size)
+    {
+        length = size - 1;
+    }
+    memcpy(field, value, length);
+    field[length] = '\0';
+}
+
+void access_log_begin(AccessRecord *record, const char *request_line, size_t line_length, const struct sockaddr_in *peer)
+{
+    record->timeNs      = clock_ns(CLOCK_REALTIME);
+    record->startNs     = clock_ns(CLOCK_MONOTONIC);
+    record->peerAddress = peer->sin_addr.s_addr;
+    record->pid         = getpid();
+    access_log_set(record->request, sizeof(record->request), request_line, line_length);
+    record->referer[0] = '\0';
+    record->agent[0]   = '\0';
+}
+
+void access_log_commit(AccessRecord *record, const HTTPResponse *response)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    if(!own_ring)
+    {
+        return;
+    }
+
+    record->status     = (uint16_t)(response->failed ? INTERNAL_SERVER_ERROR_STATUS : response->status);
+    record->bytes      = response->head.length + (response->headOnly ? 0 : response->body.length);
+    record->durationUs = (uint32_t)((clock_ns(CLOCK_MONOTONIC) - record->startNs) / NANOSECONDS_PER_MICROSECOND);
+
+    // Full: the request has been served, only its log line is lost
+    head = atomic_load_explicit(&own_ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&own_ring->tail, memory_order_acquire);
+    if(head - tail >= ACCESS_LOG_RING_RECORDS)
+    {
+        atomic_fetch_add_explicit(&own_ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    own_ring->records[head & (ACCESS_LOG_RING_RECORDS - 1)] = *record;
+    atomic_store_explicit(&own_ring->head, head + 1, memory_order_release);
+}
+
+uint64_t access_log_dropped(void)
+{
+    uint64_t dropped = 0;
+
+    for(int i = 0; access_rings && i < access_num_rings; i++)
+    {
+        dropped += atomic_load_explicit(&access_rings[i].dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
+
+/*
+ * Copies text into a quoted field. Common/Combined escape quotes and
+ * backslashes with a backslash, JSON additionally needs control characters
+ * escaped. Returns the number of bytes written.
+ */
+static size_t quote(char *out, size_t size, const char *text, bool json)
+{
+    size_t length = 0;
+
+    for(const unsigned char *c = (const unsigned char *)text; *c && length + 7 < size; c++)
+    {
+        if(*c == '"' || *c == '\\')
+        {
+            out[length++] = '\\';
+            out[length++] = (char)*c;
+        }
+        else if(*c < ' ')
+        {
+            length += (size_t)snprintf(out + length, size - length, json ? "\\u%04x" : "\\x%02x", *c);
+        }
+        else
+        {
+            out[length++] = (char)*c;
+        }
+    }
+    out[length] = '\0';
+    return length;
+}
+
+/*
+ * Formats one record as a line, without the trailing newline.
+ */
+static int format_record(const Logger *logger, const AccessRecord *record, char *line, size_t size)
+{
+    char      address[INET_ADDRSTRLEN];
+    char      when[64];
+    char      request[ACCESS_LOG_REQUEST_MAX * 2];
+    char      referer[ACCESS_LOG_HEADER_MAX * 2];
+    char      agent[ACCESS_LOG_HEADER_MAX * 2];
+    struct tm local;
+    time_t    seconds = (time_t)(record->timeNs / NANOSECONDS_PER_SECOND);
+    bool      json    = logger->format == ACCESS_LOG_JSON;
+
+    inet_ntop(AF_INET, &record->peerAddress, address, sizeof(address));
+    quote(request, sizeof(request), record->request[0] ? record->request : "-", json);
+    quote(referer, sizeof(referer), record->referer[0] ? record->referer : "-", json);
+    quote(agent, sizeof(agent), record->agent[0] ? record->agent : "-", json);
+
+    if(json)
+    {
+        gmtime_r(&seconds, &local);
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &local);
+        return snprintf(line,
+                        size,
+                        "{\"time\":\"%s.%06uZ\",\"remote\":\"%s\",\"pid\":%d,\"request\":\"%s\",\"status\":%u,\"bytes\":%llu,\"duration_us\":%u,\"referer\":\"%s\",\"agent\":\"%s\"}",
+                        when,
+                        (unsigned int)(record->timeNs % NANOSECONDS_PER_SECOND / NANOSECONDS_PER_MICROSECOND),
+                        address,
+                        record->pid,
+                        request,
+                        record->status,
+                        (unsigned long long)record->bytes,
+                        record->durationUs,
+                        referer,
+                        agent);
+    }
+
+    localtime_r(&seconds, &local);
+    strftime(when, sizeof(when), "%d/%b/%Y:%H:%M:%S %z", &local);
+    if(logger->format == ACCESS_LOG_COMBINED)
+    {
+        return snprintf(line, size, "%s - - [%s] \"%s\" %u %llu \"%s\" \"%s\"", address, when, request, record->status, (unsigned long long)record->bytes, referer, agent);
+    }
+    return snprintf(line, size, "%s - - [%s] \"%s\" %u %llu", address, when, request, record->status, (unsigned long long)record->bytes);
+}
+
+static void logger_flush(Logger *logger)
+{
+    size_t written = 0;
+
+    while(written < logger->used)
+    {
+        ssize_t result = write(logger->fd, logger->buffer + written, logger->used - written);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("access log write");
+            break;
+        }
+        written += (size_t)result;
+    }
+    logger->size += written;
+    logger->used = 0;
+}
+
+static int logger_open(Logger *logger)
+{
+    struct stat info;
+
+    logger->fd = open(logger->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(logger->fd < 0)
+    {
+        perror(logger->path);
+        return -1;
+    }
+    logger->size = fstat(logger->fd, &info) == 0 ? (size_t)info.st_size : 0;
+    return 0;
+}
+
+/*
+ * path.4 -> path.5, ..., path -> path.1, then a fresh path. The oldest file
+ * is overwritten by the rename.
+ */
+static void logger_rotate(Logger *logger)
+{
+    char from[ROTATED_PATH_MAX];
+    char to[ROTATED_PATH_MAX];
+
+    logger_flush(logger);
+    close(logger->fd);
+
+    for(int i = ACCESS_LOG_KEEP - 1; i >= 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", logger->path, i);
+        snprintf(to, sizeof(to), "%s.%d", logger->path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", logger->path);
+    rename(logger->path, to);
+
+    logger_open(logger);
+}
+
+/*
+ * Formats everything queued in every ring. Returns the number of records.
+ */
+static size_t logger_drain(Logger *logger)
+{
+    size_t drained = 0;
+
+    for(int i = 0; i < access_num_rings; i++)
+    {
+        AccessRing *ring = &access_rings[i];
+        uint64_t    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for(; tail < head; tail++)
+        {
+            int length;
+
+            if(logger->used + LOG_LINE_MAX > sizeof(logger->buffer))
+            {
+                logger_flush(logger);
+            }
+            length = format_record(logger, &ring->records[tail & (ACCESS_LOG_RING_RECORDS - 1)], logger->buffer + logger->used, LOG_LINE_MAX - 1);
+            if(length > 0)
+            {
+                logger->used += (size_t)length < LOG_LINE_MAX - 1 ? (size_t)length : LOG_LINE_MAX - 2;
+                logger->buffer[logger->used++] = '\n';
+            }
+            drained++;
+        }
+
+        // Hand the slots back only once they are formatted
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    logger_flush(logger);
+    if(logger->rotateBytes > 0 && logger->size >= logger->rotateBytes)
+    {
+        logger_rotate(logger);
+    }
+    return drained;
+}
+
+static void loggerStopHandler(int sig_num)
+{
+    (void)sig_num;
+    logger_stopping = 1;
+}
+
+static void loggerReopenHandler(int sig_num)
+{
+    (void)sig_num;
+    logger_reopening = 1;
+}
+
+/*
+ * Body of the logger process. SIGHUP reopens the file (after an external
+ * rotation), SIGTERM writes out what is queued and exits; SIGINT from the
+ * terminal is left to the master, which stops the logger after the drain.
+ */
+static void run_logger(Logger *logger)
+{
+    struct sigaction sa;
+    sigset_t         none;
+    struct timespec  idle     = {0, LOGGER_IDLE_NS};
+    uint64_t         reported = 0;
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    memset(&sa, 0, sizeof(sa));
+    set_sigaction_handler(&sa, loggerStopHandler);
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+
+    set_sigaction_handler(&sa, loggerReopenHandler);
+    sigaction(SIGHUP, &sa, NULL);
+
+    set_sigaction_handler(&sa, SIG_IGN);
+    sigaction(SIGINT, &sa, NULL);
+
+    // A logger restarted by the supervisor inherits its blocked signals
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    while(!logger_stopping)
+    {
+        uint64_t dropped;
+
+        if(logger_reopening)
+        {
+            logger_reopening = 0;
+            logger_flush(logger);
+            close(logger->fd);
+            logger_open(logger);
+        }
+
+        if(logger_drain(logger) == 0)
+        {
+            nanosleep(&idle, NULL);
+        }
+
+        dropped = access_log_dropped();
+        if(dropped != reported)
+        {
+            fprintf(stderr, "[Logger] %llu access log records dropped so far\n", (unsigned long long)dropped);
+            reported = dropped;
+        }
+    }
+
+    logger_drain(logger);
+    close(logger->fd);
+    _exit(EXIT_SUCCESS);
+}
+
+/*
+ * Forks the logger with the file open. The master keeps only the rings, for
+ * access_log_dropped.
+ */
+static int start_logger(void)
+{
+    Logger *logger = (Logger *)malloc(sizeof(Logger));
+
+    if(!logger)
+    {
+        return -1;
+    }
+    memset(logger, 0, sizeof(*logger));
+    logger->path        = logger_path;
+    logger->format      = logger_format;
+    logger->rotateBytes = logger_rotate_bytes;
+    if(logger_open(logger) != 0)
+    {
+        free(logger);
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    logger_pid = fork();
+    if(logger_pid < 0)
+    {
+        perror("fork failed");
+        logger_pid = 0;
+        close(logger->fd);
+        free(logger);
+        return -1;
+    }
+    if(logger_pid == 0)
+    {
+        run_logger(logger);
+    }
+
+    close(logger->fd);
+    free(logger);
+    return 0;
+}
+
+int access_log_init(const char *path, AccessLogFormat format, size_t rotate_mb, int max_workers)
+{
+    if(!path)
+    {
+        return 0;
+    }
+
+    access_rings = (AccessRing *)shared_memory_create(sizeof(AccessRing) * (size_t)max_workers);
+    if(!access_rings)
+    {
+        return -1;
+    }
+    access_num_rings = max_workers;
+
+    logger_path         = strdup(path);
+    logger_format       = format;
+    logger_rotate_bytes = rotate_mb * BYTES_PER_MB;
+    if(!logger_path || start_logger() != 0)
+    {
+        free(logger_path);
+        logger_path = NULL;
+        return -1;
+    }
+
+    printf("Access log %s (%s) written by logger %d\n", path, format_names[format], logger_pid);
+    return 0;
+}
+
+bool access_log_reap(pid_t pid, int status)
+{
+    if(logger_pid <= 0 || pid != logger_pid)
+    {
+        return false;
+    }
+
+    if(WIFSIGNALED(status))
+    {
+        printf("[Parent] Logger (PID %d) killed by signal %d (%s)\n", pid, WTERMSIG(status), strsignal(WTERMSIG(status)));
+    }
+    else
+    {
+        printf("[Parent] Logger (PID %d) exited with status %d\n", pid, WEXITSTATUS(status));
+    }
+
+    // The rings keep their tails, so the new logger carries on where this one stopped
+    logger_pid = 0;
+    if(start_logger() == 0)
+    {
+        printf("[Logger] Restarted with PID %d\n", logger_pid);
+    }
+    return true;
+}
+
+void access_log_reopen(void)
+{
+    if(logger_pid > 0)
+    {
+        kill(logger_pid, SIGHUP);
+    }
+}
+
+void access_log_stop(void)
+{
+    if(logger_pid > 0)
+    {
+        kill(logger_pid, SIGTERM);
+        waitpid(logger_pid, NULL, 0);
+        logger_pid = 0;
+    }
+}
@@ -0,0 +1,460 @@
+/*******************************************************************************
+ * bench: microbenchmarks for the parser, string and storage primitives
+ *
+ * Each benchmark is warmed up, then timed over several repetitions of a
+ * batch sized to take about --time-ms; the median repetition is reported as
+ * ns/op with allocations and allocated bytes per op and throughput. malloc,
+ * calloc and realloc are interposed to count allocations, so allocs/op covers
+ * libc's own (strdup, strndup, gdbm). --json writes the same numbers for
+ * diffing between commits; --filter runs the benchmarks whose name contains
+ * the given text.
+ *
+ * The storage benchmarks use a database in a fresh temporary directory.
+ ******************************************************************************/
+
+#include "../include/db.h"
+#include "../include/httpRequest.h"
+#include "../include/server.h"
+#include "../include/stringTools.h"
+#include "../include/utils.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic ignored "-Waggregate-return"
+
+#define USAGE "Usage: %s [--json path] [--filter text] [--time-ms N]\n"
+#define DECIMAL_BASE 10
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MILLISECOND 1000000ULL
+#define BYTES_PER_MEGABYTE (1024 * 1024)
+#define DEFAULT_TIME_MS 200
+#define WARMUP_MS 100
+#define REPETITIONS 7
+#define MAX_BENCHMARKS 16
+#define PATH_LENGTH 256
+#define KEY_LENGTH 32
+#define PRELOADED_ENTRIES 1000
+
+// glibc's allocator, under the names it keeps for interposers like this one
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void  __libc_free(void *pointer);
+
+typedef struct
+{
+    const char *name;
+    size_t      bytes;    // input bytes per op for MB/s, 0 when it means nothing
+    int (*setup)(void);
+    void (*run)(size_t iterations);
+} Benchmark;
+
+typedef struct
+{
+    const char *name;
+    size_t      iterations;    // per repetition
+    double      nsPerOp;       // median repetition
+    double      nsPerOpMin;
+    double      allocsPerOp;
+    double      bytesPerOp;
+    double      mbPerSecond;
+} BenchResult;
+
+static uint64_t bench_allocs    = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint64_t bench_allocated = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static char     bench_dir[PATH_LENGTH];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static char     bench_db[PATH_LENGTH * 2];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static DBO      read_dbo;                  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static size_t   sink;                      // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+void *malloc(size_t size)
+{
+    bench_allocs++;
+    bench_allocated += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    bench_allocs++;
+    bench_allocated += count * size;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    bench_allocs++;
+    bench_allocated += size;
+    return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer)
+{
+    __libc_free(pointer);
+}
+
+static const char request_head[] = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:8000\r\nConnection: keep-alive\r\n"
+                                   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                                   "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n\r\n";
+static const char request_line[] = "GET /index.html HTTP/1.1";
+static const char form_body[]    = "name=Kiet+Ngo&email=kiet%40example.com&message=hello+world&key1=kiet&key2=ngo";
+
+static void bench_tokenize_string(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        StringArray tokens = tokenizeString(request_head, "\r\n");
+
+        sink += tokens.numStrings;
+        freeStringArray(&tokens);
+    }
+}
+
+static void bench_get_first_token(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        TokenAndStr first = getFirstToken(request_line, " ");
+
+        sink += first.token ? (size_t)first.token[0] : 0;
+        free(first.originalStr);
+    }
+}
+
+static void bench_parse_request(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        HTTPRequest *request = initializeHTTPRequestFromString(request_line);
+
+        sink += strlen(request->path);
+        free(request->method);
+        free(request->path);
+        free(request->protocol);
+        free(request->body);
+        free(request);
+    }
+}
+
+static void bench_parse_key_value_body(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        StringArray pairs = parseKeyValueBody(form_body);
+
+        sink += pairs.numStrings;
+        freeStringArray(&pairs);
+    }
+}
+
+static void bench_add_character_to_start(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        char *path = addCharacterToStart("index.html", "../data/");
+
+        sink += path ? (size_t)path[0] : 0;
+        free(path);
+    }
+}
+
+// What a GET or HEAD does to turn the request path into a file path
+static void bench_static_path(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        char  verified[BUFFER_SIZE];
+        char *path;
+
+        sink += is_entries_path("/index.html") ? 1 : 0;
+        checkIfRoot("/index.html", verified);
+        path = addCharacterToStart(verified, "../data/");
+        sink += path ? strlen(path) : 0;
+        free(path);
+    }
+}
+
+static void bench_store_post_entry(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        DBO dbo;
+
+        dbo.name = bench_db;
+        dbo.db   = NULL;
+        if(store_post_entry(&dbo, form_body, POST_PK_NAME) != 0)
+        {
+            fprintf(stderr, "store_post_entry failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void bench_retrieve_byte(size_t iterations)
+{
+    for(size_t i = 0; i < iterations; i++)
+    {
+        char  key[KEY_LENGTH];
+        void *record;
+
+        format_entry_key(key, sizeof(key), (int)(i % PRELOADED_ENTRIES));
+        record = retrieve_byte(read_dbo.db, key, strlen(key) + 1);
+        sink += record ? 1 : 0;
+        free(record);
+    }
+}
+
+static int setup_database(void)
+{
+    if(bench_db[0] != '\0')
+    {
+        return 0;
+    }
+
+    snprintf(bench_dir, sizeof(bench_dir), "/tmp/bench-XXXXXX");
+    if(!mkdtemp(bench_dir))
+    {
+        perror("mkdtemp");
+        return -1;
+    }
+    snprintf(bench_db, sizeof(bench_db), "%s/post_data.db", bench_dir);
+    return 0;
+}
+
+// retrieve_byte reads from a database that already holds some entries
+static int setup_read_database(void)
+{
+    DBO dbo;
+
+    if(setup_database() != 0)
+    {
+        return -1;
+    }
+    for(int i = 0; i < PRELOADED_ENTRIES; i++)
+    {
+        dbo.name = bench_db;
+        dbo.db   = NULL;
+        if(store_post_entry(&dbo, form_body, POST_PK_NAME) != 0)
+        {
+            return -1;
+        }
+    }
+
+    read_dbo.name = bench_db;
+    read_dbo.db   = NULL;
+    return database_open_readonly(&read_dbo) < 0 ? -1 : 0;
+}
+
+static void remove_database(void)
+{
+    DIR                 *dir;
+    const struct dirent *entry;
+
+    if(read_dbo.db)
+    {
+        dbm_close(read_dbo.db);
+    }
+    if(bench_dir[0] == '\0' || !(dir = opendir(bench_dir)))
+    {
+        return;
+    }
+    while((entry = readdir(dir)) != NULL)
+    {
+        char path[PATH_LENGTH * 2];
+
+        if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        {
+            snprintf(path, sizeof(path), "%s/%s", bench_dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    rmdir(bench_dir);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double left  = *(const double *)a;
+    double right = *(const double *)b;
+
+    return (left > right) - (left < right);
+}
+
+/*
+ * Doubles the batch until it runs long enough to time, keeps running for the
+ * warm-up period, then sizes the batch to the target time.
+ */
+static void run_benchmark(const Benchmark *benchmark, uint64_t target_ns, BenchResult *result)
+{
+    double   samples[REPETITIONS];
+    size_t   iterations = 1;
+    uint64_t elapsed    = 0;
+    uint64_t warm_until = monotonic_ns() + WARMUP_MS * NANOSECONDS_PER_MILLISECOND;
+    uint64_t allocs;
+    uint64_t allocated;
+
+    while(monotonic_ns() < warm_until || elapsed < NANOSECONDS_PER_MILLISECOND)
+    {
+        uint64_t start = monotonic_ns();
+
+        benchmark->run(iterations);
+        elapsed = monotonic_ns() - start;
+        if(elapsed < NANOSECONDS_PER_MILLISECOND)
+        {
+            iterations *= 2;
+        }
+    }
+    iterations = (size_t)((double)iterations * (double)target_ns / (double)elapsed);
+    if(iterations == 0)
+    {
+        iterations = 1;
+    }
+
+    allocs    = bench_allocs;
+    allocated = bench_allocated;
+    for(int r = 0; r < REPETITIONS; r++)
+    {
+        uint64_t start = monotonic_ns();
+
+        benchmark->run(iterations);
+        samples[r] = (double)(monotonic_ns() - start) / (double)iterations;
+    }
+    allocs    = bench_allocs - allocs;
+    allocated = bench_allocated - allocated;
+    qsort(samples, REPETITIONS, sizeof(double), compare_doubles);
+
+    result->name        = benchmark->name;
+    result->iterations  = iterations;
+    result->nsPerOp     = samples[REPETITIONS / 2];
+    result->nsPerOpMin  = samples[0];
+    result->allocsPerOp = (double)allocs / (double)(iterations * REPETITIONS);
+    result->bytesPerOp  = (double)allocated / (double)(iterations * REPETITIONS);
+    result->mbPerSecond = benchmark->bytes ? (double)benchmark->bytes / result->nsPerOp * (double)NANOSECONDS_PER_SECOND / BYTES_PER_MEGABYTE : 0;
+}
+
+static int write_json(const char *path, const BenchResult *results, size_t count)
+{
+    FILE *file = fopen(path, "we");
+
+    if(!file)
+    {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(file, "{\"benchmarks\":[");
+    for(size_t i = 0; i < count; i++)
+    {
+        const BenchResult *result = &results[i];
+
+        fprintf(file,
+                "%s\n  {\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,\"ops_per_sec\":%.0f,"
+                "\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.1f,\"mb_per_sec\":%.1f}",
+                i ? "," : "",
+                result->name,
+                result->iterations,
+                result->nsPerOp,
+                result->nsPerOpMin,
+                (double)NANOSECONDS_PER_SECOND / result->nsPerOp,
+                result->allocsPerOp,
+                result->bytesPerOp,
+                result->mbPerSecond);
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        {"json",    required_argument, NULL, 'j'},
+        {"filter",  required_argument, NULL, 'f'},
+        {"time-ms", required_argument, NULL, 't'},
+        {NULL,      0,                 NULL, 0  }
+    };
+    static const Benchmark benchmarks[] = {
+        {"tokenizeString",                 sizeof(request_head) - 1, NULL,                bench_tokenize_string        },
+        {"getFirstToken",                  sizeof(request_line) - 1, NULL,                bench_get_first_token        },
+        {"initializeHTTPRequestFromString", sizeof(request_line) - 1, NULL,                bench_parse_request          },
+        {"parseKeyValueBody",              sizeof(form_body) - 1,    NULL,                bench_parse_key_value_body   },
+        {"addCharacterToStart",            0,                        NULL,                bench_add_character_to_start },
+        {"static_path_lookup",             0,                        NULL,                bench_static_path            },
+        {"store_post_entry",               sizeof(form_body) - 1,    setup_database,      bench_store_post_entry       },
+        {"retrieve_byte",                  0,                        setup_read_database, bench_retrieve_byte          },
+    };
+    BenchResult results[MAX_BENCHMARKS];
+    const char *json      = NULL;
+    const char *filter    = NULL;
+    uint64_t    target_ns = DEFAULT_TIME_MS * NANOSECONDS_PER_MILLISECOND;
+    size_t      count     = 0;
+    int         status    = EXIT_SUCCESS;
+    int         opt;
+
+    while((opt = getopt_long(argc, argv, "j:f:t:", longOptions, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'j':
+                json = optarg;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                target_ns = strtoull(optarg, NULL, DECIMAL_BASE) * NANOSECONDS_PER_MILLISECOND;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-32s %12s %12s %10s %12s %10s\n", "benchmark", "ns/op", "ops/s", "allocs/op", "B alloc/op", "MB/s");
+    for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        const Benchmark *benchmark = &benchmarks[i];
+        BenchResult     *result    = &results[count];
+
+        if(filter && !strstr(benchmark->name, filter))
+        {
+            continue;
+        }
+        if(benchmark->setup && benchmark->setup() != 0)
+        {
+            fprintf(stderr, "%s: setup failed\n", benchmark->name);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        run_benchmark(benchmark, target_ns, result);
+        printf("%-32s %12.1f %12.0f %10.2f %12.1f %10.1f\n",
+               result->name,
+               result->nsPerOp,
+               (double)NANOSECONDS_PER_SECOND / result->nsPerOp,
+               result->allocsPerOp,
+               result->bytesPerOp,
+               result->mbPerSecond);
+        count++;
+    }
+
+    remove_database();
+    if(json && write_json(json, results, count) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    return status;
+}
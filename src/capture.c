@@ -0,0 +1,130 @@
+#include "../include/capture.h"
+#include "../include/sampler.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MICROSECOND 1000ULL
+#define CAPTURE_PATH_MAX 256
+
+static int      capture_fd      = -1;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint32_t capture_percent = 0;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint64_t capture_start   = 0;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Per-worker state
+static uint32_t capture_connections = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint64_t capture_connection  = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static bool     capture_current     = false;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+uint64_t capture_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+int capture_init(unsigned int percent)
+{
+    CaptureHeader   header;
+    struct timespec realtime;
+    struct tm       local;
+    char            path[CAPTURE_PATH_MAX];
+    char            stamp[32];
+
+    if(percent == 0)
+    {
+        return 0;
+    }
+
+    // Captures hold raw requests, cookies and credentials included: owner only
+    if(mkdir(CAPTURE_DIR, S_IRWXU) != 0 && errno != EEXIST)
+    {
+        perror("mkdir capture directory");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    localtime_r(&realtime.tv_sec, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    snprintf(path, sizeof(path), "%s/capture-%s.bin", CAPTURE_DIR, stamp);
+
+    // O_APPEND: each worker's writev lands whole at the end of the file
+    capture_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(capture_fd < 0)
+    {
+        perror("open capture file");
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version         = CAPTURE_VERSION;
+    header.percent         = percent > CAPTURE_MAX_PERCENT ? CAPTURE_MAX_PERCENT : percent;
+    header.startNs         = capture_clock();
+    header.startRealtimeNs = (uint64_t)realtime.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)realtime.tv_nsec;
+    if(write(capture_fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+    {
+        perror("write capture header");
+        close(capture_fd);
+        capture_fd = -1;
+        return -1;
+    }
+
+    capture_percent = header.percent;
+    capture_start   = header.startNs;
+    printf("Capturing %u%% of connections to %s\n", capture_percent, path);
+    return 0;
+}
+
+void capture_connection_start(void)
+{
+    if(capture_fd < 0)
+    {
+        return;
+    }
+
+    capture_current = sampler_pick(capture_percent);
+    if(capture_current)
+    {
+        capture_connection = ((uint64_t)(uint32_t)getpid() << 32) | ++capture_connections;
+    }
+}
+
+bool capture_active(void)
+{
+    return capture_current;
+}
+
+void capture_request(const char *raw, size_t length, uint64_t parsed, int status)
+{
+    CaptureRecord record;
+    struct iovec  parts[2];
+
+    if(!capture_current || length > UINT32_MAX)
+    {
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.offsetNs   = parsed - capture_start;
+    record.connection = capture_connection;
+    record.length     = (uint32_t)length;
+    record.latencyUs  = (uint32_t)((capture_clock() - parsed) / NANOSECONDS_PER_MICROSECOND);
+    record.status     = (uint16_t)status;
+
+    parts[0].iov_base = &record;
+    parts[0].iov_len  = sizeof(record);
+    parts[1].iov_base = (void *)(uintptr_t)raw;
+    parts[1].iov_len  = length;
+    if(writev(capture_fd, parts, 2) != (ssize_t)(sizeof(record) + length))
+    {
+        perror("write capture record");
+    }
+}
@@ -3,69 +3,820 @@
 //
 
 #include "../include/client.h"
-#include "../include/server.h"
+#include "../include/histogram.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
-// WE DONT NEED CLIENT IN THIS PROJECT
+#define DECIMAL_BASE 10
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MILLISECOND 1000000ULL
+#define NANOSECONDS_PER_MICROSECOND 1000
+#define BYTES_PER_MEGABYTE (1024 * 1024)
+#define STATUS_CLASSES 6
+#define STATUS_CLASS_DIVISOR 100
+#define STATUS_CODE_OFFSET 9    // "HTTP/1.1 " precedes the status code
+#define MAX_EVENTS 256
+#define HEAD_BUFFER 8192
+#define DRAIN_BUFFER 65536
+#define REQUEST_HEAD_MAX 1024
+#define RETRY_DELAY_NS (10 * NANOSECONDS_PER_MILLISECOND)
+#define MAX_WAIT_MS 100
 
-void client(void)
+// Latency buckets in ns, finer than the server's: under 1% error, as in HdrHistogram
+#define LOAD_SUB_BITS 7
+#define LOAD_BUCKETS HISTOGRAM_BUCKETS_FOR(LOAD_SUB_BITS)
+
+typedef enum
+{
+    LOAD_GET = 0,
+    LOAD_HEAD,
+    LOAD_POST,
+    LOAD_METHOD_COUNT
+} LoadMethod;
+
+typedef enum
+{
+    CONNECTION_IDLE = 0,
+    CONNECTION_CONNECTING,
+    CONNECTION_SENDING,
+    CONNECTION_RECEIVING
+} ConnectionState;
+
+typedef struct
+{
+    char  *data;
+    size_t length;
+} LoadRequest;
+
+typedef struct
 {
-    printf("CLIENT\n");
+    int             fd;
+    ConnectionState state;
+    LoadMethod      method;
+    size_t          sent;
+    size_t          used;          // bytes of the response head in `head`
+    size_t          received;      // bytes of the response so far
+    size_t          expected;      // full response length once the head is parsed, else 0
+    int             status;
+    bool            closeAfter;
+    uint64_t        intendedNs;    // when the request in flight was due
+    uint64_t        nextNs;        // when the next request is due
+    char            head[HEAD_BUFFER + 1];
+} LoadConnection;
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LOAD_BUCKETS];
+} LoadHistogram;
+
+typedef struct
+{
+    uint64_t      requests;
+    uint64_t      bytes;
+    uint64_t      connectErrors;
+    uint64_t      readErrors;
+    uint64_t      writeErrors;
+    uint64_t      statuses[STATUS_CLASSES];
+    LoadHistogram latency;
+} LoadStats;
+
+typedef struct
+{
+    const LoadOptions        *options;
+    const struct sockaddr_in *address;
+    const LoadRequest        *requests;
+    unsigned int              count;          // connections of this thread
+    uint64_t                  startNs;
+    uint64_t                  endNs;
+    uint64_t                  intervalNs;     // per connection, open loop only
+    uint64_t                  random;
+    LoadStats                 stats;
+} LoadThread;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
 }
 
-int connect_client(char *serverInformation[])
+static void load_record(LoadHistogram *histogram, uint64_t value)
 {
-    const char        *server_ip   = serverInformation[0];
-    const char        *server_port = serverInformation[1];
-    struct sockaddr_in server_address;
-    int                port;
-    char              *endptr;
-    const int          decimalBase   = 10;
-    int                client_socket = socket(AF_INET, SOCK_STREAM, 0);
+    histogram->count++;
+    histogram->sum += value;
+    if(value > histogram->max)
+    {
+        histogram->max = value;
+    }
+    histogram->buckets[histogram_bucket_at(value, LOAD_SUB_BITS)]++;
+}
+
+static uint64_t load_percentile(const LoadHistogram *histogram, unsigned int perMillion)
+{
+    return histogram_buckets_percentile(histogram->buckets, LOAD_SUB_BITS, histogram->max, perMillion);
+}
+
+void load_options_defaults(LoadOptions *options)
+{
+    options->connections = LOAD_DEFAULT_CONNECTIONS;
+    options->threads     = LOAD_DEFAULT_THREADS;
+    options->seconds     = LOAD_DEFAULT_SECONDS;
+    options->rate        = 0;
+    options->keepAlive   = true;
+    options->getWeight   = 1;
+    options->headWeight  = 0;
+    options->postWeight  = 0;
+    options->path        = LOAD_DEFAULT_PATH;
+    options->bodyBytes   = LOAD_DEFAULT_BODY_BYTES;
+    options->jsonPath    = NULL;
+}
+
+int load_parse_mix(const char *spec, LoadOptions *options)
+{
+    unsigned int weights[LOAD_METHOD_COUNT] = {0};
+    const char  *cursor                     = spec;
+
+    while(*cursor)
+    {
+        static const char *const names[LOAD_METHOD_COUNT] = {"get", "head", "post"};
+        const char              *colon                    = strchr(cursor, ':');
+        char                    *end;
+        unsigned long            weight;
+        int                      method = -1;
+
+        if(!colon)
+        {
+            return -1;
+        }
+        for(int i = 0; i < LOAD_METHOD_COUNT; i++)
+        {
+            if((size_t)(colon - cursor) == strlen(names[i]) && strncasecmp(cursor, names[i], strlen(names[i])) == 0)
+            {
+                method = i;
+            }
+        }
+        weight = strtoul(colon + 1, &end, DECIMAL_BASE);
+        if(method < 0 || end == colon + 1 || (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        weights[method] = (unsigned int)weight;
+        cursor          = *end == ',' ? end + 1 : end;
+    }
+
+    if(weights[LOAD_GET] + weights[LOAD_HEAD] + weights[LOAD_POST] == 0)
+    {
+        return -1;
+    }
+    options->getWeight  = weights[LOAD_GET];
+    options->headWeight = weights[LOAD_HEAD];
+    options->postWeight = weights[LOAD_POST];
+    return 0;
+}
+
+/*
+ * Builds the three requests once; connections only ever send these bytes.
+ */
+static int build_requests(LoadRequest requests[LOAD_METHOD_COUNT], const LoadOptions *options, const char *host)
+{
+    static const char *const methods[LOAD_METHOD_COUNT] = {"GET", "HEAD", "POST"};
+    const char              *connection                 = options->keepAlive ? "keep-alive" : "close";
+
+    for(int i = 0; i < LOAD_METHOD_COUNT; i++)
+    {
+        size_t body   = i == LOAD_POST ? options->bodyBytes : 0;
+        char  *buffer = (char *)malloc(REQUEST_HEAD_MAX + body);
+        int    length;
+
+        if(!buffer)
+        {
+            perror("malloc");
+            return -1;
+        }
+
+        if(i == LOAD_POST)
+        {
+            length = snprintf(buffer,
+                              REQUEST_HEAD_MAX,
+                              "POST %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n",
+                              options->path,
+                              host,
+                              connection,
+                              body);
+        }
+        else
+        {
+            length = snprintf(buffer, REQUEST_HEAD_MAX, "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n", methods[i], options->path, host, connection);
+        }
+        if(length < 0 || length >= REQUEST_HEAD_MAX)
+        {
+            fprintf(stderr, "Request path too long\n");
+            free(buffer);
+            return -1;
+        }
+
+        // A form body the POST handler accepts, padded to the requested size
+        if(body > 0)
+        {
+            static const char prefix[] = "name=load&message=";
+            size_t            fixed    = body < sizeof(prefix) - 1 ? body : sizeof(prefix) - 1;
+
+            memcpy(buffer + length, prefix, fixed);
+            memset(buffer + (size_t)length + fixed, 'x', body - fixed);
+        }
+
+        requests[i].data   = buffer;
+        requests[i].length = (size_t)length + body;
+    }
+    return 0;
+}
+
+static uint64_t next_random(LoadThread *thread)
+{
+    thread->random ^= thread->random << 13;
+    thread->random ^= thread->random >> 7;
+    thread->random ^= thread->random << 17;
+    return thread->random;
+}
+
+static LoadMethod pick_method(LoadThread *thread)
+{
+    const LoadOptions *options = thread->options;
+    uint64_t           roll    = next_random(thread) % (options->getWeight + options->headWeight + options->postWeight);
+
+    if(roll < options->getWeight)
+    {
+        return LOAD_GET;
+    }
+    if(roll < (uint64_t)options->getWeight + options->headWeight)
+    {
+        return LOAD_HEAD;
+    }
+    return LOAD_POST;
+}
+
+static void watch(int epoll_fd, LoadConnection *connection, uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events   = events;
+    event.data.ptr = connection;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+static void drop_connection(int epoll_fd, LoadConnection *connection)
+{
+    if(connection->fd >= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+        close(connection->fd);
+        connection->fd = -1;
+    }
+    connection->state = CONNECTION_IDLE;
+}
+
+static void send_request(LoadThread *thread, int epoll_fd, LoadConnection *connection)
+{
+    const LoadRequest *request = &thread->requests[connection->method];
+
+    while(connection->sent < request->length)
+    {
+        ssize_t written = send(connection->fd, request->data + connection->sent, request->length - connection->sent, MSG_NOSIGNAL);
+
+        if(written < 0)
+        {
+            if(errno == EAGAIN)
+            {
+                connection->state = CONNECTION_SENDING;
+                watch(epoll_fd, connection, EPOLLOUT);
+                return;
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            thread->stats.writeErrors++;
+            drop_connection(epoll_fd, connection);
+            return;
+        }
+        connection->sent += (size_t)written;
+    }
+
+    connection->state = CONNECTION_RECEIVING;
+    watch(epoll_fd, connection, EPOLLIN);
+}
+
+static void start_request(LoadThread *thread, int epoll_fd, LoadConnection *connection, uint64_t intended)
+{
+    connection->method     = pick_method(thread);
+    connection->intendedNs = intended;
+    connection->sent       = 0;
+    connection->used       = 0;
+    connection->received   = 0;
+    connection->expected   = 0;
+    connection->closeAfter = !thread->options->keepAlive;
+
+    if(connection->fd < 0)
+    {
+        struct epoll_event event;
+        int                one = 1;
+
+        connection->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(connection->fd < 0)
+        {
+            thread->stats.connectErrors++;
+            return;
+        }
+        setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        event.events   = EPOLLOUT;
+        event.data.ptr = connection;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection->fd, &event);
+
+        if(connect(connection->fd, (const struct sockaddr *)thread->address, sizeof(*thread->address)) < 0)
+        {
+            if(errno != EINPROGRESS)
+            {
+                thread->stats.connectErrors++;
+                drop_connection(epoll_fd, connection);
+                return;
+            }
+            connection->state = CONNECTION_CONNECTING;
+            return;
+        }
+    }
+
+    send_request(thread, epoll_fd, connection);
+}
+
+/*
+ * Parses the status line and the headers that frame the response. HEAD
+ * answers carry a Content-Length but no body.
+ */
+static bool parse_head(LoadConnection *connection)
+{
+    const char *end;
+    const char *length;
+
+    connection->head[connection->used] = '\0';
+    end                                = strstr(connection->head, "\r\n\r\n");
+    if(!end)
+    {
+        return false;
+    }
+
+    connection->status = (int)strtol(connection->head + STATUS_CODE_OFFSET, NULL, DECIMAL_BASE);
+    length             = strcasestr(connection->head, "\r\nContent-Length:");
+    connection->expected = (size_t)(end + 4 - connection->head);
+    if(length && length < end && connection->method != LOAD_HEAD)
+    {
+        connection->expected += (size_t)strtoull(length + strlen("\r\nContent-Length:"), NULL, DECIMAL_BASE);
+    }
+
+    if(strcasestr(connection->head, "\r\nConnection: close") != NULL)
+    {
+        connection->closeAfter = true;
+    }
+    return true;
+}
+
+static void finish_response(LoadThread *thread, int epoll_fd, LoadConnection *connection, uint64_t now)
+{
+    int statusClass = connection->status / STATUS_CLASS_DIVISOR;
+
+    thread->stats.requests++;
+    thread->stats.bytes += connection->received;
+    thread->stats.statuses[statusClass > 0 && statusClass < STATUS_CLASSES ? statusClass : 0]++;
+    load_record(&thread->stats.latency, now - connection->intendedNs);
+
+    if(connection->closeAfter)
+    {
+        drop_connection(epoll_fd, connection);
+    }
+    else
+    {
+        connection->state = CONNECTION_IDLE;
+        watch(epoll_fd, connection, 0);
+    }
+}
+
+static void receive_response(LoadThread *thread, int epoll_fd, LoadConnection *connection, char *drain)
+{
+    for(;;)
+    {
+        ssize_t bytes;
+
+        // The head is kept to be parsed; body bytes are only counted
+        if(connection->expected == 0)
+        {
+            if(connection->used == HEAD_BUFFER)
+            {
+                thread->stats.readErrors++;
+                drop_connection(epoll_fd, connection);
+                return;
+            }
+            bytes = recv(connection->fd, connection->head + connection->used, HEAD_BUFFER - connection->used, 0);
+        }
+        else
+        {
+            size_t left = connection->expected - connection->received;
 
-    printf("IP: %s\n", server_ip);
-    printf("PORT: %s\n", server_port);
+            bytes = recv(connection->fd, drain, left < DRAIN_BUFFER ? left : DRAIN_BUFFER, 0);
+        }
 
-    if(client_socket == -1)
+        if(bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(bytes < 0 && (errno == EAGAIN))
+        {
+            return;
+        }
+        if(bytes <= 0)
+        {
+            thread->stats.readErrors++;
+            drop_connection(epoll_fd, connection);
+            return;
+        }
+
+        connection->received += (size_t)bytes;
+        if(connection->expected == 0)
+        {
+            connection->used += (size_t)bytes;
+            if(!parse_head(connection))
+            {
+                continue;
+            }
+        }
+        if(connection->received >= connection->expected)
+        {
+            finish_response(thread, epoll_fd, connection, monotonic_ns());
+            return;
+        }
+    }
+}
+
+static void handle_event(LoadThread *thread, int epoll_fd, LoadConnection *connection, uint32_t events, char *drain)
+{
+    // The server closed a kept-alive connection between requests
+    if(connection->state == CONNECTION_IDLE)
     {
-        perror("Socket create failed");
-        exit(EXIT_FAILURE);
+        drop_connection(epoll_fd, connection);
+        return;
     }
+    if(connection->state == CONNECTION_CONNECTING)
+    {
+        int       error  = 0;
+        socklen_t length = sizeof(error);
+
+        if(getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+        {
+            thread->stats.connectErrors++;
+            drop_connection(epoll_fd, connection);
+            return;
+        }
+        send_request(thread, epoll_fd, connection);
+        return;
+    }
+    if(connection->state == CONNECTION_SENDING && (events & EPOLLOUT))
+    {
+        send_request(thread, epoll_fd, connection);
+        return;
+    }
+    if(connection->state == CONNECTION_RECEIVING && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    {
+        receive_response(thread, epoll_fd, connection, drain);
+    }
+}
+
+/*
+ * Starts every idle connection that is due and returns how long to wait for
+ * the next one, in milliseconds.
+ */
+static int start_due(LoadThread *thread, int epoll_fd, LoadConnection *connections, uint64_t now)
+{
+    uint64_t earliest = thread->endNs;
+
+    for(unsigned int i = 0; i < thread->count; i++)
+    {
+        LoadConnection *connection = &connections[i];
+        uint64_t        errors;
+
+        if(connection->state != CONNECTION_IDLE)
+        {
+            continue;
+        }
+        if(connection->nextNs <= now)
+        {
+            // Open loop keeps the schedule: a late request counts from when it was due
+            uint64_t intended = thread->intervalNs ? connection->nextNs : now;
+
+            errors             = thread->stats.connectErrors + thread->stats.writeErrors;
+            connection->nextNs = thread->intervalNs ? connection->nextNs + thread->intervalNs : now;
+            start_request(thread, epoll_fd, connection, intended);
+
+            // Do not spin on a server that refuses connections
+            if(connection->state == CONNECTION_IDLE && errors != thread->stats.connectErrors + thread->stats.writeErrors)
+            {
+                connection->nextNs = now + RETRY_DELAY_NS;
+            }
+        }
+        if(connection->state == CONNECTION_IDLE && connection->nextNs < earliest)
+        {
+            earliest = connection->nextNs;
+        }
+    }
+
+    if(earliest <= now)
+    {
+        return 0;
+    }
+    earliest = (earliest - now + NANOSECONDS_PER_MILLISECOND - 1) / NANOSECONDS_PER_MILLISECOND;
+    return earliest < MAX_WAIT_MS ? (int)earliest : MAX_WAIT_MS;
+}
+
+static void *load_thread(void *arg)
+{
+    LoadThread        *thread = (LoadThread *)arg;
+    LoadConnection    *connections;
+    char              *drain;
+    struct epoll_event events[MAX_EVENTS];
+    int                epoll_fd;
+    uint64_t           now;
+
+    connections = (LoadConnection *)calloc(thread->count, sizeof(LoadConnection));
+    drain       = (char *)malloc(DRAIN_BUFFER);
+    epoll_fd    = epoll_create1(EPOLL_CLOEXEC);
+    if(!connections || !drain || epoll_fd < 0)
+    {
+        perror("load thread setup");
+        free(connections);
+        free(drain);
+        if(epoll_fd >= 0)
+        {
+            close(epoll_fd);
+        }
+        return NULL;
+    }
+
+    // Spread each open-loop connection's first send over one interval
+    for(unsigned int i = 0; i < thread->count; i++)
+    {
+        connections[i].fd     = -1;
+        connections[i].nextNs = thread->startNs + (thread->intervalNs ? next_random(thread) % thread->intervalNs : 0);
+    }
+
+    while((now = monotonic_ns()) < thread->endNs)
+    {
+        int timeout = start_due(thread, epoll_fd, connections, now);
+        int ready   = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+
+        for(int i = 0; i < ready; i++)
+        {
+            handle_event(thread, epoll_fd, (LoadConnection *)events[i].data.ptr, events[i].events, drain);
+        }
+    }
+
+    for(unsigned int i = 0; i < thread->count; i++)
+    {
+        drop_connection(epoll_fd, &connections[i]);
+    }
+    close(epoll_fd);
+    free(drain);
+    free(connections);
+    return NULL;
+}
+
+static void merge_stats(LoadStats *total, const LoadStats *stats)
+{
+    total->requests += stats->requests;
+    total->bytes += stats->bytes;
+    total->connectErrors += stats->connectErrors;
+    total->readErrors += stats->readErrors;
+    total->writeErrors += stats->writeErrors;
+    for(int i = 0; i < STATUS_CLASSES; i++)
+    {
+        total->statuses[i] += stats->statuses[i];
+    }
+    total->latency.count += stats->latency.count;
+    total->latency.sum += stats->latency.sum;
+    if(stats->latency.max > total->latency.max)
+    {
+        total->latency.max = stats->latency.max;
+    }
+    for(unsigned int i = 0; i < LOAD_BUCKETS; i++)
+    {
+        total->latency.buckets[i] += stats->latency.buckets[i];
+    }
+}
+
+static const unsigned int load_quantiles[] = {500000, 750000, 900000, 990000, 999000, 999900};
+static const char *const  quantile_names[] = {"p50", "p75", "p90", "p99", "p99.9", "p99.99"};
+
+static void print_report(const LoadStats *total, const LoadOptions *options, const char *target, double elapsed)
+{
+    const LoadHistogram *latency = &total->latency;
+
+    printf("%u threads, %u connections, %s, %s, %.1fs against %s\n",
+           options->threads,
+           options->connections,
+           options->rate > 0 ? "open loop" : "closed loop",
+           options->keepAlive ? "keep-alive" : "connection per request",
+           elapsed,
+           target);
+    printf("  Requests   %llu (%.1f/s), %.2f MB/s\n", (unsigned long long)total->requests, (double)total->requests / elapsed, (double)total->bytes / BYTES_PER_MEGABYTE / elapsed);
+    printf("  Status     1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+           (unsigned long long)total->statuses[1],
+           (unsigned long long)total->statuses[2],
+           (unsigned long long)total->statuses[3],
+           (unsigned long long)total->statuses[4],
+           (unsigned long long)total->statuses[5],
+           (unsigned long long)total->statuses[0]);
+    printf("  Errors     connect %llu, read %llu, write %llu\n", (unsigned long long)total->connectErrors, (unsigned long long)total->readErrors, (unsigned long long)total->writeErrors);
+    printf("  Latency    mean %.1f us, max %.1f us\n",
+           latency->count ? (double)latency->sum / (double)latency->count / NANOSECONDS_PER_MICROSECOND : 0,
+           (double)latency->max / NANOSECONDS_PER_MICROSECOND);
+    for(size_t i = 0; i < sizeof(load_quantiles) / sizeof(load_quantiles[0]); i++)
+    {
+        uint64_t value = load_percentile(latency, load_quantiles[i]);
+
+        printf("  %9s  %.1f us\n", quantile_names[i], (double)value / NANOSECONDS_PER_MICROSECOND);
+    }
+}
+
+/*
+ * The same numbers for scripts, plus the non-empty buckets so runs can be
+ * merged or compared at any quantile.
+ */
+static int write_json(const LoadStats *total, const LoadOptions *options, const char *target, double elapsed)
+{
+    const LoadHistogram *latency = &total->latency;
+    FILE                *file    = fopen(options->jsonPath, "we");
+    bool                 first   = true;
+
+    if(!file)
+    {
+        perror("open JSON output");
+        return -1;
+    }
+
+    fprintf(file,
+            "{\"target\":\"%s\",\"threads\":%u,\"connections\":%u,\"rate\":%.1f,\"keep_alive\":%s,\"seconds\":%.3f,"
+            "\"requests\":%llu,\"throughput\":%.1f,\"bytes\":%llu,",
+            target,
+            options->threads,
+            options->connections,
+            options->rate,
+            options->keepAlive ? "true" : "false",
+            elapsed,
+            (unsigned long long)total->requests,
+            (double)total->requests / elapsed,
+            (unsigned long long)total->bytes);
+    fprintf(file,
+            "\"status\":{\"1xx\":%llu,\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu,\"other\":%llu},"
+            "\"errors\":{\"connect\":%llu,\"read\":%llu,\"write\":%llu},",
+            (unsigned long long)total->statuses[1],
+            (unsigned long long)total->statuses[2],
+            (unsigned long long)total->statuses[3],
+            (unsigned long long)total->statuses[4],
+            (unsigned long long)total->statuses[5],
+            (unsigned long long)total->statuses[0],
+            (unsigned long long)total->connectErrors,
+            (unsigned long long)total->readErrors,
+            (unsigned long long)total->writeErrors);
+    fprintf(file,
+            "\"latency_us\":{\"mean\":%.3f,\"max\":%.3f",
+            latency->count ? (double)latency->sum / (double)latency->count / NANOSECONDS_PER_MICROSECOND : 0,
+            (double)latency->max / NANOSECONDS_PER_MICROSECOND);
+    for(size_t i = 0; i < sizeof(load_quantiles) / sizeof(load_quantiles[0]); i++)
+    {
+        uint64_t value = load_percentile(latency, load_quantiles[i]);
+
+        fprintf(file, ",\"%s\":%.3f", quantile_names[i], (double)value / NANOSECONDS_PER_MICROSECOND);
+    }
+    fprintf(file, "},\"histogram_ns\":[");
+    for(unsigned int i = 0; i < LOAD_BUCKETS; i++)
+    {
+        if(latency->buckets[i])
+        {
+            fprintf(file, "%s[%llu,%llu]", first ? "" : ",", (unsigned long long)histogram_bucket_upper_at(i, LOAD_SUB_BITS), (unsigned long long)latency->buckets[i]);
+            first = false;
+        }
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+int connect_client(char *serverInformation[], const LoadOptions *options)
+{
+    const char        *server_ip   = serverInformation[0];
+    const char        *server_port = serverInformation[1];
+    struct sockaddr_in server_address;
+    LoadRequest        requests[LOAD_METHOD_COUNT] = {0};
+    LoadThread        *threads;
+    pthread_t          ids[LOAD_MAX_THREADS];
+    LoadStats         *total;
+    LoadOptions        effective = *options;
+    char               target[REQUEST_HEAD_MAX];
+    unsigned int       started = 0;
+    uint64_t           start;
+    uint64_t           finish;
+    int                result = 1;
 
     memset(&server_address, 0, sizeof(server_address));
     server_address.sin_family = AF_INET;
-
+    server_address.sin_port   = htons((uint16_t)strtol(server_port, NULL, DECIMAL_BASE));
     if(inet_pton(AF_INET, server_ip, &server_address.sin_addr) <= 0)
     {
-        perror("Invalid IP address");
-        close(client_socket);
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "Invalid IP address: %s\n", server_ip);
+        return 1;
+    }
+
+    // Every thread needs at least one connection
+    if(effective.connections == 0 || effective.seconds == 0)
+    {
+        fprintf(stderr, "Need at least one connection and one second\n");
+        return 1;
+    }
+    if(effective.threads == 0)
+    {
+        effective.threads = 1;
+    }
+    if(effective.threads > LOAD_MAX_THREADS)
+    {
+        effective.threads = LOAD_MAX_THREADS;
+    }
+    if(effective.threads > effective.connections)
+    {
+        effective.threads = effective.connections;
     }
 
-    // Convert the port from string to integer
-    port                    = (int)strtol(server_port, &endptr, decimalBase);
-    server_address.sin_port = htons((uint16_t)port);
+    snprintf(target, sizeof(target), "http://%s:%s%s", server_ip, server_port, effective.path);
+    threads = (LoadThread *)calloc(effective.threads, sizeof(LoadThread));
+    total   = (LoadStats *)calloc(1, sizeof(LoadStats));
+    if(!threads || !total || build_requests(requests, &effective, server_ip) != 0)
+    {
+        goto cleanup;
+    }
 
-    if(connect(client_socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1)
+    start = monotonic_ns();
+    for(unsigned int i = 0; i < effective.threads; i++)
     {
-        perror("Connection failed");
-        close(client_socket);
-        exit(EXIT_FAILURE);
+        LoadThread *thread = &threads[i];
+
+        thread->options    = &effective;
+        thread->address    = &server_address;
+        thread->requests   = requests;
+        thread->count      = effective.connections * (i + 1) / effective.threads - effective.connections * i / effective.threads;
+        thread->startNs    = start;
+        thread->endNs      = start + (uint64_t)effective.seconds * NANOSECONDS_PER_SECOND;
+        thread->intervalNs = effective.rate > 0 ? (uint64_t)((double)NANOSECONDS_PER_SECOND * effective.connections / effective.rate) : 0;
+        thread->random     = (start ^ ((uint64_t)(i + 1) << 32)) | 1;
+        if(pthread_create(&ids[i], NULL, load_thread, thread) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+        started++;
     }
 
-    printf("Connected to the server at %s:%s\n", server_ip, server_port);
+    for(unsigned int i = 0; i < started; i++)
+    {
+        pthread_join(ids[i], NULL);
+        merge_stats(total, &threads[i].stats);
+    }
+    finish = monotonic_ns();
 
-    // Now you can send and receive data through client_socket
-    // handle send/recv
-    sleep(decimalBase * decimalBase * decimalBase);
-    // Close the client socket when done
-    close(client_socket);
+    if(started == effective.threads)
+    {
+        double elapsed = (double)(finish - start) / (double)NANOSECONDS_PER_SECOND;
 
-    return 0;
+        print_report(total, &effective, target, elapsed);
+        result = effective.jsonPath && write_json(total, &effective, target, elapsed) != 0 ? 1 : 0;
+    }
+
+cleanup:
+    for(int i = 0; i < LOAD_METHOD_COUNT; i++)
+    {
+        free(requests[i].data);
+    }
+    free(total);
+    free(threads);
+    return result;
 }
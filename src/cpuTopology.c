@@ -0,0 +1,318 @@
+#include "../include/cpuTopology.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CPU_LIST_MAX 4096
+#define DECIMAL_BASE 10
+
+// Allowed CPUs in placement order, and the NUMA node of each
+static int placement[CPU_SETSIZE];     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int cpu_node[CPU_SETSIZE];      // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int placement_count = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+/*
+ * Parses a sysfs CPU list such as "0-3,8-11" into a set.
+ */
+static void parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    const char *cursor = list;
+
+    CPU_ZERO(set);
+    while(*cursor)
+    {
+        char *end;
+        long  first = strtol(cursor, &end, DECIMAL_BASE);
+        long  last  = first;
+
+        if(end == cursor)
+        {
+            break;
+        }
+        if(*end == '-')
+        {
+            cursor = end + 1;
+            last   = strtol(cursor, &end, DECIMAL_BASE);
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET((size_t)cpu, set);
+        }
+        if(*end != ',')
+        {
+            break;
+        }
+        cursor = end + 1;
+    }
+}
+
+/*
+ * Records the node of every CPU from /sys/devices/system/node/nodeN/cpulist.
+ * Returns the number of nodes seen (0 without NUMA information).
+ */
+static int read_numa_nodes(void)
+{
+    DIR           *dir;
+    struct dirent *entry;
+    int            nodes = 0;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        cpu_node[cpu] = 0;
+    }
+
+    dir = opendir(NUMA_NODE_DIR);
+    if(!dir)
+    {
+        return 0;
+    }
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        char      path[PATH_MAX];
+        char      list[CPU_LIST_MAX];
+        cpu_set_t set;
+        FILE     *file;
+        int       node;
+
+        if(strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+        {
+            continue;
+        }
+        node = (int)strtol(entry->d_name + 4, NULL, DECIMAL_BASE);
+
+        snprintf(path, sizeof(path), "%s/%s/cpulist", NUMA_NODE_DIR, entry->d_name);
+        file = fopen(path, "re");
+        if(!file)
+        {
+            continue;
+        }
+        if(fgets(list, sizeof(list), file))
+        {
+            parse_cpu_list(list, &set);
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if(CPU_ISSET((size_t)cpu, &set))
+                {
+                    cpu_node[cpu] = node;
+                }
+            }
+            nodes = node >= nodes ? node + 1 : nodes;
+        }
+        fclose(file);
+    }
+    closedir(dir);
+    return nodes;
+}
+
+int cpu_topology_init(void)
+{
+    cpu_set_t allowed;
+    bool      taken[CPU_SETSIZE];
+    int       nodes;
+    int       total;
+
+    placement_count = 0;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        perror("sched_getaffinity failed");
+        placement[placement_count++] = 0;
+        return 1;
+    }
+
+    nodes = read_numa_nodes();
+    total = CPU_COUNT(&allowed);
+    memset(taken, 0, sizeof(taken));
+
+    // Round-robin over the nodes, lowest free CPU of each node per round
+    while(placement_count < total)
+    {
+        for(int node = 0; node < (nodes > 0 ? nodes : 1); node++)
+        {
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if(CPU_ISSET((size_t)cpu, &allowed) && !taken[cpu] && (nodes == 0 || cpu_node[cpu] == node))
+                {
+                    taken[cpu]                   = true;
+                    placement[placement_count++] = cpu;
+                    break;
+                }
+            }
+        }
+    }
+
+    if(placement_count == 0)
+    {
+        placement[placement_count++] = 0;
+    }
+    return placement_count;
+}
+
+/*
+ * Reads a cgroup v2 cpu.max, "<quota|max> <period>", as a number of CPUs,
+ * rounded up. Returns 0 if unlimited, -1 if the group has no cpu.max.
+ */
+static int read_cpu_max(const char *dir)
+{
+    char  quota[64];
+    long  period = 0;
+    long  limit  = 0;
+    FILE *file;
+    int   dir_fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    int   fd     = dir_fd < 0 ? -1 : openat(dir_fd, "cpu.max", O_RDONLY | O_CLOEXEC);
+
+    if(dir_fd >= 0)
+    {
+        close(dir_fd);
+    }
+    file = fd < 0 ? NULL : fdopen(fd, "r");
+    if(!file)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if(fscanf(file, "%63s %ld", quota, &period) == 2 && strcmp(quota, "max") != 0)
+    {
+        limit = strtol(quota, NULL, DECIMAL_BASE);
+    }
+    fclose(file);
+
+    if(limit <= 0 || period <= 0)
+    {
+        return 0;
+    }
+    return (int)((limit + period - 1) / period);
+}
+
+/*
+ * cgroup v2: the process's group is the "0::<path>" line of /proc/self/cgroup.
+ * A quota on any group above it applies as well, so the tightest one between
+ * the group and the root wins. Returns 0 if there is no limit, -1 if the
+ * process is not in a cgroup v2 hierarchy.
+ */
+static int cgroup_v2_cpu_limit(void)
+{
+    char   line[PATH_MAX - sizeof(CGROUP_V2_ROOT)];
+    char   dir[PATH_MAX];
+    FILE  *file;
+    bool   found      = false;
+    bool   seen       = false;
+    int    tightest   = 0;
+    size_t rootLength = strlen(CGROUP_V2_ROOT);
+
+    file = fopen(PROC_SELF_CGROUP, "re");
+    if(!file)
+    {
+        return -1;
+    }
+    while(!found && fgets(line, sizeof(line), file))
+    {
+        found = strncmp(line, "0::", 3) == 0;
+    }
+    fclose(file);
+    if(!found || !strchr(line, '\n'))
+    {
+        return -1;
+    }
+
+    line[strcspn(line, "\n")] = '\0';
+    snprintf(dir, sizeof(dir), "%s%s", CGROUP_V2_ROOT, line + 3);
+
+    // Walk up to the root, which has no cpu.max of its own
+    while(strlen(dir) > rootLength)
+    {
+        int limit = read_cpu_max(dir);
+
+        seen = seen || limit >= 0;
+        if(limit > 0 && (tightest == 0 || limit < tightest))
+        {
+            tightest = limit;
+        }
+        *strrchr(dir, '/') = '\0';
+    }
+    return seen ? tightest : -1;
+}
+
+/*
+ * Reads the cgroup CPU quota as a number of CPUs, rounded up.
+ * Returns 0 if there is no limit.
+ */
+static int cgroup_cpu_limit(void)
+{
+    long  period = 0;
+    long  limit  = cgroup_v2_cpu_limit();
+    FILE *file;
+
+    if(limit >= 0)
+    {
+        return (int)limit;
+    }
+
+    // cgroup v1: quota is -1 when unlimited
+    limit = 0;
+    file  = fopen(CGROUP_V1_CPU_QUOTA, "re");
+    if(file)
+    {
+        if(fscanf(file, "%ld", &limit) != 1)
+        {
+            limit = 0;
+        }
+        fclose(file);
+    }
+    file = fopen(CGROUP_V1_CPU_PERIOD, "re");
+    if(file)
+    {
+        if(fscanf(file, "%ld", &period) != 1)
+        {
+            period = 0;
+        }
+        fclose(file);
+    }
+
+    if(limit <= 0 || period <= 0)
+    {
+        return 0;
+    }
+    return (int)((limit + period - 1) / period);
+}
+
+int cpu_topology_budget(void)
+{
+    int budget = placement_count > 0 ? placement_count : cpu_topology_init();
+    int limit  = cgroup_cpu_limit();
+
+    if(limit > 0 && limit < budget)
+    {
+        budget = limit;
+    }
+    return budget > 0 ? budget : 1;
+}
+
+int cpu_topology_pin(int worker)
+{
+    cpu_set_t set;
+
+    if(placement_count == 0)
+    {
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET((size_t)placement[worker % placement_count], &set);
+    if(sched_setaffinity(0, sizeof(set), &set) < 0)
+    {
+        perror("sched_setaffinity failed");
+        return -1;
+    }
+    return 0;
+}
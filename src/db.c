@@ -8,6 +8,11 @@
  ******************************************************************************/
 
 #include "../include/db.h"
+#include "../include/dbIndex.h"
+#include "../include/probes.h"
+#include "../include/record.h"
+#include "../include/recordCache.h"
+#include "../include/sharedMemory.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -19,6 +24,70 @@
 
 #define MAX_KEY 64
 
+// Compression dictionaries are trained once this many entries exist
+#define RECORD_TRAIN_MIN_ENTRIES 32
+
+// Number of recent entries the dictionary is trained from
+#define RECORD_TRAIN_SAMPLES 128
+
+// Serializes database access between workers; NULL when running standalone
+static pthread_mutex_t *db_lock = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Field names and compression dictionary, loaded per process
+static RecordDictionary record_dict;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Whether new records are compressed; set by the master before fork
+static bool compression_enabled = false;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+int database_init_shared_lock(void)
+{
+    bool attached;
+
+    if(db_lock)
+    {
+        return 0;
+    }
+
+    // Handed over on a binary upgrade so both generations serialize on it
+    db_lock = (pthread_mutex_t *)shared_memory_attach("db_lock", sizeof(pthread_mutex_t), &attached);
+    if(!db_lock)
+    {
+        return -1;
+    }
+
+    if(!attached && shared_mutex_init(db_lock) < 0)
+    {
+        shared_memory_destroy(db_lock, sizeof(pthread_mutex_t));
+        db_lock = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int database_lock(void)
+{
+    // A dead owner leaves nothing to repair: gdbm commits each store itself
+    if(db_lock && shared_mutex_lock(db_lock) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void database_unlock(void)
+{
+    if(db_lock)
+    {
+        shared_mutex_unlock(db_lock);
+    }
+}
+
+void format_entry_key(char *key, size_t size, int id)
+{
+    // Format the key like "entry_0001"
+    snprintf(key, size, POST_ENTRY_KEY_FORMAT, id);
+}
+
 /* Opens the DBM database specified by dbo->name.
    Returns 0 on success, -1 on error. */
 ssize_t database_open(DBO *dbo)
@@ -32,6 +101,18 @@ ssize_t database_open(DBO *dbo)
     return 0;
 }
 
+/* Opens the DBM database specified by dbo->name without creating it.
+   Returns 0 on success, -1 on error. */
+ssize_t database_open_readonly(DBO *dbo)
+{
+    dbo->db = dbm_open(dbo->name, O_RDONLY, 0);
+    if(!dbo->db)
+    {
+        return -1;
+    }
+    return 0;
+}
+
 /* Stores the string value under the given key in the database.
    Returns 0 on success, -1 on failure. */
 int store_string(DBM *db, const char *key, const char *value)
@@ -44,34 +125,168 @@ int store_string(DBM *db, const char *key, const char *value)
 
 int store_int(DBM *db, const char *key, int value)
 {
-    const_datum key_datum = MAKE_CONST_DATUM(key);
-    datum       value_datum;
-    int         result;
+    const_datum key_datum   = MAKE_CONST_DATUM(key);
+    const_datum value_datum = MAKE_CONST_DATUM_BYTE(&value, sizeof(int));
 
-    value_datum.dptr = (char *)malloc(TO_SIZE_T(sizeof(int)));
+    // The counter is stored straight from the stack; no copy needed
+    return dbm_store(db, *(datum *)&key_datum, *(datum *)&value_datum, DBM_REPLACE);
+}
 
-    if(value_datum.dptr == NULL)
+/* Stores raw bytes under the given key in the database.
+   Returns 0 on success, -1 on failure. */
+static int store_bytes(DBM *db, const char *key, const void *value, size_t size)
+{
+    const_datum key_datum   = MAKE_CONST_DATUM(key);
+    const_datum value_datum = MAKE_CONST_DATUM_BYTE(value, size);
+
+    return dbm_store(db, *(datum *)&key_datum, *(datum *)&value_datum, DBM_REPLACE);
+}
+
+/*
+ * Trains the compression dictionary from the most recent entries once there
+ * are enough of them. The database must be open for writing.
+ */
+static void train_dictionary(DBM *db, int count)
+{
+    unsigned char *samples[RECORD_TRAIN_SAMPLES];
+    size_t         sizes[RECORD_TRAIN_SAMPLES];
+    size_t         numSamples = 0;
+    int            first;
+
+    if(!compression_enabled || record_dict.zdict || count < RECORD_TRAIN_MIN_ENTRIES)
     {
-        return -1;
+        return;
+    }
+
+    first = count > RECORD_TRAIN_SAMPLES ? count - RECORD_TRAIN_SAMPLES : 0;
+    for(int id = first; id < count; id++)
+    {
+        char         key[MAX_KEY];
+        const_datum  key_datum;
+        datum        fetched;
+        void        *stored;
+        size_t       size;
+        RecordFields fields;
+
+        format_entry_key(key, sizeof(key), id);
+        key_datum = MAKE_CONST_DATUM(key);
+        fetched   = dbm_fetch(db, *(datum *)&key_datum);
+        if(fetched.dptr == NULL)
+        {
+            continue;
+        }
+
+        stored = malloc(TO_SIZE_T(fetched.dsize));
+        if(!stored)
+        {
+            break;
+        }
+        size = TO_SIZE_T(fetched.dsize);
+        memcpy(stored, fetched.dptr, size);
+
+        // Samples are the uncompressed form, which is what the dictionary primes
+        if(decode_record(db, stored, size, &fields) == 0)
+        {
+            samples[numSamples] = record_encode(&fields, &record_dict, false, &sizes[numSamples]);
+            if(samples[numSamples])
+            {
+                numSamples++;
+            }
+            record_fields_free(&fields);
+        }
+        free(stored);
+    }
+
+    if(record_dictionary_train(db, &record_dict, (const unsigned char *const *)samples, sizes, numSamples) != 0)
+    {
+        fprintf(stderr, "Failed to train compression dictionary\n");
+    }
+    else if(record_dict.zdict)
+    {
+        printf("Trained %zu byte compression dictionary from %zu entries\n", record_dict.zdictLength, numSamples);
     }
 
-    memcpy(value_datum.dptr, &value, sizeof(int));
-    value_datum.dsize = sizeof(int);
+    for(size_t i = 0; i < numSamples; i++)
+    {
+        free(samples[i]);
+    }
+}
 
-    result = dbm_store(db, *(datum *)&key_datum, value_datum, DBM_REPLACE);
+void database_set_compression(bool enabled)
+{
+    compression_enabled = enabled;
+}
+
+int decode_record(DBM *db, const void *data, size_t size, RecordFields *fields)
+{
+    int result = record_decode(data, size, &record_dict, fields);
+
+    if(result == RECORD_UNKNOWN_REF)
+    {
+        // Written by another worker after this one loaded the dictionary
+        if(record_dictionary_load(db, &record_dict) != 0)
+        {
+            return -1;
+        }
+        result = record_decode(data, size, &record_dict, fields);
+    }
+    return result == 0 ? 0 : -1;
+}
 
-    free(value_datum.dptr);
+int decode_post_entry(DBO *dbo, const PostEntry *entry, RecordFields *fields)
+{
+    int result = record_decode(entry->data, entry->size, &record_dict, fields);
+
+    if(result != RECORD_UNKNOWN_REF)
+    {
+        return result;
+    }
+
+    if(database_lock() < 0)
+    {
+        return -1;
+    }
+    if(database_open_readonly(dbo) < 0)
+    {
+        database_unlock();
+        return -1;
+    }
+
+    result = decode_record(dbo->db, entry->data, entry->size, fields);
+
+    dbm_close(dbo->db);
+    database_unlock();
     return result;
 }
 
-int store_post_entry(DBO *dbo, const char *body_string, const char *pk_name)
+/*
+ * store_post_entry without the probes around it.
+ */
+static int store_entry(DBO *dbo, const char *body_string, const char *pk_name)
 {
-    int  current_id;
-    char key[MAX_KEY];
+    int            current_id;
+    char           key[MAX_KEY];
+    RecordFields   fields;
+    unsigned char *record;
+    size_t         record_size;
+
+    // Decode the form once; the record, the indexes and the cache all use it
+    if(record_parse_body(body_string, &fields) != 0)
+    {
+        return -1;
+    }
+
+    if(database_lock() < 0)
+    {
+        record_fields_free(&fields);
+        return -1;
+    }
 
     // Open the database if not already open
     if(database_open(dbo) < 0)
     {
+        database_unlock();
+        record_fields_free(&fields);
         return -1;
     }
 
@@ -82,31 +297,268 @@ int store_post_entry(DBO *dbo, const char *body_string, const char *pk_name)
         current_id = 0;
     }
 
-    // Format the key like "entry_0001"
+    format_entry_key(key, sizeof(key), current_id);
 
-    snprintf(key, sizeof(key), "entry_%04d", current_id);
+    // Until a dictionary exists, pick up one trained by another worker or train it
+    if(compression_enabled && !record_dict.zdict)
+    {
+        record_dictionary_load(dbo->db, &record_dict);
+        train_dictionary(dbo->db, current_id);
+    }
 
-    // Store the full body string under the generated key
-    if(store_string(dbo->db, key, body_string) != 0)
+    for(size_t i = 0; i < fields.count; i++)
+    {
+        record_dictionary_intern(dbo->db, &record_dict, fields.fields[i].name);
+    }
+
+    // Store the encoded record under the generated key
+    record = record_encode(&fields, &record_dict, compression_enabled, &record_size);
+    if(!record || store_bytes(dbo->db, key, record, record_size) != 0)
     {
         fprintf(stderr, "Failed to store POST entry in DB\n");
         dbm_close(dbo->db);
+        database_unlock();
+        free(record);
+        record_fields_free(&fields);
         return -1;
     }
 
     // Increment the primary key and save it back
-    current_id++;
-    if(store_int(dbo->db, pk_name, current_id) != 0)
+    if(store_int(dbo->db, pk_name, current_id + 1) != 0)
     {
         fprintf(stderr, "Failed to update primary key in DB\n");
         dbm_close(dbo->db);
+        database_unlock();
+        free(record);
+        record_fields_free(&fields);
         return -1;
     }
 
+    // The entry is stored either way; a failed index update only makes searches miss it
+    if(db_index_add_entry(dbo->db, current_id, &fields) != 0)
+    {
+        fprintf(stderr, "Failed to update secondary indexes for %s\n", key);
+    }
+
     dbm_close(dbo->db);
+    database_unlock();
+
+    // Recent submissions are the ones dashboards poll, so cache them right away
+    record_cache_put(current_id, record, record_size);
+    record_cache_set_count(current_id + 1);
+
+    free(record);
+    record_fields_free(&fields);
     return 0;
 }
 
+int store_post_entry(DBO *dbo, const char *body_string, const char *pk_name)
+{
+    int result;
+
+    PROBE1(db_store_begin, dbo->name);
+    result = store_entry(dbo, body_string, pk_name);
+    PROBE2(db_store_end, dbo->name, result);
+    return result;
+}
+
+int retrieve_post_count(DBO *dbo, const char *pk_name)
+{
+    int count;
+
+    count = record_cache_get_count();
+    if(count >= 0)
+    {
+        return count;
+    }
+
+    if(database_lock() < 0)
+    {
+        return -1;
+    }
+
+    if(database_open_readonly(dbo) < 0)
+    {
+        // Nothing has been posted yet
+        database_unlock();
+        return 0;
+    }
+
+    if(retrieve_int(dbo->db, pk_name, &count) < 0)
+    {
+        count = 0;
+    }
+
+    dbm_close(dbo->db);
+    database_unlock();
+
+    record_cache_set_count(count);
+    return count;
+}
+
+int retrieve_post_entries(DBO *dbo, PostEntry *entries, size_t count)
+{
+    char   cached[RECORD_CACHE_MAX_VALUE];
+    size_t misses = 0;
+    int    result = 0;
+
+    // Serve what we can from the shared cache without touching the file
+    for(size_t i = 0; i < count; i++)
+    {
+        ssize_t length = record_cache_get(entries[i].id, cached, sizeof(cached));
+
+        entries[i].data = NULL;
+        entries[i].size = 0;
+
+        if(length < 0)
+        {
+            misses++;
+            continue;
+        }
+
+        entries[i].data = malloc((size_t)length);
+        if(!entries[i].data)
+        {
+            free_post_entries(entries, i);
+            return -1;
+        }
+        memcpy(entries[i].data, cached, (size_t)length);
+        entries[i].size = (size_t)length;
+    }
+
+    if(misses == 0)
+    {
+        return 0;
+    }
+
+    // One open for the whole batch of misses
+    if(database_lock() < 0)
+    {
+        return -1;
+    }
+
+    if(database_open_readonly(dbo) < 0)
+    {
+        database_unlock();
+        return 0;
+    }
+
+    for(size_t i = 0; i < count && result == 0; i++)
+    {
+        char        key[MAX_KEY];
+        const_datum key_datum;
+        datum       fetched;
+
+        if(entries[i].data)
+        {
+            continue;
+        }
+
+        format_entry_key(key, sizeof(key), entries[i].id);
+        key_datum = MAKE_CONST_DATUM(key);
+        fetched   = dbm_fetch(dbo->db, *(datum *)&key_datum);
+        if(fetched.dptr == NULL)
+        {
+            continue;
+        }
+
+        entries[i].data = malloc(TO_SIZE_T(fetched.dsize));
+        if(!entries[i].data)
+        {
+            result = -1;
+            continue;
+        }
+        memcpy(entries[i].data, fetched.dptr, TO_SIZE_T(fetched.dsize));
+        entries[i].size = TO_SIZE_T(fetched.dsize);
+
+        record_cache_put(entries[i].id, entries[i].data, entries[i].size);
+    }
+
+    dbm_close(dbo->db);
+    database_unlock();
+
+    if(result != 0)
+    {
+        free_post_entries(entries, count);
+    }
+    return result;
+}
+
+int database_prepare(DBO *dbo, const char *pk_name)
+{
+    int count;
+    int result;
+
+    if(database_lock() < 0)
+    {
+        return -1;
+    }
+
+    if(database_open(dbo) < 0)
+    {
+        database_unlock();
+        return -1;
+    }
+
+    if(retrieve_int(dbo->db, pk_name, &count) < 0)
+    {
+        count = 0;
+    }
+
+    // Loaded before fork so workers start with the names and dictionary in memory
+    result = record_dictionary_load(dbo->db, &record_dict);
+    if(result == 0)
+    {
+        train_dictionary(dbo->db, count);
+
+        // Searches still work without the missing entries; the next start retries
+        if(db_index_catch_up(dbo->db, count) < 0)
+        {
+            fprintf(stderr, "Warning: failed to bring secondary indexes up to date; searches may miss entries\n");
+        }
+    }
+
+    dbm_close(dbo->db);
+    database_unlock();
+    return result;
+}
+
+int search_post_entries(DBO *dbo, const char *field, const char *value, bool prefix, int *ids, size_t max)
+{
+    int found;
+
+    if(!db_index_is_declared(field))
+    {
+        return -1;
+    }
+
+    if(database_lock() < 0)
+    {
+        return -1;
+    }
+
+    if(database_open_readonly(dbo) < 0)
+    {
+        database_unlock();
+        return 0;
+    }
+
+    found = db_index_find(dbo->db, field, value, prefix, ids, max);
+
+    dbm_close(dbo->db);
+    database_unlock();
+    return found;
+}
+
+void free_post_entries(PostEntry *entries, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        free(entries[i].data);
+        entries[i].data = NULL;
+    }
+}
+
 int retrieve_int(DBM *db, const char *key, int *result)
 {
     datum       fetched;
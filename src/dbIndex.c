@@ -0,0 +1,417 @@
+/*******************************************************************************
+ * Secondary indexes over POST form fields
+ *
+ * Each declared field gets two kinds of posting lists, stored in the same DBM
+ * file as the entries they point to:
+ *
+ *   idx:<field>:<length>:<value>    ids of entries whose field equals value
+ *   idxp:<field>:<length>:<prefix>  ids of entries whose field starts with
+ *                                   prefix, for every prefix up to
+ *                                   INDEX_MAX_PREFIX bytes
+ *
+ * A list is a counter under its own key plus fixed-size chunks under
+ * "<key>#<n>", so appending an id rewrites at most one small chunk no matter
+ * how long the list grows. The length prefix keeps a value that contains
+ * "#<n>" from naming another value's chunk. Values are the decoded form
+ * values, so "a%40b.com" and "a@b.com" match the same entries.
+ * "idxm:<field>" records how many entries the index covers, which lets
+ * indexes declared on an existing database catch up. An index that fell
+ * behind is not extended past the gap until a catch-up closes it.
+ ******************************************************************************/
+
+#include "../include/dbIndex.h"
+#include "../include/record.h"
+#include "../include/stringTools.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#pragma GCC diagnostic ignored "-Waggregate-return"
+
+#define INDEX_CHUNK_IDS 128
+#define INDEX_MAX_VALUE 128
+#define INDEX_MAX_PREFIX 8
+#define INDEX_MAX_KEY (DB_INDEX_MAX_NAME + INDEX_MAX_VALUE + 32)
+#define INDEX_META_KEY (DB_INDEX_MAX_NAME + 8)
+#define ENTRY_MAX_KEY 64
+
+static char   declared_fields[DB_INDEX_MAX_FIELDS][DB_INDEX_MAX_NAME + 1];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static size_t num_declared_fields = 0;                                         // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+int db_index_declare(const char *field)
+{
+    size_t length = strlen(field);
+
+    if(length == 0 || length > DB_INDEX_MAX_NAME || num_declared_fields == DB_INDEX_MAX_FIELDS)
+    {
+        return -1;
+    }
+
+    for(size_t i = 0; i < length; i++)
+    {
+        if(!isalnum((unsigned char)field[i]) && field[i] != '_' && field[i] != '-')
+        {
+            return -1;
+        }
+    }
+
+    if(db_index_is_declared(field))
+    {
+        return 0;
+    }
+
+    memcpy(declared_fields[num_declared_fields], field, length + 1);
+    num_declared_fields++;
+    return 0;
+}
+
+int db_index_declare_list(const char *fields)
+{
+    StringArray names;
+    int         result = 0;
+
+    // tokenizeString refuses strings without tokens
+    if(strspn(fields, ",") == strlen(fields))
+    {
+        return 0;
+    }
+
+    names = tokenizeString(fields, ",");
+    for(unsigned int i = 0; i < names.numStrings && result == 0; i++)
+    {
+        result = db_index_declare(names.strings[i]);
+        if(result != 0)
+        {
+            fprintf(stderr, "Invalid index field: %s\n", names.strings[i]);
+        }
+    }
+    freeStringArray(&names);
+    return result;
+}
+
+bool db_index_is_declared(const char *field)
+{
+    for(size_t i = 0; i < num_declared_fields; i++)
+    {
+        if(strcmp(declared_fields[i], field) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Key formatters return -1 rather than store or look up a truncated key.
+ */
+static int format_list_key(char *key, size_t size, const char *kind, const char *field, const char *value, size_t valueLength)
+{
+    int length = snprintf(key, size, "%s:%.*s:%zu:%.*s", kind, DB_INDEX_MAX_NAME, field, valueLength, (int)valueLength, value);
+
+    return length < 0 || (size_t)length >= size ? -1 : 0;
+}
+
+static int format_meta_key(char *key, size_t size, const char *field)
+{
+    int length = snprintf(key, size, "idxm:%.*s", DB_INDEX_MAX_NAME, field);
+
+    return length < 0 || (size_t)length >= size ? -1 : 0;
+}
+
+static int posting_list_append(DBM *db, const char *listKey, int id)
+{
+    char        chunkKey[INDEX_MAX_KEY + 16];
+    const_datum key_datum;
+    datum       fetched;
+    datum       updated;
+    int         count;
+    int         result;
+
+    if(retrieve_int(db, listKey, &count) < 0)
+    {
+        count = 0;
+    }
+
+    snprintf(chunkKey, sizeof(chunkKey), "%s#%d", listKey, count / INDEX_CHUNK_IDS);
+    key_datum = MAKE_CONST_DATUM(chunkKey);
+
+    // A new chunk starts empty; otherwise copy the partially filled one
+    updated.dsize = (datum_size)((size_t)(count % INDEX_CHUNK_IDS + 1) * sizeof(int));
+    updated.dptr  = (char *)malloc(TO_SIZE_T(updated.dsize));
+    if(!updated.dptr)
+    {
+        return -1;
+    }
+
+    if(count % INDEX_CHUNK_IDS != 0)
+    {
+        fetched = dbm_fetch(db, *(datum *)&key_datum);
+        if(fetched.dptr == NULL || TO_SIZE_T(fetched.dsize) != (size_t)(count % INDEX_CHUNK_IDS) * sizeof(int))
+        {
+            fprintf(stderr, "Corrupt index chunk %s\n", chunkKey);
+            free(updated.dptr);
+            return -1;
+        }
+        memcpy(updated.dptr, fetched.dptr, TO_SIZE_T(fetched.dsize));
+    }
+    memcpy(updated.dptr + TO_SIZE_T(updated.dsize) - sizeof(int), &id, sizeof(int));
+
+    result = dbm_store(db, *(datum *)&key_datum, updated, DBM_REPLACE);
+    free(updated.dptr);
+    if(result != 0)
+    {
+        return -1;
+    }
+
+    return store_int(db, listKey, count + 1) == 0 ? 0 : -1;
+}
+
+static int index_field_value(DBM *db, const char *field, int id, const char *value)
+{
+    char   listKey[INDEX_MAX_KEY];
+    size_t valueLength = strlen(value);
+
+    // Long values are indexed by their first INDEX_MAX_VALUE bytes; lookups verify
+    if(format_list_key(listKey, sizeof(listKey), "idx", field, value, valueLength < INDEX_MAX_VALUE ? valueLength : INDEX_MAX_VALUE) < 0 || posting_list_append(db, listKey, id) < 0)
+    {
+        return -1;
+    }
+
+    for(size_t length = 1; length <= valueLength && length <= INDEX_MAX_PREFIX; length++)
+    {
+        if(format_list_key(listKey, sizeof(listKey), "idxp", field, value, length) < 0 || posting_list_append(db, listKey, id) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int get_indexed_count(DBM *db, const char *field, int *count)
+{
+    char metaKey[INDEX_META_KEY];
+
+    if(format_meta_key(metaKey, sizeof(metaKey), field) < 0)
+    {
+        return -1;
+    }
+    if(retrieve_int(db, metaKey, count) < 0)
+    {
+        *count = 0;
+    }
+    return 0;
+}
+
+static int set_indexed_count(DBM *db, const char *field, int count)
+{
+    char metaKey[INDEX_META_KEY];
+
+    if(format_meta_key(metaKey, sizeof(metaKey), field) < 0)
+    {
+        return -1;
+    }
+    return store_int(db, metaKey, count) == 0 ? 0 : -1;
+}
+
+/*
+ * Loads and decodes one entry. Returns 0 on success, -1 if missing or corrupt.
+ */
+static int fetch_entry_fields(DBM *db, int id, RecordFields *fields)
+{
+    char        key[ENTRY_MAX_KEY];
+    const_datum key_datum;
+    datum       fetched;
+    void       *stored;
+    size_t      size;
+    int         result;
+
+    format_entry_key(key, sizeof(key), id);
+    key_datum = MAKE_CONST_DATUM(key);
+    fetched   = dbm_fetch(db, *(datum *)&key_datum);
+    if(fetched.dptr == NULL)
+    {
+        return -1;
+    }
+
+    // Decoding may fetch dictionary keys, which reuses the DBM buffer
+    size   = TO_SIZE_T(fetched.dsize);
+    stored = malloc(size);
+    if(!stored)
+    {
+        return -1;
+    }
+    memcpy(stored, fetched.dptr, size);
+
+    result = decode_record(db, stored, size, fields);
+    free(stored);
+    return result;
+}
+
+int db_index_add_entry(DBM *db, int id, const RecordFields *fields)
+{
+    for(size_t i = 0; i < num_declared_fields; i++)
+    {
+        const char *value = record_field_value(fields, declared_fields[i]);
+        int         indexed;
+
+        if(get_indexed_count(db, declared_fields[i], &indexed) < 0)
+        {
+            return -1;
+        }
+
+        // Left to the next catch-up, which indexes the gap and this entry in order
+        if(indexed != id)
+        {
+            continue;
+        }
+
+        if(value && index_field_value(db, declared_fields[i], id, value) < 0)
+        {
+            return -1;
+        }
+
+        if(set_indexed_count(db, declared_fields[i], id + 1) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int db_index_catch_up(DBM *db, int count)
+{
+    for(size_t i = 0; i < num_declared_fields; i++)
+    {
+        int indexed;
+
+        if(get_indexed_count(db, declared_fields[i], &indexed) < 0)
+        {
+            return -1;
+        }
+
+        if(indexed < count)
+        {
+            printf("Building index on \"%s\" for entries %d..%d\n", declared_fields[i], indexed, count - 1);
+        }
+
+        for(int id = indexed; id < count; id++)
+        {
+            RecordFields fields;
+            const char  *value;
+            int          result;
+
+            if(fetch_entry_fields(db, id, &fields) != 0)
+            {
+                continue;
+            }
+
+            value  = record_field_value(&fields, declared_fields[i]);
+            result = value ? index_field_value(db, declared_fields[i], id, value) : 0;
+            record_fields_free(&fields);
+            if(result < 0)
+            {
+                return -1;
+            }
+        }
+
+        if(indexed < count && set_indexed_count(db, declared_fields[i], count) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool entry_matches(DBM *db, int id, const char *field, const char *value, bool prefix)
+{
+    RecordFields fields;
+    const char  *actual;
+    bool         result = false;
+
+    if(fetch_entry_fields(db, id, &fields) != 0)
+    {
+        return false;
+    }
+
+    actual = record_field_value(&fields, field);
+    if(actual)
+    {
+        result = prefix ? strncmp(actual, value, strlen(value)) == 0 : strcmp(actual, value) == 0;
+    }
+    record_fields_free(&fields);
+    return result;
+}
+
+int db_index_find(DBM *db, const char *field, const char *value, bool prefix, int *ids, size_t max)
+{
+    char   listKey[INDEX_MAX_KEY];
+    size_t valueLength = strlen(value);
+    size_t found       = 0;
+    bool   verify;
+    int    result;
+    int    count;
+
+    if(!db_index_is_declared(field))
+    {
+        return -1;
+    }
+
+    // Anything longer than what the index stores is narrowed down, then checked
+    if(prefix)
+    {
+        verify = valueLength > INDEX_MAX_PREFIX;
+        result = format_list_key(listKey, sizeof(listKey), "idxp", field, value, verify ? INDEX_MAX_PREFIX : valueLength);
+    }
+    else
+    {
+        verify = valueLength >= INDEX_MAX_VALUE;
+        result = format_list_key(listKey, sizeof(listKey), "idx", field, value, verify ? INDEX_MAX_VALUE : valueLength);
+    }
+
+    if(result < 0)
+    {
+        return -1;
+    }
+    if(retrieve_int(db, listKey, &count) < 0)
+    {
+        return 0;
+    }
+
+    for(int chunk = 0; chunk * INDEX_CHUNK_IDS < count && found < max; chunk++)
+    {
+        char        chunkKey[INDEX_MAX_KEY + 16];
+        const_datum key_datum;
+        datum       fetched;
+        int        *chunkIds;
+        size_t      numIds;
+
+        snprintf(chunkKey, sizeof(chunkKey), "%s#%d", listKey, chunk);
+        key_datum = MAKE_CONST_DATUM(chunkKey);
+        fetched   = dbm_fetch(db, *(datum *)&key_datum);
+        if(fetched.dptr == NULL)
+        {
+            break;
+        }
+
+        // Copy out: verification fetches would overwrite the DBM buffer
+        numIds   = TO_SIZE_T(fetched.dsize) / sizeof(int);
+        chunkIds = (int *)malloc(numIds * sizeof(int));
+        if(!chunkIds)
+        {
+            return -1;
+        }
+        memcpy(chunkIds, fetched.dptr, numIds * sizeof(int));
+
+        for(size_t i = 0; i < numIds && found < max; i++)
+        {
+            if(verify && !entry_matches(db, chunkIds[i], field, value, prefix))
+            {
+                continue;
+            }
+            ids[found++] = chunkIds[i];
+        }
+        free(chunkIds);
+    }
+    return (int)found;
+}
@@ -2,50 +2,669 @@
 // Created by tom on 4/5/2025.
 //
 
+/*******************************************************************************
+ * db_viewer: dump, export and follow the POST database
+ *
+ * Entries are addressed by id ("entry_NNNN" up to the "entry_id" counter), so
+ * instead of walking every key with dbm_firstkey/dbm_nextkey the id range is
+ * cut into blocks that worker threads fetch and format in parallel, each with
+ * its own read-only handle. Finished blocks are written to stdout strictly in
+ * id order with one large write() per block, and at most a bounded window of
+ * blocks is in flight so memory stays flat however large the database is.
+ ******************************************************************************/
+
+#include "../include/db.h"
+#include "../include/record.h"
+#include <errno.h>
 #include <fcntl.h>
-#include <ndbm.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h> 
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#pragma GCC diagnostic ignored "-Waggregate-return"
+
+#define USAGE "Usage: %s [--format text|ndjson|csv] [--fields a,b] [--threads N] [--since ID] [--follow] [--interval MS] [db_path]\n"
+#define BLOCK_IDS 4096
+#define BLOCKS_PER_THREAD 4
+#define MAX_THREADS 64
+#define MAX_KEY 64
+#define MAX_COLUMNS RECORD_MAX_NAMES
+#define DEFAULT_INTERVAL_MS 200
+#define NS_PER_MS 1000000L
+#define MS_PER_SECOND 1000
+#define DECIMAL_BASE 10
+
+typedef enum
+{
+    FORMAT_TEXT,
+    FORMAT_NDJSON,
+    FORMAT_CSV
+} OutputFormat;
+
+typedef struct
+{
+    char  *data;
+    size_t used;
+    size_t capacity;
+    int    failed;
+} OutputBuffer;
+
+typedef struct
+{
+    OutputBuffer output;
+    int          ready;
+} BlockSlot;
+
+typedef struct
+{
+    const char       *dbPath;
+    OutputFormat      format;
+    RecordDictionary *dict;
+    const char      **columns;
+    size_t            numColumns;
+
+    // Id range being exported
+    int first;
+    int end;
+
+    // Block hand-off between the scanning threads and the writer
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    int             numBlocks;
+    int             nextToClaim;
+    int             nextToWrite;
+    int             window;
+    BlockSlot      *slots;
+    int             failed;
+} ExportJob;
+
+static void output_reserve(OutputBuffer *output, size_t extra)
+{
+    char  *grown;
+    size_t capacity;
+
+    if(output->failed || output->used + extra <= output->capacity)
+    {
+        return;
+    }
+
+    capacity = output->capacity ? output->capacity * 2 : BLOCK_IDS * 64;
+    while(capacity < output->used + extra)
+    {
+        capacity *= 2;
+    }
+
+    grown = (char *)realloc(output->data, capacity);
+    if(!grown)
+    {
+        output->failed = 1;
+        return;
+    }
+    output->data     = grown;
+    output->capacity = capacity;
+}
+
+static void output_append(OutputBuffer *output, const char *text, size_t length)
+{
+    output_reserve(output, length);
+    if(!output->failed)
+    {
+        memcpy(output->data + output->used, text, length);
+        output->used += length;
+    }
+}
+
+static void output_str(OutputBuffer *output, const char *text)
+{
+    output_append(output, text, strlen(text));
+}
+
+static void output_json_string(OutputBuffer *output, const char *text)
+{
+    output_append(output, "\"", 1);
+    for(const char *c = text; *c; c++)
+    {
+        char escaped[8];
+
+        if(*c == '"' || *c == '\\')
+        {
+            escaped[0] = '\\';
+            escaped[1] = *c;
+            output_append(output, escaped, 2);
+        }
+        else if((unsigned char)*c < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)(unsigned char)*c);
+            output_str(output, escaped);
+        }
+        else
+        {
+            output_append(output, c, 1);
+        }
+    }
+    output_append(output, "\"", 1);
+}
 
-void print_db_entries(const char *db_path)
+static void output_csv_string(OutputBuffer *output, const char *text)
+{
+    if(strpbrk(text, ",\"\r\n") == NULL)
+    {
+        output_str(output, text);
+        return;
+    }
+
+    output_append(output, "\"", 1);
+    for(const char *c = text; *c; c++)
+    {
+        output_append(output, c, 1);
+        if(*c == '"')
+        {
+            output_append(output, "\"", 1);
+        }
+    }
+    output_append(output, "\"", 1);
+}
+
+static int write_all(int fd, const char *data, size_t size)
+{
+    size_t done = 0;
+
+    while(done < size)
+    {
+        ssize_t written = write(fd, data + done, size - done);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("write failed");
+            return -1;
+        }
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Opens the database read-only. gdbm_compat opens without a lock, so this
+ * works while the server is writing.
+ */
+static DBM *open_database(const char *db_path)
 {
     DBM *db = dbm_open(db_path, O_RDONLY, 0);
+
     if(!db)
     {
         perror("Failed to open DB");
-        exit(EXIT_FAILURE);
     }
+    return db;
+}
 
-    printf("=== Contents of %s ===\n", db_path);
+static int read_entry_count(DBM *db)
+{
+    const_datum key_datum = MAKE_CONST_DATUM(POST_PK_NAME);
+    datum       fetched   = dbm_fetch(db, *(datum *)&key_datum);
+    int         count;
 
-    datum key = dbm_firstkey(db);
-    while(key.dptr != NULL)
+    if(fetched.dptr == NULL || TO_SIZE_T(fetched.dsize) != sizeof(int))
     {
-        datum value = dbm_fetch(db, key);
-        if(value.dptr != NULL)
+        return 0;
+    }
+    memcpy(&count, fetched.dptr, sizeof(int));
+    return count;
+}
+
+static void format_entry(const ExportJob *job, OutputBuffer *output, int id, const void *data, size_t size)
+{
+    RecordFields fields;
+    char         text[MAX_KEY * 2];
+
+    if(record_decode(data, size, job->dict, &fields) != 0)
+    {
+        fprintf(stderr, "entry_%04d: cannot decode record\n", id);
+        return;
+    }
+
+    switch(job->format)
+    {
+        case FORMAT_NDJSON:
+            snprintf(text, sizeof(text), "{\"id\":%d,\"fields\":{", id);
+            output_str(output, text);
+            for(size_t i = 0; i < fields.count; i++)
+            {
+                if(i > 0)
+                {
+                    output_append(output, ",", 1);
+                }
+                output_json_string(output, fields.fields[i].name);
+                output_append(output, ":", 1);
+                output_json_string(output, fields.fields[i].value);
+            }
+            output_str(output, "}}\n");
+            break;
+        case FORMAT_CSV:
+            snprintf(text, sizeof(text), "%d", id);
+            output_str(output, text);
+            for(size_t c = 0; c < job->numColumns; c++)
+            {
+                const char *value = record_field_value(&fields, job->columns[c]);
+
+                output_append(output, ",", 1);
+                output_csv_string(output, value ? value : "");
+            }
+            output_append(output, "\n", 1);
+            break;
+        case FORMAT_TEXT:
+        default:
+            snprintf(text, sizeof(text), "Key: entry_%04d\nValue: (%zu bytes stored)\n", id, size);
+            output_str(output, text);
+            for(size_t i = 0; i < fields.count; i++)
+            {
+                output_str(output, "  ");
+                output_str(output, fields.fields[i].name);
+                output_str(output, ": ");
+                output_str(output, fields.fields[i].value);
+                output_append(output, "\n", 1);
+            }
+            output_str(output, "----\n");
+            break;
+    }
+
+    record_fields_free(&fields);
+}
+
+static void export_range(const ExportJob *job, DBM *db, int first, int end, OutputBuffer *output)
+{
+    for(int id = first; id < end && !output->failed; id++)
+    {
+        char        key[MAX_KEY];
+        const_datum key_datum;
+        datum       fetched;
+
+        snprintf(key, sizeof(key), POST_ENTRY_KEY_FORMAT, id);
+        key_datum = MAKE_CONST_DATUM(key);
+        fetched   = dbm_fetch(db, *(datum *)&key_datum);
+        if(fetched.dptr != NULL)
         {
-            printf("Key: %.*s\n", key.dsize, key.dptr);
-            printf("Value: %.*s\n", value.dsize, value.dptr);
-            printf("----\n");
+            format_entry(job, output, id, fetched.dptr, TO_SIZE_T(fetched.dsize));
         }
+    }
+}
+
+static void *scan_blocks(void *arg)
+{
+    ExportJob *job = (ExportJob *)arg;
+    DBM       *db  = open_database(job->dbPath);
 
-        key = dbm_nextkey(db);
+    while(db)
+    {
+        OutputBuffer output;
+        int          block;
+        int          first;
+        int          end;
+
+        pthread_mutex_lock(&job->lock);
+        while(!job->failed && job->nextToClaim < job->numBlocks && job->nextToClaim - job->nextToWrite >= job->window)
+        {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        if(job->failed || job->nextToClaim >= job->numBlocks)
+        {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        block = job->nextToClaim++;
+        pthread_mutex_unlock(&job->lock);
+
+        memset(&output, 0, sizeof(output));
+        first = job->first + block * BLOCK_IDS;
+        end   = first + BLOCK_IDS < job->end ? first + BLOCK_IDS : job->end;
+        export_range(job, db, first, end, &output);
+
+        pthread_mutex_lock(&job->lock);
+        job->slots[block % job->window].output = output;
+        job->slots[block % job->window].ready  = 1;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
     }
 
-    dbm_close(db);
+    if(db)
+    {
+        dbm_close(db);
+    }
+    else
+    {
+        pthread_mutex_lock(&job->lock);
+        job->failed = 1;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Exports ids [first, end) using numThreads scanning threads while this
+ * thread writes finished blocks in order.
+ */
+static int export_parallel(ExportJob *job, int numThreads)
+{
+    pthread_t threads[MAX_THREADS];
+    int       started = 0;
+
+    job->numBlocks   = (job->end - job->first + BLOCK_IDS - 1) / BLOCK_IDS;
+    job->nextToClaim = 0;
+    job->nextToWrite = 0;
+    job->failed      = 0;
+    job->window      = numThreads * BLOCKS_PER_THREAD;
+    job->slots       = (BlockSlot *)calloc((size_t)job->window, sizeof(BlockSlot));
+    if(!job->slots)
+    {
+        return -1;
+    }
+
+    if(numThreads > job->numBlocks)
+    {
+        numThreads = job->numBlocks;
+    }
+    for(int i = 0; i < numThreads; i++)
+    {
+        if(pthread_create(&threads[i], NULL, scan_blocks, job) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    while(job->nextToWrite < job->numBlocks)
+    {
+        OutputBuffer output;
+        BlockSlot   *slot = &job->slots[job->nextToWrite % job->window];
+
+        pthread_mutex_lock(&job->lock);
+        while(!slot->ready && !job->failed && started > 0)
+        {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        if(!slot->ready)
+        {
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        output      = slot->output;
+        slot->ready = 0;
+        memset(&slot->output, 0, sizeof(slot->output));
+        job->nextToWrite++;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+
+        if(output.failed || write_all(STDOUT_FILENO, output.data, output.used) != 0)
+        {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_cond_broadcast(&job->changed);
+            pthread_mutex_unlock(&job->lock);
+        }
+        free(output.data);
+    }
+
+    for(int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Blocks finished after a failure were never written
+    for(int i = 0; i < job->window; i++)
+    {
+        free(job->slots[i].output.data);
+    }
+    free(job->slots);
+    return job->failed ? -1 : 0;
+}
+
+static size_t parse_columns(char *list, const char **columns)
+{
+    size_t count = 0;
+    char  *savePtr;
+
+    for(char *name = strtok_r(list, ",", &savePtr); name && count < MAX_COLUMNS; name = strtok_r(NULL, ",", &savePtr))
+    {
+        columns[count++] = name;
+    }
+    return count;
+}
+
+static int write_csv_header(const ExportJob *job)
+{
+    OutputBuffer output;
+    int          result;
+
+    memset(&output, 0, sizeof(output));
+    output_str(&output, "id");
+    for(size_t c = 0; c < job->numColumns; c++)
+    {
+        output_append(&output, ",", 1);
+        output_csv_string(&output, job->columns[c]);
+    }
+    output_append(&output, "\n", 1);
+
+    result = output.failed ? -1 : write_all(STDOUT_FILENO, output.data, output.used);
+    free(output.data);
+    return result;
+}
+
+/*
+ * Polls the entry counter and exports entries as they are committed. The
+ * counter is only advanced after the entry is stored, so everything below
+ * it is complete.
+ */
+static int follow_entries(ExportJob *job, int intervalMs)
+{
+    const struct timespec delay = {intervalMs / MS_PER_SECOND, (long)(intervalMs % MS_PER_SECOND) * NS_PER_MS};
+
+    while(1)
+    {
+        DBM         *db;
+        OutputBuffer output;
+        int          count;
+        int          result;
+
+        nanosleep(&delay, NULL);
+
+        db = open_database(job->dbPath);
+        if(!db)
+        {
+            continue;
+        }
+
+        count = read_entry_count(db);
+        if(count <= job->end)
+        {
+            dbm_close(db);
+            continue;
+        }
+
+        // New entries may use field names added since the last load
+        record_dictionary_load(db, job->dict);
+
+        memset(&output, 0, sizeof(output));
+        export_range(job, db, job->end, count, &output);
+        dbm_close(db);
+
+        result = output.failed ? -1 : write_all(STDOUT_FILENO, output.data, output.used);
+        free(output.data);
+        if(result != 0)
+        {
+            return -1;
+        }
+        job->end = count;
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    const char *db_path = "../data/db/post_data.db";    // default
+    static const struct option longOptions[] = {
+        {"format",   required_argument, NULL, 'f'},
+        {"fields",   required_argument, NULL, 'c'},
+        {"threads",  required_argument, NULL, 'j'},
+        {"since",    required_argument, NULL, 's'},
+        {"follow",   no_argument,       NULL, 'F'},
+        {"interval", required_argument, NULL, 'n'},
+        {NULL,       0,                 NULL, 0  }
+    };
+    const char      *columns[MAX_COLUMNS];
+    char            *ownedColumns[MAX_COLUMNS];
+    RecordDictionary dict;
+    ExportJob        job;
+    DBM             *db;
+    char            *fieldList  = NULL;
+    long             numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int              intervalMs = DEFAULT_INTERVAL_MS;
+    int              since      = 0;
+    int              follow     = 0;
+    int              count;
+    int              opt;
+    int              result;
+
+    memset(&job, 0, sizeof(job));
+    memset(&dict, 0, sizeof(dict));
+    job.dbPath = POST_DB_PATH;    // default
+    job.format = FORMAT_TEXT;
+
+    while((opt = getopt_long(argc, argv, "f:c:j:s:Fn:", longOptions, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'f':
+                if(strcmp(optarg, "ndjson") == 0)
+                {
+                    job.format = FORMAT_NDJSON;
+                }
+                else if(strcmp(optarg, "csv") == 0)
+                {
+                    job.format = FORMAT_CSV;
+                }
+                else if(strcmp(optarg, "text") != 0)
+                {
+                    fprintf(stderr, USAGE, argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                fieldList = optarg;
+                break;
+            case 'j':
+                numThreads = strtol(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 's':
+                since = (int)strtol(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'F':
+                follow = 1;
+                break;
+            case 'n':
+                intervalMs = (int)strtol(optarg, NULL, DECIMAL_BASE);
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
 
-    if(argc == 2)
+    if(optind < argc)
     {
-        db_path = argv[1];
+        job.dbPath = argv[optind];
+    }
+    if(numThreads < 1)
+    {
+        numThreads = 1;
+    }
+    if(numThreads > MAX_THREADS)
+    {
+        numThreads = MAX_THREADS;
+    }
+    if(intervalMs < 1)
+    {
+        intervalMs = DEFAULT_INTERVAL_MS;
     }
 
-    print_db_entries(db_path);
+    db = open_database(job.dbPath);
+    if(!db)
+    {
+        return EXIT_FAILURE;
+    }
+    if(record_dictionary_load(db, &dict) != 0)
+    {
+        fprintf(stderr, "Failed to load record dictionary\n");
+    }
+    count = read_entry_count(db);
+    dbm_close(db);
 
-    return 0;
+    job.dict = &dict;
+    if(fieldList)
+    {
+        job.numColumns = parse_columns(fieldList, columns);
+    }
+    else
+    {
+        // Every field name the database has seen, in first-seen order; copied
+        // because following reloads the dictionary
+        for(size_t i = 0; i < dict.numNames; i++)
+        {
+            ownedColumns[job.numColumns] = strdup(dict.names[i]);
+            if(ownedColumns[job.numColumns])
+            {
+                columns[job.numColumns] = ownedColumns[job.numColumns];
+                job.numColumns++;
+            }
+        }
+    }
+    job.columns = columns;
+
+    if(job.format == FORMAT_CSV && job.numColumns == 0)
+    {
+        fprintf(stderr, "No field names in %s; pass --fields\n", job.dbPath);
+        record_dictionary_free(&dict);
+        return EXIT_FAILURE;
+    }
+
+    if(job.format == FORMAT_TEXT)
+    {
+        printf("=== Contents of %s (%d entries) ===\n", job.dbPath, count);
+        fflush(stdout);
+    }
+    else if(job.format == FORMAT_CSV && write_csv_header(&job) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    job.first = since < count ? since : count;
+    job.end   = count;
+    result    = job.end > job.first ? export_parallel(&job, (int)numThreads) : 0;
+
+    if(result == 0 && follow)
+    {
+        result = follow_entries(&job, intervalMs);
+    }
+
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+
+    if(!fieldList)
+    {
+        for(size_t i = 0; i < job.numColumns; i++)
+        {
+            free(ownedColumns[i]);
+        }
+    }
+    record_dictionary_free(&dict);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -4,41 +4,74 @@
 #include "../include/shared_lib.h"
 #include <stdio.h>
 #include <string.h>
-#include <sys/socket.h>
 
 /**************************************************************
  ******WE WILL COMPILE THIS FILE AS handler_v1.so LATER********
  **************************************************************/
 
+// Fill a response object instead of writing to the socket (see shared_lib.h)
+const int handler_abi_version = HANDLER_ABI_VERSION;
+
 /**
  * Entry point for dynamic shared library.
- * This is called by the server for each HTTP request.
+ * This is called by the server for each HTTP request; the server sends the
+ * response afterwards.
  */
-int handle_request(int client_fd, const HTTPRequest *request)
+int handle_request_v2(void *context, const HTTPRequest *request, HTTPResponse *response)
 {
-    const char *not_supported;
+    (void)context;
 
     if(!request || !request->method || !request->path)
     {
-        const char *bad_req = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
-        send(client_fd, bad_req, strlen(bad_req), 0);
+        http_response_set_status(response, BAD_REQUEST_STATUS);
         return -1;
     }
 
     if(strcmp(request->method, "GET") == 0)
     {
-        return get_req_response(client_fd, request->path);
+        if(is_entries_path(request->path))
+        {
+            return get_entries_response(response, request->path);
+        }
+        if(strcmp(request->path, "/admin/shadow") == 0)
+        {
+            return admin_shadow_response(response, request);
+        }
+        if(strcmp(request->path, "/server-status") == 0)
+        {
+            return server_status_response(response, request);
+        }
+        if(strcmp(request->path, "/metrics") == 0)
+        {
+            return metrics_response(response, request);
+        }
+        if(strcmp(request->path, "/admin/profile") == 0)
+        {
+            return admin_profile_response(response, request);
+        }
+        return get_req_response(response, request->path);
     }
     if(strcmp(request->method, "HEAD") == 0)
     {
-        return head_req_response(client_fd, request->path);
+        return head_req_response(response, request->path);
     }
     if(strcmp(request->method, "POST") == 0)
     {
-        return handle_post_request(client_fd, request, request->body);
+        if(strcmp(request->path, "/admin/snapshot") == 0)
+        {
+            return admin_snapshot_response(response, request);
+        }
+        if(strncmp(request->path, "/admin/shadow/promote", strlen("/admin/shadow/promote")) == 0)
+        {
+            return admin_shadow_promote_response(response, request);
+        }
+        if(strncmp(request->path, "/admin/profile", strlen("/admin/profile")) == 0)
+        {
+            return admin_profile_start_response(response, request);
+        }
+        return handle_post_request(response, request, request->body);
     }
 
-    not_supported = "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n";
-    send(client_fd, not_supported, strlen(not_supported), 0);
+    http_response_set_status(response, METHOD_NOT_ALLOWED_STATUS);
     return -1;
 }
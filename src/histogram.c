@@ -0,0 +1,129 @@
+#include "../include/histogram.h"
+
+unsigned int histogram_bucket_at(uint64_t value, unsigned int subBits)
+{
+    unsigned int linearBits  = subBits + 1;
+    unsigned int linearCount = 1U << linearBits;
+    unsigned int subCount    = 1U << subBits;
+    unsigned int exponent;
+
+    if(value < linearCount)
+    {
+        return (unsigned int)value;
+    }
+
+    // exponent >= linearBits; the next subBits bits pick the sub-bucket
+    exponent = 63U - (unsigned int)__builtin_clzll(value);
+    return linearCount + (exponent - linearBits) * subCount + (unsigned int)((value >> (exponent - subBits)) & (subCount - 1));
+}
+
+uint64_t histogram_bucket_upper_at(unsigned int bucket, unsigned int subBits)
+{
+    unsigned int linearBits  = subBits + 1;
+    unsigned int linearCount = 1U << linearBits;
+    unsigned int subCount    = 1U << subBits;
+    unsigned int exponent;
+    uint64_t     mantissa;
+
+    if(bucket < linearCount)
+    {
+        return bucket;
+    }
+
+    exponent = (bucket - linearCount) / subCount + linearBits;
+    mantissa = subCount + (bucket - linearCount) % subCount;
+    return ((mantissa + 1) << (exponent - subBits)) - 1;
+}
+
+unsigned int histogram_bucket(uint64_t value)
+{
+    return histogram_bucket_at(value, HISTOGRAM_SUB_BITS);
+}
+
+uint64_t histogram_bucket_upper(unsigned int bucket)
+{
+    return histogram_bucket_upper_at(bucket, HISTOGRAM_SUB_BITS);
+}
+
+uint64_t histogram_buckets_percentile(const uint64_t *buckets, unsigned int subBits, uint64_t max, unsigned int perMillion)
+{
+    unsigned int count = HISTOGRAM_BUCKETS_FOR(subBits);
+    uint64_t     total = 0;
+    uint64_t     rank;
+    uint64_t     seen = 0;
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        total += buckets[i];
+    }
+    if(total == 0)
+    {
+        return 0;
+    }
+
+    rank = (perMillion * total + HISTOGRAM_PER_MILLION / 2) / HISTOGRAM_PER_MILLION;
+    if(rank == 0)
+    {
+        rank = 1;
+    }
+
+    for(unsigned int i = 0; i < count; i++)
+    {
+        seen += buckets[i];
+        if(seen >= rank)
+        {
+            uint64_t upper = histogram_bucket_upper_at(i, subBits);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+void histogram_record(Histogram *histogram, uint64_t value)
+{
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&histogram->buckets[histogram_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+
+    while(value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+void histogram_reset(Histogram *histogram)
+{
+    for(unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_store_explicit(&histogram->buckets[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&histogram->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+    atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+}
+
+uint64_t histogram_count(const Histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->count, memory_order_relaxed);
+}
+
+double histogram_mean(const Histogram *histogram)
+{
+    uint64_t count = histogram_count(histogram);
+
+    return count ? (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed) / (double)count : 0;
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, unsigned int perMillion)
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+
+    // A snapshot, so ranks are counted against the buckets rather than count,
+    // which writers bump separately
+    for(unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    }
+    return histogram_buckets_percentile(buckets, HISTOGRAM_SUB_BITS, atomic_load_explicit(&histogram->max, memory_order_relaxed), perMillion);
+}
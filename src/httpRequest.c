@@ -33,10 +33,16 @@ bool isValidHTTPMethod(const char *method)
 char *stripHTTPRequestReturnCharacters(const char *string)
 {
     StringArray stringArray;
+    char       *firstLine;
 
     stringArray = tokenizeString(string, RETURN_CHARACTERS);
 
-    return stringArray.strings[0];
+    // Keep the first line, release the rest of the array
+    firstLine              = stringArray.strings[0];
+    stringArray.strings[0] = NULL;
+    freeStringArray(&stringArray);
+
+    return firstLine;
 }
 
 HTTPRequest *initializeHTTPRequestFromString(const char *string)
@@ -63,8 +69,9 @@ HTTPRequest *initializeHTTPRequestFromString(const char *string)
         exit(EXIT_FAILURE);
     }
 
-    // Initialize the struct.
+    // Initialize the struct; it keeps its own copies of the tokens.
     *request = initializeHTTPRequest(stringArrayStruct.strings[0], stringArrayStruct.strings[1], stringArrayStruct.strings[2]);
+    freeStringArray(&stringArrayStruct);
 
     return request;
 }
@@ -95,6 +102,7 @@ HTTPRequest initializeHTTPRequest(const char *method, const char *path, const ch
     request.path     = strdup(path);
     request.protocol = strdup(protocol);
     request.body     = NULL;
+    request.clientFd = -1;
 
     return request;
 }
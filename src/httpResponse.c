@@ -0,0 +1,311 @@
+#include "../include/httpResponse.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define RESPONSE_BUFFER_MIN 256
+#define RESPONSE_HEAD_MAX 128    // status line plus the headers the server adds
+#define RESPONSE_BATCH_IOV 64
+
+static int buffer_grow(ResponseBuffer *buffer, size_t extra)
+{
+    size_t capacity;
+    char  *data;
+
+    if(buffer->capacity - buffer->length >= extra)
+    {
+        return 0;
+    }
+
+    capacity = buffer->capacity ? buffer->capacity : RESPONSE_BUFFER_MIN;
+    while(capacity - buffer->length < extra)
+    {
+        if(capacity > SIZE_MAX / 2)
+        {
+            return -1;
+        }
+        capacity *= 2;
+    }
+
+    data = (char *)realloc(buffer->data, capacity);
+    if(!data)
+    {
+        return -1;
+    }
+    buffer->data     = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static int buffer_append(ResponseBuffer *buffer, const void *data, size_t length)
+{
+    if(length == 0)
+    {
+        return 0;
+    }
+    if(buffer_grow(buffer, length) != 0)
+    {
+        return -1;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+void http_response_init(HTTPResponse *response)
+{
+    memset(response, 0, sizeof(*response));
+    response->status    = OK_STATUS;
+    response->keepAlive = true;
+}
+
+void http_response_reset(HTTPResponse *response)
+{
+    response->status         = OK_STATUS;
+    response->headers.length = 0;
+    response->body.length    = 0;
+    response->head.length    = 0;
+    response->contentLength  = 0;
+    response->headOnly       = false;
+    response->keepAlive      = true;
+    response->failed         = false;
+}
+
+void http_response_free(HTTPResponse *response)
+{
+    free(response->headers.data);
+    free(response->body.data);
+    free(response->head.data);
+    memset(response, 0, sizeof(*response));
+}
+
+void http_response_set_status(HTTPResponse *response, int status)
+{
+    response->status = status;
+}
+
+int http_response_add_header(HTTPResponse *response, const char *name, const char *value)
+{
+    if(buffer_append(&response->headers, name, strlen(name)) != 0 || buffer_append(&response->headers, ": ", 2) != 0 || buffer_append(&response->headers, value, strlen(value)) != 0 ||
+       buffer_append(&response->headers, "\r\n", 2) != 0)
+    {
+        response->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+int http_response_append(HTTPResponse *response, const void *data, size_t length)
+{
+    if(buffer_append(&response->body, data, length) != 0)
+    {
+        response->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+int http_response_append_str(HTTPResponse *response, const char *text)
+{
+    return http_response_append(response, text, strlen(text));
+}
+
+char *http_response_reserve(HTTPResponse *response, size_t length)
+{
+    if(buffer_grow(&response->body, length) != 0)
+    {
+        response->failed = true;
+        return NULL;
+    }
+    return response->body.data + response->body.length;
+}
+
+void http_response_commit(HTTPResponse *response, size_t length)
+{
+    response->body.length += length;
+}
+
+void http_response_set_head_only(HTTPResponse *response, size_t content_length)
+{
+    response->headOnly      = true;
+    response->contentLength = content_length;
+    response->body.length   = 0;
+}
+
+int http_response_set_text(HTTPResponse *response, int status, const char *content_type, const char *body)
+{
+    response->status      = status;
+    response->body.length = 0;
+    if(content_type && http_response_add_header(response, "Content-Type", content_type) != 0)
+    {
+        return -1;
+    }
+    return http_response_append_str(response, body);
+}
+
+const char *http_status_reason(int status)
+{
+    switch(status)
+    {
+        case OK_STATUS:
+            return "OK";
+        case CREATED_STATUS:
+            return "Created";
+        case BAD_REQUEST_STATUS:
+            return "Bad Request";
+        case FORBIDDEN_STATUS:
+            return "Forbidden";
+        case NOT_FOUND_STATUS:
+            return "Not Found";
+        case METHOD_NOT_ALLOWED_STATUS:
+            return "Method Not Allowed";
+        case REQUEST_TIMEOUT_STATUS:
+            return "Request Timeout";
+        case CONTENT_TOO_LARGE_STATUS:
+            return "Content Too Large";
+        case HEADERS_TOO_LARGE_STATUS:
+            return "Request Header Fields Too Large";
+        case INTERNAL_SERVER_ERROR_STATUS:
+            return "Internal Server Error";
+        case SERVICE_UNAVAILABLE_STATUS:
+            return "Service Unavailable";
+        default:
+            return "Unknown";
+    }
+}
+
+/*
+ * Writes the status line and headers into response->head.
+ */
+static int serialize_head(HTTPResponse *response)
+{
+    char   line[RESPONSE_HEAD_MAX];
+    size_t content_length;
+    int    length;
+
+    if(response->failed)
+    {
+        // A half-built body is worse than an honest error
+        response->status         = INTERNAL_SERVER_ERROR_STATUS;
+        response->headers.length = 0;
+        response->body.length    = 0;
+        response->headOnly       = false;
+    }
+
+    content_length = response->headOnly ? response->contentLength : response->body.length;
+    length         = snprintf(line,
+                      sizeof(line),
+                      "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nConnection: %s\r\n",
+                      response->status,
+                      http_status_reason(response->status),
+                      content_length,
+                      response->keepAlive ? "keep-alive" : "close");
+    if(length < 0 || (size_t)length >= sizeof(line))
+    {
+        return -1;
+    }
+
+    response->head.length = 0;
+    if(buffer_append(&response->head, line, (size_t)length) != 0 || buffer_append(&response->head, response->headers.data, response->headers.length) != 0 ||
+       buffer_append(&response->head, "\r\n", 2) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Sends every byte described by iov, waiting for the socket to drain when it
+ * would block. iov is consumed.
+ */
+static int send_iov(int client_fd, struct iovec *iov, int count)
+{
+    while(count > 0)
+    {
+        ssize_t sent = writev(client_fd, iov, count);
+        if(sent < 0)
+        {
+            struct pollfd pfd;
+            int           ready;
+
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(errno != EAGAIN)
+            {
+                perror("writev failed");
+                return -1;
+            }
+
+            pfd.fd     = client_fd;
+            pfd.events = POLLOUT;
+            ready      = poll(&pfd, 1, HTTP_RESPONSE_SEND_TIMEOUT_MS);
+            if(ready < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(ready <= 0)
+            {
+                fprintf(stderr, "Client fd %d stopped reading, dropping response\n", client_fd);
+                return -1;
+            }
+            continue;
+        }
+
+        // Skip the fully sent entries, then trim the partially sent one
+        while(count > 0 && (size_t)sent >= iov->iov_len)
+        {
+            sent -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= (size_t)sent;
+        }
+    }
+    return 0;
+}
+
+int http_response_send(int client_fd, HTTPResponse *responses, size_t count)
+{
+    struct iovec iov[RESPONSE_BATCH_IOV];
+    int          used = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        HTTPResponse *response = &responses[i];
+
+        if(serialize_head(response) != 0)
+        {
+            return -1;
+        }
+
+        if(used > RESPONSE_BATCH_IOV - 2)
+        {
+            if(send_iov(client_fd, iov, used) != 0)
+            {
+                return -1;
+            }
+            used = 0;
+        }
+
+        iov[used].iov_base = response->head.data;
+        iov[used].iov_len  = response->head.length;
+        used++;
+        if(!response->headOnly && response->body.length > 0)
+        {
+            iov[used].iov_base = response->body.data;
+            iov[used].iov_len  = response->body.length;
+            used++;
+        }
+    }
+
+    return used > 0 ? send_iov(client_fd, iov, used) : 0;
+}
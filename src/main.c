@@ -2,28 +2,55 @@
 // Created by Kiet & Tommy on 12/1/25.
 //
 
+#include "../include/accessLog.h"
+#include "../include/capture.h"
 #include "../include/client.h"
+#include "../include/cpuTopology.h"
+#include "../include/db.h"
+#include "../include/dbIndex.h"
+#include "../include/perfCounters.h"
+#include "../include/scoreboard.h"
 #include "../include/server.h"
+#include "../include/shadow.h"
 #include "../include/sigintHandler.h"
 #include "../include/stringTools.h"
+#include "../include/supervisor.h"
+#include "../include/trace.h"
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#define USAGE "Usage: -t type -i ip -p port\n"
+#define USAGE "Usage: -t type -i ip -p port [-x indexed,fields] [-z] [-s shadow_percent] [-d drain_seconds] [-w workers|min:max] [-n max_requests] [-m max_rss_mb] [-a max_age_seconds] [-r trace_percent] [-l access_log] [-f common|combined|json] [-L rotate_mb] [-c] [-P capture_percent] [-C connections] [-T threads] [-D seconds] [-R rate] [-K] [-M get:N,head:N,post:N] [-u path] [-b body_bytes] [-j json_out]\n"
+#define DECIMAL_BASE 10
+#define MS_PER_SECOND 1000
 
 // Struct to hold command-line args
 struct arguments
 {
-    char *type;
-    char *ip;
-    char *port;
+    char         *type;
+    char         *ip;
+    char         *port;
+    char         *indexes;
+    bool          compress;
+    unsigned int  shadow_percent;
+    unsigned int  drain_seconds;
+    unsigned int  trace_percent;
+    char         *access_log;
+    int           access_log_format;
+    size_t        access_log_rotate_mb;
+    bool          perf_counters;
+    unsigned int  capture_percent;
+    LoadOptions   load;
+    char         *workers;
+    RecyclePolicy recycle;
 };
 
 // Parse arguments
 static struct arguments parse_args(int argc, char *argv[]);
+// Parse -w into the worker pool bounds
+static int parse_workers(const char *spec, int *min_workers, int *max_workers);
 // Handle logic based on -t type
 static int handle_args(struct arguments args);
 
@@ -42,12 +69,27 @@ static struct arguments parse_args(int argc, char *argv[])
     struct arguments args;
 
     // Initialize struct
-    args.type = NULL;
-    args.ip   = NULL;
-    args.port = NULL;
+    args.type     = NULL;
+    args.ip       = NULL;
+    args.port     = NULL;
+    args.indexes  = NULL;
+    args.compress = false;
+
+    args.shadow_percent = 0;
+    args.drain_seconds  = 0;
+    args.trace_percent  = 0;
+
+    args.access_log           = NULL;
+    args.access_log_format    = ACCESS_LOG_COMBINED;
+    args.access_log_rotate_mb = ACCESS_LOG_ROTATE_MB;
+    args.perf_counters        = false;
+    args.capture_percent      = 0;
+    load_options_defaults(&args.load);
+    args.workers = NULL;
+    memset(&args.recycle, 0, sizeof(args.recycle));
 
     // Parse arguments
-    while((opt = getopt(argc, argv, "t:i:p:")) != -1)
+    while((opt = getopt(argc, argv, "t:i:p:x:zs:d:w:n:m:a:r:l:f:L:cP:C:T:D:R:KM:u:b:j:")) != -1)
     {
         switch(opt)
         {
@@ -60,13 +102,86 @@ static struct arguments parse_args(int argc, char *argv[])
             case 'p':
                 args.port = optarg;
                 break;
+            case 'x':
+                args.indexes = optarg;
+                break;
+            case 'z':
+                args.compress = true;
+                break;
+            case 's':
+                args.shadow_percent = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'd':
+                args.drain_seconds = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'w':
+                args.workers = optarg;
+                break;
+            case 'n':
+                args.recycle.maxRequests = strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'm':
+                args.recycle.maxRssMb = strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'a':
+                args.recycle.maxAgeSeconds = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'r':
+                args.trace_percent = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'l':
+                args.access_log = optarg;
+                break;
+            case 'f':
+                args.access_log_format = access_log_parse_format(optarg);
+                break;
+            case 'L':
+                args.access_log_rotate_mb = strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'c':
+                args.perf_counters = true;
+                break;
+            case 'P':
+                args.capture_percent = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'C':
+                args.load.connections = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'T':
+                args.load.threads = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'D':
+                args.load.seconds = (unsigned int)strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'R':
+                args.load.rate = strtod(optarg, NULL);
+                break;
+            case 'K':
+                args.load.keepAlive = false;
+                break;
+            case 'M':
+                if(load_parse_mix(optarg, &args.load) != 0)
+                {
+                    fprintf(stderr, "Invalid request mix: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                args.load.path = optarg;
+                break;
+            case 'b':
+                args.load.bodyBytes = strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'j':
+                args.load.jsonPath = optarg;
+                break;
             default:
-                fprintf(stderr, "Usage: %s -t type -i ip -p port\n", argv[0]);
+                fprintf(stderr, USAGE);
                 exit(EXIT_FAILURE);
         }
     }
 
-    if(!args.type || !args.ip || !args.port || !checkIfCharInString(args.ip, '.') || checkIfCharInString(args.port, '.'))
+    if(!args.type || !args.ip || args.access_log_format < 0 || !args.port || !checkIfCharInString(args.ip, '.') || checkIfCharInString(args.port, '.'))
     {
         fprintf(stderr, USAGE);
         exit(EXIT_FAILURE);
@@ -90,18 +205,71 @@ static int handle_args(struct arguments args)
 
     if(strcmp(args.type, "client") == 0)
     {
-        // client
-        return connect_client(serverInformation);
+        // Load generator
+        return connect_client(serverInformation, &args.load);
     }
 
     if(strcmp(args.type, "server") == 0)
     {
-        const char *so_path     = "../data/handler/handler_v1.so";
-        int         num_workers = 4;
+        const char *so_path = "../data/handler/handler_v1.so";
+        int         min_workers;
+        int         max_workers;
+
+        // Sized from the CPUs we may use unless -w says otherwise
+        if(parse_workers(args.workers, &min_workers, &max_workers) != 0)
+        {
+            fprintf(stderr, USAGE);
+            return 1;
+        }
+
+        // Secondary indexes on POST form fields, maintained by every worker
+        if(db_index_declare_list(args.indexes ? args.indexes : DEFAULT_INDEXED_FIELDS) != 0)
+        {
+            return 1;
+        }
 
-        printf("Starting pre-fork server on %s:%s with %d workers using %s\n", args.ip, args.port, num_workers, so_path);
+        // Compress new records with a dictionary trained from recent ones
+        database_set_compression(args.compress);
 
-        return start_prefork_server(args.ip, args.port, so_path, num_workers);
+        // Run a sample of GET/HEAD traffic through *.candidate.so handlers as well
+        if(shadow_init(args.shadow_percent) != 0)
+        {
+            return 1;
+        }
+
+        // Per-phase timings of a sample of requests, one ring per worker
+        if(trace_init(args.trace_percent, max_workers) != 0)
+        {
+            return 1;
+        }
+
+        // Workers queue access log records; a logger process formats and writes them
+        if(access_log_init(args.access_log, (AccessLogFormat)args.access_log_format, args.access_log_rotate_mb, max_workers) != 0)
+        {
+            return 1;
+        }
+
+        // perf_event_open counters around each handler call, per route and method
+        if(perf_counters_init(args.perf_counters) != 0)
+        {
+            return 1;
+        }
+
+        // Raw requests of a sample of connections, for replay
+        if(capture_init(args.capture_percent) != 0)
+        {
+            return 1;
+        }
+
+        // How long a shutdown waits for in-flight requests before killing workers
+        supervisor_set_drain_timeout(args.drain_seconds * MS_PER_SECOND);
+
+        // Replace workers before slow leaks or fragmentation add up
+        supervisor_set_recycle(&args.recycle);
+
+        printf("Starting pre-fork server on %s:%s with %d-%d workers using %s\n", args.ip, args.port, min_workers, max_workers, so_path);
+
+        return start_prefork_server(args.ip, args.port, so_path, min_workers, max_workers);
     }
 
     // Handle invalid type case
@@ -112,3 +280,29 @@ static int handle_args(struct arguments args)
             USAGE);
     return 1;
 }
+
+static int parse_workers(const char *spec, int *min_workers, int *max_workers)
+{
+    char *end;
+
+    if(!spec)
+    {
+        *min_workers = cpu_topology_budget();
+        *max_workers = *min_workers * SUPERVISOR_MAX_WORKERS_PER_CPU;
+        return 0;
+    }
+
+    // "n" is a fixed pool, "min:max" lets it scale
+    *min_workers = (int)strtol(spec, &end, DECIMAL_BASE);
+    *max_workers = *min_workers;
+    if(*end == ':')
+    {
+        *max_workers = (int)strtol(end + 1, &end, DECIMAL_BASE);
+    }
+
+    if(*end != '\0' || *min_workers < 1 || *max_workers < *min_workers || *max_workers > SCOREBOARD_MAX_WORKERS)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "../include/perfCounters.h"
+#include "../include/scoreboard.h"
+#include "../include/sharedMemory.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define REPORT_LINE 512
+
+typedef struct
+{
+    atomic_ulong calls;
+    atomic_ulong events[PERF_EVENT_COUNT];
+} PerfClass;
+
+typedef struct
+{
+    atomic_uint available;    // bit per PerfEvent some worker could open
+    PerfClass   classes[SCOREBOARD_MAX_ROUTES][PERF_METHOD_COUNT];
+} PerfTotals;
+
+static const struct
+{
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+} perf_events[PERF_EVENT_COUNT] = {
+    {"instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS     },
+    {"cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES       },
+    {"cache_misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES     },
+    {"task_clock_ns",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK       },
+    {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    {"page_faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS      },
+};
+
+static const char *const perf_method_names[PERF_METHOD_COUNT] = {"GET", "HEAD", "POST", "other"};
+
+static PerfTotals *perf_totals = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// This worker's group: the leader's fd and which event each value read belongs to
+static int       group_fd     = -1;                  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int       group_size   = 0;                   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static PerfEvent group_events[PERF_EVENT_COUNT];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+int perf_counters_init(bool enabled)
+{
+    if(!enabled)
+    {
+        return 0;
+    }
+
+    perf_totals = (PerfTotals *)shared_memory_create(sizeof(PerfTotals));
+    return perf_totals ? 0 : -1;
+}
+
+bool perf_counters_enabled(void)
+{
+    return perf_totals != NULL;
+}
+
+/*
+ * Counts this process only, on any CPU. User-space only is retried when the
+ * kernel refuses to count kernel time (perf_event_paranoid >= 2); switches
+ * and faults then undercount, instructions and cycles do not.
+ */
+static int open_event(PerfEvent event, int leader)
+{
+    struct perf_event_attr attributes;
+    int                    fd;
+
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size        = sizeof(attributes);
+    attributes.type        = perf_events[event].type;
+    attributes.config      = perf_events[event].config;
+    attributes.read_format = PERF_FORMAT_GROUP;
+    attributes.disabled    = leader < 0;
+    attributes.exclude_hv  = 1;
+
+    fd = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    if(fd < 0 && (errno == EACCES || errno == EPERM))
+    {
+        attributes.exclude_kernel = 1;
+        fd                        = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+void perf_counters_worker_start(void)
+{
+    unsigned int opened = 0;
+    int          error  = 0;
+
+    if(!perf_totals)
+    {
+        return;
+    }
+
+    // One group, so every event is read in a single read() and covers the same interval
+    for(int i = 0; i < PERF_EVENT_COUNT; i++)
+    {
+        int fd = open_event((PerfEvent)i, group_fd);
+
+        if(fd < 0)
+        {
+            error = errno;
+            continue;
+        }
+        if(group_fd < 0)
+        {
+            group_fd = fd;
+        }
+        group_events[group_size++] = (PerfEvent)i;
+        opened |= 1U << i;
+    }
+
+    if(group_fd < 0)
+    {
+        fprintf(stderr, "[Worker %d] perf_event_open: %s; running without counters\n", getpid(), strerror(error));
+        return;
+    }
+
+    ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    atomic_fetch_or_explicit(&perf_totals->available, opened, memory_order_relaxed);
+}
+
+static bool read_group(uint64_t values[PERF_EVENT_COUNT])
+{
+    uint64_t buffer[1 + PERF_EVENT_COUNT];
+    ssize_t  bytes = read(group_fd, buffer, sizeof(buffer));
+
+    if(bytes < (ssize_t)sizeof(uint64_t) || buffer[0] != (uint64_t)group_size)
+    {
+        return false;
+    }
+    for(int i = 0; i < group_size; i++)
+    {
+        values[group_events[i]] = buffer[1 + i];
+    }
+    return true;
+}
+
+void perf_counters_begin(PerfSnapshot *snapshot)
+{
+    snapshot->valid = group_fd >= 0 && read_group(snapshot->values);
+}
+
+static PerfMethod perf_method(const char *method)
+{
+    if(strcmp(method, "GET") == 0)
+    {
+        return PERF_METHOD_GET;
+    }
+    if(strcmp(method, "HEAD") == 0)
+    {
+        return PERF_METHOD_HEAD;
+    }
+    if(strcmp(method, "POST") == 0)
+    {
+        return PERF_METHOD_POST;
+    }
+    return PERF_METHOD_OTHER;
+}
+
+void perf_counters_end(const PerfSnapshot *snapshot, int route, const char *method)
+{
+    uint64_t   values[PERF_EVENT_COUNT];
+    PerfClass *totals;
+
+    if(!snapshot->valid || route < 0 || route >= SCOREBOARD_MAX_ROUTES || !read_group(values))
+    {
+        return;
+    }
+
+    totals = &perf_totals->classes[route][perf_method(method)];
+    atomic_fetch_add_explicit(&totals->calls, 1, memory_order_relaxed);
+    for(int i = 0; i < group_size; i++)
+    {
+        PerfEvent event = group_events[i];
+
+        atomic_fetch_add_explicit(&totals->events[event], values[event] - snapshot->values[event], memory_order_relaxed);
+    }
+}
+
+void perf_counters_calls_metrics(HTTPResponse *response, int route, const char *route_label)
+{
+    char line[REPORT_LINE];
+
+    if(!perf_totals || route < 0 || route >= SCOREBOARD_MAX_ROUTES)
+    {
+        return;
+    }
+
+    for(int m = 0; m < PERF_METHOD_COUNT; m++)
+    {
+        unsigned long calls = atomic_load_explicit(&perf_totals->classes[route][m].calls, memory_order_relaxed);
+
+        if(calls == 0)
+        {
+            continue;
+        }
+        snprintf(line, sizeof(line), "app_perf_calls_total{route=\"%s\",method=\"%s\"} %lu\n", route_label, perf_method_names[m], calls);
+        http_response_append_str(response, line);
+    }
+}
+
+void perf_counters_events_metrics(HTTPResponse *response, int route, const char *route_label)
+{
+    char         line[REPORT_LINE];
+    unsigned int available;
+
+    if(!perf_totals || route < 0 || route >= SCOREBOARD_MAX_ROUTES)
+    {
+        return;
+    }
+
+    available = atomic_load_explicit(&perf_totals->available, memory_order_relaxed);
+    for(int m = 0; m < PERF_METHOD_COUNT; m++)
+    {
+        const PerfClass *totals = &perf_totals->classes[route][m];
+
+        if(atomic_load_explicit(&totals->calls, memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+        for(int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            if(!(available & (1U << e)))
+            {
+                continue;
+            }
+            snprintf(line,
+                     sizeof(line),
+                     "app_perf_events_total{route=\"%s\",method=\"%s\",event=\"%s\"} %lu\n",
+                     route_label,
+                     perf_method_names[m],
+                     perf_events[e].name,
+                     atomic_load_explicit(&totals->events[e], memory_order_relaxed));
+            http_response_append_str(response, line);
+        }
+    }
+}
@@ -0,0 +1,492 @@
+#include "../include/profiler.h"
+#include "../include/scoreboard.h"
+#include "../include/sharedMemory.h"
+#include "../include/sigintHandler.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define WORKER_MASK_BITS 64
+#define WORKER_MASK_WORDS (SCOREBOARD_MAX_WORKERS / WORKER_MASK_BITS)
+#define FRAME_NAME_MAX 128
+#define DECIMAL_BASE 10
+
+typedef struct
+{
+    uint32_t  depth;
+    uintptr_t frames[PROFILER_MAX_DEPTH];    // leaf first
+} ProfileSample;
+
+/*
+ * Written only by its worker, from the SIGPROF handler; count is published
+ * after the sample it covers so any worker can build the report.
+ */
+typedef struct
+{
+    _Atomic(uint32_t) run;
+    _Atomic(uint32_t) count;
+    _Atomic(uint32_t) dropped;
+    ProfileSample     samples[PROFILER_MAX_SAMPLES];
+} ProfileBuffer;
+
+/*
+ * The current run. Arming writes the parameters, then bumps run; workers
+ * notice the new number in profiler_poll.
+ */
+typedef struct
+{
+    _Atomic(uint32_t) run;
+    uint32_t          seconds;
+    uint32_t          hz;
+    uint64_t          workers[WORKER_MASK_WORDS];
+    ProfileBuffer     buffers[];
+} Profiler;
+
+static Profiler *profiler         = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int       profiler_workers = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Per-worker sampler state
+static ProfileBuffer *own_buffer   = NULL;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int            own_index    = -1;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint32_t       seen_run     = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static timer_t        sample_timer;            // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static bool           timer_created = false;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static bool           timer_running = false;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uintptr_t      stack_low    = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uintptr_t      stack_high   = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint64_t       sample_until = 0;        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Shared with the SIGPROF handler
+static volatile sig_atomic_t sampling = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static volatile sig_atomic_t woken    = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * Walks the frame-pointer chain from the interrupted context. Every frame
+ * pointer is checked against this thread's stack before it is dereferenced,
+ * so code built without frame pointers yields a short stack, not a fault.
+ */
+static void record_sample(const ucontext_t *context)
+{
+    uint32_t       index = atomic_load_explicit(&own_buffer->count, memory_order_relaxed);
+    ProfileSample *sample;
+    uintptr_t      frame;
+
+    if(index >= PROFILER_MAX_SAMPLES)
+    {
+        atomic_fetch_add_explicit(&own_buffer->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    sample = &own_buffer->samples[index];
+#if defined(__x86_64__)
+    sample->frames[0] = (uintptr_t)context->uc_mcontext.gregs[REG_RIP];
+    frame             = (uintptr_t)context->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    sample->frames[0] = (uintptr_t)context->uc_mcontext.pc;
+    frame             = (uintptr_t)context->uc_mcontext.regs[29];
+#else
+    (void)context;
+    sample->frames[0] = 0;
+    frame             = 0;
+#endif
+    sample->depth = 1;
+
+    while(sample->depth < PROFILER_MAX_DEPTH && frame >= stack_low && frame + 2 * sizeof(uintptr_t) <= stack_high && frame % sizeof(uintptr_t) == 0)
+    {
+        const uintptr_t *saved = (const uintptr_t *)frame;
+
+        if(saved[1] == 0)
+        {
+            break;
+        }
+        sample->frames[sample->depth++] = saved[1];
+
+        // The chain only ever moves up the stack
+        if(saved[0] <= frame)
+        {
+            break;
+        }
+        frame = saved[0];
+    }
+
+    atomic_store_explicit(&own_buffer->count, index + 1, memory_order_release);
+}
+
+/*
+ * Timer ticks take a sample; a SIGPROF sent by kill() only wakes the worker
+ * (interrupting its poll) so profiler_poll runs.
+ */
+static void profileSignalHandler(int sig_num, siginfo_t *info, void *context)
+{
+    int saved_errno = errno;
+
+    (void)sig_num;
+    if(info->si_code != SI_TIMER)
+    {
+        woken = 1;
+    }
+    else if(sampling)
+    {
+        if(monotonic_ns() >= sample_until)
+        {
+            sampling = 0;
+        }
+        else
+        {
+            record_sample((const ucontext_t *)context);
+        }
+    }
+    errno = saved_errno;
+}
+
+int profiler_init(int max_workers)
+{
+    profiler = (Profiler *)shared_memory_create(sizeof(Profiler) + sizeof(ProfileBuffer) * (size_t)max_workers);
+    if(!profiler)
+    {
+        return -1;
+    }
+    profiler_workers = max_workers;
+    return 0;
+}
+
+void profiler_worker_start(int worker)
+{
+    struct sigaction sa;
+
+    if(!profiler || worker < 0 || worker >= profiler_workers)
+    {
+        return;
+    }
+
+    own_index  = worker;
+    own_buffer = &profiler->buffers[worker];
+    seen_run   = atomic_load_explicit(&profiler->run, memory_order_acquire);
+
+    memset(&sa, 0, sizeof(sa));
+    set_sigaction_action(&sa, profileSignalHandler);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGPROF, &sa, NULL) < 0)
+    {
+        perror("sigaction SIGPROF");
+        own_buffer = NULL;
+    }
+}
+
+static bool worker_selected(const Profiler *control, int worker)
+{
+    return (control->workers[worker / WORKER_MASK_BITS] >> (worker % WORKER_MASK_BITS)) & 1U;
+}
+
+int profiler_arm(unsigned int seconds, unsigned int hz, const char *workers)
+{
+    uint64_t mask[WORKER_MASK_WORDS] = {0};
+    uint32_t run;
+
+    if(!profiler)
+    {
+        return -1;
+    }
+
+    for(const char *cursor = workers; cursor && *cursor;)
+    {
+        char *end;
+        long  worker = strtol(cursor, &end, DECIMAL_BASE);
+
+        if(end == cursor || worker < 0 || worker >= profiler_workers || (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        mask[worker / WORKER_MASK_BITS] |= 1ULL << (worker % WORKER_MASK_BITS);
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    for(int i = 0; !workers && i < profiler_workers; i++)
+    {
+        mask[i / WORKER_MASK_BITS] |= 1ULL << (i % WORKER_MASK_BITS);
+    }
+
+    profiler->seconds = seconds == 0 ? PROFILER_DEFAULT_SECONDS : (seconds > PROFILER_MAX_SECONDS ? PROFILER_MAX_SECONDS : seconds);
+    profiler->hz      = hz == 0 ? PROFILER_DEFAULT_HZ : (hz > PROFILER_MAX_HZ ? PROFILER_MAX_HZ : hz);
+    memcpy(profiler->workers, mask, sizeof(mask));
+    run = atomic_fetch_add_explicit(&profiler->run, 1, memory_order_release) + 1;
+
+    // Workers blocked in accept would only notice with their next connection
+    for(int i = 0; i < profiler_workers; i++)
+    {
+        const WorkerScore *score = scoreboard_worker(i);
+        pid_t              pid   = score ? atomic_load_explicit(&score->pid, memory_order_relaxed) : 0;
+
+        if(i != own_index && pid > 0 && worker_selected(profiler, i))
+        {
+            kill(pid, SIGPROF);
+        }
+    }
+    return (int)run;
+}
+
+static void stop_sampling(void)
+{
+    struct itimerspec off;
+
+    sampling = 0;
+    if(timer_running)
+    {
+        memset(&off, 0, sizeof(off));
+        timer_settime(sample_timer, 0, &off, NULL);
+        timer_running = false;
+    }
+}
+
+static void start_sampling(uint32_t run)
+{
+    struct sigevent   event;
+    struct itimerspec interval;
+    long              period = (long)(NANOSECONDS_PER_SECOND / profiler->hz);
+
+    // Bounds for the frame-pointer walk; the main thread's stack does not move
+    if(stack_high == 0)
+    {
+        pthread_attr_t attributes;
+        void          *low;
+        size_t         size;
+
+        if(pthread_getattr_np(pthread_self(), &attributes) == 0)
+        {
+            if(pthread_attr_getstack(&attributes, &low, &size) == 0)
+            {
+                stack_low  = (uintptr_t)low;
+                stack_high = (uintptr_t)low + size;
+            }
+            pthread_attr_destroy(&attributes);
+        }
+    }
+
+    if(!timer_created)
+    {
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify = SIGEV_SIGNAL;
+        event.sigev_signo  = SIGPROF;
+        if(timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &sample_timer) != 0)
+        {
+            perror("timer_create");
+            return;
+        }
+        timer_created = true;
+    }
+
+    atomic_store_explicit(&own_buffer->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&own_buffer->dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&own_buffer->run, run, memory_order_release);
+    sample_until = monotonic_ns() + (uint64_t)profiler->seconds * NANOSECONDS_PER_SECOND;
+    sampling     = 1;
+
+    interval.it_interval.tv_sec  = 0;
+    interval.it_interval.tv_nsec = period;
+    interval.it_value            = interval.it_interval;
+    if(timer_settime(sample_timer, 0, &interval, NULL) != 0)
+    {
+        perror("timer_settime");
+        sampling = 0;
+        return;
+    }
+    timer_running = true;
+}
+
+void profiler_poll(void)
+{
+    uint32_t run;
+
+    if(!own_buffer)
+    {
+        return;
+    }
+
+    run = atomic_load_explicit(&profiler->run, memory_order_acquire);
+    if(run != seen_run)
+    {
+        seen_run = run;
+        woken    = 0;
+        stop_sampling();
+        if(worker_selected(profiler, own_index))
+        {
+            start_sampling(run);
+        }
+        return;
+    }
+
+    // kill -PROF <worker>: profile just this worker
+    if(woken)
+    {
+        char self[DECIMAL_BASE + 2];
+
+        woken = 0;
+        snprintf(self, sizeof(self), "%d", own_index);
+        profiler_arm(0, 0, self);
+        profiler_poll();
+        return;
+    }
+
+    // The handler stops sampling at the deadline; the timer is stopped here
+    if(timer_running && !sampling)
+    {
+        stop_sampling();
+    }
+}
+
+/*
+ * Appends one frame's name: the symbol if the dynamic symbol table has it,
+ * otherwise object+offset. Return addresses are looked up one byte back so
+ * a call at the very end of a function is not blamed on the next one.
+ */
+static size_t append_frame(char *line, size_t length, size_t size, uintptr_t address, bool return_address)
+{
+    Dl_info info;
+    int     found;
+    int     written;
+
+    if(return_address)
+    {
+        address--;
+    }
+
+    // info is only filled in when dladdr finds the address
+    found = dladdr((void *)address, &info);
+    if(found && info.dli_sname)
+    {
+        written = snprintf(line + length, size - length, ";%s", info.dli_sname);
+    }
+    else if(found && info.dli_fname)
+    {
+        char object[FRAME_NAME_MAX];
+
+        snprintf(object, sizeof(object), "%s", info.dli_fname);
+        written = snprintf(line + length, size - length, ";%s+0x%lx", basename(object), (unsigned long)(address - (uintptr_t)info.dli_fbase));
+    }
+    else
+    {
+        written = snprintf(line + length, size - length, ";0x%lx", (unsigned long)address);
+    }
+
+    if(written < 0 || (size_t)written >= size - length)
+    {
+        return size - 1;
+    }
+    return length + (size_t)written;
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int profiler_report(HTTPResponse *response)
+{
+    char     header[FRAME_NAME_MAX];
+    char   **lines;
+    size_t   numLines = 0;
+    size_t   capacity = 0;
+    uint64_t dropped  = 0;
+    uint32_t run;
+
+    if(!profiler)
+    {
+        return http_response_set_text(response, SERVICE_UNAVAILABLE_STATUS, "text/plain", "profiler not enabled\n");
+    }
+
+    run = atomic_load_explicit(&profiler->run, memory_order_acquire);
+    for(int i = 0; i < profiler_workers; i++)
+    {
+        if(atomic_load_explicit(&profiler->buffers[i].run, memory_order_acquire) == run)
+        {
+            capacity += atomic_load_explicit(&profiler->buffers[i].count, memory_order_acquire);
+        }
+    }
+
+    lines = (char **)calloc(capacity ? capacity : 1, sizeof(char *));
+    if(!lines)
+    {
+        http_response_set_status(response, INTERNAL_SERVER_ERROR_STATUS);
+        return -1;
+    }
+
+    // One line per sample, root first, so identical stacks sort together
+    for(int i = 0; i < profiler_workers; i++)
+    {
+        const ProfileBuffer *buffer = &profiler->buffers[i];
+        uint32_t             count;
+
+        if(atomic_load_explicit(&buffer->run, memory_order_acquire) != run)
+        {
+            continue;
+        }
+        count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+        dropped += atomic_load_explicit(&buffer->dropped, memory_order_relaxed);
+
+        for(uint32_t s = 0; s < count && numLines < capacity; s++)
+        {
+            const ProfileSample *sample = &buffer->samples[s];
+            char                 line[PROFILER_MAX_DEPTH * FRAME_NAME_MAX];
+            size_t               length = (size_t)snprintf(line, sizeof(line), "worker %d", i);
+
+            for(uint32_t f = sample->depth; f > 0; f--)
+            {
+                length = append_frame(line, length, sizeof(line), sample->frames[f - 1], f > 1);
+            }
+            lines[numLines] = strdup(line);
+            if(lines[numLines])
+            {
+                numLines++;
+            }
+        }
+    }
+
+    qsort(lines, numLines, sizeof(char *), compare_lines);
+
+    http_response_add_header(response, "Content-Type", "text/plain");
+    snprintf(header, sizeof(header), "%u", run);
+    http_response_add_header(response, "X-Profile-Run", header);
+    snprintf(header, sizeof(header), "%llu", (unsigned long long)dropped);
+    http_response_add_header(response, "X-Profile-Dropped", header);
+
+    for(size_t i = 0; i < numLines;)
+    {
+        size_t same = 1;
+        char   count[FRAME_NAME_MAX];
+
+        while(i + same < numLines && strcmp(lines[i], lines[i + same]) == 0)
+        {
+            same++;
+        }
+        http_response_append_str(response, lines[i]);
+        snprintf(count, sizeof(count), " %zu\n", same);
+        http_response_append_str(response, count);
+        i += same;
+    }
+
+    for(size_t i = 0; i < numLines; i++)
+    {
+        free(lines[i]);
+    }
+    free(lines);
+    return response->failed ? -1 : 0;
+}
@@ -0,0 +1,666 @@
+/*******************************************************************************
+ * Compact binary record encoding for stored POST entries
+ *
+ * A record is a two byte header (RECORD_MAGIC, flags) followed by the field
+ * section:
+ *
+ *   varint count
+ *   count times: varint nameId  (0 = name follows inline as varint length + bytes)
+ *                varint valueLength, value bytes (URL-decoded)
+ *
+ * With RECORD_FLAG_COMPRESSED the header is followed by varint dictionaryId,
+ * varint fieldSectionLength and the field section as a raw deflate stream,
+ * primed with the trained dictionary when dictionaryId is not 0.
+ *
+ * Field names and the trained dictionary live in the database under "__"
+ * keys, so any reader of the database (workers, db_viewer) can decode it.
+ * Entries written before this format are plain URL-encoded text and are
+ * still decoded.
+ ******************************************************************************/
+
+#include "../include/record.h"
+#include "../include/stringTools.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#pragma GCC diagnostic ignored "-Waggregate-return"
+
+#define RECORD_HEADER_SIZE 2
+#define RECORD_NAME_KEY_PREFIX "__field:"
+#define RECORD_NAME_COUNT_KEY "__fieldcount"
+#define RECORD_ZDICT_KEY "__zdict"
+#define RECORD_MAX_KEY 64
+#define VARINT_MAX_BYTES 10
+#define VARINT_PAYLOAD_BITS 7
+#define VARINT_PAYLOAD_MASK 0x7F
+#define VARINT_CONTINUE 0x80
+#define DEFLATE_RAW_WINDOW_BITS (-15)
+#define DEFLATE_MEM_LEVEL 8
+
+typedef struct
+{
+    unsigned char *data;
+    size_t         used;
+    size_t         capacity;
+    int            failed;
+} ByteBuffer;
+
+static void buffer_reserve(ByteBuffer *buffer, size_t extra)
+{
+    unsigned char *grown;
+    size_t         capacity;
+
+    if(buffer->failed || buffer->used + extra <= buffer->capacity)
+    {
+        return;
+    }
+
+    capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+    while(capacity < buffer->used + extra)
+    {
+        capacity *= 2;
+    }
+
+    grown = (unsigned char *)realloc(buffer->data, capacity);
+    if(!grown)
+    {
+        buffer->failed = 1;
+        return;
+    }
+    buffer->data     = grown;
+    buffer->capacity = capacity;
+}
+
+static void buffer_put(ByteBuffer *buffer, const void *bytes, size_t length)
+{
+    buffer_reserve(buffer, length);
+    if(!buffer->failed)
+    {
+        memcpy(buffer->data + buffer->used, bytes, length);
+        buffer->used += length;
+    }
+}
+
+static void buffer_put_varint(ByteBuffer *buffer, uint64_t value)
+{
+    unsigned char bytes[VARINT_MAX_BYTES];
+    size_t        length = 0;
+
+    do
+    {
+        bytes[length] = (unsigned char)(value & VARINT_PAYLOAD_MASK);
+        value >>= VARINT_PAYLOAD_BITS;
+        if(value)
+        {
+            bytes[length] |= VARINT_CONTINUE;
+        }
+        length++;
+    } while(value);
+
+    buffer_put(buffer, bytes, length);
+}
+
+static int read_varint(const unsigned char **cursor, const unsigned char *end, uint64_t *value)
+{
+    unsigned int shift = 0;
+
+    *value = 0;
+    while(*cursor < end && shift < VARINT_MAX_BYTES * VARINT_PAYLOAD_BITS)
+    {
+        unsigned char byte = *(*cursor)++;
+
+        *value |= (uint64_t)(byte & VARINT_PAYLOAD_MASK) << shift;
+        if(!(byte & VARINT_CONTINUE))
+        {
+            return 0;
+        }
+        shift += VARINT_PAYLOAD_BITS;
+    }
+    return -1;
+}
+
+int record_parse_body(const char *body, RecordFields *fields)
+{
+    StringArray pairs;
+
+    fields->fields = NULL;
+    fields->count  = 0;
+
+    // tokenizeString refuses strings without tokens
+    if(strspn(body, "&") == strlen(body))
+    {
+        return 0;
+    }
+
+    pairs          = parseKeyValueBody(body);
+    fields->fields = (RecordField *)calloc(pairs.numStrings, sizeof(RecordField));
+    if(!fields->fields)
+    {
+        freeStringArray(&pairs);
+        return -1;
+    }
+
+    for(unsigned int i = 0; i < pairs.numStrings; i++)
+    {
+        const char  *equalSign = strchr(pairs.strings[i], '=');
+        RecordField *field     = &fields->fields[fields->count];
+        char        *rawName;
+        char        *rawValue;
+
+        rawName  = strndup(pairs.strings[i], equalSign ? (size_t)(equalSign - pairs.strings[i]) : strlen(pairs.strings[i]));
+        rawValue = extractValueFromPair(pairs.strings[i]);
+
+        field->name  = rawName ? urlDecode(rawName) : NULL;
+        field->value = urlDecode(rawValue ? rawValue : "");
+        free(rawName);
+        free(rawValue);
+
+        if(!field->name || !field->value)
+        {
+            free(field->name);
+            free(field->value);
+            freeStringArray(&pairs);
+            record_fields_free(fields);
+            return -1;
+        }
+        field->valueLength = strlen(field->value);
+        fields->count++;
+    }
+
+    freeStringArray(&pairs);
+    return 0;
+}
+
+void record_fields_free(RecordFields *fields)
+{
+    for(size_t i = 0; i < fields->count; i++)
+    {
+        free(fields->fields[i].name);
+        free(fields->fields[i].value);
+    }
+    free(fields->fields);
+    fields->fields = NULL;
+    fields->count  = 0;
+}
+
+const char *record_field_value(const RecordFields *fields, const char *name)
+{
+    for(size_t i = 0; i < fields->count; i++)
+    {
+        if(strcmp(fields->fields[i].name, name) == 0)
+        {
+            return fields->fields[i].value;
+        }
+    }
+    return NULL;
+}
+
+static unsigned int find_name_id(const RecordDictionary *dict, const char *name)
+{
+    for(size_t i = 0; i < dict->numNames; i++)
+    {
+        if(strcmp(dict->names[i], name) == 0)
+        {
+            return (unsigned int)i + 1;
+        }
+    }
+    return 0;
+}
+
+static void encode_field_section(ByteBuffer *buffer, const RecordFields *fields, const RecordDictionary *dict)
+{
+    buffer_put_varint(buffer, fields->count);
+    for(size_t i = 0; i < fields->count; i++)
+    {
+        unsigned int nameId = find_name_id(dict, fields->fields[i].name);
+
+        buffer_put_varint(buffer, nameId);
+        if(nameId == 0)
+        {
+            size_t nameLength = strlen(fields->fields[i].name);
+
+            buffer_put_varint(buffer, nameLength);
+            buffer_put(buffer, fields->fields[i].name, nameLength);
+        }
+        buffer_put_varint(buffer, fields->fields[i].valueLength);
+        buffer_put(buffer, fields->fields[i].value, fields->fields[i].valueLength);
+    }
+}
+
+/*
+ * Deflates the field section into out after the compressed header.
+ * Returns 0 on success, -1 if compression failed or did not pay off.
+ */
+static int compress_field_section(const ByteBuffer *section, const RecordDictionary *dict, ByteBuffer *out)
+{
+    z_stream stream;
+    uLong    bound;
+    int      result;
+
+    memset(&stream, 0, sizeof(stream));
+    if(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, DEFLATE_RAW_WINDOW_BITS, DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return -1;
+    }
+
+    if(dict->zdict && deflateSetDictionary(&stream, dict->zdict, (uInt)dict->zdictLength) != Z_OK)
+    {
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    out->data[1] = RECORD_FLAG_COMPRESSED;
+    buffer_put_varint(out, dict->zdict ? dict->zdictId : 0);
+    buffer_put_varint(out, section->used);
+
+    bound = deflateBound(&stream, (uLong)section->used);
+    buffer_reserve(out, bound);
+    if(out->failed)
+    {
+        deflateEnd(&stream);
+        return -1;
+    }
+
+    stream.next_in   = section->data;
+    stream.avail_in  = (uInt)section->used;
+    stream.next_out  = out->data + out->used;
+    stream.avail_out = (uInt)(out->capacity - out->used);
+
+    result = deflate(&stream, Z_FINISH);
+    out->used += stream.total_out;
+    deflateEnd(&stream);
+
+    if(result != Z_STREAM_END || out->used >= RECORD_HEADER_SIZE + section->used)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+unsigned char *record_encode(const RecordFields *fields, const RecordDictionary *dict, bool compress, size_t *size)
+{
+    ByteBuffer          section;
+    ByteBuffer          out;
+    const unsigned char header[RECORD_HEADER_SIZE] = {RECORD_MAGIC, 0};
+
+    memset(&section, 0, sizeof(section));
+    memset(&out, 0, sizeof(out));
+
+    encode_field_section(&section, fields, dict);
+    buffer_put(&out, header, sizeof(header));
+    if(section.failed || out.failed)
+    {
+        free(section.data);
+        free(out.data);
+        return NULL;
+    }
+
+    // Small records often grow under deflate; keep whichever is smaller
+    if(!compress || compress_field_section(&section, dict, &out) != 0)
+    {
+        out.used    = RECORD_HEADER_SIZE;
+        out.data[1] = 0;
+        buffer_put(&out, section.data, section.used);
+    }
+
+    free(section.data);
+    if(out.failed)
+    {
+        free(out.data);
+        return NULL;
+    }
+
+    *size = out.used;
+    return out.data;
+}
+
+static unsigned char *inflate_field_section(const unsigned char *cursor, const unsigned char *end, const RecordDictionary *dict, uint64_t dictId, size_t length)
+{
+    z_stream       stream;
+    unsigned char *section;
+    int            result;
+
+    section = (unsigned char *)malloc(length ? length : 1);
+    if(!section)
+    {
+        return NULL;
+    }
+
+    memset(&stream, 0, sizeof(stream));
+    if(inflateInit2(&stream, DEFLATE_RAW_WINDOW_BITS) != Z_OK)
+    {
+        free(section);
+        return NULL;
+    }
+
+    // Raw streams take their dictionary up front
+    if(dictId != 0 && inflateSetDictionary(&stream, dict->zdict, (uInt)dict->zdictLength) != Z_OK)
+    {
+        inflateEnd(&stream);
+        free(section);
+        return NULL;
+    }
+
+    stream.next_in   = (unsigned char *)(uintptr_t)cursor;
+    stream.avail_in  = (uInt)(end - cursor);
+    stream.next_out  = section;
+    stream.avail_out = (uInt)length;
+
+    result = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if(result != Z_STREAM_END || stream.total_out != length)
+    {
+        free(section);
+        return NULL;
+    }
+    return section;
+}
+
+static int decode_field_section(const unsigned char *cursor, const unsigned char *end, const RecordDictionary *dict, RecordFields *fields)
+{
+    uint64_t count;
+
+    if(read_varint(&cursor, end, &count) < 0 || count > (uint64_t)(end - cursor))
+    {
+        return -1;
+    }
+
+    fields->fields = (RecordField *)calloc(count ? count : 1, sizeof(RecordField));
+    if(!fields->fields)
+    {
+        return -1;
+    }
+
+    for(uint64_t i = 0; i < count; i++)
+    {
+        RecordField *field = &fields->fields[fields->count];
+        uint64_t     nameId;
+        uint64_t     length;
+
+        if(read_varint(&cursor, end, &nameId) < 0)
+        {
+            return -1;
+        }
+
+        if(nameId == 0)
+        {
+            if(read_varint(&cursor, end, &length) < 0 || length > (uint64_t)(end - cursor))
+            {
+                return -1;
+            }
+            field->name = strndup((const char *)cursor, length);
+            cursor += length;
+        }
+        else if(nameId > dict->numNames)
+        {
+            return RECORD_UNKNOWN_REF;
+        }
+        else
+        {
+            field->name = strdup(dict->names[nameId - 1]);
+        }
+
+        if(read_varint(&cursor, end, &length) < 0 || length > (uint64_t)(end - cursor))
+        {
+            free(field->name);
+            field->name = NULL;
+            return -1;
+        }
+
+        field->value = (char *)malloc(length + 1);
+        if(!field->name || !field->value)
+        {
+            free(field->name);
+            free(field->value);
+            field->name  = NULL;
+            field->value = NULL;
+            return -1;
+        }
+        memcpy(field->value, cursor, length);
+        field->value[length] = '\0';
+        field->valueLength   = length;
+        cursor += length;
+        fields->count++;
+    }
+    return 0;
+}
+
+int record_decode(const void *data, size_t size, const RecordDictionary *dict, RecordFields *fields)
+{
+    const unsigned char *cursor = (const unsigned char *)data;
+    const unsigned char *end    = cursor + size;
+    unsigned char       *section;
+    uint64_t             dictId;
+    uint64_t             length;
+    int                  result;
+
+    fields->fields = NULL;
+    fields->count  = 0;
+
+    if(size < RECORD_HEADER_SIZE || cursor[0] != RECORD_MAGIC)
+    {
+        // Legacy entry: the raw URL-encoded body with its NUL
+        char *body = strndup((const char *)data, size);
+
+        if(!body)
+        {
+            return -1;
+        }
+        result = record_parse_body(body, fields);
+        free(body);
+        return result;
+    }
+
+    cursor += RECORD_HEADER_SIZE;
+    if(!(((const unsigned char *)data)[1] & RECORD_FLAG_COMPRESSED))
+    {
+        result = decode_field_section(cursor, end, dict, fields);
+    }
+    else
+    {
+        if(read_varint(&cursor, end, &dictId) < 0 || read_varint(&cursor, end, &length) < 0)
+        {
+            return -1;
+        }
+        if(dictId != 0 && dictId != dict->zdictId)
+        {
+            return RECORD_UNKNOWN_REF;
+        }
+
+        section = inflate_field_section(cursor, end, dict, dictId, (size_t)length);
+        if(!section)
+        {
+            return -1;
+        }
+        result = decode_field_section(section, section + length, dict, fields);
+        free(section);
+    }
+
+    if(result != 0)
+    {
+        record_fields_free(fields);
+    }
+    return result;
+}
+
+static datum fetch_key(DBM *db, const char *key)
+{
+    const_datum key_datum = MAKE_CONST_DATUM(key);
+
+    return dbm_fetch(db, *(datum *)&key_datum);
+}
+
+static int store_key(DBM *db, const char *key, const void *value, size_t size)
+{
+    const_datum key_datum   = MAKE_CONST_DATUM(key);
+    const_datum value_datum = MAKE_CONST_DATUM_BYTE(value, size);
+
+    return dbm_store(db, *(datum *)&key_datum, *(datum *)&value_datum, DBM_REPLACE);
+}
+
+int record_dictionary_load(DBM *db, RecordDictionary *dict)
+{
+    datum fetched;
+    int   count = 0;
+
+    record_dictionary_free(dict);
+
+    fetched = fetch_key(db, RECORD_NAME_COUNT_KEY);
+    if(fetched.dptr != NULL && TO_SIZE_T(fetched.dsize) == sizeof(int))
+    {
+        memcpy(&count, fetched.dptr, sizeof(int));
+    }
+
+    for(int id = 1; id <= count && id <= RECORD_MAX_NAMES; id++)
+    {
+        char key[RECORD_MAX_KEY];
+
+        snprintf(key, sizeof(key), RECORD_NAME_KEY_PREFIX "%d", id);
+        fetched = fetch_key(db, key);
+        if(fetched.dptr == NULL)
+        {
+            break;
+        }
+        dict->names[dict->numNames] = strndup(fetched.dptr, TO_SIZE_T(fetched.dsize));
+        if(!dict->names[dict->numNames])
+        {
+            return -1;
+        }
+        dict->numNames++;
+    }
+
+    fetched = fetch_key(db, RECORD_ZDICT_KEY);
+    if(fetched.dptr != NULL && TO_SIZE_T(fetched.dsize) > sizeof(uint32_t))
+    {
+        uint32_t id;
+
+        memcpy(&id, fetched.dptr, sizeof(id));
+        dict->zdictLength = TO_SIZE_T(fetched.dsize) - sizeof(id);
+        dict->zdict       = (unsigned char *)malloc(dict->zdictLength);
+        if(!dict->zdict)
+        {
+            return -1;
+        }
+        memcpy(dict->zdict, fetched.dptr + sizeof(id), dict->zdictLength);
+        dict->zdictId = id;
+    }
+    return 0;
+}
+
+unsigned int record_dictionary_intern(DBM *db, RecordDictionary *dict, const char *name)
+{
+    char         key[RECORD_MAX_KEY];
+    unsigned int id = find_name_id(dict, name);
+    int          count;
+
+    if(id != 0)
+    {
+        return id;
+    }
+
+    // Another worker may have added it since this process last loaded
+    if(record_dictionary_load(db, dict) != 0)
+    {
+        return 0;
+    }
+    id = find_name_id(dict, name);
+    if(id != 0 || dict->numNames == RECORD_MAX_NAMES)
+    {
+        return id;
+    }
+
+    dict->names[dict->numNames] = strdup(name);
+    if(!dict->names[dict->numNames])
+    {
+        return 0;
+    }
+    id    = (unsigned int)++dict->numNames;
+    count = (int)id;
+
+    snprintf(key, sizeof(key), RECORD_NAME_KEY_PREFIX "%u", id);
+    if(store_key(db, key, name, strlen(name) + 1) != 0 || store_key(db, RECORD_NAME_COUNT_KEY, &count, sizeof(count)) != 0)
+    {
+        free(dict->names[--dict->numNames]);
+        dict->names[dict->numNames] = NULL;
+        return 0;
+    }
+    return id;
+}
+
+int record_dictionary_train(DBM *db, RecordDictionary *dict, const unsigned char *const *samples, const size_t *sizes, size_t count)
+{
+    unsigned char *trained;
+    size_t         length = 0;
+    uint32_t       id     = 1;
+
+    if(dict->zdict || count == 0)
+    {
+        return 0;
+    }
+
+    trained = (unsigned char *)malloc(sizeof(id) + RECORD_ZDICT_MAX);
+    if(!trained)
+    {
+        return -1;
+    }
+
+    // deflate matches against the end of the dictionary best, so the newest
+    // samples go last; take samples from newest to oldest until it is full
+    for(size_t i = count; i-- > 0 && length < RECORD_ZDICT_MAX;)
+    {
+        size_t take = sizes[i] > RECORD_HEADER_SIZE ? sizes[i] - RECORD_HEADER_SIZE : 0;
+
+        if(take > RECORD_ZDICT_MAX - length)
+        {
+            take = RECORD_ZDICT_MAX - length;
+        }
+        memmove(trained + sizeof(id) + take, trained + sizeof(id), length);
+        memcpy(trained + sizeof(id), samples[i] + RECORD_HEADER_SIZE + (sizes[i] - RECORD_HEADER_SIZE - take), take);
+        length += take;
+    }
+
+    if(length == 0)
+    {
+        free(trained);
+        return 0;
+    }
+
+    memcpy(trained, &id, sizeof(id));
+    if(store_key(db, RECORD_ZDICT_KEY, trained, sizeof(id) + length) != 0)
+    {
+        free(trained);
+        return -1;
+    }
+
+    dict->zdict = (unsigned char *)malloc(length);
+    if(dict->zdict)
+    {
+        memcpy(dict->zdict, trained + sizeof(id), length);
+        dict->zdictLength = length;
+        dict->zdictId     = id;
+    }
+    free(trained);
+    return 0;
+}
+
+void record_dictionary_free(RecordDictionary *dict)
+{
+    for(size_t i = 0; i < dict->numNames; i++)
+    {
+        free(dict->names[i]);
+        dict->names[i] = NULL;
+    }
+    free(dict->zdict);
+    dict->numNames    = 0;
+    dict->zdict       = NULL;
+    dict->zdictLength = 0;
+    dict->zdictId     = 0;
+}
+
+bool record_is_internal_key(const char *key, size_t size)
+{
+    return (size >= 2 && strncmp(key, "__", 2) == 0) || (size >= 3 && strncmp(key, "idx", 3) == 0);
+}
@@ -0,0 +1,323 @@
+/*******************************************************************************
+ * Shared record cache
+ *
+ * A fixed-size LRU cache of stored POST records, mapped into shared memory by
+ * the master so that every prefork worker reads and populates the same cache.
+ * Slots are linked into an LRU list and into hash chains by index rather than
+ * by pointer, so the layout stays valid at any mapping address.
+ ******************************************************************************/
+
+#include "../include/recordCache.h"
+#include "../include/sharedMemory.h"
+#include <pthread.h>
+#include <string.h>
+
+#define RECORD_CACHE_BUCKETS (RECORD_CACHE_CAPACITY * 2)
+#define NO_SLOT (-1)
+
+typedef struct
+{
+    int      id;        // NO_SLOT when the slot is free
+    uint32_t length;    // cppcheck-suppress unusedStructMember
+    int32_t  prev;      // towards most recently used
+    int32_t  next;      // towards least recently used
+    int32_t  chain;     // next slot in the same hash bucket
+    char     data[RECORD_CACHE_MAX_VALUE];
+} RecordCacheSlot;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    int32_t         head;    // most recently used
+    int32_t         tail;    // least recently used
+    int32_t         free_list;
+    int             count;
+    size_t          size;
+    uint64_t        hits;
+    uint64_t        misses;
+    int32_t         buckets[RECORD_CACHE_BUCKETS];
+    RecordCacheSlot slots[RECORD_CACHE_CAPACITY];
+} RecordCache;
+
+static RecordCache *record_cache = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static size_t bucket_for(int id)
+{
+    // Sequential ids spread well under a multiplicative hash
+    return ((uint32_t)id * 2654435761U) % RECORD_CACHE_BUCKETS;
+}
+
+/*
+ * Empties the cache. Called at creation and whenever a worker died while
+ * holding the lock, since the lists may then be half-updated.
+ */
+static void reset_cache(RecordCache *cache)
+{
+    for(int32_t i = 0; i < RECORD_CACHE_BUCKETS; i++)
+    {
+        cache->buckets[i] = NO_SLOT;
+    }
+
+    for(int32_t i = 0; i < RECORD_CACHE_CAPACITY; i++)
+    {
+        cache->slots[i].id    = NO_SLOT;
+        cache->slots[i].next  = (i < RECORD_CACHE_CAPACITY - 1) ? i + 1 : NO_SLOT;
+        cache->slots[i].prev  = NO_SLOT;
+        cache->slots[i].chain = NO_SLOT;
+    }
+
+    cache->head      = NO_SLOT;
+    cache->tail      = NO_SLOT;
+    cache->free_list = 0;
+    cache->count     = -1;
+    cache->size      = 0;
+}
+
+static int lock_cache(void)
+{
+    int result = shared_mutex_lock(&record_cache->lock);
+    if(result < 0)
+    {
+        return -1;
+    }
+    if(result == 1)
+    {
+        reset_cache(record_cache);
+    }
+    return 0;
+}
+
+static void lru_unlink(RecordCache *cache, int32_t index)
+{
+    RecordCacheSlot *slot = &cache->slots[index];
+
+    if(slot->prev != NO_SLOT)
+    {
+        cache->slots[slot->prev].next = slot->next;
+    }
+    else
+    {
+        cache->head = slot->next;
+    }
+
+    if(slot->next != NO_SLOT)
+    {
+        cache->slots[slot->next].prev = slot->prev;
+    }
+    else
+    {
+        cache->tail = slot->prev;
+    }
+
+    slot->prev = NO_SLOT;
+    slot->next = NO_SLOT;
+}
+
+static void lru_push_front(RecordCache *cache, int32_t index)
+{
+    RecordCacheSlot *slot = &cache->slots[index];
+
+    slot->prev = NO_SLOT;
+    slot->next = cache->head;
+    if(cache->head != NO_SLOT)
+    {
+        cache->slots[cache->head].prev = index;
+    }
+    cache->head = index;
+    if(cache->tail == NO_SLOT)
+    {
+        cache->tail = index;
+    }
+}
+
+static int32_t find_slot(const RecordCache *cache, int id)
+{
+    int32_t index = cache->buckets[bucket_for(id)];
+
+    while(index != NO_SLOT && cache->slots[index].id != id)
+    {
+        index = cache->slots[index].chain;
+    }
+    return index;
+}
+
+static void unchain_slot(RecordCache *cache, int32_t index)
+{
+    int32_t *link = &cache->buckets[bucket_for(cache->slots[index].id)];
+
+    while(*link != NO_SLOT && *link != index)
+    {
+        link = &cache->slots[*link].chain;
+    }
+    if(*link == index)
+    {
+        *link = cache->slots[index].chain;
+    }
+    cache->slots[index].chain = NO_SLOT;
+}
+
+static int32_t take_slot(RecordCache *cache)
+{
+    int32_t index;
+
+    if(cache->free_list != NO_SLOT)
+    {
+        index            = cache->free_list;
+        cache->free_list = cache->slots[index].next;
+        cache->size++;
+        return index;
+    }
+
+    // Full: evict the least recently used record
+    index = cache->tail;
+    lru_unlink(cache, index);
+    unchain_slot(cache, index);
+    return index;
+}
+
+int record_cache_init(void)
+{
+    bool attached;
+
+    if(record_cache)
+    {
+        return 0;
+    }
+
+    // A new master after a binary upgrade keeps the old one's warm cache
+    record_cache = (RecordCache *)shared_memory_attach("record_cache", sizeof(RecordCache), &attached);
+    if(!record_cache)
+    {
+        return -1;
+    }
+
+    if(attached)
+    {
+        return 0;
+    }
+
+    if(shared_mutex_init(&record_cache->lock) < 0)
+    {
+        shared_memory_destroy(record_cache, sizeof(RecordCache));
+        record_cache = NULL;
+        return -1;
+    }
+
+    reset_cache(record_cache);
+    return 0;
+}
+
+void record_cache_put(int id, const void *data, size_t length)
+{
+    int32_t index;
+
+    if(!record_cache || id < 0 || length > RECORD_CACHE_MAX_VALUE)
+    {
+        return;
+    }
+
+    if(lock_cache() < 0)
+    {
+        return;
+    }
+
+    index = find_slot(record_cache, id);
+    if(index == NO_SLOT)
+    {
+        size_t bucket;
+
+        index                            = take_slot(record_cache);
+        bucket                           = bucket_for(id);
+        record_cache->slots[index].id    = id;
+        record_cache->slots[index].chain = record_cache->buckets[bucket];
+        record_cache->buckets[bucket]    = index;
+    }
+    else
+    {
+        lru_unlink(record_cache, index);
+    }
+
+    memcpy(record_cache->slots[index].data, data, length);
+    record_cache->slots[index].length = (uint32_t)length;
+    lru_push_front(record_cache, index);
+
+    shared_mutex_unlock(&record_cache->lock);
+}
+
+ssize_t record_cache_get(int id, void *out, size_t out_size)
+{
+    int32_t index;
+    ssize_t length;
+
+    if(!record_cache)
+    {
+        return -1;
+    }
+
+    if(lock_cache() < 0)
+    {
+        return -1;
+    }
+
+    index = find_slot(record_cache, id);
+    if(index == NO_SLOT || record_cache->slots[index].length > out_size)
+    {
+        record_cache->misses++;
+        shared_mutex_unlock(&record_cache->lock);
+        return -1;
+    }
+
+    length = (ssize_t)record_cache->slots[index].length;
+    memcpy(out, record_cache->slots[index].data, (size_t)length);
+    lru_unlink(record_cache, index);
+    lru_push_front(record_cache, index);
+    record_cache->hits++;
+
+    shared_mutex_unlock(&record_cache->lock);
+    return length;
+}
+
+void record_cache_set_count(int count)
+{
+    if(!record_cache || lock_cache() < 0)
+    {
+        return;
+    }
+
+    // Never move backwards: a slower writer may report an older count
+    if(count > record_cache->count)
+    {
+        record_cache->count = count;
+    }
+
+    shared_mutex_unlock(&record_cache->lock);
+}
+
+int record_cache_get_count(void)
+{
+    int count;
+
+    if(!record_cache || lock_cache() < 0)
+    {
+        return -1;
+    }
+
+    count = record_cache->count;
+    shared_mutex_unlock(&record_cache->lock);
+    return count;
+}
+
+void record_cache_get_stats(RecordCacheStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if(!record_cache || lock_cache() < 0)
+    {
+        return;
+    }
+
+    stats->hits   = record_cache->hits;
+    stats->misses = record_cache->misses;
+    stats->size   = record_cache->size;
+    shared_mutex_unlock(&record_cache->lock);
+}
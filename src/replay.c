@@ -0,0 +1,956 @@
+/*******************************************************************************
+ * replay: play captured traffic back against a server
+ *
+ * The server (started with -P percent) records the raw requests of a sample
+ * of connections under ../data/capture. This sends them again: every
+ * captured connection gets its own connection, its requests go out in order
+ * and, by default, at their original offsets (--speed 2 halves the gaps,
+ * --speed max drops them and keeps at most as many connections open as the
+ * capture had at its peak). Latency counts from when a request was due, so a
+ * slow server is charged for the requests it delayed.
+ *
+ * Statuses are checked against the ones the capture recorded. --out saves
+ * this run's statuses and latencies; --compare sets them against a saved
+ * run, request by request, to judge a handler or server change.
+ ******************************************************************************/
+
+#include "../include/capture.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define USAGE "Usage: %s [--speed N|max] [--concurrency N] [--out results] [--compare results] ip:port capture_path\n"
+#define RESULTS_MAGIC "appreplr"
+#define RESULTS_VERSION 1
+#define DECIMAL_BASE 10
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MILLISECOND 1000000ULL
+#define NANOSECONDS_PER_MICROSECOND 1000ULL
+#define STATUS_CLASSES 6
+#define STATUS_CLASS_DIVISOR 100
+#define STATUS_CODE_OFFSET 9    // "HTTP/1.1 " precedes the status code
+#define MAX_EVENTS 256
+#define HEAD_BUFFER 8192
+#define DRAIN_BUFFER 65536
+#define MAX_WAIT_MS 100
+#define MISMATCHES_SHOWN 10
+#define REQUEST_LINE_SHOWN 80
+#define PERCENT 100
+#define PER_MILLION 1000000
+
+typedef struct
+{
+    CaptureRecord record;    // copied out: records in the file are not aligned
+    const char   *data;
+} Entry;
+
+typedef struct
+{
+    size_t   first;    // into the session-ordered index
+    size_t   count;
+    uint64_t startNs;
+    uint64_t endNs;
+} Session;
+
+/**
+ * What one request got: status 0 when it failed before a response.
+ */
+typedef struct
+{
+    uint32_t latencyUs;
+    uint16_t status;
+    uint16_t reserved;
+} ReplayResult;
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+} ResultsHeader;
+
+typedef enum
+{
+    SLOT_FREE = 0,
+    SLOT_IDLE,
+    SLOT_CONNECTING,
+    SLOT_SENDING,
+    SLOT_RECEIVING
+} SlotState;
+
+typedef struct
+{
+    int       fd;
+    SlotState state;
+    size_t    session;
+    size_t    next;        // position in the session of the request in flight or due
+    size_t    sent;
+    size_t    used;
+    size_t    received;
+    size_t    expected;
+    int       status;
+    bool      closeAfter;
+    uint64_t  dueNs;
+    char      head[HEAD_BUFFER + 1];
+} Slot;
+
+typedef struct
+{
+    Entry              *entries;         // by offset; results use the same order
+    size_t             *bySession;       // entry indexes grouped by session
+    Session            *sessions;        // by start
+    size_t              numEntries;
+    size_t              numSessions;
+    uint64_t            baseNs;          // offset of the first request
+    double              speed;           // 0 for as fast as possible
+    uint64_t            startNs;
+    struct sockaddr_in  address;
+    ReplayResult       *results;
+    Slot               *slots;
+    size_t              numSlots;
+    size_t              nextSession;
+    size_t              doneSessions;
+    int                 epollFd;
+    char               *drain;
+} Replay;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+    uint64_t left  = ((const Entry *)a)->record.offsetNs;
+    uint64_t right = ((const Entry *)b)->record.offsetNs;
+
+    return (left > right) - (left < right);
+}
+
+static const Entry *sort_entries = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// By connection, then offset; entries are already by offset so the index breaks ties
+static int compare_sessions(const void *a, const void *b)
+{
+    size_t   left_index  = *(const size_t *)a;
+    size_t   right_index = *(const size_t *)b;
+    uint64_t left        = sort_entries[left_index].record.connection;
+    uint64_t right       = sort_entries[right_index].record.connection;
+
+    if(left != right)
+    {
+        return (left > right) - (left < right);
+    }
+    return (left_index > right_index) - (left_index < right_index);
+}
+
+static int compare_starts(const void *a, const void *b)
+{
+    uint64_t left  = ((const Session *)a)->startNs;
+    uint64_t right = ((const Session *)b)->startNs;
+
+    return (left > right) - (left < right);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t left  = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t left  = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+/*
+ * Indexes the records of a mapped capture and groups them into sessions.
+ */
+static int load_capture(Replay *replay, const char *map, size_t size)
+{
+    CaptureHeader header;
+    size_t        offset;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, map, size < sizeof(header) ? size : sizeof(header));
+    if(size < sizeof(CaptureHeader) || memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.version != CAPTURE_VERSION)
+    {
+        fprintf(stderr, "not a capture file\n");
+        return -1;
+    }
+
+    for(offset = sizeof(CaptureHeader); offset + sizeof(CaptureRecord) <= size;)
+    {
+        CaptureRecord record;
+
+        memcpy(&record, map + offset, sizeof(record));
+        if(offset + sizeof(CaptureRecord) + record.length > size)
+        {
+            break;    // cut off while the server was writing
+        }
+        replay->numEntries++;
+        offset += sizeof(CaptureRecord) + record.length;
+    }
+    if(replay->numEntries == 0)
+    {
+        fprintf(stderr, "capture holds no requests\n");
+        return -1;
+    }
+
+    replay->entries   = (Entry *)calloc(replay->numEntries, sizeof(Entry));
+    replay->bySession = (size_t *)calloc(replay->numEntries, sizeof(size_t));
+    replay->sessions  = (Session *)calloc(replay->numEntries, sizeof(Session));
+    replay->results   = (ReplayResult *)calloc(replay->numEntries, sizeof(ReplayResult));
+    if(!replay->entries || !replay->bySession || !replay->sessions || !replay->results)
+    {
+        perror("calloc");
+        return -1;
+    }
+
+    offset = sizeof(CaptureHeader);
+    for(size_t i = 0; i < replay->numEntries; i++)
+    {
+        memcpy(&replay->entries[i].record, map + offset, sizeof(CaptureRecord));
+        replay->entries[i].data = map + offset + sizeof(CaptureRecord);
+        replay->bySession[i]    = i;
+        offset += sizeof(CaptureRecord) + replay->entries[i].record.length;
+    }
+
+    // Records are written as requests finish; replay goes by when they arrived
+    qsort(replay->entries, replay->numEntries, sizeof(Entry), compare_offsets);
+    replay->baseNs = replay->entries[0].record.offsetNs;
+
+    sort_entries = replay->entries;
+    qsort(replay->bySession, replay->numEntries, sizeof(size_t), compare_sessions);
+    for(size_t i = 0; i < replay->numEntries; i++)
+    {
+        const Entry *entry = &replay->entries[replay->bySession[i]];
+        Session     *session;
+
+        if(i == 0 || entry->record.connection != replay->entries[replay->bySession[i - 1]].record.connection)
+        {
+            session          = &replay->sessions[replay->numSessions++];
+            session->first   = i;
+            session->startNs = entry->record.offsetNs;
+        }
+        session = &replay->sessions[replay->numSessions - 1];
+        session->count++;
+        session->endNs = entry->record.offsetNs + (uint64_t)entry->record.latencyUs * NANOSECONDS_PER_MICROSECOND;
+    }
+    qsort(replay->sessions, replay->numSessions, sizeof(Session), compare_starts);
+    return 0;
+}
+
+/*
+ * The most connections the capture had open at once, counting a connection
+ * as open from its first request to the end of its last.
+ */
+static size_t peak_concurrency(const Replay *replay)
+{
+    uint64_t *ends = (uint64_t *)calloc(replay->numSessions, sizeof(uint64_t));
+    size_t    open = 0;
+    size_t    peak = 1;
+    size_t    e    = 0;
+
+    if(!ends)
+    {
+        return replay->numSessions;
+    }
+    for(size_t i = 0; i < replay->numSessions; i++)
+    {
+        ends[i] = replay->sessions[i].endNs;
+    }
+    qsort(ends, replay->numSessions, sizeof(uint64_t), compare_u64);
+
+    for(size_t i = 0; i < replay->numSessions; i++)
+    {
+        for(; e < replay->numSessions && ends[e] < replay->sessions[i].startNs; e++)
+        {
+            open--;
+        }
+        open++;
+        if(open > peak)
+        {
+            peak = open;
+        }
+    }
+    free(ends);
+    return peak;
+}
+
+static uint64_t due_ns(const Replay *replay, size_t entry)
+{
+    if(replay->speed <= 0)
+    {
+        return 0;
+    }
+    return replay->startNs + (uint64_t)((double)(replay->entries[entry].record.offsetNs - replay->baseNs) / replay->speed);
+}
+
+static size_t slot_entry(const Replay *replay, const Slot *slot)
+{
+    return replay->bySession[replay->sessions[slot->session].first + slot->next];
+}
+
+static void watch(const Replay *replay, Slot *slot, uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events   = events;
+    event.data.ptr = slot;
+    epoll_ctl(replay->epollFd, EPOLL_CTL_MOD, slot->fd, &event);
+}
+
+static void close_slot(const Replay *replay, Slot *slot)
+{
+    if(slot->fd >= 0)
+    {
+        epoll_ctl(replay->epollFd, EPOLL_CTL_DEL, slot->fd, NULL);
+        close(slot->fd);
+        slot->fd = -1;
+    }
+}
+
+/*
+ * Records the result of the request in flight and moves to the next one; a
+ * session that is done frees its slot.
+ */
+static void finish_request(Replay *replay, Slot *slot, int status)
+{
+    size_t   entry = slot_entry(replay, slot);
+    uint64_t now   = monotonic_ns();
+    uint64_t from  = slot->dueNs;
+
+    replay->results[entry].status    = (uint16_t)status;
+    replay->results[entry].latencyUs = (uint32_t)((now - from) / NANOSECONDS_PER_MICROSECOND);
+
+    if(status == 0 || slot->closeAfter)
+    {
+        close_slot(replay, slot);
+    }
+    else
+    {
+        watch(replay, slot, 0);
+    }
+
+    slot->state = SLOT_IDLE;
+    if(++slot->next == replay->sessions[slot->session].count)
+    {
+        close_slot(replay, slot);
+        slot->state = SLOT_FREE;
+        replay->doneSessions++;
+        return;
+    }
+    slot->dueNs = due_ns(replay, slot_entry(replay, slot));
+}
+
+static void send_request(Replay *replay, Slot *slot)
+{
+    const Entry *entry = &replay->entries[slot_entry(replay, slot)];
+
+    while(slot->sent < entry->record.length)
+    {
+        ssize_t written = send(slot->fd, entry->data + slot->sent, entry->record.length - slot->sent, MSG_NOSIGNAL);
+
+        if(written < 0)
+        {
+            if(errno == EAGAIN)
+            {
+                slot->state = SLOT_SENDING;
+                watch(replay, slot, EPOLLOUT);
+                return;
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            finish_request(replay, slot, 0);
+            return;
+        }
+        slot->sent += (size_t)written;
+    }
+
+    slot->state = SLOT_RECEIVING;
+    watch(replay, slot, EPOLLIN);
+}
+
+static void start_request(Replay *replay, Slot *slot, uint64_t now)
+{
+    slot->sent       = 0;
+    slot->used       = 0;
+    slot->received   = 0;
+    slot->expected   = 0;
+    slot->closeAfter = false;
+    if(replay->speed <= 0)
+    {
+        slot->dueNs = now;
+    }
+
+    if(slot->fd < 0)
+    {
+        struct epoll_event event;
+        int                one = 1;
+
+        slot->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(slot->fd < 0)
+        {
+            finish_request(replay, slot, 0);
+            return;
+        }
+        setsockopt(slot->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        event.events   = EPOLLOUT;
+        event.data.ptr = slot;
+        epoll_ctl(replay->epollFd, EPOLL_CTL_ADD, slot->fd, &event);
+
+        if(connect(slot->fd, (const struct sockaddr *)&replay->address, sizeof(replay->address)) < 0)
+        {
+            if(errno != EINPROGRESS)
+            {
+                finish_request(replay, slot, 0);
+                return;
+            }
+            slot->state = SLOT_CONNECTING;
+            return;
+        }
+    }
+    send_request(replay, slot);
+}
+
+static bool parse_head(const Replay *replay, Slot *slot)
+{
+    const Entry *entry = &replay->entries[slot_entry(replay, slot)];
+    const char  *end;
+    const char  *length;
+
+    slot->head[slot->used] = '\0';
+    end                    = strstr(slot->head, "\r\n\r\n");
+    if(!end)
+    {
+        return false;
+    }
+
+    slot->status   = (int)strtol(slot->head + STATUS_CODE_OFFSET, NULL, DECIMAL_BASE);
+    slot->expected = (size_t)(end + 4 - slot->head);
+    length         = strcasestr(slot->head, "\r\nContent-Length:");
+    if(length && length < end && strncmp(entry->data, "HEAD ", strlen("HEAD ")) != 0)
+    {
+        slot->expected += (size_t)strtoull(length + strlen("\r\nContent-Length:"), NULL, DECIMAL_BASE);
+    }
+    slot->closeAfter = strcasestr(slot->head, "\r\nConnection: close") != NULL;
+    return true;
+}
+
+static void receive_response(Replay *replay, Slot *slot)
+{
+    for(;;)
+    {
+        ssize_t bytes;
+
+        if(slot->expected == 0)
+        {
+            if(slot->used == HEAD_BUFFER)
+            {
+                finish_request(replay, slot, 0);
+                return;
+            }
+            bytes = recv(slot->fd, slot->head + slot->used, HEAD_BUFFER - slot->used, 0);
+        }
+        else
+        {
+            size_t left = slot->expected - slot->received;
+
+            bytes = recv(slot->fd, replay->drain, left < DRAIN_BUFFER ? left : DRAIN_BUFFER, 0);
+        }
+
+        if(bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(bytes < 0 && (errno == EAGAIN))
+        {
+            return;
+        }
+        if(bytes <= 0)
+        {
+            finish_request(replay, slot, 0);
+            return;
+        }
+
+        slot->received += (size_t)bytes;
+        if(slot->expected == 0)
+        {
+            slot->used += (size_t)bytes;
+            if(!parse_head(replay, slot))
+            {
+                continue;
+            }
+        }
+        if(slot->received >= slot->expected)
+        {
+            finish_request(replay, slot, slot->status);
+            return;
+        }
+    }
+}
+
+static void handle_event(Replay *replay, Slot *slot, uint32_t events)
+{
+    if(slot->state == SLOT_IDLE)
+    {
+        // The server closed the connection between two requests
+        close_slot(replay, slot);
+        return;
+    }
+    if(slot->state == SLOT_CONNECTING)
+    {
+        int       error  = 0;
+        socklen_t length = sizeof(error);
+
+        if(getsockopt(slot->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+        {
+            finish_request(replay, slot, 0);
+            return;
+        }
+        send_request(replay, slot);
+        return;
+    }
+    if(slot->state == SLOT_SENDING && (events & EPOLLOUT))
+    {
+        send_request(replay, slot);
+        return;
+    }
+    if(slot->state == SLOT_RECEIVING && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    {
+        receive_response(replay, slot);
+    }
+}
+
+/*
+ * Opens the sessions that are due while slots are free, sends every request
+ * that is due, and returns how long to wait for the next one.
+ */
+static int start_due(Replay *replay, uint64_t now)
+{
+    uint64_t earliest = UINT64_MAX;
+
+    for(size_t i = 0; i < replay->numSlots; i++)
+    {
+        Slot *slot = &replay->slots[i];
+
+        if(slot->state == SLOT_FREE && replay->nextSession < replay->numSessions)
+        {
+            uint64_t first = due_ns(replay, replay->bySession[replay->sessions[replay->nextSession].first]);
+
+            if(first > now)
+            {
+                earliest = first < earliest ? first : earliest;
+                continue;
+            }
+            slot->state   = SLOT_IDLE;
+            slot->session = replay->nextSession++;
+            slot->next    = 0;
+            slot->dueNs   = first;
+        }
+        if(slot->state == SLOT_IDLE)
+        {
+            if(slot->dueNs <= now)
+            {
+                start_request(replay, slot, now);
+            }
+            else if(slot->dueNs < earliest)
+            {
+                earliest = slot->dueNs;
+            }
+        }
+    }
+
+    if(earliest == UINT64_MAX)
+    {
+        return MAX_WAIT_MS;
+    }
+    if(earliest <= now)
+    {
+        return 0;
+    }
+    earliest = (earliest - now + NANOSECONDS_PER_MILLISECOND - 1) / NANOSECONDS_PER_MILLISECOND;
+    return earliest < MAX_WAIT_MS ? (int)earliest : MAX_WAIT_MS;
+}
+
+static void run_replay(Replay *replay)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    replay->startNs = monotonic_ns();
+    while(replay->doneSessions < replay->numSessions)
+    {
+        int timeout = start_due(replay, monotonic_ns());
+        int ready   = epoll_wait(replay->epollFd, events, MAX_EVENTS, timeout);
+
+        for(int i = 0; i < ready; i++)
+        {
+            handle_event(replay, (Slot *)events[i].data.ptr, events[i].events);
+        }
+    }
+}
+
+static uint32_t percentile(const uint32_t *sorted, size_t count, unsigned int perMillion)
+{
+    size_t index = count * perMillion / PER_MILLION;
+
+    if(count == 0)
+    {
+        return 0;
+    }
+    return sorted[index < count ? index : count - 1];
+}
+
+/*
+ * Sorted latencies of the requests that got a response.
+ */
+static size_t answered_latencies(const ReplayResult *results, size_t count, uint32_t *latencies)
+{
+    size_t answered = 0;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(results[i].status != 0)
+        {
+            latencies[answered++] = results[i].latencyUs;
+        }
+    }
+    qsort(latencies, answered, sizeof(uint32_t), compare_u32);
+    return answered;
+}
+
+static void print_request_line(const Entry *entry)
+{
+    size_t length = 0;
+
+    while(length < entry->record.length && length < REQUEST_LINE_SHOWN && entry->data[length] != '\r' && entry->data[length] != '\n')
+    {
+        length++;
+    }
+    printf("%.*s", (int)length, entry->data);
+}
+
+static void print_summary(const Replay *replay, double elapsed, size_t concurrency)
+{
+    uint64_t  statuses[STATUS_CLASSES] = {0};
+    uint32_t *latencies                = (uint32_t *)calloc(replay->numEntries, sizeof(uint32_t));
+    size_t    answered;
+    size_t    differ = 0;
+
+    for(size_t i = 0; i < replay->numEntries; i++)
+    {
+        int statusClass = replay->results[i].status / STATUS_CLASS_DIVISOR;
+
+        statuses[statusClass > 0 && statusClass < STATUS_CLASSES ? statusClass : 0]++;
+        if(replay->results[i].status != replay->entries[i].record.status)
+        {
+            differ++;
+        }
+    }
+
+    printf("Replayed %zu requests on %zu connections in %.2fs (%.1f/s), speed %s, at most %zu open\n",
+           replay->numEntries,
+           replay->numSessions,
+           elapsed,
+           (double)replay->numEntries / elapsed,
+           replay->speed > 0 ? "scaled" : "max",
+           concurrency);
+    printf("  Status     2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, failed %llu\n",
+           (unsigned long long)statuses[2],
+           (unsigned long long)statuses[3],
+           (unsigned long long)statuses[4],
+           (unsigned long long)statuses[5],
+           (unsigned long long)statuses[0] + statuses[1]);
+    printf("  Captured   %zu statuses differ from the capture\n", differ);
+
+    if(!latencies)
+    {
+        return;
+    }
+    answered = answered_latencies(replay->results, replay->numEntries, latencies);
+    printf("  Latency    p50 %u us, p90 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+           percentile(latencies, answered, 500000),
+           percentile(latencies, answered, 900000),
+           percentile(latencies, answered, 990000),
+           percentile(latencies, answered, 999000),
+           answered ? latencies[answered - 1] : 0);
+    free(latencies);
+}
+
+static int save_results(const Replay *replay, const char *path)
+{
+    ResultsHeader header;
+    FILE         *file = fopen(path, "we");
+    int           result;
+
+    if(!file)
+    {
+        perror(path);
+        return -1;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESULTS_MAGIC, sizeof(header.magic));
+    header.version = RESULTS_VERSION;
+    header.count   = (uint32_t)replay->numEntries;
+
+    result = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(replay->results, sizeof(ReplayResult), replay->numEntries, file) == replay->numEntries ? 0 : -1;
+    if(fclose(file) != 0 || result != 0)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Request by request against a saved run of the same capture: which statuses
+ * changed, and how the latency distribution moved.
+ */
+static int compare_results(const Replay *replay, const char *path)
+{
+    ResultsHeader header;
+    ReplayResult *before    = NULL;
+    uint32_t     *latencies = NULL;
+    uint32_t     *previous  = NULL;
+    FILE         *file      = fopen(path, "re");
+    size_t        mismatches = 0;
+    size_t        answered;
+    size_t        answered_before;
+    int           result = -1;
+
+    if(!file)
+    {
+        perror(path);
+        return -1;
+    }
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, RESULTS_MAGIC, sizeof(header.magic)) != 0 || header.version != RESULTS_VERSION)
+    {
+        fprintf(stderr, "%s: not a replay results file\n", path);
+        goto done;
+    }
+    if(header.count != replay->numEntries)
+    {
+        fprintf(stderr, "%s: %u requests, this capture has %zu\n", path, header.count, replay->numEntries);
+        goto done;
+    }
+
+    before    = (ReplayResult *)calloc(replay->numEntries, sizeof(ReplayResult));
+    latencies = (uint32_t *)calloc(replay->numEntries, sizeof(uint32_t));
+    previous  = (uint32_t *)calloc(replay->numEntries, sizeof(uint32_t));
+    if(!before || !latencies || !previous || fread(before, sizeof(ReplayResult), replay->numEntries, file) != replay->numEntries)
+    {
+        fprintf(stderr, "%s: truncated\n", path);
+        goto done;
+    }
+
+    printf("Against %s:\n", path);
+    for(size_t i = 0; i < replay->numEntries; i++)
+    {
+        if(before[i].status == replay->results[i].status)
+        {
+            continue;
+        }
+        if(mismatches++ < MISMATCHES_SHOWN)
+        {
+            printf("  ");
+            print_request_line(&replay->entries[i]);
+            printf(": %u -> %u\n", before[i].status, replay->results[i].status);
+        }
+    }
+    printf("  Status     %zu of %zu requests changed\n", mismatches, replay->numEntries);
+
+    answered        = answered_latencies(replay->results, replay->numEntries, latencies);
+    answered_before = answered_latencies(before, replay->numEntries, previous);
+    {
+        static const unsigned int quantiles[] = {500000, 900000, 990000, 999000};
+        static const char        *names[]     = {"p50", "p90", "p99", "p99.9"};
+
+        for(size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        {
+            uint32_t old_value = percentile(previous, answered_before, quantiles[q]);
+            uint32_t new_value = percentile(latencies, answered, quantiles[q]);
+
+            printf("  %-9s  %u us -> %u us (%+.1f%%)\n", names[q], old_value, new_value, old_value ? ((double)new_value - (double)old_value) * PERCENT / (double)old_value : 0);
+        }
+    }
+    result = 0;
+
+done:
+    fclose(file);
+    free(before);
+    free(latencies);
+    free(previous);
+    return result;
+}
+
+static int parse_target(const char *target, struct sockaddr_in *address)
+{
+    char        host[INET_ADDRSTRLEN];
+    const char *colon = strrchr(target, ':');
+    size_t      length;
+
+    if(!colon || (length = (size_t)(colon - target)) >= sizeof(host))
+    {
+        return -1;
+    }
+    memcpy(host, target, length);
+    host[length] = '\0';
+
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port   = htons((uint16_t)strtoul(colon + 1, NULL, DECIMAL_BASE));
+    return inet_pton(AF_INET, host, &address->sin_addr) == 1 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        {"speed",       required_argument, NULL, 's'},
+        {"concurrency", required_argument, NULL, 'c'},
+        {"out",         required_argument, NULL, 'o'},
+        {"compare",     required_argument, NULL, 'C'},
+        {NULL,          0,                 NULL, 0  }
+    };
+    Replay      replay;
+    struct stat info;
+    const char *out         = NULL;
+    const char *compare     = NULL;
+    size_t      concurrency = 0;
+    void       *map;
+    uint64_t    finished;
+    int         fd;
+    int         opt;
+    int         status = EXIT_FAILURE;
+
+    memset(&replay, 0, sizeof(replay));
+    replay.speed   = 1;
+    replay.epollFd = -1;
+
+    while((opt = getopt_long(argc, argv, "s:c:o:C:", longOptions, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                replay.speed = strcmp(optarg, "max") == 0 ? 0 : strtod(optarg, NULL);
+                if(replay.speed <= 0 && strcmp(optarg, "max") != 0)
+                {
+                    fprintf(stderr, USAGE, argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                concurrency = strtoul(optarg, NULL, DECIMAL_BASE);
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            case 'C':
+                compare = optarg;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(argc - optind != 2 || parse_target(argv[optind], &replay.address) != 0)
+    {
+        fprintf(stderr, USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    fd = open(argv[optind + 1], O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        perror(argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        fprintf(stderr, "%s: empty\n", argv[optind + 1]);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap capture");
+        return EXIT_FAILURE;
+    }
+
+    if(load_capture(&replay, (const char *)map, (size_t)info.st_size) != 0)
+    {
+        goto cleanup;
+    }
+
+    // Timed replays open connections as the capture did; max keeps its peak
+    if(concurrency == 0)
+    {
+        concurrency = replay.speed > 0 ? replay.numSessions : peak_concurrency(&replay);
+    }
+    replay.numSlots = concurrency < replay.numSessions ? concurrency : replay.numSessions;
+    replay.slots    = (Slot *)calloc(replay.numSlots, sizeof(Slot));
+    replay.drain    = (char *)malloc(DRAIN_BUFFER);
+    replay.epollFd  = epoll_create1(EPOLL_CLOEXEC);
+    if(!replay.slots || !replay.drain || replay.epollFd < 0)
+    {
+        perror("replay setup");
+        goto cleanup;
+    }
+    for(size_t i = 0; i < replay.numSlots; i++)
+    {
+        replay.slots[i].fd = -1;
+    }
+
+    run_replay(&replay);
+    finished = monotonic_ns();
+    print_summary(&replay, (double)(finished - replay.startNs) / (double)NANOSECONDS_PER_SECOND, replay.numSlots);
+
+    status = EXIT_SUCCESS;
+    if(compare && compare_results(&replay, compare) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+    if(out && save_results(&replay, out) != 0)
+    {
+        status = EXIT_FAILURE;
+    }
+
+cleanup:
+    if(replay.epollFd >= 0)
+    {
+        close(replay.epollFd);
+    }
+    free(replay.drain);
+    free(replay.slots);
+    free(replay.results);
+    free(replay.sessions);
+    free(replay.bySession);
+    free(replay.entries);
+    munmap(map, (size_t)info.st_size);
+    return status;
+}
@@ -0,0 +1,213 @@
+#include "../include/routeTable.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUTE_FANOUT 256
+#define ROUTE_INITIAL_NODES 16
+
+enum RouteMethod
+{
+    ROUTE_METHOD_ANY,
+    ROUTE_METHOD_GET,
+    ROUTE_METHOD_HEAD,
+    ROUTE_METHOD_POST,
+    ROUTE_METHOD_COUNT,
+    ROUTE_METHOD_OTHER = ROUTE_METHOD_COUNT
+};
+
+/*
+ * One trie node per distinct prefix byte. Children are indexes into the
+ * table's node array (0 means none: the root is never anyone's child).
+ */
+typedef struct
+{
+    uint32_t child[ROUTE_FANOUT];
+    int32_t  route[ROUTE_METHOD_COUNT];    // -1 where no route ends here
+} RouteNode;
+
+typedef struct
+{
+    char *method;
+    char *prefix;
+    int   module;
+} Route;
+
+struct RouteTable
+{
+    RouteNode *nodes;
+    size_t     numNodes;
+    size_t     capacity;
+    Route     *routes;
+    size_t     numRoutes;
+};
+
+static int route_method(const char *method)
+{
+    if(strcmp(method, ROUTE_ANY_METHOD) == 0)
+    {
+        return ROUTE_METHOD_ANY;
+    }
+    if(strcmp(method, "GET") == 0)
+    {
+        return ROUTE_METHOD_GET;
+    }
+    if(strcmp(method, "HEAD") == 0)
+    {
+        return ROUTE_METHOD_HEAD;
+    }
+    if(strcmp(method, "POST") == 0)
+    {
+        return ROUTE_METHOD_POST;
+    }
+    return ROUTE_METHOD_OTHER;
+}
+
+static uint32_t route_node_new(RouteTable *table)
+{
+    RouteNode *node;
+
+    if(table->numNodes == table->capacity)
+    {
+        size_t     capacity = table->capacity ? table->capacity * 2 : ROUTE_INITIAL_NODES;
+        RouteNode *nodes    = (RouteNode *)realloc(table->nodes, capacity * sizeof(RouteNode));
+        if(!nodes)
+        {
+            return 0;
+        }
+        table->nodes    = nodes;
+        table->capacity = capacity;
+    }
+
+    node = &table->nodes[table->numNodes];
+    memset(node->child, 0, sizeof(node->child));
+    for(size_t i = 0; i < ROUTE_METHOD_COUNT; i++)
+    {
+        node->route[i] = -1;
+    }
+    return (uint32_t)table->numNodes++;
+}
+
+RouteTable *route_table_create(void)
+{
+    RouteTable *table = (RouteTable *)calloc(1, sizeof(RouteTable));
+
+    if(!table)
+    {
+        return NULL;
+    }
+
+    // Node 0 is the root, the empty prefix
+    route_node_new(table);
+    if(table->numNodes != 1)
+    {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+int route_table_add(RouteTable *table, const char *method, const char *prefix, int module)
+{
+    uint32_t current = 0;
+    int      index   = route_method(method);
+    Route   *routes;
+
+    if(index == ROUTE_METHOD_OTHER)
+    {
+        fprintf(stderr, "Unsupported route method: %s\n", method);
+        return -1;
+    }
+
+    for(const unsigned char *c = (const unsigned char *)prefix; *c; c++)
+    {
+        uint32_t next = table->nodes[current].child[*c];
+        if(next == 0)
+        {
+            // Allocate first: realloc may move the node array
+            next = route_node_new(table);
+            if(next == 0)
+            {
+                return -1;
+            }
+            table->nodes[current].child[*c] = next;
+        }
+        current = next;
+    }
+
+    // Same method and prefix again: the later module wins
+    if(table->nodes[current].route[index] >= 0)
+    {
+        table->routes[table->nodes[current].route[index]].module = module;
+        return 0;
+    }
+
+    routes = (Route *)realloc(table->routes, (table->numRoutes + 1) * sizeof(Route));
+    if(!routes)
+    {
+        return -1;
+    }
+    table->routes                   = routes;
+    routes[table->numRoutes].method = strdup(method);
+    routes[table->numRoutes].prefix = strdup(prefix);
+    routes[table->numRoutes].module = module;
+    if(!routes[table->numRoutes].method || !routes[table->numRoutes].prefix)
+    {
+        free(routes[table->numRoutes].method);
+        free(routes[table->numRoutes].prefix);
+        return -1;
+    }
+    table->nodes[current].route[index] = (int32_t)table->numRoutes++;
+    return 0;
+}
+
+int route_table_match(const RouteTable *table, const char *method, const char *path)
+{
+    const RouteNode *node  = &table->nodes[0];
+    int              index = route_method(method);
+    int              found = -1;
+
+    for(const unsigned char *c = (const unsigned char *)path;; c++)
+    {
+        // Prefixes match whole segments: /entries covers /entries/5 and
+        // /entries?since=5 but not /entriesX
+        bool boundary = c == (const unsigned char *)path || c[-1] == '/' || *c == '\0' || *c == '/' || *c == '?';
+
+        if(boundary && index != ROUTE_METHOD_OTHER && node->route[index] >= 0)
+        {
+            found = node->route[index];
+        }
+        else if(boundary && node->route[ROUTE_METHOD_ANY] >= 0)
+        {
+            found = node->route[ROUTE_METHOD_ANY];
+        }
+
+        if(*c == '\0' || node->child[*c] == 0)
+        {
+            return found;
+        }
+        node = &table->nodes[node->child[*c]];
+    }
+}
+
+int route_table_module(const RouteTable *table, int route)
+{
+    return table->routes[route].module;
+}
+
+const char *route_table_method(const RouteTable *table, int route)
+{
+    return table->routes[route].method;
+}
+
+const char *route_table_prefix(const RouteTable *table, int route)
+{
+    return table->routes[route].prefix;
+}
+
+size_t route_table_size(const RouteTable *table)
+{
+    return table->numRoutes;
+}
@@ -0,0 +1,25 @@
+#include "../include/sampler.h"
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define SAMPLER_SEED_MIX 0x9E3779B97F4A7C15ULL
+
+static uint64_t sampler_state = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+bool sampler_pick(unsigned int percent)
+{
+    if(sampler_state == 0)
+    {
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sampler_state = ((uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec) ^ ((uint64_t)getpid() << 32) ^ SAMPLER_SEED_MIX;
+    }
+
+    sampler_state ^= sampler_state << 13;
+    sampler_state ^= sampler_state >> 7;
+    sampler_state ^= sampler_state << 17;
+    return sampler_state % SAMPLER_MAX_PERCENT < percent;
+}
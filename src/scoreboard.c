@@ -0,0 +1,536 @@
+#include "../include/scoreboard.h"
+#include "../include/accessLog.h"
+#include "../include/perfCounters.h"
+#include "../include/sharedMemory.h"
+#include "../include/shared_lib.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MILLISECOND 1000000
+#define MICROSECONDS_PER_SECOND 1000000
+#define STATUS_CLASS_DIVISOR 100
+#define SERVER_ERROR_CLASS 5
+#define REPORT_LINE 1024
+#define LABEL_LENGTH 128
+#define ROUTE_LABELS_LENGTH (LABEL_LENGTH * 3)
+
+typedef struct
+{
+    WorkerScore retired;    // counters of workers that have exited, so totals never go backwards
+    RouteScore  routes[SCOREBOARD_MAX_ROUTES];
+    WorkerScore workers[];
+} Scoreboard;
+
+static Scoreboard  *scoreboard      = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int          scoreboard_rows = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static WorkerScore *own_score       = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static const char *const state_names[WORKER_STATE_COUNT] = {"empty", "idle", "reading", "handling", "writing"};
+
+// Prometheus `le` bounds for the route latency histograms, in microseconds
+static const uint64_t latency_bounds_us[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+
+/*
+ * Moves one counter of a row into the retired totals and clears it.
+ */
+static void retire_counter(atomic_ulong *retired, atomic_ulong *counter)
+{
+    atomic_fetch_add_explicit(retired, atomic_exchange_explicit(counter, 0, memory_order_relaxed), memory_order_relaxed);
+}
+
+uint64_t scoreboard_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+int scoreboard_init(int max_workers)
+{
+    if(max_workers > SCOREBOARD_MAX_WORKERS)
+    {
+        fprintf(stderr, "Scoreboard limited to %d workers\n", SCOREBOARD_MAX_WORKERS);
+        return -1;
+    }
+
+    scoreboard = (Scoreboard *)shared_memory_create(sizeof(Scoreboard) + sizeof(WorkerScore) * (size_t)max_workers);
+    if(!scoreboard)
+    {
+        return -1;
+    }
+    scoreboard_rows = max_workers;
+    return 0;
+}
+
+void scoreboard_reset(int worker)
+{
+    WorkerScore *score;
+
+    if(!scoreboard || worker < 0 || worker >= scoreboard_rows)
+    {
+        return;
+    }
+
+    score = &scoreboard->workers[worker];
+    atomic_store_explicit(&score->pid, 0, memory_order_relaxed);
+    atomic_store_explicit(&score->state, WORKER_STATE_EMPTY, memory_order_relaxed);
+    atomic_store_explicit(&score->startedNs, scoreboard_now_ns(), memory_order_relaxed);
+    atomic_store_explicit(&score->busyNs, 0, memory_order_relaxed);
+    atomic_store_explicit(&score->busySince, 0, memory_order_relaxed);
+    retire_counter(&scoreboard->retired.requests, &score->requests);
+    retire_counter(&scoreboard->retired.connections, &score->connections);
+    retire_counter(&scoreboard->retired.bytesIn, &score->bytesIn);
+    retire_counter(&scoreboard->retired.bytesOut, &score->bytesOut);
+    for(int i = 0; i < SCOREBOARD_STATUS_CLASSES; i++)
+    {
+        retire_counter(&scoreboard->retired.statuses[i], &score->statuses[i]);
+    }
+}
+
+void scoreboard_worker_start(int worker)
+{
+    if(!scoreboard || worker < 0 || worker >= scoreboard_rows)
+    {
+        return;
+    }
+
+    own_score = &scoreboard->workers[worker];
+    atomic_store_explicit(&own_score->pid, getpid(), memory_order_relaxed);
+    atomic_store_explicit(&own_score->state, WORKER_STATE_IDLE, memory_order_relaxed);
+}
+
+void scoreboard_busy(void)
+{
+    if(!own_score)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&own_score->busySince, scoreboard_now_ns(), memory_order_relaxed);
+    atomic_fetch_add_explicit(&own_score->connections, 1, memory_order_relaxed);
+    atomic_store_explicit(&own_score->state, WORKER_STATE_READING, memory_order_release);
+}
+
+void scoreboard_idle(void)
+{
+    uint64_t since;
+
+    if(!own_score)
+    {
+        return;
+    }
+
+    // Only this worker writes its row, so plain load + store is enough
+    since = atomic_load_explicit(&own_score->busySince, memory_order_relaxed);
+    atomic_store_explicit(&own_score->state, WORKER_STATE_IDLE, memory_order_relaxed);
+    atomic_fetch_add_explicit(&own_score->busyNs, scoreboard_now_ns() - since, memory_order_relaxed);
+}
+
+void scoreboard_set_state(WorkerState state)
+{
+    if(own_score)
+    {
+        atomic_store_explicit(&own_score->state, state, memory_order_relaxed);
+    }
+}
+
+void scoreboard_bytes_in(size_t bytes)
+{
+    if(own_score)
+    {
+        atomic_fetch_add_explicit(&own_score->bytesIn, bytes, memory_order_relaxed);
+    }
+}
+
+void scoreboard_response(const HTTPResponse *response)
+{
+    int    statusClass = response->status / STATUS_CLASS_DIVISOR;
+    size_t bytes       = response->head.length;
+
+    if(!own_score)
+    {
+        return;
+    }
+
+    if(!response->headOnly)
+    {
+        bytes += response->body.length;
+    }
+    if(statusClass < 1 || statusClass >= SCOREBOARD_STATUS_CLASSES)
+    {
+        statusClass = 0;
+    }
+
+    atomic_fetch_add_explicit(&own_score->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&own_score->bytesOut, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&own_score->statuses[statusClass], 1, memory_order_relaxed);
+}
+
+void scoreboard_route(int route, int status, uint64_t latency_ns)
+{
+    RouteScore *score;
+
+    if(!scoreboard || route < 0 || route >= SCOREBOARD_MAX_ROUTES)
+    {
+        return;
+    }
+
+    score = &scoreboard->routes[route];
+    atomic_fetch_add_explicit(&score->requests, 1, memory_order_relaxed);
+    if(status / STATUS_CLASS_DIVISOR == SERVER_ERROR_CLASS)
+    {
+        atomic_fetch_add_explicit(&score->errors, 1, memory_order_relaxed);
+    }
+    histogram_record(&score->latency, latency_ns);
+}
+
+uint64_t scoreboard_busy_ns(int worker, uint64_t now_ns)
+{
+    const WorkerScore *score = scoreboard_worker(worker);
+    uint64_t           busy;
+
+    if(!score)
+    {
+        return 0;
+    }
+
+    busy = atomic_load_explicit(&score->busyNs, memory_order_relaxed);
+    if(atomic_load_explicit(&score->state, memory_order_acquire) > WORKER_STATE_IDLE)
+    {
+        uint64_t since = atomic_load_explicit(&score->busySince, memory_order_relaxed);
+
+        busy += now_ns > since ? now_ns - since : 0;
+    }
+    return busy;
+}
+
+int scoreboard_size(void)
+{
+    return scoreboard_rows;
+}
+
+const WorkerScore *scoreboard_worker(int worker)
+{
+    if(!scoreboard || worker < 0 || worker >= scoreboard_rows)
+    {
+        return NULL;
+    }
+    return &scoreboard->workers[worker];
+}
+
+const RouteScore *scoreboard_route_score(int route)
+{
+    if(!scoreboard || route < 0 || route >= SCOREBOARD_MAX_ROUTES)
+    {
+        return NULL;
+    }
+    return &scoreboard->routes[route];
+}
+
+const char *scoreboard_state_name(int state)
+{
+    if(state < 0 || state >= WORKER_STATE_COUNT)
+    {
+        return "unknown";
+    }
+    return state_names[state];
+}
+
+/*
+ * Adds a row's counters to a running total.
+ */
+static void add_counters(WorkerScore *total, const WorkerScore *score)
+{
+    atomic_fetch_add_explicit(&total->requests, atomic_load_explicit(&score->requests, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&total->connections, atomic_load_explicit(&score->connections, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&total->bytesIn, atomic_load_explicit(&score->bytesIn, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_add_explicit(&total->bytesOut, atomic_load_explicit(&score->bytesOut, memory_order_relaxed), memory_order_relaxed);
+    for(int i = 0; i < SCOREBOARD_STATUS_CLASSES; i++)
+    {
+        atomic_fetch_add_explicit(&total->statuses[i], atomic_load_explicit(&score->statuses[i], memory_order_relaxed), memory_order_relaxed);
+    }
+}
+
+/*
+ * Totals over the retired counters and every live row; also counts the rows
+ * in each state.
+ */
+static void sum_counters(WorkerScore *total, unsigned long states[WORKER_STATE_COUNT])
+{
+    *total = (WorkerScore){0};
+    add_counters(total, &scoreboard->retired);
+    for(int i = 0; i < WORKER_STATE_COUNT; i++)
+    {
+        states[i] = 0;
+    }
+
+    for(int i = 0; i < scoreboard_rows; i++)
+    {
+        const WorkerScore *score = &scoreboard->workers[i];
+        int                state = atomic_load_explicit(&score->state, memory_order_relaxed);
+
+        add_counters(total, score);
+        if(state >= 0 && state < WORKER_STATE_COUNT)
+        {
+            states[state]++;
+        }
+    }
+}
+
+/*
+ * Copies a label value, escaping what the Prometheus text format requires.
+ */
+static void escape_label(char *label, size_t size, const char *value)
+{
+    size_t length = 0;
+
+    for(const char *c = value; *c && length + 2 < size; c++)
+    {
+        if(*c == '"' || *c == '\\')
+        {
+            label[length++] = '\\';
+        }
+        label[length++] = *c == '\n' ? ' ' : *c;
+    }
+    label[length] = '\0';
+}
+
+int scoreboard_status_report(HTTPResponse *response)
+{
+    char          line[REPORT_LINE];
+    WorkerScore   total;
+    unsigned long states[WORKER_STATE_COUNT];
+    uint64_t      now = scoreboard_now_ns();
+
+    if(!scoreboard)
+    {
+        return http_response_set_text(response, SERVICE_UNAVAILABLE_STATUS, "text/plain", "scoreboard not enabled\n");
+    }
+
+    sum_counters(&total, states);
+    http_response_add_header(response, "Content-Type", "text/plain");
+    snprintf(line,
+             sizeof(line),
+             "Workers: %lu idle, %lu reading, %lu handling, %lu writing (%d slots)\n"
+             "Requests: %lu  Connections: %lu  Bytes in: %lu  Bytes out: %lu\n"
+             "Responses: 1xx %lu  2xx %lu  3xx %lu  4xx %lu  5xx %lu  other %lu\n\n",
+             states[WORKER_STATE_IDLE],
+             states[WORKER_STATE_READING],
+             states[WORKER_STATE_HANDLING],
+             states[WORKER_STATE_WRITING],
+             scoreboard_rows,
+             total.requests,
+             total.connections,
+             total.bytesIn,
+             total.bytesOut,
+             total.statuses[1],
+             total.statuses[2],
+             total.statuses[3],
+             total.statuses[4],
+             total.statuses[SERVER_ERROR_CLASS],
+             total.statuses[0]);
+    http_response_append_str(response, line);
+
+    http_response_append_str(response, "Slot      PID  State       Requests  Conns     Bytes in    Bytes out  Busy s   Age s\n");
+    for(int i = 0; i < scoreboard_rows; i++)
+    {
+        const WorkerScore *score = &scoreboard->workers[i];
+        int                state = atomic_load_explicit(&score->state, memory_order_relaxed);
+        uint64_t           busy;
+
+        if(state == WORKER_STATE_EMPTY)
+        {
+            continue;
+        }
+        busy = scoreboard_busy_ns(i, now);
+        snprintf(line,
+                 sizeof(line),
+                 "%4d %8d  %-9s %10lu %6lu %12lu %12lu %7.1f %7.1f\n",
+                 i,
+                 atomic_load_explicit(&score->pid, memory_order_relaxed),
+                 scoreboard_state_name(state),
+                 atomic_load_explicit(&score->requests, memory_order_relaxed),
+                 atomic_load_explicit(&score->connections, memory_order_relaxed),
+                 atomic_load_explicit(&score->bytesIn, memory_order_relaxed),
+                 atomic_load_explicit(&score->bytesOut, memory_order_relaxed),
+                 (double)busy / (double)NANOSECONDS_PER_SECOND,
+                 (double)(now - atomic_load_explicit(&score->startedNs, memory_order_relaxed)) / (double)NANOSECONDS_PER_SECOND);
+        http_response_append_str(response, line);
+    }
+
+    http_response_append_str(response, "\nMethod  Route                         Requests  5xx     Mean ms   p50 ms   p99 ms   Max ms\n");
+    for(int i = 0; i < handler_route_count() && i < SCOREBOARD_MAX_ROUTES; i++)
+    {
+        const RouteScore *route = &scoreboard->routes[i];
+        const char       *method;
+        const char       *prefix;
+        uint64_t          p50 = histogram_percentile(&route->latency, 500000);
+        uint64_t          p99 = histogram_percentile(&route->latency, 990000);
+
+        handler_route_describe(i, &method, &prefix);
+        snprintf(line,
+                 sizeof(line),
+                 "%-7s %-28s %9lu %5lu %9.3f %8.3f %8.3f %8.3f\n",
+                 method,
+                 prefix,
+                 atomic_load_explicit(&route->requests, memory_order_relaxed),
+                 atomic_load_explicit(&route->errors, memory_order_relaxed),
+                 histogram_mean(&route->latency) / NANOSECONDS_PER_MILLISECOND,
+                 (double)p50 / NANOSECONDS_PER_MILLISECOND,
+                 (double)p99 / NANOSECONDS_PER_MILLISECOND,
+                 (double)atomic_load_explicit(&route->latency.max, memory_order_relaxed) / NANOSECONDS_PER_MILLISECOND);
+        http_response_append_str(response, line);
+    }
+
+    return response->failed ? -1 : 0;
+}
+
+/*
+ * The method and route labels of a route, escaped for the exposition format.
+ */
+static void route_labels(int route_index, char *labels)
+{
+    char        method[LABEL_LENGTH];
+    char        prefix[LABEL_LENGTH];
+    const char *route_method;
+    const char *route_prefix;
+
+    handler_route_describe(route_index, &route_method, &route_prefix);
+    escape_label(method, sizeof(method), route_method);
+    escape_label(prefix, sizeof(prefix), route_prefix);
+    snprintf(labels, ROUTE_LABELS_LENGTH, "method=\"%s\",route=\"%s\"", method, prefix);
+}
+
+/*
+ * One route's latency as a Prometheus histogram. Log buckets are folded into
+ * the fixed `le` bounds by their upper edge, so a count can land one bound late.
+ */
+static void metrics_route_duration(HTTPResponse *response, int route_index)
+{
+    const RouteScore *route = &scoreboard->routes[route_index];
+    char              line[REPORT_LINE];
+    char              labels[ROUTE_LABELS_LENGTH];
+    unsigned int      bucket     = 0;
+    uint64_t          cumulative = 0;
+    uint64_t          count      = histogram_count(&route->latency);
+
+    route_labels(route_index, labels);
+    for(size_t i = 0; i < sizeof(latency_bounds_us) / sizeof(latency_bounds_us[0]); i++)
+    {
+        uint64_t bound = latency_bounds_us[i] * (NANOSECONDS_PER_SECOND / MICROSECONDS_PER_SECOND);
+
+        for(; bucket < HISTOGRAM_BUCKETS && histogram_bucket_upper(bucket) <= bound; bucket++)
+        {
+            cumulative += atomic_load_explicit(&route->latency.buckets[bucket], memory_order_relaxed);
+        }
+        snprintf(line,
+                 sizeof(line),
+                 "app_route_duration_seconds_bucket{%s,le=\"%g\"} %llu\n",
+                 labels,
+                 (double)latency_bounds_us[i] / (double)MICROSECONDS_PER_SECOND,
+                 (unsigned long long)cumulative);
+        http_response_append_str(response, line);
+    }
+
+    snprintf(line, sizeof(line), "app_route_duration_seconds_bucket{%s,le=\"+Inf\"} %llu\n", labels, (unsigned long long)count);
+    http_response_append_str(response, line);
+    snprintf(line, sizeof(line), "app_route_duration_seconds_count{%s} %llu\n", labels, (unsigned long long)count);
+    http_response_append_str(response, line);
+    snprintf(line,
+             sizeof(line),
+             "app_route_duration_seconds_sum{%s} %.9f\n",
+             labels,
+             (double)atomic_load_explicit(&route->latency.sum, memory_order_relaxed) / (double)NANOSECONDS_PER_SECOND);
+    http_response_append_str(response, line);
+}
+
+/*
+ * One perf counter family for every route, labelled by route prefix.
+ */
+static void metrics_perf(HTTPResponse *response, void (*family)(HTTPResponse *, int, const char *))
+{
+    for(int i = 0; i < handler_route_count() && i < SCOREBOARD_MAX_ROUTES; i++)
+    {
+        char        prefix[LABEL_LENGTH];
+        const char *route_method;
+        const char *route_prefix;
+
+        handler_route_describe(i, &route_method, &route_prefix);
+        escape_label(prefix, sizeof(prefix), route_prefix);
+        family(response, i, prefix);
+    }
+}
+
+int scoreboard_metrics_report(HTTPResponse *response)
+{
+    static const char *const status_classes[SCOREBOARD_STATUS_CLASSES] = {"other", "1xx", "2xx", "3xx", "4xx", "5xx"};
+    char                     line[REPORT_LINE];
+    WorkerScore              total;
+    unsigned long            states[WORKER_STATE_COUNT];
+
+    if(!scoreboard)
+    {
+        return http_response_set_text(response, SERVICE_UNAVAILABLE_STATUS, "text/plain", "scoreboard not enabled\n");
+    }
+
+    sum_counters(&total, states);
+    http_response_add_header(response, "Content-Type", "text/plain; version=0.0.4");
+
+    http_response_append_str(response, "# HELP app_workers Worker processes by state.\n# TYPE app_workers gauge\n");
+    for(int i = WORKER_STATE_IDLE; i < WORKER_STATE_COUNT; i++)
+    {
+        snprintf(line, sizeof(line), "app_workers{state=\"%s\"} %lu\n", state_names[i], states[i]);
+        http_response_append_str(response, line);
+    }
+
+    snprintf(line,
+             sizeof(line),
+             "# HELP app_requests_total Requests answered.\n# TYPE app_requests_total counter\napp_requests_total %lu\n"
+             "# HELP app_connections_total Connections accepted.\n# TYPE app_connections_total counter\napp_connections_total %lu\n"
+             "# HELP app_received_bytes_total Bytes read from clients.\n# TYPE app_received_bytes_total counter\napp_received_bytes_total %lu\n"
+             "# HELP app_sent_bytes_total Response bytes sent.\n# TYPE app_sent_bytes_total counter\napp_sent_bytes_total %lu\n"
+             "# HELP app_access_log_dropped_total Access log records dropped because a ring was full.\n# TYPE app_access_log_dropped_total counter\napp_access_log_dropped_total %llu\n"
+             "# HELP app_responses_total Responses by status class.\n# TYPE app_responses_total counter\n",
+             total.requests,
+             total.connections,
+             total.bytesIn,
+             total.bytesOut,
+             (unsigned long long)access_log_dropped());
+    http_response_append_str(response, line);
+    for(int i = 1; i <= SCOREBOARD_STATUS_CLASSES; i++)
+    {
+        int statusClass = i % SCOREBOARD_STATUS_CLASSES;
+
+        snprintf(line, sizeof(line), "app_responses_total{code=\"%s\"} %lu\n", status_classes[statusClass], total.statuses[statusClass]);
+        http_response_append_str(response, line);
+    }
+
+    http_response_append_str(response, "# HELP app_route_duration_seconds Handler time per route.\n# TYPE app_route_duration_seconds histogram\n");
+    for(int i = 0; i < handler_route_count() && i < SCOREBOARD_MAX_ROUTES; i++)
+    {
+        metrics_route_duration(response, i);
+    }
+
+    http_response_append_str(response, "# HELP app_route_errors_total 5xx responses per route.\n# TYPE app_route_errors_total counter\n");
+    for(int i = 0; i < handler_route_count() && i < SCOREBOARD_MAX_ROUTES; i++)
+    {
+        char labels[ROUTE_LABELS_LENGTH];
+
+        route_labels(i, labels);
+        snprintf(line, sizeof(line), "app_route_errors_total{%s} %lu\n", labels, atomic_load_explicit(&scoreboard->routes[i].errors, memory_order_relaxed));
+        http_response_append_str(response, line);
+    }
+
+    if(perf_counters_enabled())
+    {
+        http_response_append_str(response, "# HELP app_perf_calls_total Handler calls measured with perf counters.\n# TYPE app_perf_calls_total counter\n");
+        metrics_perf(response, perf_counters_calls_metrics);
+        http_response_append_str(response, "# HELP app_perf_events_total perf events counted during handler calls.\n# TYPE app_perf_events_total counter\n");
+        metrics_perf(response, perf_counters_events_metrics);
+    }
+
+    return response->failed ? -1 : 0;
+}
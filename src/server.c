@@ -3,26 +3,47 @@
 //
 
 #include "../include/server.h"
+#include "../include/accessLog.h"
+#include "../include/capture.h"
+#include "../include/cpuTopology.h"
 #include "../include/db.h"
+#include "../include/dbIndex.h"
 #include "../include/fileTools.h"
+#include "../include/perfCounters.h"
+#include "../include/probes.h"
+#include "../include/profiler.h"
+#include "../include/recordCache.h"
+#include "../include/routeTable.h"
+#include "../include/scoreboard.h"
+#include "../include/shadow.h"
 #include "../include/shared_lib.h"
-#include "../include/sigintHandler.h"
+#include "../include/snapshot.h"
 #include "../include/stringTools.h"
+#include "../include/supervisor.h"
+#include "../include/trace.h"
+#include "../include/upgrade.h"
 #include "../include/utils.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
-#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
-#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#define REQUEST_BUFFER_SIZE (BUFFER_SIZE * 16)
+#define KEEPALIVE_TIMEOUT_MS 5000
+#define PIPELINE_BATCH 16
+#define DECIMAL_BASE 10
+
+// Access log records of the responses queued in a worker's pipeline batch
+static AccessRecord access_records[PIPELINE_BATCH];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
 static int set_nonblocking(int sockfd)
 {
     int flags = fcntl(sockfd, F_GETFL, 0);
@@ -39,25 +60,451 @@ static int set_nonblocking(int sockfd)
     return 0;
 }
 
+/*
+ * Where one request sits in the connection buffer.
+ */
+typedef struct
+{
+    size_t headerLength;    // request line and headers, including the blank line
+    size_t bodyLength;
+    bool   keepAlive;
+    bool   closeAfter;    // body length unknown, so nothing after it can be framed
+} RequestFrame;
+
+/*
+ * Finds a header in the block [headers, end) and returns its value with
+ * leading blanks skipped, or NULL. Names compare case-insensitively.
+ */
+static const char *find_header(const char *headers, const char *end, const char *name, size_t *value_length)
+{
+    size_t name_length = strlen(name);
+
+    for(const char *line = headers; line < end;)
+    {
+        const char *line_end = (const char *)memmem(line, (size_t)(end - line), "\r\n", 2);
+        if(!line_end)
+        {
+            line_end = end;
+        }
+
+        if((size_t)(line_end - line) > name_length && line[name_length] == ':' && strncasecmp(line, name, name_length) == 0)
+        {
+            const char *value = line + name_length + 1;
+            while(value < line_end && (*value == ' ' || *value == '\t'))
+            {
+                value++;
+            }
+            *value_length = (size_t)(line_end - value);
+            return value;
+        }
+        line = line_end + 2;
+    }
+    return NULL;
+}
+
+/*
+ * Frames the next request in buffer.
+ * Returns 1 when a whole request is buffered, 0 when more bytes are needed,
+ * or an HTTP error status when the request can never be served.
+ */
+static int parse_request_frame(const char *buffer, size_t used, size_t capacity, RequestFrame *frame)
+{
+    const char *header_end;
+    const char *headers;
+    const char *value;
+    size_t      value_length;
+    bool        http11;
+
+    header_end = (const char *)memmem(buffer, used, "\r\n\r\n", 4);
+    if(!header_end)
+    {
+        return used == capacity ? HEADERS_TOO_LARGE_STATUS : 0;
+    }
+
+    frame->headerLength = (size_t)(header_end - buffer) + 4;
+    frame->bodyLength   = 0;
+    frame->closeAfter   = false;
+
+    headers = (const char *)memmem(buffer, frame->headerLength, "\r\n", 2) + 2;
+    http11  = memmem(buffer, (size_t)(headers - buffer), "HTTP/1.1\r\n", 10) != NULL;
+
+    value = find_header(headers, header_end + 2, "Connection", &value_length);
+    if(value)
+    {
+        frame->keepAlive = value_length == 10 && strncasecmp(value, "keep-alive", 10) == 0;
+        if(http11 && !(value_length == 5 && strncasecmp(value, "close", 5) == 0))
+        {
+            frame->keepAlive = true;
+        }
+    }
+    else
+    {
+        frame->keepAlive = http11;
+    }
+
+    value = find_header(headers, header_end + 2, "Content-Length", &value_length);
+    if(value)
+    {
+        char         *endptr;
+        unsigned long length = strtoul(value, &endptr, DECIMAL_BASE);
+
+        if(endptr == value || length > capacity - frame->headerLength)
+        {
+            return endptr == value ? BAD_REQUEST_STATUS : CONTENT_TOO_LARGE_STATUS;
+        }
+        frame->bodyLength = length;
+    }
+    else if(strncmp(buffer, "POST ", 5) == 0)
+    {
+        // Old clients send a body without a length: take what has arrived
+        frame->bodyLength = used - frame->headerLength;
+        frame->closeAfter = true;
+    }
+
+    return used - frame->headerLength >= frame->bodyLength ? 1 : 0;
+}
+
+/*
+ * Builds an HTTPRequest from a framed request, or returns NULL if the request
+ * line is not "METHOD PATH PROTOCOL".
+ */
+static HTTPRequest *build_request(const char *buffer, const RequestFrame *frame, int client_fd)
+{
+    char         line[BUFFER_SIZE];
+    char        *method;
+    char        *path;
+    char        *protocol;
+    char        *extra;
+    char        *saveptr;
+    HTTPRequest *request;
+    size_t       line_length;
+
+    line_length = (size_t)((const char *)memmem(buffer, frame->headerLength, "\r\n", 2) - buffer);
+    if(line_length >= sizeof(line))
+    {
+        return NULL;
+    }
+    memcpy(line, buffer, line_length);
+    line[line_length] = '\0';
+
+    method   = strtok_r(line, " ", &saveptr);
+    path     = strtok_r(NULL, " ", &saveptr);
+    protocol = strtok_r(NULL, " ", &saveptr);
+    extra    = strtok_r(NULL, " ", &saveptr);
+    if(!method || !path || !protocol || extra)
+    {
+        return NULL;
+    }
+
+    request = (HTTPRequest *)malloc(sizeof(HTTPRequest));
+    if(!request)
+    {
+        return NULL;
+    }
+    *request          = initializeHTTPRequest(method, path, protocol);
+    request->clientFd = client_fd;
+
+    if(frame->bodyLength > 0)
+    {
+        request->body = strndup(buffer + frame->headerLength, frame->bodyLength);
+    }
+    return request;
+}
+
+static void free_request(HTTPRequest *request)
+{
+    free(request->method);
+    free(request->path);
+    free(request->protocol);
+    if(request->body)
+    {
+        free(request->body);
+    }
+    free(request);
+}
+
+/*
+ * Starts the access log record of a framed request: request line, Referer
+ * and User-Agent are copied out of the raw header block.
+ */
+static void log_request(AccessRecord *record, const char *headers, const RequestFrame *frame, const struct sockaddr_in *peer)
+{
+    const char *end = headers + frame->headerLength;
+    const char *line_end;
+    const char *value;
+    size_t      length = 0;
+
+    line_end = (const char *)memmem(headers, frame->headerLength, "\r\n", 2);
+    access_log_begin(record, headers, line_end ? (size_t)(line_end - headers) : 0, peer);
+
+    value = find_header(headers, end, "Referer", &length);
+    access_log_set(record->referer, sizeof(record->referer), value, length);
+    value = find_header(headers, end, "User-Agent", &length);
+    access_log_set(record->agent, sizeof(record->agent), value, length);
+}
+
+/*
+ * Sends a batch of responses, counts them on the scoreboard, queues their
+ * access log records and closes the trace of the requests they answer.
+ * Shadowed requests run through their candidates once the batch is out.
+ */
+static int send_responses(int client_fd, HTTPResponse *responses, size_t count)
+{
+    uint64_t started = trace_clock();
+    int      result;
+
+    scoreboard_set_state(WORKER_STATE_WRITING);
+    result = http_response_send(client_fd, responses, count);
+    for(size_t i = 0; i < count; i++)
+    {
+        scoreboard_response(&responses[i]);
+        access_log_commit(&access_records[i], &responses[i]);
+    }
+    scoreboard_set_state(WORKER_STATE_READING);
+    trace_phase(TRACE_SEND, started);
+    trace_request_end(responses[count - 1].status, (uint32_t)count);
+    shadow_run_pending();
+    return result;
+}
+
+/*
+ * Serves requests on one connection until the client closes it, asks for
+ * close, stays idle past the keep-alive timeout, or hits a legacy handler.
+ * Requests that arrive pipelined are answered with a single batched send.
+ * Returns the number of requests answered.
+ */
+static size_t serve_connection(int client_fd, HTTPResponse *responses, const struct sockaddr_in *peer)
+{
+    char   buffer[REQUEST_BUFFER_SIZE];
+    size_t start  = 0;
+    size_t used   = 0;
+    size_t count  = 0;
+    size_t served = 0;
+    bool   open   = true;
+
+    while(open)
+    {
+        struct pollfd client_pfd[2];
+        RequestFrame  frame;
+        ssize_t       bytes;
+        uint64_t      received;
+        uint64_t      parsed = trace_clock();
+        int           ready;
+        int           status = 0;
+
+        // A long keep-alive connection must not hold off a profiling run
+        profiler_poll();
+
+        // Answer every complete request already buffered
+        while(open && (status = parse_request_frame(buffer + start, used - start, sizeof(buffer) - start, &frame)) == 1)
+        {
+            HTTPRequest  *request;
+            HTTPResponse *response = &responses[count];
+            HandlerSlot  *slot;
+            PerfSnapshot  counters;
+            const char   *raw        = buffer + start;
+            size_t        raw_length = frame.headerLength + frame.bodyLength;
+            uint64_t      captured   = capture_active() ? capture_clock() : 0;
+            uint64_t      started;
+            uint64_t      handled;
+            int           module;
+            int           route = -1;
+
+            http_response_reset(response);
+            request = build_request(buffer + start, &frame, client_fd);
+            trace_phase(TRACE_PARSE, parsed);
+            if(access_log_enabled())
+            {
+                log_request(&access_records[count], buffer + start, &frame, peer);
+            }
+            start += frame.headerLength + frame.bodyLength;
+            if(!frame.keepAlive || frame.closeAfter)
+            {
+                open = false;
+            }
+
+            if(!request)
+            {
+                http_response_set_status(response, BAD_REQUEST_STATUS);
+                open = false;
+            }
+            else
+            {
+                PROBE2(request_parsed, request->method, request->path);
+                handler_refresh();
+                module = handler_route(request->method, request->path, &route);
+                slot   = handler_acquire(module);
+                if(!slot)
+                {
+                    http_response_set_status(response, NOT_FOUND_STATUS);
+                }
+                else if(slot->abi_version == HANDLER_ABI_LEGACY)
+                {
+                    // Legacy modules write to the socket themselves and frame
+                    // nothing: flush what is queued, let it answer, then close
+                    if(count == 0 || send_responses(client_fd, responses, count) == 0)
+                    {
+                        started = trace_clock();
+                        PROBE3(handler_entry, module, request->method, request->path);
+                        handler_invoke(slot, client_fd, request, NULL);
+                        PROBE2(handler_exit, module, 0);
+                        trace_phase(TRACE_HANDLE, started);
+                        trace_request_end(0, 1);
+                    }
+                    count = 0;
+                    handler_release(slot);
+                    free_request(request);
+                    open = false;
+                    break;
+                }
+                else
+                {
+                    scoreboard_set_state(WORKER_STATE_HANDLING);
+                    started = scoreboard_now_ns();
+                    handled = trace_clock();
+                    PROBE3(handler_entry, module, request->method, request->path);
+                    perf_counters_begin(&counters);
+                    shadow_invoke(module, slot, client_fd, request, response);
+                    perf_counters_end(&counters, route, request->method);
+                    PROBE2(handler_exit, module, response->status);
+                    trace_phase(TRACE_HANDLE, handled);
+                    scoreboard_route(route, response->failed ? INTERNAL_SERVER_ERROR_STATUS : response->status, scoreboard_now_ns() - started);
+                    scoreboard_set_state(WORKER_STATE_READING);
+                }
+                handler_release(slot);
+                free_request(request);
+            }
+            capture_request(raw, raw_length, captured, response->failed ? INTERNAL_SERVER_ERROR_STATUS : response->status);
+
+            response->keepAlive = response->keepAlive && open;
+            open                = response->keepAlive;
+            served++;
+            if(++count == PIPELINE_BATCH)
+            {
+                if(send_responses(client_fd, responses, count) != 0)
+                {
+                    open = false;
+                }
+                count = 0;
+            }
+            parsed = trace_clock();
+        }
+
+        // Draining: answer what was received, then close rather than wait
+        // for more, unless a request is still arriving or none came yet
+        if(supervisor_worker_draining() && status == 0 && used == start && served > 0)
+        {
+            if(count > 0)
+            {
+                responses[count - 1].keepAlive = false;
+            }
+            open = false;
+        }
+
+        // The pipeline is drained: send the batch in one go
+        if(count > 0)
+        {
+            if(send_responses(client_fd, responses, count) != 0)
+            {
+                open = false;
+            }
+            count = 0;
+        }
+
+        if(!open)
+        {
+            break;
+        }
+
+        if(status > 1)
+        {
+            // Unframeable request: answer once and close
+            http_response_reset(&responses[0]);
+            http_response_set_status(&responses[0], status);
+            responses[0].keepAlive = false;
+            access_log_begin(&access_records[0], NULL, 0, peer);
+            send_responses(client_fd, responses, 1);
+            break;
+        }
+
+        // Keep the unparsed tail at the front of the buffer
+        if(start > 0)
+        {
+            memmove(buffer, buffer + start, used - start);
+            used -= start;
+            start = 0;
+        }
+
+        // Also wake up when the drain starts; once it has, only finish the
+        // request that is partly received
+        client_pfd[0].fd     = client_fd;
+        client_pfd[0].events = POLLIN;
+        client_pfd[1].fd     = supervisor_worker_drain_fd();
+        client_pfd[1].events = POLLIN;
+        ready = poll(client_pfd, supervisor_worker_draining() ? 1 : 2, KEEPALIVE_TIMEOUT_MS);
+        if(ready < 0 && errno == EINTR)
+        {
+            // SIGTERM landed mid-poll: look again with the drain in effect
+            continue;
+        }
+        if(ready <= 0)
+        {
+            break;
+        }
+
+        // An idle keep-alive connection is closed at once when the drain starts
+        if(!(client_pfd[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            if(used == 0 && served > 0)
+            {
+                break;
+            }
+            continue;
+        }
+
+        received = trace_clock();
+        bytes    = recv(client_fd, buffer + used, sizeof(buffer) - used, 0);
+        if(bytes < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            continue;
+        }
+        if(bytes <= 0)
+        {
+            break;
+        }
+        trace_phase(TRACE_READ, received);
+        scoreboard_bytes_in((size_t)bytes);
+        used += (size_t)bytes;
+    }
+
+    return served;
+}
+
 /**
- * Function to handle the recvmsg from the client
+ * Function to accept a client and serve its connection
  * @param server_fd server.fd
- * @param so_path path to the shared library
+ * @param responses per-worker responses reused across connections
  */
-static void handle_recvmsg(int server_fd, const char *so_path, RequestHandlerFunc handler)
+static void handle_recvmsg(int server_fd, HTTPResponse *responses)
 {
-    struct pollfd pfd;
+    struct pollfd pfd[2];
+    size_t        served;
     int           ret;
 
     // Set up the pollfd structure to monitor the server socket for readability
-    pfd.fd     = server_fd;
-    pfd.events = POLLIN;
+    pfd[0].fd     = server_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd     = supervisor_worker_drain_fd();
+    pfd[1].events = POLLIN;
 
-    // Wait for incoming connections
-    ret = poll(&pfd, 1, -1);
+    // Wait for incoming connections, or for the drain to start
+    ret = poll(pfd, 2, -1);
     if(ret < 0)
     {
-        perror("poll failed");
+        if(errno != EINTR)
+        {
+            perror("poll failed");
+        }
         return;
     }
 
@@ -67,108 +514,106 @@ static void handle_recvmsg(int server_fd, const char *so_path, RequestHandlerFun
         return;
     }
 
-    if(pfd.revents & POLLIN)
+    if((pfd[0].revents & POLLIN) && !supervisor_worker_draining())
     {
-        struct pollfd client_pfd;
-        int           client_ret;
-        int           client_fd = accept(server_fd, NULL, NULL);
+        struct sockaddr_in peer;
+        socklen_t          peer_length = sizeof(peer);
+        uint64_t           started     = trace_clock();
+        int                client_fd   = accept(server_fd, (struct sockaddr *)&peer, &peer_length);
         if(client_fd < 0)
         {
             perror("accept failed");
             return;
         }
-        printf("\n[Worker %d] Connection accepted the client fd %d\n", getpid(), client_fd);
+        trace_phase(TRACE_ACCEPT, started);
+        PROBE2(connection_accept, client_fd, peer.sin_addr.s_addr);
 
         // Set socket to non-blocking mode
         if(set_nonblocking(client_fd) < 0)
         {
             close(client_fd);
+            trace_discard();
             return;
         }
 
-        // Now that the client is connected, handle the client request using poll for reading
-        client_pfd.fd     = client_fd;
-        client_pfd.events = POLLIN;
+        // The worker counts as busy for as long as it holds the connection
+        scoreboard_busy();
+        capture_connection_start();
+        served = serve_connection(client_fd, responses, &peer);
+        close(client_fd);
+        PROBE2(connection_close, client_fd, served);
+        scoreboard_idle();
+        trace_discard();
+    }
+}
 
-        // Wait for data from the client
-        client_ret = poll(&client_pfd, 1, -1);    // Timeout is set to -1 (wait indefinitely)
-        if(client_ret < 0)
-        {
-            perror("poll failed");
-            close(client_fd);
-            return;
-        }
+/*
+ * Body of a worker process: initializes the handler module once for this
+ * worker, then serves connections until SIGTERM starts a drain.
+ */
+static void run_worker(int worker, void *arg)
+{
+    HTTPResponse responses[PIPELINE_BATCH];
+    int          server_fd = *(const int *)arg;
 
-        if(client_ret == 0)
-        {
-            printf("poll timed out for client fd %d\n", client_fd);
-            close(client_fd);
-            return;
-        }
+    (void)worker;
 
-        if(client_pfd.revents & POLLIN)
-        {
-            ssize_t      bytes;
-            TokenAndStr  firstLine;
-            HTTPRequest *request;
-            char         buffer[BUFFER_SIZE];
-
-            struct msghdr msg = {0};
-            struct iovec  iov;
-            iov.iov_base = buffer;
-            iov.iov_len  = sizeof(buffer);
-
-            msg.msg_name       = NULL;    // No address information
-            msg.msg_namelen    = 0;
-            msg.msg_iov        = &iov;    // Pointer to the vector of buffers
-            msg.msg_iovlen     = 1;       // Number of buffers
-            msg.msg_control    = NULL;    // No control messages
-            msg.msg_controllen = 0;       // Length of control data
-            msg.msg_flags      = 0;       // Flags (not using any here)
-
-            bytes = recvmsg(client_fd, &msg, 0);
-            if(bytes < 0)
-            {
-                perror("recvmsg failed");
-                close(client_fd);
-                return;
-            }
-            buffer[bytes] = '\0';
-            printf("Received: %s", buffer);
+    if(handler_worker_start() != 0)
+    {
+        fprintf(stderr, "[Worker %d] Handler failed to initialize\n", getpid());
+        exit(EXIT_FAILURE);
+    }
 
-            // Get the first line (request line)
-            firstLine = getFirstToken(buffer, "\n");
-            request   = initializeHTTPRequestFromString(firstLine.token);
-            free(firstLine.originalStr);
+    for(size_t i = 0; i < PIPELINE_BATCH; i++)
+    {
+        http_response_init(&responses[i]);
+    }
 
-            // Handle POST body (if any)
-            if(strcmp(request->method, "POST") == 0)
-            {
-                // Detect start of body: after empty line (\r\n\r\n)
-                char *body_start = strstr(buffer, "\r\n\r\n");
-                if(body_start)
-                {
-                    body_start += 4;    // Skip past \r\n\r\n
-                    setHTTPRequestBody(request, body_start);
-                }
-            }
+    while(!supervisor_worker_draining())
+    {
+        profiler_poll();
+        handle_recvmsg(server_fd, responses);
+    }
 
-            // Handle request
-            check_for_handler_update(so_path, &handler);
-            handler(client_fd, request);
+    // Draining: stop accepting, let the modules clean up, exit
+    close(server_fd);
+    for(size_t i = 0; i < PIPELINE_BATCH; i++)
+    {
+        http_response_free(&responses[i]);
+    }
+    handler_worker_stop();
+    printf("[Worker %d] Drained\n", getpid());
+    exit(EXIT_SUCCESS);
+}
 
-            // Clean up
-            free(request->method);
-            free(request->path);
-            free(request->protocol);
-            if(request->body)
-            {
-                free(request->body);
-            }
-            free(request);
-        }
-        close(client_fd);
+static void take_snapshot(void)
+{
+    SnapshotResult result;
+
+    if(database_snapshot(POST_DB_PATH, &result) != 0)
+    {
+        fprintf(stderr, "[Parent] Snapshot failed\n");
+        return;
     }
+
+    printf("[Parent] Snapshot %s: %zu bytes%s, writers paused %.3f ms, total %.3f ms\n", result.path, result.bytes, result.reflinked ? " (reflinked)" : "", result.pauseMs, result.totalMs);
+}
+
+static int prepare_post_database(void)
+{
+    DBO dbo;
+    int result;
+
+    dbo.name = strdup(POST_DB_PATH);
+    dbo.db   = NULL;
+    if(!dbo.name)
+    {
+        return -1;
+    }
+
+    result = database_prepare(&dbo, POST_PK_NAME);
+    free(dbo.name);
+    return result;
 }
 
 /**
@@ -176,112 +621,120 @@ static void handle_recvmsg(int server_fd, const char *so_path, RequestHandlerFun
  * @param so_path path to the shared library
  * @return function pointer to the request handler
  */
-int start_prefork_server(const char *ip, const char *port, const char *so_path, int num_workers)
+int start_prefork_server(const char *ip, const char *port, const char *so_path, int min_workers, int max_workers)
 {
     struct serverInformation server;
-    pid_t                   *child_pids;
-    RequestHandlerFunc       handler;
+    int                      reload_fd;
 
     server.ip   = strdup(ip);
     server.port = strdup(port);
-    child_pids  = NULL;
-    handler     = NULL;
+    reload_fd   = -1;
 
-    // Setup socket
-    server.fd = socket_create();
-    if(socket_bind(server) < 0)
+    // Setup socket, unless an old master or the service manager handed one over
+    server.fd = upgrade_inherited_listener();
+    if(server.fd < 0)
     {
-        perror("Socket bind failed");
-        goto cleanup;
+        server.fd = socket_create();
+        if(socket_bind(server) < 0)
+        {
+            perror("Socket bind failed");
+            goto cleanup;
+        }
+
+        start_listen(server.fd);
     }
 
-    start_listen(server.fd);
+    // Shared state must exist before fork so every worker maps the same pages
+    if(database_init_shared_lock() < 0 || record_cache_init() < 0 || profiler_init(max_workers) < 0)
+    {
+        fprintf(stderr, "Failed to create shared server state\n");
+        goto cleanup;
+    }
 
-    // Load shared library handler
-    handler = load_request_handler(so_path);
-    if(!handler)
+    // Load dictionaries and catch up indexes declared since the last run before workers start writing
+    if(prepare_post_database() < 0)
     {
-        fprintf(stderr, "Failed to load handler from .so\n");
+        fprintf(stderr, "Failed to prepare the POST database\n");
         goto cleanup;
     }
 
-    // Fork worker processes
-    child_pids = malloc((size_t)num_workers * sizeof(pid_t));
-    if(!child_pids)
+    // Load the handler modules named in the route table (so_path if there is none)
+    if(handler_modules_load(ROUTES_PATH, so_path) < 0)
     {
-        perror("malloc failed");
+        fprintf(stderr, "Failed to load handlers from %s\n", ROUTES_PATH);
         goto cleanup;
     }
 
-    register_child_pids(child_pids, num_workers);
+    // Workers pick up a new .so when the master publishes it, not by polling the file
+    reload_fd = handler_reload_init();
 
-    for(int i = 0; i < num_workers; i++)
+    // Fork workers; the supervisor respawns them as soon as one dies
+    if(supervisor_init(min_workers, max_workers, run_worker, &server.fd) < 0)
     {
-        pid_t pid = fork();
-        if(pid < 0)
-        {
-            perror("fork failed");
-            goto cleanup;
-        }
-
-        if(pid == 0)
-        {
-            // === CHILD PROCESS ===
-            printf("[Worker %d] Started with PID %d\n", i, getpid());
+        fprintf(stderr, "Failed to start workers\n");
+        goto cleanup;
+    }
 
-            while(1)
-            {
-                handle_recvmsg(server.fd, so_path, handler);
-            }
-        }
-        else
-        {
-            // === PARENT PROCESS ===
-            child_pids[i] = pid;
-        }
+    if(reload_fd >= 0)
+    {
+        supervisor_watch(reload_fd);
     }
 
+    // Workers are accepting: an old master that started us can drain now
+    upgrade_notify_ready();
+
     printf("[Parent] Monitoring worker processes...\n");
 
-    // Monitor & restart crashed workers
+    // Sleep until a worker exits, a module changes or a signal arrives
     while(1)
     {
-        sleep(1);
-        for(int i = 0; i < num_workers; i++)
+        int events = supervisor_wait();
+
+        // SIGINT/SIGTERM: workers finish what they are serving, then exit
+        if(events & SUPERVISOR_EVENT_SHUTDOWN)
         {
-            pid_t exited = waitpid(child_pids[i], NULL, WNOHANG);
-            if(exited == 0)
-            {
-                // still alive
-                continue;
-            }
+            supervisor_drain();
+            break;
+        }
 
-            if(exited > 0)
-            {
-                pid_t new_pid;
+        // SIGUSR2: re-exec the binary, hand it the socket, and drain once it is up
+        if((events & SUPERVISOR_EVENT_UPGRADE) && upgrade_start(server.fd) == 0)
+        {
+            supervisor_drain();
+            break;
+        }
 
-                // Worker crashed, restart
-                new_pid = fork();
-                printf("[Parent] Worker %d (PID %d) died. Restarting...\n", i, exited);
+        if(events & SUPERVISOR_EVENT_WATCHED)
+        {
+            handler_reload_on_event(reload_fd);
+        }
 
-                if(new_pid == 0)
-                {
-                    printf("[Worker %d] Restarted with PID %d\n", i, getpid());
+        // kill -HUP <master> reloads every module even where inotify is
+        // unavailable, and reopens the access log after an external rotation
+        if(events & SUPERVISOR_EVENT_RELOAD)
+        {
+            handler_request_reload();
+            access_log_reopen();
+        }
 
-                    while(1)
-                    {
-                        handle_recvmsg(server.fd, so_path, handler);
-                    }
-                }
-                child_pids[i] = new_pid;
-            }
+        if(handler_reload_requested())
+        {
+            handler_publish_reload();
+        }
+
+        // kill -USR1 <master> takes an online snapshot
+        if(events & SUPERVISOR_EVENT_SNAPSHOT)
+        {
+            take_snapshot();
         }
     }
 
 cleanup:
-    if(child_pids)
+    // After the drain, so the logger writes the last workers' requests too
+    access_log_stop();
+    if(reload_fd >= 0)
     {
-        free(child_pids);
+        close(reload_fd);
     }
     if(server.port)
     {
@@ -305,9 +758,14 @@ int server_setup(char *passedServerInfo[])
     const char *ip      = passedServerInfo[0];
     const char *port    = passedServerInfo[1];
     const char *so_path = "../data/handler/handler_v1.so";
-    const int   workers = 4;    // Number of worker processes
+    const int   workers = cpu_topology_budget();    // One worker per usable CPU
+
+    if(db_index_declare_list(DEFAULT_INDEXED_FIELDS) != 0)
+    {
+        return -1;
+    }
 
-    return start_prefork_server(ip, port, so_path, workers);
+    return start_prefork_server(ip, port, so_path, workers, workers * SUPERVISOR_MAX_WORKERS_PER_CPU);
 }
 
 /**
@@ -0,0 +1,327 @@
+#include "../include/shadow.h"
+#include "../include/histogram.h"
+#include "../include/sampler.h"
+#include "../include/sharedMemory.h"
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#pragma GCC diagnostic ignored "-Waggregate-return"
+
+#define SHADOW_REPORT_LINE 512
+#define SHADOW_MAX_PENDING 16
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define NANOSECONDS_PER_MICROSECOND 1000
+#define PERCENT 100
+
+/*
+ * What one side of the comparison cost on the sampled requests.
+ */
+typedef struct
+{
+    Histogram latency;    // nanoseconds
+    Histogram heap;       // bytes the heap grew during the call
+} ShadowSide;
+
+typedef struct
+{
+    _Atomic(unsigned long) candidateGeneration;    // stats below belong to this candidate
+    _Atomic(uint64_t)      statusMismatches;
+    _Atomic(uint64_t)      lengthMismatches;
+    ShadowSide             active;
+    ShadowSide             candidate;
+} ShadowModule;
+
+/*
+ * Lives in shared memory so every worker adds to the same numbers and any
+ * worker can serve the report.
+ */
+typedef struct
+{
+    unsigned int percent;
+    ShadowModule modules[HANDLER_MAX_MODULES];
+} ShadowStats;
+
+/*
+ * A sampled request waiting for its response to go out before the candidate
+ * runs it.
+ */
+typedef struct
+{
+    int          module;
+    int          clientFd;
+    HandlerSlot *candidate;
+    HTTPRequest  request;
+    int          activeStatus;
+    size_t       activeLength;
+} ShadowPending;
+
+static ShadowStats *shadow_stats = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Per-process queue of sampled requests and the response candidates write into
+static ShadowPending shadow_pending[SHADOW_MAX_PENDING];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static size_t        shadow_num_pending = 0;                // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static HTTPResponse  shadow_scratch;                        // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static bool          shadow_scratch_ready = false;          // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+int shadow_init(unsigned int percent)
+{
+    if(percent == 0)
+    {
+        return 0;
+    }
+
+    shadow_stats = (ShadowStats *)shared_memory_create(sizeof(ShadowStats));
+    if(!shadow_stats)
+    {
+        return -1;
+    }
+
+    shadow_stats->percent = percent > SAMPLER_MAX_PERCENT ? SAMPLER_MAX_PERCENT : percent;
+    handler_set_candidates(true);
+    return 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+static size_t heap_in_use(void)
+{
+    return mallinfo2().uordblks;
+}
+
+/*
+ * Stats restart whenever a new candidate is published; the worker that first
+ * sees the new generation clears them.
+ */
+static void claim_stats(ShadowModule *stats, unsigned long generation)
+{
+    unsigned long current = atomic_load_explicit(&stats->candidateGeneration, memory_order_relaxed);
+
+    if(current != generation && atomic_compare_exchange_strong(&stats->candidateGeneration, &current, generation))
+    {
+        histogram_reset(&stats->active.latency);
+        histogram_reset(&stats->active.heap);
+        histogram_reset(&stats->candidate.latency);
+        histogram_reset(&stats->candidate.heap);
+        atomic_store_explicit(&stats->statusMismatches, 0, memory_order_relaxed);
+        atomic_store_explicit(&stats->lengthMismatches, 0, memory_order_relaxed);
+    }
+}
+
+/*
+ * Runs one handler and records what it cost.
+ */
+static int measure(ShadowSide *side, HandlerSlot *slot, int client_fd, const HTTPRequest *request, HTTPResponse *response)
+{
+    size_t   heap_before = heap_in_use();
+    uint64_t start       = now_ns();
+    int      result      = handler_invoke(slot, client_fd, request, response);
+    uint64_t elapsed     = now_ns() - start;
+    size_t   heap_after  = heap_in_use();
+
+    histogram_record(&side->latency, elapsed);
+    histogram_record(&side->heap, heap_after > heap_before ? heap_after - heap_before : 0);
+    return result;
+}
+
+/*
+ * Copies the parts of a request a handler reads. Returns 0 on success, -1 if
+ * out of memory.
+ */
+static int copy_request(HTTPRequest *copy, const HTTPRequest *request)
+{
+    copy->method   = strdup(request->method);
+    copy->path     = strdup(request->path);
+    copy->protocol = strdup(request->protocol);
+    copy->body     = request->body ? strdup(request->body) : NULL;
+    copy->clientFd = request->clientFd;
+    if(!copy->method || !copy->path || !copy->protocol || (request->body && !copy->body))
+    {
+        free(copy->method);
+        free(copy->path);
+        free(copy->protocol);
+        free(copy->body);
+        return -1;
+    }
+    return 0;
+}
+
+int shadow_invoke(int module, HandlerSlot *slot, int client_fd, const HTTPRequest *request, HTTPResponse *response)
+{
+    ShadowPending *pending;
+    ShadowModule  *stats;
+    int            result;
+
+    // Only side-effect free requests are run twice, and only through v2
+    // handlers, whose response can be thrown away
+    if(!shadow_stats || slot->abi_version != HANDLER_ABI_VERSION || (strcmp(request->method, "GET") != 0 && strcmp(request->method, "HEAD") != 0) || shadow_num_pending == SHADOW_MAX_PENDING ||
+       !sampler_pick(shadow_stats->percent))
+    {
+        return handler_invoke(slot, client_fd, request, response);
+    }
+
+    pending            = &shadow_pending[shadow_num_pending];
+    pending->candidate = handler_acquire_candidate(module);
+    if(!pending->candidate)
+    {
+        return handler_invoke(slot, client_fd, request, response);
+    }
+    if(copy_request(&pending->request, request) != 0)
+    {
+        handler_release(pending->candidate);
+        return handler_invoke(slot, client_fd, request, response);
+    }
+
+    stats = &shadow_stats->modules[module];
+    claim_stats(stats, pending->candidate->generation);
+    result = measure(&stats->active, slot, client_fd, request, response);
+
+    pending->module       = module;
+    pending->clientFd     = client_fd;
+    pending->activeStatus = response->status;
+    pending->activeLength = response->body.length;
+    shadow_num_pending++;
+    return result;
+}
+
+void shadow_run_pending(void)
+{
+    if(!shadow_scratch_ready && shadow_num_pending > 0)
+    {
+        http_response_init(&shadow_scratch);
+        shadow_scratch_ready = true;
+    }
+
+    for(size_t i = 0; i < shadow_num_pending; i++)
+    {
+        ShadowPending *pending = &shadow_pending[i];
+        ShadowModule  *stats   = &shadow_stats->modules[pending->module];
+
+        http_response_reset(&shadow_scratch);
+        measure(&stats->candidate, pending->candidate, pending->clientFd, &pending->request, &shadow_scratch);
+        handler_release(pending->candidate);
+
+        if(shadow_scratch.status != pending->activeStatus)
+        {
+            atomic_fetch_add_explicit(&stats->statusMismatches, 1, memory_order_relaxed);
+        }
+        else if(shadow_scratch.body.length != pending->activeLength)
+        {
+            atomic_fetch_add_explicit(&stats->lengthMismatches, 1, memory_order_relaxed);
+        }
+
+        free(pending->request.method);
+        free(pending->request.path);
+        free(pending->request.protocol);
+        free(pending->request.body);
+    }
+    shadow_num_pending = 0;
+}
+
+static void report_side(HTTPResponse *response, const char *name, const ShadowSide *side)
+{
+    char     line[SHADOW_REPORT_LINE];
+    uint64_t p50 = histogram_percentile(&side->latency, 500000);
+    uint64_t p90 = histogram_percentile(&side->latency, 900000);
+    uint64_t p99 = histogram_percentile(&side->latency, 990000);
+    uint64_t max = histogram_percentile(&side->latency, HISTOGRAM_PER_MILLION);
+
+    snprintf(line,
+             sizeof(line),
+             "\"%s\":{\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,\"mean_us\":%.3f,\"mean_heap_growth_bytes\":%.1f,\"p99_heap_growth_bytes\":%llu}",
+             name,
+             (double)p50 / NANOSECONDS_PER_MICROSECOND,
+             (double)p90 / NANOSECONDS_PER_MICROSECOND,
+             (double)p99 / NANOSECONDS_PER_MICROSECOND,
+             (double)max / NANOSECONDS_PER_MICROSECOND,
+             histogram_mean(&side->latency) / NANOSECONDS_PER_MICROSECOND,
+             histogram_mean(&side->heap),
+             (unsigned long long)histogram_percentile(&side->heap, 990000));
+    http_response_append_str(response, line);
+}
+
+int shadow_report(HTTPResponse *response)
+{
+    char line[SHADOW_REPORT_LINE];
+    int  written = 0;
+
+    http_response_add_header(response, "Content-Type", "application/json");
+    snprintf(line, sizeof(line), "{\"enabled\":%s,\"sample_percent\":%u,\"modules\":[", shadow_stats ? "true" : "false", shadow_stats ? shadow_stats->percent : 0);
+    http_response_append_str(response, line);
+
+    for(size_t i = 0; shadow_stats && i < handler_module_count_get(); i++)
+    {
+        const ShadowModule *stats     = &shadow_stats->modules[i];
+        HandlerSlot        *candidate = handler_acquire_candidate((int)i);
+        uint64_t            active_p99;
+        uint64_t            candidate_p99;
+
+        if(!candidate)
+        {
+            continue;
+        }
+
+        active_p99    = histogram_percentile(&stats->active.latency, 990000);
+        candidate_p99 = histogram_percentile(&stats->candidate.latency, 990000);
+
+        snprintf(line,
+                 sizeof(line),
+                 "%s{\"module\":\"%s\",\"candidate_path\":\"%s\",\"generation\":%lu,\"samples\":%llu,\"status_mismatches\":%llu,\"length_mismatches\":%llu,\"p99_change_percent\":%.1f,",
+                 written++ ? "," : "",
+                 handler_module_path((int)i),
+                 handler_candidate_path((int)i),
+                 candidate->generation,
+                 (unsigned long long)histogram_count(&stats->candidate.latency),
+                 (unsigned long long)atomic_load_explicit(&stats->statusMismatches, memory_order_relaxed),
+                 (unsigned long long)atomic_load_explicit(&stats->lengthMismatches, memory_order_relaxed),
+                 active_p99 > 0 ? ((double)candidate_p99 - (double)active_p99) * PERCENT / (double)active_p99 : 0);
+        http_response_append_str(response, line);
+        handler_release(candidate);
+
+        report_side(response, "active", &stats->active);
+        http_response_append_str(response, ",");
+        report_side(response, "candidate", &stats->candidate);
+        http_response_append_str(response, "}");
+    }
+
+    http_response_append_str(response, "]}");
+    return response->failed ? -1 : 0;
+}
+
+int shadow_promote(int module)
+{
+    int promoted = 0;
+
+    for(size_t i = 0; i < handler_module_count_get(); i++)
+    {
+        HandlerSlot *candidate;
+
+        if(module >= 0 && (size_t)module != i)
+        {
+            continue;
+        }
+
+        candidate = handler_acquire_candidate((int)i);
+        if(!candidate)
+        {
+            continue;
+        }
+        handler_release(candidate);
+
+        if(handler_promote_candidate((int)i) != 0)
+        {
+            return -1;
+        }
+        promoted++;
+    }
+    return promoted;
+}
@@ -0,0 +1,206 @@
+#include "../include/sharedMemory.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHARED_MEMORY_MAX_REGIONS 8
+
+typedef struct
+{
+    char   name[SHARED_MEMORY_NAME_MAX];
+    int    fd;
+    size_t size;
+} SharedRegion;
+
+// Named regions this master created or adopted, and ones handed over by the old master
+static SharedRegion regions[SHARED_MEMORY_MAX_REGIONS];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int          region_count  = 0;                     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static SharedRegion adopted[SHARED_MEMORY_MAX_REGIONS];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int          adopted_count = 0;                     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+void *shared_memory_create(size_t size)
+{
+    void *addr;
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED)
+    {
+        perror("mmap shared memory failed");
+        return NULL;
+    }
+
+    // Anonymous mappings are already zeroed by the kernel
+    return addr;
+}
+
+void shared_memory_destroy(void *addr, size_t size)
+{
+    if(addr)
+    {
+        munmap(addr, size);
+    }
+}
+
+int shared_memory_adopt(const char *name, int fd)
+{
+    struct stat st;
+
+    if(adopted_count == SHARED_MEMORY_MAX_REGIONS || fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    strncpy(adopted[adopted_count].name, name, SHARED_MEMORY_NAME_MAX - 1);
+    adopted[adopted_count].name[SHARED_MEMORY_NAME_MAX - 1] = '\0';
+    adopted[adopted_count].fd                               = fd;
+    adopted[adopted_count].size                             = (size_t)st.st_size;
+    adopted_count++;
+    return 0;
+}
+
+/*
+ * Takes the region the old master handed over under this name, if its size
+ * still matches; a region whose layout changed starts fresh instead.
+ */
+static int take_adopted(const char *name, size_t size)
+{
+    for(int i = 0; i < adopted_count; i++)
+    {
+        if(adopted[i].fd >= 0 && strcmp(adopted[i].name, name) == 0)
+        {
+            int fd = adopted[i].fd;
+
+            adopted[i].fd = -1;
+            if(adopted[i].size == size)
+            {
+                return fd;
+            }
+            fprintf(stderr, "Shared region %s changed size, not reusing it\n", name);
+            close(fd);
+        }
+    }
+    return -1;
+}
+
+void *shared_memory_attach(const char *name, size_t size, bool *attached)
+{
+    void *addr;
+    int   fd;
+
+    *attached = false;
+    if(region_count == SHARED_MEMORY_MAX_REGIONS)
+    {
+        fprintf(stderr, "Too many named shared regions\n");
+        return NULL;
+    }
+
+    fd = take_adopted(name, size);
+    if(fd >= 0)
+    {
+        *attached = true;
+    }
+    else
+    {
+        fd = memfd_create(name, MFD_CLOEXEC);
+        if(fd < 0 || ftruncate(fd, (off_t)size) < 0)
+        {
+            perror("memfd shared memory failed");
+            if(fd >= 0)
+            {
+                close(fd);
+            }
+            return NULL;
+        }
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED)
+    {
+        perror("mmap shared memory failed");
+        close(fd);
+        *attached = false;
+        return NULL;
+    }
+
+    strncpy(regions[region_count].name, name, SHARED_MEMORY_NAME_MAX - 1);
+    regions[region_count].fd   = fd;
+    regions[region_count].size = size;
+    region_count++;
+    return addr;
+}
+
+int shared_memory_region_count(void)
+{
+    return region_count;
+}
+
+const char *shared_memory_region_name(int region)
+{
+    return regions[region].name;
+}
+
+int shared_memory_region_fd(int region)
+{
+    return regions[region].fd;
+}
+
+int shared_mutex_init(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attr;
+    int                 result;
+
+    if(pthread_mutexattr_init(&attr) != 0)
+    {
+        return -1;
+    }
+
+    // Shared between forked workers, and recoverable if a worker dies holding it
+    result = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if(result == 0)
+    {
+        result = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    }
+    if(result == 0)
+    {
+        result = pthread_mutex_init(mutex, &attr);
+    }
+
+    pthread_mutexattr_destroy(&attr);
+
+    if(result != 0)
+    {
+        fprintf(stderr, "shared mutex init failed: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+int shared_mutex_lock(pthread_mutex_t *mutex)
+{
+    int result;
+
+    result = pthread_mutex_lock(mutex);
+    if(result == 0)
+    {
+        return 0;
+    }
+
+    if(result == EOWNERDEAD)
+    {
+        // Previous owner crashed mid-update; hand the repair to the caller
+        pthread_mutex_consistent(mutex);
+        return 1;
+    }
+
+    fprintf(stderr, "shared mutex lock failed: %s\n", strerror(result));
+    return -1;
+}
+
+void shared_mutex_unlock(pthread_mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
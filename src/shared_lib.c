@@ -1,84 +1,964 @@
 #include "../include/shared_lib.h"
+#include "../include/probes.h"
+#include "../include/routeTable.h"
+#include "../include/sharedMemory.h"
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-// Global state for reload checks (optional if single `.so`)
-time_t last_mod_time  = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
-void  *current_handle = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+#define INOTIFY_BUFFER_SIZE 4096
+#define COPY_BUFFER_SIZE 16384
+#define ROUTE_LINE_MAX (PATH_MAX + 64)
 
-/**
- * Loads a shared library and returns the `handle_request` function pointer.
- * Also stores the last modification time for update tracking.
+/*
+ * One handler library named in the route table. Each module is loaded,
+ * reloaded and published independently of the others.
  */
-RequestHandlerFunc load_request_handler(const char *so_path)
+typedef struct
 {
-    struct stat        so_stat;
-    void              *handle;
-    RequestHandlerFunc handler;
+    char                   path[PATH_MAX];
+    _Atomic(HandlerSlot *) active;               // slot new requests are served from
+    unsigned long          loaded_generation;    // generation this process has loaded
+    int                    watch;                // inotify watch on the module's directory
+    bool                   pending;              // master: reload requested
+    char                   candidate_path[PATH_MAX];
+    _Atomic(HandlerSlot *) candidate;                // shadow candidate, NULL if none
+    unsigned long          candidate_generation;     // candidate generation this process has loaded
+    bool                   candidate_pending;        // master: candidate appeared, changed or went away
+} HandlerModule;
 
-    if(stat(so_path, &so_stat) != 0)
+/*
+ * The library image the master validated for a module or candidate: its
+ * descriptor in the master and the memfd's inode. Workers load from
+ * /proc/<master>/fd/<fd> and check the inode, so they run the validated
+ * bytes, not whatever is on disk by then. fd is -1 when there is none.
+ */
+typedef struct
+{
+    _Atomic(int)           fd;
+    _Atomic(unsigned long) inode;
+} HandlerImage;
+
+/*
+ * Generations published by the master, in shared memory. `total` moves
+ * whenever any module does, so workers check a single word per request.
+ */
+typedef struct
+{
+    _Atomic(unsigned long) total;
+    _Atomic(unsigned long) module[HANDLER_MAX_MODULES];
+    _Atomic(unsigned long) candidate[HANDLER_MAX_MODULES];
+    HandlerImage           module_image[HANDLER_MAX_MODULES];
+    HandlerImage           candidate_image[HANDLER_MAX_MODULES];
+    pid_t                  master;
+} HandlerGenerations;
+
+static HandlerModule handler_modules[HANDLER_MAX_MODULES];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static size_t        handler_module_count = 0;                // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static RouteTable   *handler_routes       = NULL;             // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static bool          candidates_enabled   = false;            // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static HandlerGenerations *handler_generations = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// handler_generations->total as last seen by this process
+static unsigned long seen_generations = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static volatile sig_atomic_t reload_signalled = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static int publish_candidate(size_t index);
+
+/*
+ * Copies the library into an anonymous memfd. dlopen of the copy always maps
+ * a fresh object (the same path would return the already-loaded one), and a
+ * later in-place overwrite of the original cannot corrupt code that is
+ * mapped from it. The copy is sealed, so what was validated stays what is
+ * loaded.
+ */
+static int copy_library(const char *so_path)
+{
+    char    buffer[COPY_BUFFER_SIZE];
+    ssize_t bytes;
+    int     source_fd;
+    int     image_fd;
+
+    source_fd = open(so_path, O_RDONLY | O_CLOEXEC);
+    if(source_fd < 0)
     {
-        perror("Failed to stat shared library");
-        return NULL;
+        perror("Failed to open shared library");
+        return -1;
     }
 
-    last_mod_time = so_stat.st_mtime;
+    image_fd = memfd_create("handler", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(image_fd < 0)
+    {
+        perror("memfd_create failed");
+        close(source_fd);
+        return -1;
+    }
 
-    handle = dlopen(so_path, RTLD_NOW);
-    if(!handle)
+    while((bytes = read(source_fd, buffer, sizeof(buffer))) > 0)
     {
-        fprintf(stderr, "dlopen error: %s\n", dlerror());
-        return NULL;
+        if(write(image_fd, buffer, (size_t)bytes) != bytes)
+        {
+            bytes = -1;
+            break;
+        }
     }
+    close(source_fd);
 
-    // Save handle globally for reuse/reload
-    current_handle = handle;
+    if(bytes < 0)
+    {
+        perror("Failed to copy shared library");
+        close(image_fd);
+        return -1;
+    }
 
-    handler = (RequestHandlerFunc)dlsym(handle, "handle_request");
-    if(!handler)
+    if(fcntl(image_fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+    {
+        perror("Failed to seal shared library copy");
+        close(image_fd);
+        return -1;
+    }
+    return image_fd;
+}
+
+/*
+ * Looks up a function symbol into a function pointer. ISO C has no cast
+ * from the object pointer dlsym returns, so the address is copied across.
+ */
+static void lookup_function(void *handle, const char *name, void *function)
+{
+    void *symbol = dlsym(handle, name);
+
+    memcpy(function, &symbol, sizeof(symbol));
+}
+
+/*
+ * Finds the entry points for the ABI the module declares.
+ */
+static int resolve_entry_points(HandlerSlot *slot)
+{
+    const int *abi_version;
+
+    abi_version       = (const int *)dlsym(slot->handle, "handler_abi_version");
+    slot->abi_version = abi_version ? *abi_version : HANDLER_ABI_LEGACY;
+
+    if(slot->abi_version == HANDLER_ABI_LEGACY)
+    {
+        lookup_function(slot->handle, "handle_request", &slot->handle_request);
+        if(!slot->handle_request)
+        {
+            fprintf(stderr, "dlsym error: %s\n", dlerror());
+            return -1;
+        }
+        return 0;
+    }
+
+    if(slot->abi_version != HANDLER_ABI_VERSION)
+    {
+        fprintf(stderr, "Unsupported handler ABI version %d\n", slot->abi_version);
+        return -1;
+    }
+
+    lookup_function(slot->handle, "handle_request_v2", &slot->handle_request_v2);
+    if(!slot->handle_request_v2)
     {
         fprintf(stderr, "dlsym error: %s\n", dlerror());
-        dlclose(handle);
-        current_handle = NULL;
+        return -1;
+    }
+    lookup_function(slot->handle, "handler_init", &slot->init);
+    lookup_function(slot->handle, "handler_fini", &slot->fini);
+    return 0;
+}
+
+/*
+ * Runs the module's per-worker init. Slots loaded in the master are never
+ * initialized there; each worker initializes its inherited copy itself.
+ */
+static int initialize_slot(HandlerSlot *slot)
+{
+    if(slot->initialized)
+    {
+        return 0;
+    }
+    if(slot->init && slot->init(&slot->context) != 0)
+    {
+        fprintf(stderr, "handler_init failed for generation %lu\n", slot->generation);
+        return -1;
+    }
+    slot->initialized = true;
+    return 0;
+}
+
+/*
+ * Loads and verifies a new slot from a library image, which the slot takes
+ * over. Nothing is published until both dlopen and dlsym have succeeded.
+ */
+static HandlerSlot *load_image(int image_fd, unsigned long generation)
+{
+    HandlerSlot *slot;
+    char         image_path[PATH_MAX];
+
+    slot = (HandlerSlot *)calloc(1, sizeof(HandlerSlot));
+    if(!slot)
+    {
+        perror("calloc failed");
+        close(image_fd);
         return NULL;
     }
+    slot->image_fd = image_fd;
+
+    // The fd stays open while the slot lives, so this path is unique among loaded objects
+    snprintf(image_path, sizeof(image_path), "/proc/self/fd/%d", slot->image_fd);
+    slot->handle = dlopen(image_path, RTLD_NOW | RTLD_LOCAL);
+    if(!slot->handle)
+    {
+        fprintf(stderr, "dlopen error: %s\n", dlerror());
+        close(slot->image_fd);
+        free(slot);
+        return NULL;
+    }
+
+    if(resolve_entry_points(slot) != 0)
+    {
+        dlclose(slot->handle);
+        close(slot->image_fd);
+        free(slot);
+        return NULL;
+    }
+
+    slot->generation = generation;
+    atomic_init(&slot->refs, 1);    // the active reference
+    return slot;
+}
+
+static HandlerSlot *load_slot(const char *so_path, unsigned long generation)
+{
+    int image_fd = copy_library(so_path);
+
+    return image_fd < 0 ? NULL : load_image(image_fd, generation);
+}
+
+/*
+ * Makes `slot` the module's active (or candidate) slot and drops the active reference on the
+ * previous one, which is unloaded as soon as its in-flight requests have
+ * released it.
+ */
+static void publish_slot_to(_Atomic(HandlerSlot *) *target, HandlerSlot *slot)
+{
+    HandlerSlot *previous;
+
+    previous = atomic_exchange_explicit(target, slot, memory_order_acq_rel);
+    handler_release(previous);
+}
+
+static void publish_slot(HandlerModule *module, HandlerSlot *slot)
+{
+    publish_slot_to(&module->active, slot);
+}
+
+/*
+ * handler_v1.so -> handler_v1.candidate.so, in the same directory. The caller
+ * has checked that the result fits in PATH_MAX.
+ */
+static void candidate_path_for(const char *so_path, char *candidate_path)
+{
+    size_t length = strlen(so_path);
+
+    if(length > 3 && strcmp(so_path + length - 3, ".so") == 0)
+    {
+        length -= 3;
+    }
+    memcpy(candidate_path, so_path, length);
+    memcpy(candidate_path + length, HANDLER_CANDIDATE_SUFFIX, sizeof(HANDLER_CANDIDATE_SUFFIX));
+}
+
+int handler_module_add(const char *so_path)
+{
+    HandlerModule *module;
+    HandlerSlot   *slot;
+
+    for(size_t i = 0; i < handler_module_count; i++)
+    {
+        if(strcmp(handler_modules[i].path, so_path) == 0)
+        {
+            return (int)i;
+        }
+    }
+
+    if(handler_module_count == HANDLER_MAX_MODULES || strlen(so_path) + sizeof(HANDLER_CANDIDATE_SUFFIX) >= PATH_MAX)
+    {
+        fprintf(stderr, "Cannot add handler module %s\n", so_path);
+        return -1;
+    }
+
+    slot = load_slot(so_path, 0);
+    if(!slot)
+    {
+        return -1;
+    }
+
+    module = &handler_modules[handler_module_count];
+    strcpy(module->path, so_path);
+    atomic_init(&module->active, slot);
+    module->loaded_generation = 0;
+    module->watch             = -1;
+    module->pending           = false;
+    candidate_path_for(so_path, module->candidate_path);
+    atomic_init(&module->candidate, NULL);
+    module->candidate_generation = 0;
+    module->candidate_pending    = false;
 
     printf("Loaded handler from %s\n", so_path);
-    return handler;
+    return (int)handler_module_count++;
 }
 
-/**
- * Checks if the shared library at `so_path` was updated.
- * If so, unloads the current one and loads the new one into `*handler_ptr`.
+/*
+ * Parses one "METHOD PREFIX SO_PATH" line into the route table.
  */
-void check_for_handler_update(const char *so_path, RequestHandlerFunc *handler_ptr)
+static int add_route_line(char *line, const char *routes_path, int line_number)
+{
+    char *saveptr;
+    char *method;
+    char *prefix;
+    char *so_path;
+    int   module;
+
+    method = strtok_r(line, " \t\r\n", &saveptr);
+    if(!method || method[0] == '#')
+    {
+        return 0;
+    }
+
+    prefix  = strtok_r(NULL, " \t\r\n", &saveptr);
+    so_path = strtok_r(NULL, " \t\r\n", &saveptr);
+    if(!prefix || !so_path || prefix[0] != '/')
+    {
+        fprintf(stderr, "%s:%d: expected METHOD /prefix path/to/handler.so\n", routes_path, line_number);
+        return -1;
+    }
+
+    module = handler_module_add(so_path);
+    if(module < 0)
+    {
+        return -1;
+    }
+    return route_table_add(handler_routes, method, prefix, module);
+}
+
+int handler_modules_load(const char *routes_path, const char *default_so_path)
 {
-    struct stat so_stat;
+    FILE *file;
+    char  line[ROUTE_LINE_MAX];
+    int   line_number = 0;
+    int   result      = 0;
+
+    handler_routes = route_table_create();
+    if(!handler_routes)
+    {
+        return -1;
+    }
+
+    file = fopen(routes_path, "re");
+    if(!file)
+    {
+        // No route file: every request goes to the default module
+        int module = handler_module_add(default_so_path);
+        return module < 0 ? -1 : route_table_add(handler_routes, ROUTE_ANY_METHOD, "/", module);
+    }
+
+    while(result == 0 && fgets(line, sizeof(line), file))
+    {
+        result = add_route_line(line, routes_path, ++line_number);
+    }
+    fclose(file);
+
+    if(result == 0 && route_table_size(handler_routes) == 0)
+    {
+        fprintf(stderr, "%s has no routes\n", routes_path);
+        result = -1;
+    }
+    return result;
+}
+
+int handler_route(const char *method, const char *path, int *route)
+{
+    int match = handler_routes ? route_table_match(handler_routes, method, path) : -1;
+
+    if(route)
+    {
+        *route = match;
+    }
+    return match < 0 ? -1 : route_table_module(handler_routes, match);
+}
+
+int handler_route_count(void)
+{
+    return handler_routes ? (int)route_table_size(handler_routes) : 0;
+}
+
+void handler_route_describe(int route, const char **method, const char **prefix)
+{
+    *method = route_table_method(handler_routes, route);
+    *prefix = route_table_prefix(handler_routes, route);
+}
+
+/*
+ * Slots are only swapped between requests on the serving thread, so a slot
+ * cannot be retired between this load and the increment.
+ */
+static HandlerSlot *acquire_slot(_Atomic(HandlerSlot *) *source)
+{
+    HandlerSlot *slot = atomic_load_explicit(source, memory_order_acquire);
+
+    if(slot)
+    {
+        atomic_fetch_add_explicit(&slot->refs, 1, memory_order_relaxed);
+    }
+    return slot;
+}
+
+HandlerSlot *handler_acquire(int module)
+{
+    if(module < 0 || (size_t)module >= handler_module_count)
+    {
+        return NULL;
+    }
+    return acquire_slot(&handler_modules[module].active);
+}
+
+HandlerSlot *handler_acquire_candidate(int module)
+{
+    if(module < 0 || (size_t)module >= handler_module_count)
+    {
+        return NULL;
+    }
+    return acquire_slot(&handler_modules[module].candidate);
+}
+
+size_t handler_module_count_get(void)
+{
+    return handler_module_count;
+}
+
+const char *handler_module_path(int module)
+{
+    return handler_modules[module].path;
+}
+
+const char *handler_candidate_path(int module)
+{
+    return handler_modules[module].candidate_path;
+}
+
+void handler_set_candidates(bool enabled)
+{
+    candidates_enabled = enabled;
+}
+
+int handler_promote_candidate(int module)
+{
+    HandlerModule *target;
+
+    if(module < 0 || (size_t)module >= handler_module_count)
+    {
+        return -1;
+    }
+
+    // The master sees the rename through inotify: the module reloads and the candidate goes away
+    target = &handler_modules[module];
+    if(rename(target->candidate_path, target->path) != 0)
+    {
+        perror("Failed to promote candidate handler");
+        return -1;
+    }
+    printf("Promoted %s over %s\n", target->candidate_path, target->path);
+    return 0;
+}
+
+int handler_worker_start(void)
+{
+    for(size_t i = 0; i < handler_module_count; i++)
+    {
+        HandlerSlot *slot      = atomic_load_explicit(&handler_modules[i].active, memory_order_acquire);
+        HandlerSlot *candidate = atomic_load_explicit(&handler_modules[i].candidate, memory_order_acquire);
+
+        if(slot && initialize_slot(slot) != 0)
+        {
+            return -1;
+        }
+
+        // A candidate that cannot start is only dropped from the shadow run
+        if(candidate && initialize_slot(candidate) != 0)
+        {
+            atomic_store_explicit(&handler_modules[i].candidate, NULL, memory_order_release);
+            handler_release(candidate);
+        }
+    }
+    return 0;
+}
+
+void handler_worker_stop(void)
+{
+    for(size_t i = 0; i < handler_module_count; i++)
+    {
+        // handler_fini runs when the last reference goes away
+        handler_release(atomic_exchange_explicit(&handler_modules[i].active, NULL, memory_order_acq_rel));
+        handler_release(atomic_exchange_explicit(&handler_modules[i].candidate, NULL, memory_order_acq_rel));
+    }
+}
+
+int handler_invoke(HandlerSlot *slot, int client_fd, const HTTPRequest *request, HTTPResponse *response)
+{
+    if(slot->abi_version == HANDLER_ABI_LEGACY)
+    {
+        slot->handle_request(client_fd, request);
+        return 0;
+    }
+
+    slot->handle_request_v2(slot->context, request, response);
+    return 1;
+}
+
+void handler_release(HandlerSlot *slot)
+{
+    if(!slot)
+    {
+        return;
+    }
+
+    if(atomic_fetch_sub_explicit(&slot->refs, 1, memory_order_acq_rel) == 1)
+    {
+        if(slot->initialized && slot->fini)
+        {
+            slot->fini(slot->context);
+        }
+        dlclose(slot->handle);
+        close(slot->image_fd);
+        free(slot);
+    }
+}
+
+int handler_reload_init(void)
+{
+    int inotify_fd;
+
+    handler_generations = (HandlerGenerations *)shared_memory_create(sizeof(HandlerGenerations));
+    if(!handler_generations)
+    {
+        return -1;
+    }
+    seen_generations            = 0;
+    handler_generations->master = getpid();
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0)
+    {
+        perror("inotify_init1 failed");
+        return -1;
+    }
+
+    // Watch directories: builds usually replace the file rather than rewrite it.
+    // Modules sharing a directory get the same watch descriptor.
+    for(size_t i = 0; i < handler_module_count; i++)
+    {
+        char directory[PATH_MAX];
+
+        strcpy(directory, handler_modules[i].path);
+        handler_modules[i].watch = inotify_add_watch(inotify_fd, dirname(directory), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM | IN_DELETE);
+        if(handler_modules[i].watch < 0)
+        {
+            perror("inotify_add_watch failed");
+        }
+
+        // Candidates already in place at startup are shadowed right away
+        if(candidates_enabled && access(handler_modules[i].candidate_path, F_OK) == 0)
+        {
+            publish_candidate(i);
+        }
+    }
+    return inotify_fd;
+}
+
+void handler_reload_on_event(int inotify_fd)
+{
+    char    buffer[INOTIFY_BUFFER_SIZE];
+    ssize_t length;
+
+    while((length = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for(char *cursor = buffer; cursor < buffer + length;)
+        {
+            struct inotify_event event;
+            const char          *name = cursor + sizeof(event);
+
+            // Events are packed back to back; copy the header out rather than alias it
+            memcpy(&event, cursor, sizeof(event));
+
+            // IN_CREATE alone means the file is still being written
+            for(size_t i = 0; event.len > 0 && i < handler_module_count; i++)
+            {
+                HandlerModule *module = &handler_modules[i];
+                char           path_copy[PATH_MAX];
+
+                if(module->watch != event.wd)
+                {
+                    continue;
+                }
+
+                strcpy(path_copy, module->path);
+                if((event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && strcmp(name, basename(path_copy)) == 0)
+                {
+                    printf("[Parent] Detected updated shared library %s\n", module->path);
+                    module->pending  = true;
+                    reload_signalled = 1;
+                }
+
+                strcpy(path_copy, module->candidate_path);
+                if(candidates_enabled && (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)) && strcmp(name, basename(path_copy)) == 0)
+                {
+                    printf("[Parent] Detected change to candidate %s\n", module->candidate_path);
+                    module->candidate_pending = true;
+                    reload_signalled          = 1;
+                }
+            }
+            cursor += sizeof(event) + event.len;
+        }
+    }
+}
+
+/*
+ * Loads the library image in a short-lived child so a bad build (missing
+ * symbol, crashing constructor) cannot take down the master.
+ */
+static bool validate_handler(int image_fd)
+{
+    pid_t pid;
+    int   status;
+
+    pid = fork();
+    if(pid < 0)
+    {
+        perror("fork failed");
+        return false;
+    }
+
+    if(pid == 0)
+    {
+        _exit(load_image(image_fd, 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    while(waitpid(pid, &status, 0) < 0)
+    {
+        if(errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*
+ * Copies the library once and validates that copy. Returns the image for
+ * the master to load, or -1 if it was rejected.
+ */
+static int validated_image(const char *so_path)
+{
+    int image_fd = copy_library(so_path);
+
+    if(image_fd >= 0 && !validate_handler(image_fd))
+    {
+        close(image_fd);
+        return -1;
+    }
+    return image_fd;
+}
+
+/*
+ * Records the image a slot was loaded from for workers to follow. Must come
+ * before the generation bump, and the bump before the previous slot (and
+ * its descriptor) is released.
+ */
+static void publish_image(HandlerImage *image, const HandlerSlot *slot)
+{
+    struct stat status;
+
+    if(!slot || fstat(slot->image_fd, &status) != 0)
+    {
+        atomic_store_explicit(&image->fd, -1, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(&image->inode, (unsigned long)status.st_ino, memory_order_relaxed);
+    atomic_store_explicit(&image->fd, slot->image_fd, memory_order_relaxed);
+}
+
+/*
+ * Validates and publishes one module. Returns 0 on success.
+ */
+static int publish_module(size_t index)
+{
+    HandlerModule *module = &handler_modules[index];
+    HandlerSlot   *slot;
+    unsigned long  generation;
+    int            image_fd;
+
+    image_fd = validated_image(module->path);
+    if(image_fd < 0)
+    {
+        fprintf(stderr, "[Parent] Rejected %s: it does not load or lacks its entry points\n", module->path);
+        return -1;
+    }
+
+    // Forked workers inherit the master's slot, so keep it current too
+    slot = load_image(image_fd, module->loaded_generation + 1);
+    if(!slot)
+    {
+        fprintf(stderr, "[Parent] Reload of %s failed. Keeping generation %lu.\n", module->path, module->loaded_generation);
+        return -1;
+    }
+
+    generation = slot->generation;
+    if(handler_generations)
+    {
+        publish_image(&handler_generations->module_image[index], slot);
+        generation       = atomic_fetch_add_explicit(&handler_generations->module[index], 1, memory_order_relaxed) + 1;
+        seen_generations = atomic_fetch_add_explicit(&handler_generations->total, 1, memory_order_seq_cst) + 1;
+    }
+    slot->generation          = generation;
+    module->loaded_generation = generation;
+    publish_slot(module, slot);
+    printf("[Parent] Published %s generation %lu\n", module->path, generation);
+    return 0;
+}
+
+/*
+ * Loads, replaces or drops a module's shadow candidate and publishes the
+ * change. Candidates must implement ABI v2: their response is discarded, which
+ * a legacy module writing to the socket cannot allow.
+ */
+static int publish_candidate(size_t index)
+{
+    HandlerModule *module = &handler_modules[index];
+    HandlerSlot   *slot   = NULL;
+
+    if(access(module->candidate_path, F_OK) == 0)
+    {
+        int image_fd = validated_image(module->candidate_path);
+
+        if(image_fd < 0)
+        {
+            fprintf(stderr, "[Parent] Rejected candidate %s: it does not load or lacks its entry points\n", module->candidate_path);
+            return -1;
+        }
+
+        slot = load_image(image_fd, module->candidate_generation + 1);
+        if(!slot)
+        {
+            return -1;
+        }
+        if(slot->abi_version != HANDLER_ABI_VERSION)
+        {
+            fprintf(stderr, "[Parent] Rejected candidate %s: shadow candidates must implement ABI v%d\n", module->candidate_path, HANDLER_ABI_VERSION);
+            handler_release(slot);
+            return -1;
+        }
+    }
+
+    module->candidate_generation++;
+    if(handler_generations)
+    {
+        publish_image(&handler_generations->candidate_image[index], slot);
+        module->candidate_generation = atomic_fetch_add_explicit(&handler_generations->candidate[index], 1, memory_order_relaxed) + 1;
+        seen_generations             = atomic_fetch_add_explicit(&handler_generations->total, 1, memory_order_seq_cst) + 1;
+    }
+    if(slot)
+    {
+        slot->generation = module->candidate_generation;
+    }
+    publish_slot_to(&module->candidate, slot);
+    printf("[Parent] %s candidate %s (generation %lu)\n", slot ? "Shadowing" : "Dropped", module->candidate_path, module->candidate_generation);
+    return 0;
+}
+
+int handler_publish_reload(void)
+{
+    bool any_pending    = false;
+    bool candidate_only = false;
+    int  result         = 0;
+
+    for(size_t i = 0; i < handler_module_count; i++)
+    {
+        if(handler_modules[i].candidate_pending)
+        {
+            handler_modules[i].candidate_pending = false;
+            if(publish_candidate(i) != 0)
+            {
+                result = -1;
+            }
+            candidate_only = true;
+        }
+        any_pending = any_pending || handler_modules[i].pending;
+    }
+    candidate_only = candidate_only && !any_pending;
+
+    // SIGHUP without a file event reloads every module
+    for(size_t i = 0; i < handler_module_count && !candidate_only; i++)
+    {
+        if(!any_pending || handler_modules[i].pending)
+        {
+            handler_modules[i].pending = false;
+            if(publish_module(i) != 0)
+            {
+                result = -1;
+            }
+        }
+    }
+    return result;
+}
+
+void handler_request_reload(void)
+{
+    reload_signalled = 1;
+}
+
+bool handler_reload_requested(void)
+{
+    if(!reload_signalled)
+    {
+        return false;
+    }
+    reload_signalled = 0;
+    return true;
+}
+
+/*
+ * Worker: loads the image the master published. If the master has moved on
+ * and its descriptor now names another image, the inode gives it away; the
+ * newer generation is already published and is picked up next time.
+ */
+static HandlerSlot *load_published_image(const HandlerImage *image, unsigned long generation)
+{
+    char          path[PATH_MAX];
+    struct stat   status;
+    unsigned long inode;
+    int           master_fd;
+    int           image_fd;
+
+    master_fd = atomic_load_explicit(&image->fd, memory_order_relaxed);
+    inode     = atomic_load_explicit(&image->inode, memory_order_relaxed);
+    if(master_fd < 0)
+    {
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)handler_generations->master, master_fd);
+    image_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(image_fd < 0)
+    {
+        perror("Failed to open the published handler image");
+        return NULL;
+    }
+
+    if(fstat(image_fd, &status) != 0 || (unsigned long)status.st_ino != inode)
+    {
+        fprintf(stderr, "Handler image for generation %lu was replaced; waiting for the next one\n", generation);
+        close(image_fd);
+        return NULL;
+    }
+    return load_image(image_fd, generation);
+}
+
+/*
+ * Worker side of publish_module: loads, initializes and swaps in the module's
+ * new generation, keeping the current slot if anything fails.
+ */
+static void refresh_module(size_t index, unsigned long generation)
+{
+    HandlerModule *module = &handler_modules[index];
+    HandlerSlot   *slot;
+
+    // Either way this generation is settled; a failed load waits for the next publish
+    module->loaded_generation = generation;
+
+    slot = load_published_image(&handler_generations->module_image[index], generation);
+    if(!slot)
+    {
+        fprintf(stderr, "Reload of %s generation %lu failed. Keeping the current handler.\n", module->path, generation);
+        return;
+    }
+
+    // The new module must be ready before the first request reaches it
+    if(initialize_slot(slot) != 0)
+    {
+        handler_release(slot);
+        fprintf(stderr, "Keeping the current handler for %s.\n", module->path);
+        return;
+    }
+    publish_slot(module, slot);
+    PROBE2(handler_reload, module->path, generation);
+    printf("Loaded %s generation %lu\n", module->path, generation);
+}
+
+/*
+ * Worker side of publish_candidate.
+ */
+static void refresh_candidate(size_t index, unsigned long generation)
+{
+    HandlerModule *module = &handler_modules[index];
+    HandlerSlot   *slot;
+
+    module->candidate_generation = generation;
+
+    slot = load_published_image(&handler_generations->candidate_image[index], generation);
+    if(slot && (slot->abi_version != HANDLER_ABI_VERSION || initialize_slot(slot) != 0))
+    {
+        handler_release(slot);
+        slot = NULL;
+    }
+    publish_slot_to(&module->candidate, slot);
+}
+
+void handler_refresh(void)
+{
+    unsigned long total;
+
+    if(!handler_generations)
+    {
+        return;
+    }
 
-    if(stat(so_path, &so_stat) != 0)
+    total = atomic_load_explicit(&handler_generations->total, memory_order_acquire);
+    if(total == seen_generations)
     {
-        perror("Failed to stat shared library");
         return;
     }
+    seen_generations = total;
 
-    // Compare last modified timestamp
-    if(so_stat.st_mtime > last_mod_time)
+    for(size_t i = 0; i < handler_module_count; i++)
     {
-        printf("Detected updated shared library. Reloading...\n");
+        unsigned long generation = atomic_load_explicit(&handler_generations->module[i], memory_order_relaxed);
 
-        if(current_handle)
+        if(generation != handler_modules[i].loaded_generation)
         {
-            dlclose(current_handle);
-            current_handle = NULL;
+            refresh_module(i, generation);
         }
 
-        *handler_ptr = load_request_handler(so_path);
-        if(!*handler_ptr)
+        generation = atomic_load_explicit(&handler_generations->candidate[i], memory_order_relaxed);
+        if(generation != handler_modules[i].candidate_generation)
         {
-            fprintf(stderr, "Reload failed. Keeping old handler (if any).\n");
+            refresh_candidate(i, generation);
         }
     }
 }
@@ -7,7 +7,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 pid_t *registered_child_pids = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
@@ -19,6 +18,17 @@ void register_child_pids(pid_t *pids, int count)
     registered_num_pids   = count;
 }
 
+void set_sigaction_handler(struct sigaction *sa, void (*handler)(int))
+{
+    // The handler union is the first member of struct sigaction
+    memcpy(sa, &handler, sizeof(handler));
+}
+
+void set_sigaction_action(struct sigaction *sa, void (*action)(int, siginfo_t *, void *))
+{
+    memcpy(sa, &action, sizeof(action));
+}
+
 void setup_sigint_handler(void)
 {
     // Define sigaction manually to avoid macro expansion
@@ -27,7 +37,7 @@ void setup_sigint_handler(void)
 
     sa.sa_flags = 0;
     // Don't touch sa_handler macro
-    *(void **)&sa = (void *)sigintHandler;    // Raw assignment to bypass macro safely
+    set_sigaction_handler(&sa, sigintHandler);
 
     sigemptyset(&sa.sa_mask);
 
@@ -38,20 +48,29 @@ void setup_sigint_handler(void)
     }
 }
 
+/*
+ * Only async-signal-safe calls in here: write() instead of printf() and
+ * _exit() instead of exit(). Once the prefork server is up the master takes
+ * SIGINT through its supervisor and drains the workers instead, so this only
+ * runs for the client or before the workers exist.
+ */
 __attribute__((noreturn)) void sigintHandler(int sig_num)
 {
+    static const char message[] = "\nSIGINT caught. Cleaning up child processes...\n";
+    ssize_t           ignored;
+
     (void)sig_num;    // Suppress unused parameter warning
-    printf("\nSIGINT caught. Cleaning up child processes...\n");
+    ignored = write(STDOUT_FILENO, message, sizeof(message) - 1);
+    (void)ignored;
 
-    // Kill all children
+    // Ask the children to drain
     for(int i = 0; i < registered_num_pids; ++i)
     {
         if(registered_child_pids[i] > 0)
         {
-            printf("Killing worker PID: %d\n", registered_child_pids[i]);
             kill(registered_child_pids[i], SIGTERM);
         }
     }
 
-    exit(0);
+    _exit(0);
 }
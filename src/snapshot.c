@@ -0,0 +1,253 @@
+/*******************************************************************************
+ * Online snapshots of the POST database
+ *
+ * The database is a gdbm file that workers open and close around every write
+ * while holding the shared database lock, so the files on disk are consistent
+ * whenever that lock is held. A snapshot takes the lock, captures the files
+ * as cheaply as possible, and lets writers go again before doing anything
+ * slow: on filesystems with reflinks (btrfs, XFS) the capture is a
+ * copy-on-write clone; elsewhere it is a read into memory, which runs at page
+ * cache speed and is written out to the snapshot once writers have resumed.
+ ******************************************************************************/
+
+#include "../include/snapshot.h"
+#include "../include/db.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// gdbm_compat keeps an ndbm database in two files
+#define SNAPSHOT_NUM_FILES 2
+#define MS_PER_SECOND 1000
+#define NS_PER_MS 1000000
+#define SNAPSHOT_DIR_MODE 0700
+
+static const char *const db_file_suffixes[SNAPSHOT_NUM_FILES] = {".pag", ".dir"};
+
+typedef struct
+{
+    char   source[SNAPSHOT_MAX_PATH];
+    char   temp[SNAPSHOT_MAX_PATH + 8];      // target + ".tmp"
+    char   target[SNAPSHOT_MAX_PATH + 4];    // result path + suffix
+    int    fd;
+    char  *data;
+    size_t size;
+    bool   cloned;
+} SnapshotFile;
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * MS_PER_SECOND + (double)(end->tv_nsec - start->tv_nsec) / NS_PER_MS;
+}
+
+/*
+ * Reads a whole file into memory. Returns 0 on success, -1 on failure.
+ */
+static int read_whole_file(int fd, SnapshotFile *file)
+{
+    struct stat st;
+    size_t      done = 0;
+
+    if(fstat(fd, &st) != 0)
+    {
+        return -1;
+    }
+
+    file->size = (size_t)st.st_size;
+    file->data = (char *)malloc(file->size ? file->size : 1);
+    if(!file->data)
+    {
+        return -1;
+    }
+
+    while(done < file->size)
+    {
+        ssize_t got = pread(fd, file->data + done, file->size - done, (off_t)done);
+        if(got <= 0)
+        {
+            if(got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)got;
+    }
+    return 0;
+}
+
+static int write_whole_file(int fd, const char *data, size_t size)
+{
+    size_t done = 0;
+
+    while(done < size)
+    {
+        ssize_t written = write(fd, data + done, size - done);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * Captures one file while writers are paused: a reflink if the filesystem
+ * supports it, otherwise an in-memory copy.
+ */
+static int capture_file(SnapshotFile *file)
+{
+    int source = open(file->source, O_RDONLY | O_CLOEXEC);
+    int result;
+
+    if(source < 0)
+    {
+        perror("Failed to open database file for snapshot");
+        return -1;
+    }
+
+    if(ioctl(file->fd, FICLONE, source) == 0)
+    {
+        struct stat st;
+
+        file->cloned = true;
+        file->size   = fstat(file->fd, &st) == 0 ? (size_t)st.st_size : 0;
+        close(source);
+        return 0;
+    }
+
+    result = read_whole_file(source, file);
+    close(source);
+    return result;
+}
+
+static void discard_files(SnapshotFile *files, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        if(files[i].fd >= 0)
+        {
+            close(files[i].fd);
+            unlink(files[i].temp);
+        }
+        free(files[i].data);
+    }
+}
+
+int database_snapshot(const char *db_path, SnapshotResult *result)
+{
+    SnapshotFile    files[SNAPSHOT_NUM_FILES];
+    struct timespec start;
+    struct timespec paused;
+    struct timespec resumed;
+    struct timespec done;
+    char            stamp[32];
+    struct tm       now;
+    time_t          seconds;
+    int             status = 0;
+
+    memset(result, 0, sizeof(*result));
+    memset(files, 0, sizeof(files));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if(mkdir(SNAPSHOT_DIR, SNAPSHOT_DIR_MODE) != 0 && errno != EEXIST)
+    {
+        perror("Failed to create snapshot directory");
+        return -1;
+    }
+
+    seconds = time(NULL);
+    localtime_r(&seconds, &now);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &now);
+    snprintf(result->path, sizeof(result->path), "%s/post_data-%s-%d.db", SNAPSHOT_DIR, stamp, getpid());
+
+    // Create the targets before pausing anyone
+    for(size_t i = 0; i < SNAPSHOT_NUM_FILES; i++)
+    {
+        int length = snprintf(files[i].source, sizeof(files[i].source), "%s%s", db_path, db_file_suffixes[i]);
+
+        if(length < 0 || (size_t)length >= sizeof(files[i].source))
+        {
+            fprintf(stderr, "Database path too long to snapshot: %s\n", db_path);
+            discard_files(files, i);
+            return -1;
+        }
+        snprintf(files[i].target, sizeof(files[i].target), "%s%s", result->path, db_file_suffixes[i]);
+        snprintf(files[i].temp, sizeof(files[i].temp), "%s%s.tmp", result->path, db_file_suffixes[i]);
+        files[i].fd = open(files[i].temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if(files[i].fd < 0)
+        {
+            perror("Failed to create snapshot file");
+            discard_files(files, i);
+            return -1;
+        }
+    }
+
+    if(database_lock() < 0)
+    {
+        discard_files(files, SNAPSHOT_NUM_FILES);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &paused);
+
+    for(size_t i = 0; i < SNAPSHOT_NUM_FILES && status == 0; i++)
+    {
+        status = capture_file(&files[i]);
+    }
+
+    database_unlock();
+    clock_gettime(CLOCK_MONOTONIC, &resumed);
+
+    // Writers are running again; now do the slow part
+    for(size_t i = 0; i < SNAPSHOT_NUM_FILES && status == 0; i++)
+    {
+        if(!files[i].cloned && write_whole_file(files[i].fd, files[i].data, files[i].size) != 0)
+        {
+            perror("Failed to write snapshot file");
+            status = -1;
+        }
+        if(status == 0 && fsync(files[i].fd) != 0)
+        {
+            perror("Failed to sync snapshot file");
+            status = -1;
+        }
+        result->bytes += files[i].size;
+    }
+    result->reflinked = files[0].cloned && files[1].cloned;
+
+    if(status != 0)
+    {
+        discard_files(files, SNAPSHOT_NUM_FILES);
+        return -1;
+    }
+
+    for(size_t i = 0; i < SNAPSHOT_NUM_FILES; i++)
+    {
+        close(files[i].fd);
+        files[i].fd = -1;
+        free(files[i].data);
+        files[i].data = NULL;
+        if(rename(files[i].temp, files[i].target) != 0)
+        {
+            perror("Failed to publish snapshot file");
+            status = -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    result->pauseMs = elapsed_ms(&paused, &resumed);
+    result->totalMs = elapsed_ms(&start, &done);
+    return status;
+}
@@ -192,3 +192,74 @@ char *extractValueFromPair(const char *pair)
     value[valueLen] = '\0';
     return value;
 }
+
+void freeStringArray(StringArray *stringArray)
+{
+    if(!stringArray || !stringArray->strings)
+    {
+        return;
+    }
+
+    for(unsigned int i = 0; i < stringArray->numStrings; i++)
+    {
+        free(stringArray->strings[i]);
+    }
+
+    free((void *)stringArray->strings);
+    free(stringArray->stringLengths);
+    stringArray->strings       = NULL;
+    stringArray->stringLengths = NULL;
+    stringArray->numStrings    = 0;
+}
+
+static int hexDigitValue(char digit)
+{
+    if(digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+    if(digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+    if(digit >= 'A' && digit <= 'F')
+    {
+        return digit - 'A' + 10;
+    }
+    return -1;
+}
+
+char *urlDecode(const char *encoded)
+{
+    char  *decoded;
+    size_t length;
+    size_t out = 0;
+
+    length  = strlen(encoded);
+    decoded = (char *)malloc(length + 1);
+    if(!decoded)
+    {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < length; i++)
+    {
+        if(encoded[i] == '+')
+        {
+            decoded[out++] = ' ';
+        }
+        else if(encoded[i] == '%' && hexDigitValue(encoded[i + 1]) >= 0 && hexDigitValue(encoded[i + 2]) >= 0)
+        {
+            decoded[out++] = (char)((hexDigitValue(encoded[i + 1]) << 4) | hexDigitValue(encoded[i + 2]));
+            i += 2;
+        }
+        else
+        {
+            // Malformed escapes are kept as-is
+            decoded[out++] = encoded[i];
+        }
+    }
+
+    decoded[out] = '\0';
+    return decoded;
+}
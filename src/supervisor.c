@@ -0,0 +1,723 @@
+#include "../include/supervisor.h"
+#include "../include/accessLog.h"
+#include "../include/cpuTopology.h"
+#include "../include/perfCounters.h"
+#include "../include/probes.h"
+#include "../include/profiler.h"
+#include "../include/scoreboard.h"
+#include "../include/sigintHandler.h"
+#include "../include/trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUPERVISOR_MAX_EVENTS 8
+#define MILLISECONDS_PER_SECOND 1000
+#define NANOSECONDS_PER_MILLISECOND 1000000
+#define PERCENT 100
+#define BYTES_PER_KILOBYTE 1024
+#define KILOBYTES_PER_MEGABYTE 1024
+#define STATM_PATH_SIZE 64
+
+typedef struct
+{
+    int            epollFd;
+    int            signalFd;
+    sigset_t       signals;
+    sigset_t       previousMask;
+    WorkerMainFunc workerMain;
+    void          *arg;
+    int            numWorkers;    // current pool size: slots [0, numWorkers) are kept running
+    int            minWorkers;
+    int            maxWorkers;    // size of workers[] and pids[]
+    WorkerSlot    *workers;
+    pid_t         *pids;    // mirror of workers[].pid for the SIGINT handler
+    unsigned int   drainTimeoutMs;
+    bool           draining;    // no respawns once shutdown started
+    uint64_t       nextSampleMs;    // next autoscale/recycling check
+    uint64_t       lastScaleNs;
+    RecyclePolicy  recycle;
+    unsigned int   idleTicks;    // consecutive samples below SUPERVISOR_SCALE_DOWN_PERCENT
+} Supervisor;
+
+static Supervisor supervisor;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Worker side: set by SIGTERM, which also writes to the pipe to wake poll()
+static volatile sig_atomic_t worker_draining = 0;           // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static int                   drain_pipe[2]   = {-1, -1};    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static uint64_t monotonic_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * MILLISECONDS_PER_SECOND + (uint64_t)now.tv_nsec / NANOSECONDS_PER_MILLISECOND;
+}
+
+static void drainSignalHandler(int sig_num)
+{
+    int     saved_errno = errno;
+    ssize_t ignored;
+
+    (void)sig_num;
+    worker_draining = 1;
+    ignored         = write(drain_pipe[1], "", 1);
+    (void)ignored;
+    errno = saved_errno;
+}
+
+/*
+ * Runs in a new worker before its signals are unblocked: SIGTERM starts a
+ * drain, and SIGINT from the terminal is left to the master, which turns
+ * it into SIGTERM for every worker. SIGPIPE is ignored so a client that
+ * hangs up mid-response costs a failed write, not the worker.
+ */
+static void setup_worker_signals(void)
+{
+    struct sigaction sa;
+
+    if(pipe2(drain_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        perror("pipe2 failed");
+        _exit(EXIT_FAILURE);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    set_sigaction_handler(&sa, drainSignalHandler);
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGTERM, &sa, NULL) < 0)
+    {
+        perror("sigaction failed");
+        _exit(EXIT_FAILURE);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    set_sigaction_handler(&sa, SIG_IGN);
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGPIPE, &sa, NULL);
+}
+
+static int spawn_worker(int worker)
+{
+    WorkerSlot *slot = &supervisor.workers[worker];
+    pid_t       pid;
+
+    scoreboard_reset(worker);
+
+    // Or the worker's exit() writes the master's buffered output again
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+
+    if(pid < 0)
+    {
+        perror("fork failed");
+        return -1;
+    }
+
+    if(pid == 0)
+    {
+        // The worker gets the signal mask the master started with
+        close(supervisor.epollFd);
+        close(supervisor.signalFd);
+        setup_worker_signals();
+        sigprocmask(SIG_SETMASK, &supervisor.previousMask, NULL);
+
+        // One worker per core, and its memory on that core's node
+        cpu_topology_pin(worker);
+        scoreboard_worker_start(worker);
+        trace_worker_start(worker);
+        access_log_worker_start(worker);
+        profiler_worker_start(worker);
+        perf_counters_worker_start();
+
+        supervisor.workerMain(worker, supervisor.arg);
+        _exit(EXIT_FAILURE);
+    }
+
+    PROBE2(worker_spawn, worker, pid);
+    slot->pid               = pid;
+    slot->startedMs         = monotonic_ms();
+    slot->respawnAtMs       = 0;
+    slot->sampledBusyNs     = 0;
+    slot->recycling         = false;
+    supervisor.pids[worker] = pid;
+
+    // Stagger recycling: each worker gets limits up to RECYCLE_JITTER_PERCENT higher
+    slot->requestLimit = supervisor.recycle.maxRequests + supervisor.recycle.maxRequests * (unsigned long)(random() % (RECYCLE_JITTER_PERCENT + 1)) / PERCENT;
+    slot->ageLimitMs   = (uint64_t)supervisor.recycle.maxAgeSeconds * MILLISECONDS_PER_SECOND;
+    slot->ageLimitMs += slot->ageLimitMs * (uint64_t)(random() % (RECYCLE_JITTER_PERCENT + 1)) / PERCENT;
+    return 0;
+}
+
+static void log_exit(int worker, pid_t pid, int status)
+{
+    if(WIFEXITED(status))
+    {
+        printf("[Parent] Worker %d (PID %d) exited with status %d\n", worker, pid, WEXITSTATUS(status));
+    }
+    else if(WIFSIGNALED(status))
+    {
+        printf("[Parent] Worker %d (PID %d) killed by signal %d (%s)%s\n", worker, pid, WTERMSIG(status), strsignal(WTERMSIG(status)), WCOREDUMP(status) ? ", core dumped" : "");
+    }
+}
+
+/*
+ * Schedules a respawn: immediately after a worker that ran for a while, with
+ * exponential backoff when it keeps dying right after starting.
+ */
+static void schedule_respawn(int worker, int status)
+{
+    WorkerSlot *slot  = &supervisor.workers[worker];
+    uint64_t    now   = monotonic_ms();
+    uint64_t    delay = 0;
+
+    slot->lastStatus        = status;
+    slot->pid               = 0;
+    supervisor.pids[worker] = 0;
+
+    // A recycled worker was asked to leave: replace it at once, whatever its age
+    if(slot->recycling)
+    {
+        slot->failures    = 0;
+        slot->respawnAtMs = now;
+        return;
+    }
+
+    if(now - slot->startedMs < SUPERVISOR_STABLE_MS)
+    {
+        slot->failures++;
+    }
+    else
+    {
+        slot->failures = 0;
+    }
+
+    if(slot->failures > 1)
+    {
+        unsigned int shift = slot->failures - 2;
+
+        delay = shift >= 16 ? SUPERVISOR_BACKOFF_MAX_MS : (uint64_t)SUPERVISOR_BACKOFF_BASE_MS << shift;
+        if(delay > SUPERVISOR_BACKOFF_MAX_MS)
+        {
+            delay = SUPERVISOR_BACKOFF_MAX_MS;
+        }
+        printf("[Parent] Worker %d crashed %u times in a row, restarting in %llu ms\n", worker, slot->failures, (unsigned long long)delay);
+    }
+    slot->respawnAtMs = now + delay;
+}
+
+static void reap_workers(void)
+{
+    pid_t pid;
+    int   status;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        if(access_log_reap(pid, status))
+        {
+            continue;
+        }
+        for(int i = 0; i < supervisor.maxWorkers; i++)
+        {
+            if(supervisor.workers[i].pid == pid)
+            {
+                PROBE3(worker_exit, i, pid, status);
+                log_exit(i, pid, status);
+
+                // Retired by a scale-down, or shutting down: leave the slot empty
+                if(supervisor.draining || i >= supervisor.numWorkers)
+                {
+                    supervisor.workers[i].lastStatus = status;
+                    supervisor.workers[i].pid        = 0;
+                    supervisor.pids[i]               = 0;
+                }
+                else
+                {
+                    schedule_respawn(i, status);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Respawns every worker whose time has come and returns how long until the
+ * next one is due (-1 if none), for epoll_wait.
+ */
+static int respawn_due_workers(void)
+{
+    uint64_t now  = monotonic_ms();
+    int      wait = -1;
+
+    for(int i = 0; i < supervisor.numWorkers; i++)
+    {
+        WorkerSlot *slot = &supervisor.workers[i];
+
+        if(slot->pid != 0 || supervisor.draining)
+        {
+            continue;
+        }
+
+        if(slot->respawnAtMs <= now)
+        {
+            bool first_start = slot->startedMs == 0;
+
+            if(spawn_worker(i) == 0)
+            {
+                // A slot the pool just grew into has never run before
+                slot->restarts += first_start ? 0 : 1;
+                printf("[Worker %d] %s with PID %d\n", i, first_start ? "Started" : "Restarted", slot->pid);
+                continue;
+            }
+            // fork failed: try again shortly
+            slot->respawnAtMs = now + SUPERVISOR_BACKOFF_BASE_MS;
+        }
+
+        if(wait < 0 || slot->respawnAtMs - now < (uint64_t)wait)
+        {
+            wait = (int)(slot->respawnAtMs - now);
+        }
+    }
+    return wait;
+}
+
+int supervisor_init(int min_workers, int max_workers, WorkerMainFunc worker_main, void *arg)
+{
+    struct epoll_event event;
+
+    if(min_workers < 1 || max_workers < min_workers)
+    {
+        fprintf(stderr, "Invalid worker pool %d:%d\n", min_workers, max_workers);
+        return -1;
+    }
+
+    supervisor.workerMain  = worker_main;
+    supervisor.arg         = arg;
+    supervisor.numWorkers  = min_workers;
+    supervisor.minWorkers  = min_workers;
+    supervisor.maxWorkers  = max_workers;
+    supervisor.nextSampleMs = monotonic_ms() + SUPERVISOR_SAMPLE_INTERVAL_MS;
+    supervisor.lastScaleNs = scoreboard_now_ns();
+    supervisor.workers     = (WorkerSlot *)calloc((size_t)max_workers, sizeof(WorkerSlot));
+    supervisor.pids        = (pid_t *)calloc((size_t)max_workers, sizeof(pid_t));
+    if(!supervisor.workers || !supervisor.pids)
+    {
+        perror("calloc failed");
+        return -1;
+    }
+
+    cpu_topology_init();
+    srandom((unsigned int)getpid() ^ (unsigned int)supervisor.nextSampleMs);
+    if(scoreboard_init(max_workers) < 0)
+    {
+        return -1;
+    }
+
+    // Handle these signals as events instead of interrupting the master
+    sigemptyset(&supervisor.signals);
+    sigaddset(&supervisor.signals, SIGCHLD);
+    sigaddset(&supervisor.signals, SIGHUP);
+    sigaddset(&supervisor.signals, SIGUSR1);
+    sigaddset(&supervisor.signals, SIGINT);
+    sigaddset(&supervisor.signals, SIGTERM);
+    sigaddset(&supervisor.signals, SIGUSR2);
+    if(sigprocmask(SIG_BLOCK, &supervisor.signals, &supervisor.previousMask) < 0)
+    {
+        perror("sigprocmask failed");
+        return -1;
+    }
+
+    supervisor.signalFd = signalfd(-1, &supervisor.signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    supervisor.epollFd  = epoll_create1(EPOLL_CLOEXEC);
+    if(supervisor.signalFd < 0 || supervisor.epollFd < 0)
+    {
+        perror("signalfd/epoll_create1 failed");
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN;
+    event.data.fd = supervisor.signalFd;
+    if(epoll_ctl(supervisor.epollFd, EPOLL_CTL_ADD, supervisor.signalFd, &event) < 0)
+    {
+        perror("epoll_ctl failed");
+        return -1;
+    }
+
+    register_child_pids(supervisor.pids, max_workers);
+
+    for(int i = 0; i < min_workers; i++)
+    {
+        if(spawn_worker(i) < 0)
+        {
+            return -1;
+        }
+        printf("[Worker %d] Started with PID %d\n", i, supervisor.pids[i]);
+    }
+    return 0;
+}
+
+int supervisor_watch(int fd)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN;
+    event.data.fd = fd;
+    if(epoll_ctl(supervisor.epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        perror("epoll_ctl failed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Samples how busy the pool was since the last call (time workers spent
+ * holding a connection, from the scoreboard) and grows it by one worker when
+ * it is nearly saturated, or retires one after it stayed mostly idle.
+ */
+static void autoscale(void)
+{
+    uint64_t     now_ns  = scoreboard_now_ns();
+    uint64_t     elapsed = now_ns - supervisor.lastScaleNs;
+    uint64_t     busy    = 0;
+    int          live    = 0;
+    unsigned int utilization;
+
+    supervisor.lastScaleNs = now_ns;
+
+    for(int i = 0; i < supervisor.numWorkers; i++)
+    {
+        WorkerSlot *slot = &supervisor.workers[i];
+        uint64_t    total;
+
+        if(slot->pid <= 0)
+        {
+            continue;
+        }
+
+        total = scoreboard_busy_ns(i, now_ns);
+        busy += total > slot->sampledBusyNs ? total - slot->sampledBusyNs : 0;
+        slot->sampledBusyNs = total;
+        live++;
+    }
+
+    if(live == 0 || elapsed == 0)
+    {
+        return;
+    }
+    utilization = (unsigned)(busy * PERCENT / (elapsed * (uint64_t)live));
+
+    if(utilization >= SUPERVISOR_SCALE_UP_PERCENT && supervisor.numWorkers < supervisor.maxWorkers)
+    {
+        WorkerSlot *slot = &supervisor.workers[supervisor.numWorkers];
+
+        // The new slot is started by respawn_due_workers right away
+        slot->failures    = 0;
+        slot->respawnAtMs = 0;
+        supervisor.numWorkers++;
+        supervisor.idleTicks = 0;
+        printf("[Parent] Workers %u%% busy, growing the pool to %d\n", utilization, supervisor.numWorkers);
+        return;
+    }
+
+    supervisor.idleTicks = utilization < SUPERVISOR_SCALE_DOWN_PERCENT ? supervisor.idleTicks + 1 : 0;
+    if(supervisor.idleTicks >= SUPERVISOR_SCALE_DOWN_TICKS && supervisor.numWorkers > supervisor.minWorkers)
+    {
+        WorkerSlot *slot;
+
+        // The highest slot drains and is not respawned
+        supervisor.numWorkers--;
+        supervisor.idleTicks = 0;
+        slot                 = &supervisor.workers[supervisor.numWorkers];
+        if(slot->pid > 0)
+        {
+            kill(slot->pid, SIGTERM);
+        }
+        printf("[Parent] Workers %u%% busy, shrinking the pool to %d\n", utilization, supervisor.numWorkers);
+    }
+}
+
+/*
+ * Resident set size of a process in KiB, from /proc/<pid>/statm.
+ */
+static unsigned long read_rss_kb(pid_t pid)
+{
+    char          path[STATM_PATH_SIZE];
+    unsigned long size;
+    unsigned long resident = 0;
+    FILE         *file;
+
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    file = fopen(path, "re");
+    if(!file)
+    {
+        return 0;
+    }
+    if(fscanf(file, "%lu %lu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+    fclose(file);
+    return resident * (unsigned long)sysconf(_SC_PAGESIZE) / BYTES_PER_KILOBYTE;
+}
+
+/*
+ * Retires the first worker over a recycling limit with a graceful SIGTERM;
+ * it is replaced as soon as it exits. Only one worker recycles at a time so
+ * the pool never loses more than one worker's capacity to it.
+ */
+static void recycle_workers(void)
+{
+    uint64_t now = monotonic_ms();
+
+    for(int i = 0; i < supervisor.numWorkers; i++)
+    {
+        if(supervisor.workers[i].pid > 0 && supervisor.workers[i].recycling)
+        {
+            return;
+        }
+    }
+
+    for(int i = 0; i < supervisor.numWorkers; i++)
+    {
+        WorkerSlot        *slot  = &supervisor.workers[i];
+        const WorkerScore *score = scoreboard_worker(i);
+        unsigned long      requests;
+        unsigned long      rss_kb = 0;
+        const char        *reason = NULL;
+
+        if(slot->pid <= 0 || !score)
+        {
+            continue;
+        }
+
+        requests = atomic_load_explicit(&score->requests, memory_order_relaxed);
+        if(supervisor.recycle.maxRssMb > 0)
+        {
+            rss_kb = read_rss_kb(slot->pid);
+        }
+
+        if(slot->requestLimit > 0 && requests >= slot->requestLimit)
+        {
+            reason = "request limit";
+        }
+        else if(supervisor.recycle.maxRssMb > 0 && rss_kb >= supervisor.recycle.maxRssMb * KILOBYTES_PER_MEGABYTE)
+        {
+            reason = "memory limit";
+        }
+        else if(slot->ageLimitMs > 0 && now - slot->startedMs >= slot->ageLimitMs)
+        {
+            reason = "age limit";
+        }
+
+        if(reason)
+        {
+            printf("[Parent] Recycling worker %d (PID %d): %s (%lu requests, %lu KiB, %llu s)\n", i, slot->pid, reason, requests, rss_kb, (unsigned long long)((now - slot->startedMs) / MILLISECONDS_PER_SECOND));
+            slot->recycling = true;
+            kill(slot->pid, SIGTERM);
+            return;
+        }
+    }
+}
+
+static bool sampling_enabled(void)
+{
+    return supervisor.minWorkers < supervisor.maxWorkers || supervisor.recycle.maxRequests > 0 || supervisor.recycle.maxRssMb > 0 || supervisor.recycle.maxAgeSeconds > 0;
+}
+
+int supervisor_wait(void)
+{
+    struct epoll_event events[SUPERVISOR_MAX_EVENTS];
+    int                timeout;
+    int                count;
+    int                result = 0;
+
+    // Sleeps until a signal, a watched fd, the next due respawn or pool sample
+    timeout = respawn_due_workers();
+    if(sampling_enabled())
+    {
+        uint64_t now   = monotonic_ms();
+        int      scale = supervisor.nextSampleMs > now ? (int)(supervisor.nextSampleMs - now) : 0;
+
+        timeout = (timeout < 0 || scale < timeout) ? scale : timeout;
+    }
+    count = epoll_wait(supervisor.epollFd, events, SUPERVISOR_MAX_EVENTS, timeout);
+    if(count < 0 && errno != EINTR)
+    {
+        perror("epoll_wait failed");
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        if(events[i].data.fd != supervisor.signalFd)
+        {
+            result |= SUPERVISOR_EVENT_WATCHED;
+            continue;
+        }
+
+        for(;;)
+        {
+            struct signalfd_siginfo info;
+
+            if(read(supervisor.signalFd, &info, sizeof(info)) != (ssize_t)sizeof(info))
+            {
+                break;
+            }
+
+            if(info.ssi_signo == SIGCHLD)
+            {
+                reap_workers();
+            }
+            else if(info.ssi_signo == SIGHUP)
+            {
+                result |= SUPERVISOR_EVENT_RELOAD;
+            }
+            else if(info.ssi_signo == SIGUSR1)
+            {
+                result |= SUPERVISOR_EVENT_SNAPSHOT;
+            }
+            else if(info.ssi_signo == SIGUSR2)
+            {
+                result |= SUPERVISOR_EVENT_UPGRADE;
+            }
+            else if(info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM)
+            {
+                result |= SUPERVISOR_EVENT_SHUTDOWN;
+            }
+        }
+    }
+
+    if(sampling_enabled() && monotonic_ms() >= supervisor.nextSampleMs)
+    {
+        supervisor.nextSampleMs = monotonic_ms() + SUPERVISOR_SAMPLE_INTERVAL_MS;
+        if(supervisor.minWorkers < supervisor.maxWorkers)
+        {
+            autoscale();
+        }
+        recycle_workers();
+    }
+
+    // Capacity comes back as soon as the crash is seen
+    respawn_due_workers();
+    return result;
+}
+
+void supervisor_set_drain_timeout(unsigned int timeout_ms)
+{
+    supervisor.drainTimeoutMs = timeout_ms;
+}
+
+void supervisor_set_recycle(const RecyclePolicy *policy)
+{
+    supervisor.recycle = *policy;
+}
+
+static int live_workers(void)
+{
+    int live = 0;
+
+    for(int i = 0; i < supervisor.maxWorkers; i++)
+    {
+        if(supervisor.workers[i].pid > 0)
+        {
+            live++;
+        }
+    }
+    return live;
+}
+
+int supervisor_drain(void)
+{
+    struct pollfd pfd;
+    uint64_t      deadline;
+    int           remaining;
+
+    supervisor.draining = true;
+    deadline            = monotonic_ms() + (supervisor.drainTimeoutMs ? supervisor.drainTimeoutMs : SUPERVISOR_DRAIN_TIMEOUT_MS);
+
+    for(int i = 0; i < supervisor.maxWorkers; i++)
+    {
+        if(supervisor.workers[i].pid > 0)
+        {
+            kill(supervisor.workers[i].pid, SIGTERM);
+        }
+    }
+    printf("[Parent] Draining %d workers\n", live_workers());
+
+    // Only SIGCHLD matters now; a second SIGINT/SIGTERM does not cut the drain short
+    pfd.fd     = supervisor.signalFd;
+    pfd.events = POLLIN;
+    while((remaining = live_workers()) > 0)
+    {
+        uint64_t now = monotonic_ms();
+
+        if(now >= deadline)
+        {
+            break;
+        }
+
+        if(poll(&pfd, 1, (int)(deadline - now)) > 0)
+        {
+            struct signalfd_siginfo info;
+
+            // Discard the queued signals; reap_workers finds every exited child
+            while(read(supervisor.signalFd, &info, sizeof(info)) == (ssize_t)sizeof(info))
+            {
+                continue;
+            }
+            reap_workers();
+        }
+    }
+
+    if(remaining > 0)
+    {
+        printf("[Parent] Drain deadline passed, killing %d workers\n", remaining);
+        for(int i = 0; i < supervisor.maxWorkers; i++)
+        {
+            if(supervisor.workers[i].pid > 0)
+            {
+                int status;
+
+                kill(supervisor.workers[i].pid, SIGKILL);
+                waitpid(supervisor.workers[i].pid, &status, 0);
+                log_exit(i, supervisor.workers[i].pid, status);
+                supervisor.workers[i].pid = 0;
+                supervisor.pids[i]        = 0;
+            }
+        }
+    }
+    return remaining;
+}
+
+bool supervisor_worker_draining(void)
+{
+    return worker_draining != 0;
+}
+
+int supervisor_worker_drain_fd(void)
+{
+    return drain_pipe[0];
+}
+
+const WorkerSlot *supervisor_worker(int worker)
+{
+    if(worker < 0 || worker >= supervisor.maxWorkers)
+    {
+        return NULL;
+    }
+    return &supervisor.workers[worker];
+}
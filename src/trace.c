@@ -0,0 +1,238 @@
+#include "../include/trace.h"
+#include "../include/sampler.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+#define NANOSECONDS_PER_SECOND 1000000000ULL
+#define CALIBRATION_NS 20000000L
+#define CPUINFO_LINE 4096
+
+typedef struct
+{
+    TracePhase phase;
+    uint64_t   start;
+    uint64_t   end;
+} PendingPhase;
+
+static TraceHeader *trace_header = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static bool         trace_tsc    = false;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+// Per-worker state: its ring and the phases of the request in flight
+static TraceRing   *trace_ring     = NULL;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static uint32_t     trace_requests = 0;       // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static PendingPhase trace_pending[TRACE_PENDING_EVENTS];    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+static size_t       trace_num_pending = 0;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+static const char *const phase_names[TRACE_PHASE_COUNT] = {"accept", "read", "parse", "handle", "db_write", "send", "request"};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+/*
+ * The TSC is only usable as a clock when it ticks at a fixed rate through
+ * frequency changes and idle states, and is in sync across cores.
+ */
+static bool tsc_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "re");
+    char  line[CPUINFO_LINE];
+    bool  invariant = false;
+
+    if(!cpuinfo)
+    {
+        return false;
+    }
+    while(fgets(line, sizeof(line), cpuinfo))
+    {
+        if(strncmp(line, "flags", strlen("flags")) == 0)
+        {
+            invariant = strstr(line, " constant_tsc") && strstr(line, " nonstop_tsc");
+            break;
+        }
+    }
+    fclose(cpuinfo);
+    return invariant;
+#else
+    return false;
+#endif
+}
+
+static uint64_t read_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if(trace_tsc)
+    {
+        return __rdtsc();
+    }
+#endif
+    return monotonic_ns();
+}
+
+/*
+ * Measures TSC ticks per nanosecond against CLOCK_MONOTONIC.
+ */
+static double calibrate(void)
+{
+    struct timespec pause = {0, CALIBRATION_NS};
+    uint64_t        start_ns;
+    uint64_t        start_ticks;
+    uint64_t        elapsed_ns;
+
+    start_ns    = monotonic_ns();
+    start_ticks = read_clock();
+    nanosleep(&pause, NULL);
+    elapsed_ns = monotonic_ns() - start_ns;
+    return (double)(read_clock() - start_ticks) / (double)elapsed_ns;
+}
+
+int trace_init(unsigned int percent, int max_workers)
+{
+    size_t size;
+    int    fd;
+    void  *map;
+
+    if(percent == 0)
+    {
+        return 0;
+    }
+
+    // A fresh inode every time: workers of a master being replaced keep
+    // writing to the old one
+    unlink(TRACE_PATH);
+    fd = open(TRACE_PATH, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if(fd < 0)
+    {
+        perror("open trace file");
+        return -1;
+    }
+
+    size = sizeof(TraceHeader) + sizeof(TraceRing) * (size_t)max_workers;
+    if(ftruncate(fd, (off_t)size) != 0)
+    {
+        perror("ftruncate trace file");
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap trace file");
+        return -1;
+    }
+
+    trace_tsc    = tsc_invariant();
+    trace_header = (TraceHeader *)map;
+    memcpy(trace_header->magic, TRACE_MAGIC, sizeof(trace_header->magic));
+    trace_header->version    = TRACE_VERSION;
+    trace_header->workers    = (uint32_t)max_workers;
+    trace_header->ringEvents = TRACE_RING_EVENTS;
+    trace_header->percent    = percent > SAMPLER_MAX_PERCENT ? SAMPLER_MAX_PERCENT : percent;
+    trace_header->ticksPerNs = trace_tsc ? calibrate() : 1;
+    trace_header->baseNs     = monotonic_ns();
+    trace_header->baseTicks  = read_clock();
+    snprintf(trace_header->clock, sizeof(trace_header->clock), "%s", trace_tsc ? "tsc" : "monotonic");
+
+    printf("Tracing %u%% of requests to %s (%s clock, %.3f ticks/ns)\n", trace_header->percent, TRACE_PATH, trace_header->clock, trace_header->ticksPerNs);
+    return 0;
+}
+
+void trace_worker_start(int worker)
+{
+    if(!trace_header || worker < 0 || (uint32_t)worker >= trace_header->workers)
+    {
+        return;
+    }
+
+    trace_ring        = (TraceRing *)(trace_header + 1) + worker;
+    trace_num_pending = 0;
+}
+
+uint64_t trace_clock(void)
+{
+    return trace_ring ? read_clock() : 0;
+}
+
+void trace_phase(TracePhase phase, uint64_t start)
+{
+    PendingPhase *pending;
+
+    if(!trace_ring || trace_num_pending == TRACE_PENDING_EVENTS)
+    {
+        return;
+    }
+
+    pending        = &trace_pending[trace_num_pending++];
+    pending->phase = phase;
+    pending->start = start;
+    pending->end   = read_clock();
+}
+
+/*
+ * Appends one event. The sequence is cleared first and set last, so a reader
+ * racing the writer can tell a slot being overwritten from a complete one.
+ */
+static void ring_write(TracePhase phase, uint64_t start, uint64_t end, int status, uint32_t count)
+{
+    uint64_t    position = atomic_load_explicit(&trace_ring->head, memory_order_relaxed);
+    TraceEvent *event    = &trace_ring->events[position & (TRACE_RING_EVENTS - 1)];
+
+    atomic_store_explicit(&event->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->start   = start;
+    event->end     = end;
+    event->pid     = getpid();
+    event->request = trace_requests;
+    event->phase   = (uint16_t)phase;
+    event->status  = (uint16_t)status;
+    event->count   = count;
+    atomic_store_explicit(&event->sequence, position + 1, memory_order_release);
+    atomic_store_explicit(&trace_ring->head, position + 1, memory_order_release);
+}
+
+void trace_request_end(int status, uint32_t count)
+{
+    if(!trace_ring || trace_num_pending == 0)
+    {
+        return;
+    }
+
+    if(sampler_pick(trace_header->percent))
+    {
+        trace_requests++;
+        for(size_t i = 0; i < trace_num_pending; i++)
+        {
+            ring_write(trace_pending[i].phase, trace_pending[i].start, trace_pending[i].end, 0, 0);
+        }
+        ring_write(TRACE_REQUEST, trace_pending[0].start, trace_pending[trace_num_pending - 1].end, status, count);
+    }
+    trace_num_pending = 0;
+}
+
+void trace_discard(void)
+{
+    trace_num_pending = 0;
+}
+
+const char *trace_phase_name(int phase)
+{
+    if(phase < 0 || phase >= TRACE_PHASE_COUNT)
+    {
+        return "unknown";
+    }
+    return phase_names[phase];
+}
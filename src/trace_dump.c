@@ -0,0 +1,245 @@
+/*******************************************************************************
+ * trace_dump: turn the per-worker request trace rings into something to look at
+ *
+ * The server (started with -r percent) keeps the phases of a sample of
+ * requests in ../data/trace.ring, one ring per worker. This reads the rings,
+ * live or after the fact, and prints the events either as Chrome trace JSON
+ * (load it in chrome://tracing or ui.perfetto.dev; every request is a slice
+ * with its phases nested under it) or as one text line per event. With
+ * --min-us only requests at least that slow are kept, to look at the tail.
+ ******************************************************************************/
+
+#include "../include/trace.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define USAGE "Usage: %s [--format chrome|text] [--min-us N] [trace_path]\n"
+#define NANOSECONDS_PER_MICROSECOND 1000
+#define MICROSECONDS_PER_SECOND 1000000
+
+typedef enum
+{
+    FORMAT_CHROME,
+    FORMAT_TEXT
+} OutputFormat;
+
+typedef struct
+{
+    const TraceHeader *header;
+    OutputFormat       format;
+    double             minUs;
+    int                written;
+} DumpJob;
+
+static double ticks_to_us(const TraceHeader *header, uint64_t ticks)
+{
+    return (double)(int64_t)(ticks - header->baseTicks) / header->ticksPerNs / NANOSECONDS_PER_MICROSECOND;
+}
+
+static void print_event(DumpJob *job, int worker, const TraceEvent *event)
+{
+    double start = ticks_to_us(job->header, event->start);
+    double end   = ticks_to_us(job->header, event->end);
+
+    if(job->format == FORMAT_TEXT)
+    {
+        // Laid out like `perf script`: comm pid [cpu] time: event: details
+        printf("app %7d [%03d] %14.6f: %s: dur_us=%.3f request=%u", event->pid, worker, start / MICROSECONDS_PER_SECOND, trace_phase_name(event->phase), end - start, event->request);
+        if(event->phase == TRACE_REQUEST)
+        {
+            printf(" status=%u responses=%u", event->status, event->count);
+        }
+        printf("\n");
+        return;
+    }
+
+    printf("%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"worker\":%d,\"request\":%u",
+           job->written++ ? "," : "",
+           trace_phase_name(event->phase),
+           event->phase == TRACE_REQUEST ? "request" : "phase",
+           start,
+           end - start,
+           event->pid,
+           event->pid,
+           worker,
+           event->request);
+    if(event->phase == TRACE_REQUEST)
+    {
+        printf(",\"status\":%u,\"responses\":%u", event->status, event->count);
+    }
+    printf("}}");
+}
+
+/*
+ * Copies an event out of a ring that may still be written to. The writer
+ * clears the sequence before it touches a slot and sets it last, so a copy
+ * taken between two equal, expected sequence reads is whole.
+ */
+static int read_event(const TraceRing *ring, uint64_t position, TraceEvent *copy)
+{
+    const TraceEvent *event = &ring->events[position & (TRACE_RING_EVENTS - 1)];
+    uint64_t          before;
+
+    before = atomic_load_explicit(&event->sequence, memory_order_acquire);
+    if(before != position + 1)
+    {
+        return -1;
+    }
+    copy->start   = event->start;
+    copy->end     = event->end;
+    copy->pid     = event->pid;
+    copy->request = event->request;
+    copy->phase   = event->phase;
+    copy->status  = event->status;
+    copy->count   = event->count;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&event->sequence, memory_order_relaxed) == before ? 0 : -1;
+}
+
+/*
+ * A request's phases are written together with its TRACE_REQUEST event last,
+ * so they are held until that event says whether the request is slow enough.
+ */
+static void dump_ring(DumpJob *job, int worker, const TraceRing *ring)
+{
+    TraceEvent held[TRACE_PENDING_EVENTS];
+    size_t     numHeld = 0;
+    uint64_t   head    = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t   first   = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+
+    for(uint64_t position = first; position < head; position++)
+    {
+        TraceEvent event;
+
+        if(read_event(ring, position, &event) != 0)
+        {
+            numHeld = 0;
+            continue;
+        }
+
+        if(event.phase != TRACE_REQUEST)
+        {
+            // Drop phases whose request was lost to wrap-around or a torn read
+            if(numHeld > 0 && held[numHeld - 1].request != event.request)
+            {
+                numHeld = 0;
+            }
+            if(numHeld < TRACE_PENDING_EVENTS)
+            {
+                held[numHeld++] = event;
+            }
+            continue;
+        }
+
+        if(ticks_to_us(job->header, event.end) - ticks_to_us(job->header, event.start) >= job->minUs)
+        {
+            print_event(job, worker, &event);
+            for(size_t i = 0; i < numHeld; i++)
+            {
+                if(held[i].request == event.request)
+                {
+                    print_event(job, worker, &held[i]);
+                }
+            }
+        }
+        numHeld = 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option longOptions[] = {
+        {"format", required_argument, NULL, 'f'},
+        {"min-us", required_argument, NULL, 'u'},
+        {NULL,     0,                 NULL, 0  }
+    };
+    const char  *path = TRACE_PATH;
+    DumpJob      job;
+    struct stat  info;
+    void        *map;
+    int          fd;
+    int          opt;
+
+    memset(&job, 0, sizeof(job));
+    job.format = FORMAT_CHROME;
+
+    while((opt = getopt_long(argc, argv, "f:u:", longOptions, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'f':
+                if(strcmp(optarg, "text") == 0)
+                {
+                    job.format = FORMAT_TEXT;
+                }
+                else if(strcmp(optarg, "chrome") != 0)
+                {
+                    fprintf(stderr, USAGE, argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'u':
+                job.minUs = strtod(optarg, NULL);
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind < argc)
+    {
+        path = argv[optind];
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TraceHeader))
+    {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    job.header = (const TraceHeader *)map;
+    if(memcmp(job.header->magic, TRACE_MAGIC, sizeof(job.header->magic)) != 0 || job.header->version != TRACE_VERSION || job.header->ringEvents != TRACE_RING_EVENTS ||
+       (size_t)info.st_size < sizeof(TraceHeader) + sizeof(TraceRing) * job.header->workers)
+    {
+        fprintf(stderr, "%s: not a trace file, or from another version\n", path);
+        munmap(map, (size_t)info.st_size);
+        return EXIT_FAILURE;
+    }
+
+    if(job.format == FORMAT_CHROME)
+    {
+        printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"clock\":\"%s\",\"ticks_per_ns\":%.6f,\"sample_percent\":%u},\"traceEvents\":[", job.header->clock, job.header->ticksPerNs, job.header->percent);
+    }
+    for(uint32_t worker = 0; worker < job.header->workers; worker++)
+    {
+        dump_ring(&job, (int)worker, (const TraceRing *)(job.header + 1) + worker);
+    }
+    if(job.format == FORMAT_CHROME)
+    {
+        printf("\n]}\n");
+    }
+
+    munmap(map, (size_t)info.st_size);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,299 @@
+#include "../include/upgrade.h"
+#include "../include/sharedMemory.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define UPGRADE_MAX_FDS 9    // the listening socket and up to 8 shared regions
+#define UPGRADE_MAX_ARGS 64
+#define CMDLINE_BUFFER_SIZE 4096
+#define DELETED_SUFFIX " (deleted)"
+#define DECIMAL_BASE 10
+
+// New master: channel back to the old master until it has been told we are ready
+static int ready_fd = -1;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,-warnings-as-errors)
+
+/*
+ * Receives the handover message: the listening socket followed by the shared
+ * regions, whose names are sent NUL-separated in the payload.
+ */
+static int receive_handover(int channel)
+{
+    char            names[UPGRADE_MAX_FDS * SHARED_MEMORY_NAME_MAX];
+    char            control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    int             fds[UPGRADE_MAX_FDS];
+    size_t          count;
+    ssize_t         received;
+    const char     *name;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = names;
+    iov.iov_len        = sizeof(names);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    received = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    cmsg     = CMSG_FIRSTHDR(&msg);
+    if(received <= 0 || !cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        fprintf(stderr, "No listening socket received from the old master\n");
+        return -1;
+    }
+
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+
+    // First name is the listener's; every other fd is a shared region
+    names[sizeof(names) - 1] = '\0';
+    name                     = names;
+    for(size_t i = 1; i < count; i++)
+    {
+        name += strlen(name) + 1;
+        if(name >= names + received || shared_memory_adopt(name, fds[i]) < 0)
+        {
+            close(fds[i]);
+        }
+    }
+    return count > 0 ? fds[0] : -1;
+}
+
+int upgrade_inherited_listener(void)
+{
+    const char *listen_pid = getenv("LISTEN_PID");
+    const char *listen_fds = getenv("LISTEN_FDS");
+    const char *channel    = getenv(UPGRADE_FD_ENV);
+    int         listen_fd  = -1;
+
+    // Socket activation: only the first socket is used
+    if(listen_pid && listen_fds && strtol(listen_pid, NULL, DECIMAL_BASE) == getpid() && strtol(listen_fds, NULL, DECIMAL_BASE) > 0)
+    {
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        fcntl(LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+        printf("Using listening socket %d from the service manager\n", LISTEN_FDS_START);
+        return LISTEN_FDS_START;
+    }
+
+    if(!channel)
+    {
+        return -1;
+    }
+
+    ready_fd = (int)strtol(channel, NULL, DECIMAL_BASE);
+    unsetenv(UPGRADE_FD_ENV);
+    fcntl(ready_fd, F_SETFD, FD_CLOEXEC);
+
+    listen_fd = receive_handover(ready_fd);
+    if(listen_fd < 0)
+    {
+        close(ready_fd);
+        ready_fd = -1;
+        return -1;
+    }
+
+    printf("Took over listening socket %d from the old master\n", listen_fd);
+    return listen_fd;
+}
+
+void upgrade_notify_ready(void)
+{
+    if(ready_fd < 0)
+    {
+        return;
+    }
+
+    if(write(ready_fd, "R", 1) != 1)
+    {
+        perror("Failed to notify the old master");
+    }
+    close(ready_fd);
+    ready_fd = -1;
+}
+
+/*
+ * Rebuilds argv from /proc/self/cmdline so the new master starts with the
+ * same options.
+ */
+static int read_cmdline(char *buffer, size_t size, char **argv)
+{
+    ssize_t length;
+    int     fd;
+    int     argc = 0;
+
+    fd = open("/proc/self/cmdline", O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    length = read(fd, buffer, size - 1);
+    close(fd);
+    if(length <= 0)
+    {
+        return -1;
+    }
+    buffer[length] = '\0';
+
+    for(ssize_t i = 0; i < length && argc < UPGRADE_MAX_ARGS - 1; i += (ssize_t)strlen(buffer + i) + 1)
+    {
+        argv[argc++] = buffer + i;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/*
+ * The path this binary was started from. After the file is replaced,
+ * /proc/self/exe reads "<path> (deleted)": the path is what we want to exec.
+ */
+static int executable_path(char *path, size_t size)
+{
+    ssize_t length;
+    size_t  suffix = strlen(DELETED_SUFFIX);
+
+    length = readlink("/proc/self/exe", path, size - 1);
+    if(length <= 0)
+    {
+        return -1;
+    }
+    path[length] = '\0';
+
+    if((size_t)length > suffix && strcmp(path + (size_t)length - suffix, DELETED_SUFFIX) == 0)
+    {
+        path[(size_t)length - suffix] = '\0';
+    }
+    return 0;
+}
+
+static int send_handover(int channel, int listen_fd)
+{
+    char            names[UPGRADE_MAX_FDS * SHARED_MEMORY_NAME_MAX];
+    char            control[CMSG_SPACE(sizeof(int) * UPGRADE_MAX_FDS)];
+    int             fds[UPGRADE_MAX_FDS];
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cmsg;
+    size_t          length = 0;
+    int             count  = 0;
+
+    // The listener goes first, then every named shared region
+    memcpy(names, "listen", sizeof("listen"));
+    length       = sizeof("listen");
+    fds[count++] = listen_fd;
+    for(int i = 0; i < shared_memory_region_count() && count < UPGRADE_MAX_FDS; i++)
+    {
+        size_t name_length = strlen(shared_memory_region_name(i)) + 1;
+
+        memcpy(names + length, shared_memory_region_name(i), name_length);
+        length += name_length;
+        fds[count++] = shared_memory_region_fd(i);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base       = names;
+    iov.iov_len        = length;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)count);
+
+    cmsg             = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * (size_t)count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * (size_t)count);
+
+    if(sendmsg(channel, &msg, MSG_NOSIGNAL) < 0)
+    {
+        perror("Failed to hand over the listening socket");
+        return -1;
+    }
+    return 0;
+}
+
+int upgrade_start(int listen_fd)
+{
+    char          cmdline[CMDLINE_BUFFER_SIZE];
+    char         *argv[UPGRADE_MAX_ARGS];
+    char          path[PATH_MAX];
+    int           channel[2];
+    struct pollfd pfd;
+    char          reply;
+    pid_t         pid;
+
+    if(read_cmdline(cmdline, sizeof(cmdline), argv) <= 0 || executable_path(path, sizeof(path)) < 0)
+    {
+        fprintf(stderr, "Cannot find the binary to upgrade to\n");
+        return -1;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) < 0)
+    {
+        perror("socketpair failed");
+        return -1;
+    }
+
+    pid = fork();
+    if(pid < 0)
+    {
+        perror("fork failed");
+        close(channel[0]);
+        close(channel[1]);
+        return -1;
+    }
+
+    if(pid == 0)
+    {
+        char     value[sizeof(int) * 3 + 1];
+        sigset_t none;
+
+        // The new master starts with no signals blocked, like a fresh start
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+
+        close(channel[0]);
+        fcntl(channel[1], F_SETFD, 0);
+        snprintf(value, sizeof(value), "%d", channel[1]);
+        setenv(UPGRADE_FD_ENV, value, 1);
+
+        execv(path, argv);
+        perror("execv failed");
+        _exit(EXIT_FAILURE);
+    }
+
+    close(channel[1]);
+    printf("[Parent] Upgrading: started %s as PID %d\n", path, pid);
+
+    if(send_handover(channel[0], listen_fd) < 0)
+    {
+        close(channel[0]);
+        return -1;
+    }
+
+    // EOF here means the new master died before it got its workers up
+    pfd.fd     = channel[0];
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, UPGRADE_READY_TIMEOUT_MS) <= 0 || read(channel[0], &reply, 1) != 1)
+    {
+        fprintf(stderr, "[Parent] New master PID %d did not become ready, upgrade aborted\n", pid);
+        kill(pid, SIGTERM);
+        close(channel[0]);
+        return -1;
+    }
+
+    close(channel[0]);
+    printf("[Parent] New master PID %d is ready, draining this generation\n", pid);
+    return 0;
+}
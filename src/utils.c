@@ -1,12 +1,32 @@
 #include "../include/utils.h"
 #include "../include/db.h"
+#include "../include/httpResponse.h"
+#include "../include/profiler.h"
+#include "../include/record.h"
+#include "../include/scoreboard.h"
 #include "../include/server.h"
+#include "../include/shadow.h"
+#include "../include/snapshot.h"
 #include "../include/stringTools.h"
+#include "../include/trace.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 
+#define ENTRIES_PATH "/entries"
+#define ENTRIES_PATH_LENGTH (sizeof(ENTRIES_PATH) - 1)
+#define ENTRIES_SEARCH_PATH "/search"
+#define ENTRIES_SEARCH_PATH_LENGTH (sizeof(ENTRIES_SEARCH_PATH) - 1)
+#define ENTRIES_DEFAULT_LIMIT 50
+#define ENTRIES_MAX_LIMIT 1000
+#define ENTRIES_BATCH 64
+#define DECIMAL_BASE 10
+#define JSON_CONTENT_TYPE "application/json"
+
 /**
  * Function to check if a filePath is the root. If it is the root, then it will
  * change the verified_path to a default value
@@ -20,7 +40,6 @@ int checkIfRoot(const char *filePath, char *verified_path)
 {
     if(strcmp(filePath, "../data/") == 0)
     {
-        printf("Requesting default file path...");
         strncpy(verified_path, "index.html", BUFFER_SIZE - 1);
         verified_path[BUFFER_SIZE - 1] = '\0';
     }
@@ -33,7 +52,7 @@ int checkIfRoot(const char *filePath, char *verified_path)
     return 0;
 }
 
-int head_req_response(int client_socket, const char *filePath)
+int head_req_response(HTTPResponse *response, const char *filePath)
 {
     /*
      * Steps:
@@ -56,6 +75,7 @@ int head_req_response(int client_socket, const char *filePath)
     if(filePathWithDot == NULL)
     {
         perror(". character not added");
+        http_response_set_status(response, INTERNAL_SERVER_ERROR_STATUS);
         return -1;
     }
 
@@ -65,6 +85,7 @@ int head_req_response(int client_socket, const char *filePath)
     if(resource_file == NULL)
     {
         perror("Error opening resource file");
+        http_response_set_status(response, NOT_FOUND_STATUS);
         return -1;
     }
 
@@ -72,8 +93,8 @@ int head_req_response(int client_socket, const char *filePath)
     totalBytesRead = ftell(resource_file);
     fseek(resource_file, 0, SEEK_SET);
 
-    // send header
-    send_response_head(client_socket, (size_t)totalBytesRead);
+    // headers only, advertising the resource length
+    http_response_set_head_only(response, totalBytesRead > 0 ? (size_t)totalBytesRead : 0);
 
     // close file
     fclose(resource_file);
@@ -82,12 +103,11 @@ int head_req_response(int client_socket, const char *filePath)
 }
 
 /**
- * Function to read the resource, save the resource into a malloc, send the
- * resource back to the client
- * @param client_socket client socket that sends the req
+ * Function to read the resource straight into the response body
+ * @param response response the server sends back to the client
  * @return 0 if success
  */
-int get_req_response(int client_socket, const char *filePath)
+int get_req_response(HTTPResponse *response, const char *filePath)
 {
     char  *filePathWithDot;
     FILE  *resource_file;
@@ -105,6 +125,7 @@ int get_req_response(int client_socket, const char *filePath)
     if(filePathWithDot == NULL)
     {
         perror(". character not added");
+        http_response_set_status(response, INTERNAL_SERVER_ERROR_STATUS);
         return -1;
     }
 
@@ -114,6 +135,7 @@ int get_req_response(int client_socket, const char *filePath)
     {
         fprintf(stderr, "Error opening resource file: %s\n", filePathWithDot);
         free(filePathWithDot);
+        http_response_set_status(response, NOT_FOUND_STATUS);
         return -1;
     }
 
@@ -126,13 +148,15 @@ int get_req_response(int client_socket, const char *filePath)
         fprintf(stderr, "File is empty or ftell failed: %ld\n", totalBytesRead);
         fclose(resource_file);
         free(filePathWithDot);
+        http_response_set_status(response, NOT_FOUND_STATUS);
         return -1;
     }
+    free(filePathWithDot);
 
     fseek(resource_file, 0, SEEK_SET);
 
-    // allocate memory
-    file_content = (char *)malloc((unsigned long)(totalBytesRead + 1));
+    // read straight into the response body
+    file_content = http_response_reserve(response, (size_t)totalBytesRead);
     if(file_content == NULL)
     {
         perror("Error allocating memory");
@@ -140,118 +164,579 @@ int get_req_response(int client_socket, const char *filePath)
         return -1;
     }
 
-    // read into buffer
-    bytesRead = fread(file_content, 1, (unsigned long)totalBytesRead, resource_file);
+    bytesRead = fread(file_content, 1, (size_t)totalBytesRead, resource_file);
+    fclose(resource_file);
     if((long)bytesRead != totalBytesRead)
     {
         perror("Error reading HTML file");
-        free(file_content);
-        fclose(resource_file);
+        http_response_set_status(response, INTERNAL_SERVER_ERROR_STATUS);
         return -1;
     }
-    fclose(resource_file);
-
-    // create response and send
-    if(send_response_resource(client_socket, file_content, bytesRead) == -1)
-    {
-        free(file_content);
-        return -1;
-    }
-
-    // free resources on success
-    free(filePathWithDot);
-    free(file_content);
+    http_response_commit(response, bytesRead);
     return 0;
 }
 
 /**
  * POST handling helper — stores POST body into ndbm.
  */
-int handle_post_request(int client_socket, const HTTPRequest *request, const char *body)
+int handle_post_request(HTTPResponse *response, const HTTPRequest *request, const char *body)
 {
-    DBO   dbo;
-    char *created_response = NULL;
+    DBO      dbo;
+    uint64_t started;
+    int      result;
 
     if(!request || !body || strlen(body) == 0)
     {
-        const char *bad_request = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
-        send(client_socket, bad_request, strlen(bad_request), 0);
+        http_response_set_status(response, BAD_REQUEST_STATUS);
         return -1;
     }
 
-    dbo.name         = strdup("../data/db/post_data.db");    // Path to your ndbm database
-    created_response = strdup("HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n");
-
-    if(store_post_entry(&dbo, body, "entry_id") != 0)
+    dbo.name = strdup(POST_DB_PATH);    // Path to your ndbm database
+    dbo.db   = NULL;
+    if(!dbo.name)
     {
-        const char *internal_error = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
-        send(client_socket, internal_error, strlen(internal_error), 0);
-        free((void *)created_response);
+        http_response_set_status(response, INTERNAL_SERVER_ERROR_STATUS);
         return -1;
     }
 
-    // Only send and then free after use
-    if(created_response != NULL)
+    started = trace_clock();
+    result  = store_post_entry(&dbo, body, POST_PK_NAME);
+    trace_phase(TRACE_DB_WRITE, started);
+    free(dbo.name);
+    if(result != 0)
     {
-        send(client_socket, created_response, strlen(created_response), 0);
-        free((void *)created_response);
+        http_response_set_status(response, INTERNAL_SERVER_ERROR_STATUS);
+        return -1;
     }
 
+    http_response_set_status(response, CREATED_STATUS);
     return 0;
 }
 
-/**
- * Function to construct the response and send to client socket from a given
- * resource Only called when a resource is confirmed to exist
- * @param client_socket client to send the response to
- * @param content content of the resource requested
- * @return 0 if success
+static void json_append(HTTPResponse *response, const char *text, size_t length)
+{
+    http_response_append(response, text, length);
+}
+
+static void json_append_str(HTTPResponse *response, const char *text)
+{
+    json_append(response, text, strlen(text));
+}
+
+static void json_append_string(HTTPResponse *response, const char *text)
+{
+    json_append(response, "\"", 1);
+    for(const char *c = text; *c; c++)
+    {
+        char escaped[8];
+
+        if(*c == '"' || *c == '\\')
+        {
+            escaped[0] = '\\';
+            escaped[1] = *c;
+            json_append(response, escaped, 2);
+        }
+        else if((unsigned char)*c < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)(unsigned char)*c);
+            json_append_str(response, escaped);
+        }
+        else
+        {
+            json_append(response, c, 1);
+        }
+    }
+    json_append(response, "\"", 1);
+}
+
+/*
+ * Writes {"id":N,"fields":{...}} for one stored entry.
  */
-// todo add status codes and handle each situation based on that
-int send_response_resource(int client_socket, const char *content, size_t content_length)
+static void json_append_entry(HTTPResponse *response, DBO *dbo, const PostEntry *entry)
 {
-    char   response[BUFFER_SIZE];
-    size_t total_sent = 0;
-    snprintf(response, BUFFER_SIZE, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", content_length);
+    char         number[32];
+    RecordFields fields;
+
+    snprintf(number, sizeof(number), "{\"id\":%d,\"fields\":{", entry->id);
+    json_append_str(response, number);
 
-    // send the response header
-    if(send(client_socket, response, strlen(response), 0) == -1)
+    if(decode_post_entry(dbo, entry, &fields) == 0)
     {
-        perror("Error sending response header");
-        return -1;
+        for(size_t i = 0; i < fields.count; i++)
+        {
+            if(i > 0)
+            {
+                json_append(response, ",", 1);
+            }
+            json_append_string(response, fields.fields[i].name);
+            json_append(response, ":", 1);
+            json_append_string(response, fields.fields[i].value);
+        }
+        record_fields_free(&fields);
     }
 
-    // send content
-    while(total_sent < content_length)
+    json_append_str(response, "}}");
+}
+
+/*
+ * Loads a batch of entries (ids already filled in) and appends the ones that
+ * exist, comma-separated after the *written entries already in the array.
+ */
+static void json_append_entry_batch(HTTPResponse *response, DBO *dbo, PostEntry *batch, size_t count, int *written)
+{
+    if(retrieve_post_entries(dbo, batch, count) != 0)
     {
-        ssize_t sent = send(client_socket, content + total_sent, content_length - total_sent, 0);
-        if(sent == -1)
+        response->failed = true;
+        return;
+    }
+
+    for(size_t i = 0; i < count; i++)
+    {
+        if(!batch[i].data)
         {
-            perror("Error sending content");
-            return -1;
+            continue;
         }
-        total_sent += (size_t)sent;
+        if((*written)++ > 0)
+        {
+            json_append(response, ",", 1);
+        }
+        json_append_entry(response, dbo, &batch[i]);
     }
-    return 0;
+    free_post_entries(batch, count);
+}
+
+/*
+ * Finds a query parameter such as "since" in "/entries?since=5" and returns a
+ * pointer to its raw value, which runs until the next '&' or the end.
+ */
+static const char *query_find(const char *path, const char *name)
+{
+    const char *query = strchr(path, '?');
+    size_t      nameLength;
+
+    if(!query)
+    {
+        return NULL;
+    }
+
+    nameLength = strlen(name);
+    for(const char *param = query + 1; param && *param; param = strchr(param, '&'))
+    {
+        if(*param == '&')
+        {
+            param++;
+        }
+        if(strncmp(param, name, nameLength) == 0 && param[nameLength] == '=')
+        {
+            return param + nameLength + 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns the decoded value of a query parameter (must be freed), or NULL.
+ */
+static char *query_string(const char *path, const char *name)
+{
+    const char *raw = query_find(path, name);
+    char       *encoded;
+    char       *decoded;
+
+    if(!raw)
+    {
+        return NULL;
+    }
+
+    encoded = strndup(raw, strcspn(raw, "&"));
+    if(!encoded)
+    {
+        return NULL;
+    }
+    decoded = urlDecode(encoded);
+    free(encoded);
+    return decoded;
+}
+
+/*
+ * Reads an integer query parameter such as "since" from "/entries?since=5".
+ */
+static int query_int(const char *path, const char *name, int fallback)
+{
+    const char *raw = query_find(path, name);
+    char       *endptr;
+    long        value;
+
+    if(!raw)
+    {
+        return fallback;
+    }
+
+    value = strtol(raw, &endptr, DECIMAL_BASE);
+    if(endptr == raw || value < 0 || value > INT32_MAX)
+    {
+        return fallback;
+    }
+    return (int)value;
+}
+
+static int send_json_status(HTTPResponse *response, int status, const char *body)
+{
+    http_response_set_text(response, status, JSON_CONTENT_TYPE, body);
+    return status < BAD_REQUEST_STATUS ? 0 : -1;
+}
+
+static int send_entry(HTTPResponse *response, DBO *dbo, const char *idString)
+{
+    PostEntry entry;
+    char     *endptr;
+    long      id;
+
+    id = strtol(idString, &endptr, DECIMAL_BASE);
+    if(endptr == idString || (*endptr != '\0' && *endptr != '?') || id < 0 || id > INT32_MAX)
+    {
+        return send_json_status(response, BAD_REQUEST_STATUS, "{\"error\":\"invalid id\"}");
+    }
+
+    entry.id = (int)id;
+    if(retrieve_post_entries(dbo, &entry, 1) != 0)
+    {
+        return send_json_status(response, INTERNAL_SERVER_ERROR_STATUS, "{\"error\":\"database error\"}");
+    }
+    if(!entry.data)
+    {
+        return send_json_status(response, NOT_FOUND_STATUS, "{\"error\":\"not found\"}");
+    }
+
+    http_response_add_header(response, "Content-Type", JSON_CONTENT_TYPE);
+    json_append_entry(response, dbo, &entry);
+    free_post_entries(&entry, 1);
+
+    return response->failed ? -1 : 0;
+}
+
+static int send_entry_list(HTTPResponse *response, DBO *dbo, const char *path)
+{
+    PostEntry batch[ENTRIES_BATCH];
+    char      text[BUFFER_SIZE];
+    int       since;
+    int       limit;
+    int       total;
+    int       end;
+    int       written = 0;
+
+    since = query_int(path, "since", 0);
+    limit = query_int(path, "limit", ENTRIES_DEFAULT_LIMIT);
+    if(limit > ENTRIES_MAX_LIMIT)
+    {
+        limit = ENTRIES_MAX_LIMIT;
+    }
+
+    total = retrieve_post_count(dbo, POST_PK_NAME);
+    if(total < 0)
+    {
+        return send_json_status(response, INTERNAL_SERVER_ERROR_STATUS, "{\"error\":\"database error\"}");
+    }
+
+    if(since > total)
+    {
+        since = total;
+    }
+    end = (limit > total - since) ? total : since + limit;
+
+    // Responses are server-owned and sent with a Content-Length, so a page is
+    // built in memory; ENTRIES_MAX_LIMIT bounds it, and clients page with next
+    http_response_add_header(response, "Content-Type", JSON_CONTENT_TYPE);
+    snprintf(text, sizeof(text), "{\"total\":%d,\"next\":%d,\"entries\":[", total, end);
+    json_append_str(response, text);
+
+    for(int first = since; first < end && !response->failed; first += ENTRIES_BATCH)
+    {
+        size_t count = (size_t)(end - first < ENTRIES_BATCH ? end - first : ENTRIES_BATCH);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            batch[i].id = first + (int)i;
+        }
+        json_append_entry_batch(response, dbo, batch, count, &written);
+    }
+
+    json_append_str(response, "]}");
+    return response->failed ? -1 : 0;
+}
+
+static int send_search_results(HTTPResponse *response, DBO *dbo, const char *path)
+{
+    PostEntry batch[ENTRIES_BATCH];
+    char     *field;
+    char     *value;
+    int      *ids;
+    char      text[BUFFER_SIZE];
+    bool      prefix;
+    int       limit;
+    int       found;
+    int       written = 0;
+
+    field  = query_string(path, "field");
+    value  = query_string(path, "eq");
+    prefix = false;
+    if(!value)
+    {
+        value  = query_string(path, "prefix");
+        prefix = true;
+    }
+
+    if(!field || !value || (prefix && value[0] == '\0'))
+    {
+        free(field);
+        free(value);
+        return send_json_status(response, BAD_REQUEST_STATUS, "{\"error\":\"expected field and eq or prefix\"}");
+    }
+
+    limit = query_int(path, "limit", ENTRIES_DEFAULT_LIMIT);
+    if(limit > ENTRIES_MAX_LIMIT)
+    {
+        limit = ENTRIES_MAX_LIMIT;
+    }
+
+    ids   = (int *)malloc((size_t)(limit > 0 ? limit : 1) * sizeof(int));
+    found = ids ? search_post_entries(dbo, field, value, prefix, ids, (size_t)limit) : -1;
+    if(found < 0)
+    {
+        free(ids);
+        free(field);
+        free(value);
+        return send_json_status(response, BAD_REQUEST_STATUS, "{\"error\":\"field is not indexed\"}");
+    }
+
+    http_response_add_header(response, "Content-Type", JSON_CONTENT_TYPE);
+    json_append_str(response, "{\"field\":");
+    json_append_string(response, field);
+    json_append_str(response, prefix ? ",\"prefix\":" : ",\"eq\":");
+    json_append_string(response, value);
+    snprintf(text, sizeof(text), ",\"count\":%d,\"entries\":[", found);
+    json_append_str(response, text);
+
+    for(int first = 0; first < found && !response->failed; first += ENTRIES_BATCH)
+    {
+        size_t count = (size_t)(found - first < ENTRIES_BATCH ? found - first : ENTRIES_BATCH);
+
+        for(size_t i = 0; i < count; i++)
+        {
+            batch[i].id = ids[(size_t)first + i];
+        }
+        json_append_entry_batch(response, dbo, batch, count, &written);
+    }
+
+    json_append_str(response, "]}");
+
+    free(ids);
+    free(field);
+    free(value);
+    return response->failed ? -1 : 0;
 }
 
 /**
- * Function to construct and send the head request response
- * @param client_socket the client that will get the response
- * @param content_length the length of the content in the requested resource
- * @return 0 if success
- */ // todo <-- additional status codes
-int send_response_head(int client_socket, size_t content_length)
+ * Read API for stored POST entries.
+ * GET /entries/<id> returns one entry, GET /entries?since=&limit= lists a
+ * range of entries and GET /entries/search?field=&eq=|prefix= answers from the
+ * secondary indexes, all as JSON.
+ */
+int get_entries_response(HTTPResponse *response, const char *path)
 {
-    char response[BUFFER_SIZE];
-    snprintf(response, BUFFER_SIZE, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", content_length);
+    DBO dbo;
+    int result;
 
-    // Send the response header
-    if(send(client_socket, response, strlen(response), 0) == -1)
+    if(!is_entries_path(path))
     {
-        perror("Error sending response header");
-        return -1;
+        return send_json_status(response, NOT_FOUND_STATUS, "{\"error\":\"not found\"}");
     }
 
-    return 0;
+    dbo.name = strdup(POST_DB_PATH);
+    dbo.db   = NULL;
+    if(!dbo.name)
+    {
+        return send_json_status(response, INTERNAL_SERVER_ERROR_STATUS, "{\"error\":\"out of memory\"}");
+    }
+
+    if(strncmp(path + ENTRIES_PATH_LENGTH, ENTRIES_SEARCH_PATH, ENTRIES_SEARCH_PATH_LENGTH) == 0 &&
+       (path[ENTRIES_PATH_LENGTH + ENTRIES_SEARCH_PATH_LENGTH] == '\0' || path[ENTRIES_PATH_LENGTH + ENTRIES_SEARCH_PATH_LENGTH] == '?'))
+    {
+        result = send_search_results(response, &dbo, path);
+    }
+    else if(path[ENTRIES_PATH_LENGTH] == '/' && path[ENTRIES_PATH_LENGTH + 1] != '\0' && path[ENTRIES_PATH_LENGTH + 1] != '?')
+    {
+        result = send_entry(response, &dbo, path + ENTRIES_PATH_LENGTH + 1);
+    }
+    else
+    {
+        result = send_entry_list(response, &dbo, path);
+    }
+
+    free(dbo.name);
+    return result;
+}
+
+bool is_entries_path(const char *path)
+{
+    if(strncmp(path, ENTRIES_PATH, ENTRIES_PATH_LENGTH) != 0)
+    {
+        return false;
+    }
+    return path[ENTRIES_PATH_LENGTH] == '\0' || path[ENTRIES_PATH_LENGTH] == '/' || path[ENTRIES_PATH_LENGTH] == '?';
+}
+
+/**
+ * Admin endpoints are only served to clients on the loopback interface.
+ */
+bool is_loopback_client(int client_socket)
+{
+    struct sockaddr_in peer;
+    socklen_t          length = sizeof(peer);
+
+    if(getpeername(client_socket, (struct sockaddr *)&peer, &length) != 0 || peer.sin_family != AF_INET)
+    {
+        return false;
+    }
+    return (ntohl(peer.sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+}
+
+/**
+ * POST /admin/snapshot: takes an online snapshot of the POST database and
+ * reports how long writers were paused.
+ */
+int admin_snapshot_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    SnapshotResult result;
+    char           body[BUFFER_SIZE];
+
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+
+    if(database_snapshot(POST_DB_PATH, &result) != 0)
+    {
+        return send_json_status(response, INTERNAL_SERVER_ERROR_STATUS, "{\"error\":\"snapshot failed\"}");
+    }
+
+    snprintf(body,
+             sizeof(body),
+             "{\"path\":\"%s\",\"bytes\":%zu,\"reflinked\":%s,\"writer_pause_ms\":%.3f,\"total_ms\":%.3f}",
+             result.path,
+             result.bytes,
+             result.reflinked ? "true" : "false",
+             result.pauseMs,
+             result.totalMs);
+    return send_json_status(response, OK_STATUS, body);
+}
+
+/**
+ * GET /admin/shadow: latency and heap growth of each shadow candidate next to
+ * its active handler, on the same sampled requests.
+ */
+int admin_shadow_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+    return shadow_report(response);
+}
+
+/**
+ * POST /admin/shadow/promote[?module=N]: makes the candidate the active
+ * handler of module N, or of every module that has one.
+ */
+int admin_shadow_promote_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    char body[BUFFER_SIZE];
+    int  promoted;
+
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+
+    promoted = shadow_promote(query_find(request->path, "module") ? query_int(request->path, "module", -1) : -1);
+    if(promoted < 0)
+    {
+        return send_json_status(response, INTERNAL_SERVER_ERROR_STATUS, "{\"error\":\"promotion failed\"}");
+    }
+
+    snprintf(body, sizeof(body), "{\"promoted\":%d}", promoted);
+    return send_json_status(response, OK_STATUS, body);
+}
+
+/**
+ * GET /server-status: what each worker is doing, with request, byte and
+ * status counters and per-route latency.
+ */
+int server_status_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+    return scoreboard_status_report(response);
+}
+
+/**
+ * GET /metrics: the scoreboard for a Prometheus scraper.
+ */
+int metrics_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+    return scoreboard_metrics_report(response);
+}
+
+/**
+ * POST /admin/profile[?seconds=S&hz=H&workers=0,2]: starts sampling the
+ * stacks of the chosen workers (all by default).
+ */
+int admin_profile_start_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    char  body[BUFFER_SIZE];
+    char *workers;
+    int   seconds;
+    int   hz;
+    int   run;
+
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+
+    seconds = query_int(request->path, "seconds", PROFILER_DEFAULT_SECONDS);
+    hz      = query_int(request->path, "hz", PROFILER_DEFAULT_HZ);
+    workers = query_string(request->path, "workers");
+    run     = seconds > 0 && hz > 0 ? profiler_arm((unsigned int)seconds, (unsigned int)hz, workers) : -1;
+    free(workers);
+    if(run < 0)
+    {
+        return send_json_status(response, BAD_REQUEST_STATUS, "{\"error\":\"bad seconds, hz or workers\"}");
+    }
+
+    snprintf(body,
+             sizeof(body),
+             "{\"run\":%d,\"seconds\":%d,\"hz\":%d}",
+             run,
+             seconds > PROFILER_MAX_SECONDS ? PROFILER_MAX_SECONDS : seconds,
+             hz > PROFILER_MAX_HZ ? PROFILER_MAX_HZ : hz);
+    return send_json_status(response, OK_STATUS, body);
+}
+
+/**
+ * GET /admin/profile: the latest run as folded stacks.
+ */
+int admin_profile_response(HTTPResponse *response, const HTTPRequest *request)
+{
+    if(!is_loopback_client(request->clientFd))
+    {
+        return send_json_status(response, FORBIDDEN_STATUS, "{\"error\":\"admin endpoints are loopback only\"}");
+    }
+    return profiler_report(response);
 }